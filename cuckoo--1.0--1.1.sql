@@ -0,0 +1,168 @@
+/* cuckoo--1.0--1.1.sql */
+
+-- Complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION cuckoo UPDATE TO '1.1'" to load this file. \quit
+
+-- =============================================================================
+-- Cross-type equality
+-- =============================================================================
+
+-- Integer types hash compatibly, so each integer family takes the
+-- cross-type equality operators and the hash functions of the other types
+ALTER OPERATOR FAMILY int2_ops USING cuckoo ADD
+    OPERATOR    1   =(int2, int4),
+    OPERATOR    1   =(int2, int8),
+    FUNCTION    1   (int4, int4) hashint4(int4),
+    FUNCTION    1   (int8, int8) hashint8(int8);
+
+ALTER OPERATOR FAMILY int4_ops USING cuckoo ADD
+    OPERATOR    1   =(int4, int2),
+    OPERATOR    1   =(int4, int8),
+    FUNCTION    1   (int2, int2) hashint2(int2),
+    FUNCTION    1   (int8, int8) hashint8(int8);
+
+ALTER OPERATOR FAMILY int8_ops USING cuckoo ADD
+    OPERATOR    1   =(int8, int2),
+    OPERATOR    1   =(int8, int4),
+    FUNCTION    1   (int2, int2) hashint2(int2),
+    FUNCTION    1   (int4, int4) hashint4(int4);
+
+-- float4 values are hashed as float8
+ALTER OPERATOR FAMILY float4_ops USING cuckoo ADD
+    OPERATOR    1   =(float4, float8),
+    FUNCTION    1   (float8, float8) hashfloat8(float8);
+
+ALTER OPERATOR FAMILY float8_ops USING cuckoo ADD
+    OPERATOR    1   =(float8, float4),
+    FUNCTION    1   (float4, float4) hashfloat4(float4);
+
+-- text and name hash the same bytes
+ALTER OPERATOR FAMILY text_ops USING cuckoo ADD
+    OPERATOR    1   =(text, name),
+    FUNCTION    1   (name, name) hashname(name);
+
+ALTER OPERATOR FAMILY name_ops USING cuckoo ADD
+    OPERATOR    1   =(name, text),
+    FUNCTION    1   (text, text) hashtext(text);
+
+-- =============================================================================
+-- Element operator classes
+-- =============================================================================
+
+-- Extract the hashes of the elements of an array
+CREATE FUNCTION ckarray_extract_value(anyarray, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- Operator class for arrays, indexing each distinct element
+CREATE OPERATOR CLASS array_ops
+DEFAULT FOR TYPE anyarray USING cuckoo AS
+    OPERATOR    1   =(anyarray, anyarray),
+    OPERATOR    2   @>(anyarray, anyarray),
+    OPERATOR    3   &&(anyarray, anyarray),
+    FUNCTION    3   ckarray_extract_value(anyarray, internal);
+
+-- Extract the (path, value) hashes of a jsonb document
+CREATE FUNCTION ckjsonb_path_extract_value(jsonb, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- Operator class for jsonb containment, indexing each (path, value) pair
+CREATE OPERATOR CLASS jsonb_path_ops
+FOR TYPE jsonb USING cuckoo AS
+    OPERATOR    1   =(jsonb, jsonb),
+    OPERATOR    2   @>(jsonb, jsonb),
+    FUNCTION    3   ckjsonb_path_extract_value(jsonb, internal);
+
+-- Extract the trigram hashes of a text value
+CREATE FUNCTION cktext_trgm_extract_value(text, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- Extract the trigram hashes of an equality or LIKE/ILIKE query
+CREATE FUNCTION cktext_trgm_extract_query(text, internal, int2)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- Operator class for substring matching, indexing each trigram of a value
+CREATE OPERATOR CLASS text_trgm_ops
+FOR TYPE text USING cuckoo AS
+    OPERATOR    1   =(text, text),
+    OPERATOR    4   ~~(text, text),
+    OPERATOR    5   ~~*(text, text),
+    FUNCTION    3   cktext_trgm_extract_value(text, internal),
+    FUNCTION    4   cktext_trgm_extract_query(text, internal, int2);
+
+-- =============================================================================
+-- Maintenance functions
+-- =============================================================================
+
+-- Rebuild a cuckoo index with the read-only frozen layout
+CREATE FUNCTION cuckoo_freeze(idx regclass)
+RETURNS void
+AS $$
+BEGIN
+    IF NOT EXISTS (SELECT 1 FROM pg_class c JOIN pg_am a ON a.oid = c.relam
+                   WHERE c.oid = idx AND a.amname = 'cuckoo') THEN
+        RAISE EXCEPTION '"%" is not a cuckoo index', idx;
+    END IF;
+    EXECUTE format('ALTER INDEX %s SET (layout = frozen)', idx);
+    EXECUTE format('REINDEX INDEX %s', idx);
+END;
+$$ LANGUAGE plpgsql;
+
+-- Check whether a cuckoo index may hold a value; used by the planner to
+-- skip partitions at executor startup
+CREATE FUNCTION cuckoo_may_contain(idx regclass, val anyelement)
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+-- Count the index tuples that may match a value, without visiting the heap
+CREATE FUNCTION cuckoo_estimate_count(idx regclass, VARIADIC vals "any")
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE PARALLEL SAFE;
+
+-- Expected number of false positives included in cuckoo_estimate_count()
+CREATE FUNCTION cuckoo_estimate_error(idx regclass)
+RETURNS float8
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+-- Estimated number of distinct values in a cuckoo index
+CREATE FUNCTION cuckoo_ndistinct(idx regclass)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+-- Rewrite a cuckoo index from its own tuples, optionally narrowing its tags
+CREATE FUNCTION cuckoo_reorganize(idx regclass, bits_per_tag int DEFAULT NULL)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+-- Rebuild the cuckoo indexes of a table with a single scan of the table
+CREATE FUNCTION cuckoo_build_indexes(tbl regclass, idxs regclass[] DEFAULT NULL)
+RETURNS int
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+-- Compare cuckoo index configurations, btree and hash on a sample of a column
+CREATE FUNCTION cuckoo_advise(tbl regclass, col text,
+                              sample_pct float8 DEFAULT 10)
+RETURNS TABLE (am text, layout text, summary bool, bits_per_tag int,
+               index_bytes bigint, fpr float8, false_rows float8,
+               lookup_pages float8, recommended bool)
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+-- Functions that rewrite indexes are meant for the owners of the indexes,
+-- not for every role
+REVOKE EXECUTE ON FUNCTION cuckoo_reorganize(regclass, int) FROM PUBLIC;
+REVOKE EXECUTE ON FUNCTION cuckoo_build_indexes(regclass, regclass[])
+    FROM PUBLIC;
@@ -198,6 +198,502 @@ RESET enable_seqscan;
 -- Cleanup opclass test
 DROP TABLE opclass_test;
 
+--
+-- Element operator classes
+--
+CREATE TABLE arrtest (i int4, a int4[]);
+INSERT INTO arrtest SELECT i, ARRAY[i % 10, 100 + i % 3] FROM generate_series(1, 1000) i;
+CREATE INDEX cuckooidx_arr ON arrtest USING cuckoo (a);
+-- rows inserted after the build, including one without elements
+INSERT INTO arrtest VALUES (0, '{}'), (0, NULL);
+
+SET enable_seqscan = off;
+
+EXPLAIN (COSTS OFF) SELECT count(*) FROM arrtest WHERE a @> ARRAY[3];
+SELECT count(*) FROM arrtest WHERE a @> ARRAY[3];
+SELECT count(*) FROM arrtest WHERE a @> ARRAY[3, 101];
+SELECT count(*) FROM arrtest WHERE a && ARRAY[3, 101];
+SELECT count(*) FROM arrtest WHERE a = ARRAY[3, 101];
+SELECT count(*) FROM arrtest WHERE a = '{}';
+SELECT count(*) FROM arrtest WHERE a @> '{}';
+SELECT count(*) FROM arrtest WHERE a && '{}';
+
+RESET enable_seqscan;
+DROP TABLE arrtest;
+
+CREATE TABLE jsontest (i int4, doc jsonb);
+INSERT INTO jsontest SELECT i, jsonb_build_object('customer_id', i % 50, 'tags', jsonb_build_array('t' || i % 4), 'meta', jsonb_build_object('region', 'r' || i % 3)) FROM generate_series(1, 1000) i;
+CREATE INDEX cuckooidx_json ON jsontest USING cuckoo (doc jsonb_path_ops);
+
+SET enable_seqscan = off;
+
+EXPLAIN (COSTS OFF) SELECT count(*) FROM jsontest WHERE doc @> '{"customer_id": 42}';
+SELECT count(*) FROM jsontest WHERE doc @> '{"customer_id": 42}';
+SELECT count(*) FROM jsontest WHERE doc @> '{"customer_id": 42, "tags": ["t2"]}';
+SELECT count(*) FROM jsontest WHERE doc @> '{"meta": {"region": "r1"}}';
+SELECT count(*) FROM jsontest WHERE doc @> '{"customer_id": "42"}';
+SELECT count(*) FROM jsontest WHERE doc @> '{}';
+
+RESET enable_seqscan;
+DROP TABLE jsontest;
+
+CREATE TABLE trgmtest (i int4, msg text);
+INSERT INTO trgmtest SELECT i, 'event ' || i || CASE WHEN i % 100 = 0 THEN ' ERROR disk full' ELSE ' ok' END FROM generate_series(1, 1000) i;
+CREATE INDEX cuckooidx_trgm ON trgmtest USING cuckoo (msg text_trgm_ops);
+INSERT INTO trgmtest VALUES (2000, 'event 2000 ERROR Disk Full');
+
+SET enable_seqscan = off;
+
+EXPLAIN (COSTS OFF) SELECT count(*) FROM trgmtest WHERE msg LIKE '%disk full%';
+SELECT count(*) FROM trgmtest WHERE msg LIKE '%disk full%';
+SELECT count(*) FROM trgmtest WHERE msg ILIKE '%DISK FULL%';
+SELECT count(*) FROM trgmtest WHERE msg LIKE '%DISK FULL%';
+SELECT count(*) FROM trgmtest WHERE msg LIKE 'event 42 %';
+SELECT count(*) FROM trgmtest WHERE msg LIKE '%x%';
+SELECT count(*) FROM trgmtest WHERE msg LIKE '%';
+SELECT count(*) FROM trgmtest WHERE msg = 'event 7 ok';
+
+RESET enable_seqscan;
+DROP TABLE trgmtest;
+
+--
+-- Cross-type operator families
+--
+CREATE TABLE crosstest (i2 int2, i4 int4, i8 int8, f4 float4, t text, n name);
+INSERT INTO crosstest SELECT i, i, i, i / 4.0, 'v' || i, 'v' || i FROM generate_series(1, 1000) i;
+CREATE INDEX cuckooidx_cross_i2 ON crosstest USING cuckoo (i2);
+CREATE INDEX cuckooidx_cross_i4 ON crosstest USING cuckoo (i4);
+CREATE INDEX cuckooidx_cross_i8 ON crosstest USING cuckoo (i8);
+CREATE INDEX cuckooidx_cross_f4 ON crosstest USING cuckoo (f4);
+CREATE INDEX cuckooidx_cross_t ON crosstest USING cuckoo (t);
+CREATE INDEX cuckooidx_cross_n ON crosstest USING cuckoo (n);
+
+SET enable_seqscan = off;
+
+EXPLAIN (COSTS OFF) SELECT count(*) FROM crosstest WHERE i4 = 42::int8;
+SELECT count(*) FROM crosstest WHERE i4 = 42::int8;
+SELECT count(*) FROM crosstest WHERE i2 = 42;
+SELECT count(*) FROM crosstest WHERE i8 = 42::int2;
+SELECT count(*) FROM crosstest WHERE f4 = 0.5::float8;
+SELECT count(*) FROM crosstest WHERE t = 'v42'::name;
+SELECT count(*) FROM crosstest WHERE n = 'v42'::text;
+
+RESET enable_seqscan;
+DROP TABLE crosstest;
+
+--
+-- Hashed layout
+--
+CREATE TABLE hashtest (i int4, a int4[]);
+CREATE INDEX cuckooidx_hash_i ON hashtest USING cuckoo (i) WITH (layout = hashed);
+CREATE INDEX cuckooidx_hash_a ON hashtest USING cuckoo (a) WITH (layout = hashed);
+SELECT reloptions FROM pg_class WHERE oid = 'cuckooidx_hash_i'::regclass;
+
+-- enough rows to split buckets many times over
+INSERT INTO hashtest SELECT i, ARRAY[i % 100, i % 7] FROM generate_series(1, 20000) i;
+
+SET enable_seqscan = off;
+
+EXPLAIN (COSTS OFF) SELECT count(*) FROM hashtest WHERE i = 42;
+SELECT count(*) FROM hashtest WHERE i = 42;
+SELECT count(*) FROM generate_series(1, 20000, 97) g
+  WHERE EXISTS (SELECT 1 FROM hashtest WHERE i = g);
+SELECT count(*) FROM hashtest WHERE a @> ARRAY[42];
+SELECT count(*) FROM hashtest WHERE a @> ARRAY[42, 3];
+SELECT count(*) FROM hashtest WHERE a @> '{}';
+
+-- vacuum removes dead tuples and leftovers of splits
+DELETE FROM hashtest WHERE i % 2 = 0;
+VACUUM hashtest;
+SELECT count(*) FROM hashtest WHERE i = 42;
+SELECT count(*) FROM hashtest WHERE i = 43;
+SELECT count(*) FROM hashtest WHERE a @> ARRAY[43];
+
+-- rebuild sorts tuples straight into buckets
+REINDEX INDEX cuckooidx_hash_i;
+SELECT count(*) FROM generate_series(1, 20000, 97) g
+  WHERE EXISTS (SELECT 1 FROM hashtest WHERE i = g);
+
+RESET enable_seqscan;
+DROP TABLE hashtest;
+
+--
+-- Summary pages
+--
+CREATE TABLE sumtest (i int4);
+INSERT INTO sumtest SELECT i FROM generate_series(1, 20000) i;
+CREATE INDEX cuckooidx_sum ON sumtest USING cuckoo (i) WITH (summary = on);
+SELECT reloptions FROM pg_class WHERE oid = 'cuckooidx_sum'::regclass;
+INSERT INTO sumtest SELECT i FROM generate_series(20001, 30000) i;
+
+SET enable_seqscan = off;
+
+SELECT count(*) FROM sumtest WHERE i = 42;
+SELECT count(*) FROM sumtest WHERE i = 25000;
+SELECT count(*) FROM generate_series(1, 30000, 97) g
+  WHERE EXISTS (SELECT 1 FROM sumtest WHERE i = g);
+
+-- vacuum keeps the summaries in step with the data pages
+DELETE FROM sumtest WHERE i % 2 = 0;
+VACUUM sumtest;
+SELECT count(*) FROM sumtest WHERE i = 42;
+SELECT count(*) FROM sumtest WHERE i = 43;
+SELECT count(*) FROM generate_series(1, 30000, 97) g
+  WHERE EXISTS (SELECT 1 FROM sumtest WHERE i = g);
+INSERT INTO sumtest SELECT i FROM generate_series(30001, 31000) i;
+SELECT count(*) FROM sumtest WHERE i = 30500;
+
+RESET enable_seqscan;
+DROP TABLE sumtest;
+
+--
+-- Frozen layout
+--
+CREATE TABLE frztest (i int4);
+INSERT INTO frztest SELECT i FROM generate_series(1, 20000) i;
+CREATE INDEX cuckooidx_frz ON frztest USING cuckoo (i);
+SELECT cuckoo_freeze('cuckooidx_frz');
+SELECT reloptions FROM pg_class WHERE oid = 'cuckooidx_frz'::regclass;
+
+-- rows inserted after freezing go to flat pages after the frozen region
+INSERT INTO frztest SELECT i FROM generate_series(20001, 30000) i;
+
+SET enable_seqscan = off;
+
+SELECT count(*) FROM frztest WHERE i = 42;
+SELECT count(*) FROM frztest WHERE i = 25000;
+SELECT count(*) FROM frztest WHERE i = 40000;
+SELECT count(*) FROM generate_series(1, 30000, 97) g
+  WHERE EXISTS (SELECT 1 FROM frztest WHERE i = g);
+
+-- the filter covers the frozen region, the inserted pages are scanned
+SELECT cuckoo_may_contain('cuckooidx_frz', 42),
+       cuckoo_may_contain('cuckooidx_frz', 25000),
+       cuckoo_may_contain('cuckooidx_frz', 40000);
+
+-- vacuum removes dead tuples from the frozen pages in place
+DELETE FROM frztest WHERE i % 2 = 0;
+VACUUM frztest;
+SELECT count(*) FROM frztest WHERE i = 42;
+SELECT count(*) FROM frztest WHERE i = 43;
+SELECT count(*) FROM generate_series(1, 30000, 97) g
+  WHERE EXISTS (SELECT 1 FROM frztest WHERE i = g);
+
+-- freezing again folds the inserted rows into the frozen region
+SELECT cuckoo_freeze('cuckooidx_frz');
+SELECT count(*) FROM frztest WHERE i = 25001;
+SELECT count(*) FROM generate_series(1, 30000, 97) g
+  WHERE EXISTS (SELECT 1 FROM frztest WHERE i = g);
+
+RESET enable_seqscan;
+DROP TABLE frztest;
+
+--
+-- Block range filters
+--
+CREATE TABLE rngtest (t int4, v int4);
+INSERT INTO rngtest SELECT i, i % 50 + (i / 1000) * 100
+  FROM generate_series(1, 20000) i;
+CREATE INDEX cuckooidx_rng ON rngtest USING cuckoo (v)
+  WITH (pages_per_range = 4);
+SELECT reloptions FROM pg_class WHERE oid = 'cuckooidx_rng'::regclass;
+
+SET enable_seqscan = off;
+
+SELECT count(*) FROM rngtest WHERE v = 42;
+SELECT count(*) FROM rngtest WHERE v = 1042;
+
+-- ranges added since the build match everything until vacuum
+INSERT INTO rngtest SELECT i, i % 50 + (i / 1000) * 100
+  FROM generate_series(20001, 30000) i;
+SELECT count(*) FROM rngtest WHERE v = 2542;
+VACUUM rngtest;
+SELECT count(*) FROM rngtest WHERE v = 2542;
+SELECT count(*) FROM generate_series(0, 2999) g
+  WHERE EXISTS (SELECT 1 FROM rngtest WHERE v = g);
+
+DELETE FROM rngtest WHERE v = 42;
+VACUUM rngtest;
+SELECT count(*) FROM rngtest WHERE v = 42;
+SELECT count(*) FROM rngtest WHERE v = 43;
+
+RESET enable_seqscan;
+DROP TABLE rngtest;
+
+--
+-- Partition pruning
+--
+CREATE TABLE prntest (d int4, u int4) PARTITION BY RANGE (d);
+CREATE TABLE prntest_1 PARTITION OF prntest FOR VALUES FROM (0) TO (100);
+CREATE TABLE prntest_2 PARTITION OF prntest FOR VALUES FROM (100) TO (200);
+INSERT INTO prntest SELECT i % 200, i FROM generate_series(0, 3999) i;
+CREATE INDEX cuckooidx_prn ON prntest USING cuckoo (u)
+  WITH (layout = hashed, bits_per_tag = 32);
+SELECT cuckoo_may_contain('prntest_1_u_idx', 5),
+       cuckoo_may_contain('prntest_1_u_idx', 150),
+       cuckoo_may_contain('prntest_2_u_idx', 150::int8);
+
+SET enable_seqscan = off;
+
+SELECT count(*) FROM prntest WHERE u = 150;
+SELECT count(*) FROM prntest WHERE u = 5000;
+
+-- the filter is evaluated at executor startup, so cached plans stay right
+PREPARE prnq(int4) AS SELECT count(*) FROM prntest WHERE u = $1;
+EXECUTE prnq(150);
+EXECUTE prnq(9999);
+INSERT INTO prntest VALUES (5, 9999);
+EXECUTE prnq(9999);
+DEALLOCATE prnq;
+
+SET cuckoo.enable_partition_pruning = off;
+SELECT count(*) FROM prntest WHERE u = 150;
+RESET cuckoo.enable_partition_pruning;
+
+-- calls need read access; the planner leaves out the ones that would fail
+CREATE ROLE regress_cuckoo_reader;
+GRANT SELECT ON prntest TO regress_cuckoo_reader;
+SET ROLE regress_cuckoo_reader;
+SELECT cuckoo_may_contain('prntest_1_u_idx', 5);
+SELECT count(*) FROM prntest WHERE u = 150;
+RESET ROLE;
+
+RESET enable_seqscan;
+DROP TABLE prntest;
+DROP ROLE regress_cuckoo_reader;
+
+--
+-- Approximate counts
+--
+CREATE TABLE esttest (k int8, t text);
+INSERT INTO esttest SELECT i % 100, 'v' || (i % 7) FROM generate_series(1, 3000) i;
+CREATE INDEX cuckooidx_est ON esttest USING cuckoo (k) WITH (bits_per_tag = 32);
+CREATE INDEX cuckooidx_est_t ON esttest USING cuckoo (t)
+  WITH (layout = hashed, bits_per_tag = 32);
+SELECT cuckoo_estimate_count('cuckooidx_est', 42::int8);
+SELECT cuckoo_estimate_count('cuckooidx_est', 42);
+SELECT cuckoo_estimate_count('cuckooidx_est', 1000);
+SELECT cuckoo_estimate_count('cuckooidx_est', NULL::int8);
+SELECT cuckoo_estimate_count('cuckooidx_est_t', 'v3');
+-- binary-coercible values are hashed as the column's type
+SELECT cuckoo_estimate_count('cuckooidx_est_t', 'v3'::varchar);
+SELECT cuckoo_estimate_count('cuckooidx_est', 'v3'::text);
+
+-- the expected number of false positives is reltuples / 2^bits_per_tag
+DROP INDEX cuckooidx_est;
+CREATE INDEX cuckooidx_est ON esttest USING cuckoo (k) WITH (bits_per_tag = 16);
+SELECT cuckoo_estimate_error('cuckooidx_est');
+DROP TABLE esttest;
+
+--
+-- Distinct-value sketch
+--
+CREATE TABLE ndtest (i int4, t text);
+INSERT INTO ndtest SELECT i % 1000, 'x' || (i % 50) FROM generate_series(1, 20000) i;
+CREATE INDEX cuckooidx_nd ON ndtest USING cuckoo (i);
+CREATE INDEX cuckooidx_nd_expr ON ndtest USING cuckoo (lower(t))
+  WITH (layout = hashed);
+SELECT cuckoo_ndistinct('cuckooidx_nd') BETWEEN 900 AND 1100 AS build;
+SELECT cuckoo_ndistinct('cuckooidx_nd_expr') BETWEEN 45 AND 55 AS expr;
+INSERT INTO ndtest SELECT i, 'y' FROM generate_series(1000, 2999) i;
+SELECT cuckoo_ndistinct('cuckooidx_nd') BETWEEN 2550 AND 3450 AS inserted;
+
+-- VACUUM rebuilds the sketch after removing most of the rows
+DELETE FROM ndtest WHERE i >= 100;
+VACUUM ndtest;
+SELECT cuckoo_ndistinct('cuckooidx_nd') BETWEEN 90 AND 110 AS vacuumed;
+
+-- The estimate needs read access to the table
+CREATE ROLE regress_cuckoo_nd;
+SET ROLE regress_cuckoo_nd;
+SELECT cuckoo_ndistinct('cuckooidx_nd');
+RESET ROLE;
+DROP ROLE regress_cuckoo_nd;
+DROP TABLE ndtest;
+
+--
+-- Rebuilding several indexes with one scan
+--
+CREATE TABLE multitest (a int4, b text, c int8);
+INSERT INTO multitest SELECT i, 'b' || i, i % 10 FROM generate_series(1, 2000) i;
+CREATE INDEX cuckooidx_multi_a ON multitest USING cuckoo (a);
+CREATE INDEX cuckooidx_multi_b ON multitest USING cuckoo (lower(b));
+CREATE INDEX cuckooidx_multi_c ON multitest USING cuckoo (c)
+  WITH (layout = hashed);
+CREATE INDEX btreeidx_multi ON multitest (a);
+SELECT cuckoo_build_indexes('multitest');
+SELECT cuckoo_build_indexes('multitest', ARRAY['cuckooidx_multi_b']::regclass[]);
+SET enable_seqscan = off;
+SELECT count(*) FROM multitest WHERE a = 42;
+SELECT count(*) FROM multitest WHERE lower(b) = 'b42';
+SELECT count(*) FROM multitest WHERE c = 7;
+RESET enable_seqscan;
+SELECT cuckoo_ndistinct('cuckooidx_multi_a') BETWEEN 1800 AND 2200 AS ndistinct;
+
+-- The rebuild records the new sizes in pg_class
+INSERT INTO multitest SELECT i, 'b' || i, i % 10 FROM generate_series(2001, 3000) i;
+SELECT cuckoo_build_indexes('multitest',
+                            ARRAY['cuckooidx_multi_a', 'cuckooidx_multi_c']::regclass[]);
+SELECT relname, reltuples, relpages > 0 AS pages FROM pg_class
+  WHERE relname IN ('multitest', 'cuckooidx_multi_a', 'cuckooidx_multi_c')
+  ORDER BY relname;
+
+-- Only the owner of the table may rebuild its indexes
+CREATE ROLE regress_cuckoo_build;
+GRANT EXECUTE ON FUNCTION cuckoo_build_indexes(regclass, regclass[])
+  TO regress_cuckoo_build;
+SET ROLE regress_cuckoo_build;
+SELECT cuckoo_build_indexes('multitest');
+RESET ROLE;
+REVOKE EXECUTE ON FUNCTION cuckoo_build_indexes(regclass, regclass[])
+  FROM regress_cuckoo_build;
+DROP ROLE regress_cuckoo_build;
+DROP TABLE multitest;
+
+--
+-- Reorganize
+--
+CREATE TABLE reorgtest (k int4);
+INSERT INTO reorgtest SELECT i % 100 FROM generate_series(1, 3000) i;
+CREATE INDEX cuckooidx_reorg ON reorgtest USING cuckoo (k)
+  WITH (bits_per_tag = 16, summary = on);
+CREATE INDEX cuckooidx_reorg_h ON reorgtest USING cuckoo (k)
+  WITH (layout = hashed, bits_per_tag = 16);
+DELETE FROM reorgtest WHERE k >= 50;
+VACUUM reorgtest;
+SELECT cuckoo_reorganize('cuckooidx_reorg');
+SELECT cuckoo_reorganize('cuckooidx_reorg', 8);
+SELECT cuckoo_reorganize('cuckooidx_reorg_h', bits_per_tag => 8);
+SET enable_seqscan = off;
+SELECT count(*) FROM reorgtest WHERE k = 42;
+DROP INDEX cuckooidx_reorg_h;
+SELECT count(*) FROM reorgtest WHERE k = 42;
+RESET enable_seqscan;
+SELECT cuckoo_reorganize('cuckooidx_reorg', 12);
+
+-- Only the owner may reorganize an index
+CREATE ROLE regress_cuckoo_reorg;
+GRANT EXECUTE ON FUNCTION cuckoo_reorganize(regclass, int)
+  TO regress_cuckoo_reorg;
+SET ROLE regress_cuckoo_reorg;
+SELECT cuckoo_reorganize('cuckooidx_reorg');
+RESET ROLE;
+REVOKE EXECUTE ON FUNCTION cuckoo_reorganize(regclass, int)
+  FROM regress_cuckoo_reorg;
+DROP ROLE regress_cuckoo_reorg;
+DROP TABLE reorgtest;
+
+--
+-- NULL searches
+--
+CREATE TABLE nulltest (k int4, a int4[]);
+INSERT INTO nulltest
+  SELECT CASE WHEN i % 10 = 0 THEN NULL ELSE i END,
+         CASE WHEN i % 4 = 0 THEN NULL ELSE ARRAY[i] END
+  FROM generate_series(1, 1000) i;
+CREATE INDEX cuckooidx_null ON nulltest USING cuckoo (k);
+CREATE INDEX cuckooidx_null_arr ON nulltest USING cuckoo (a);
+-- a row inserted after the build
+INSERT INTO nulltest VALUES (NULL, NULL);
+SET enable_seqscan = off;
+EXPLAIN (COSTS OFF) SELECT count(*) FROM nulltest WHERE k IS NULL;
+SELECT count(*) FROM nulltest WHERE k IS NULL;
+SELECT count(*) FROM nulltest WHERE k IS NOT NULL;
+SELECT count(*) FROM nulltest WHERE a IS NULL;
+SELECT count(*) FROM nulltest WHERE a IS NOT NULL;
+SELECT count(*) FROM nulltest WHERE a IS NOT NULL AND a @> ARRAY[3];
+RESET enable_seqscan;
+DROP TABLE nulltest;
+
+--
+-- Exact keys
+--
+CREATE TABLE exacttest (k int4);
+INSERT INTO exacttest SELECT i % 100 FROM generate_series(1, 1000) i;
+INSERT INTO exacttest VALUES (NULL);
+CREATE INDEX cuckooidx_exact ON exacttest USING cuckoo (k)
+  WITH (exact_keys = on);
+-- a row inserted after the build
+INSERT INTO exacttest VALUES (42);
+VACUUM exacttest;
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+EXPLAIN (COSTS OFF) SELECT count(*) FROM exacttest WHERE k = 42;
+SELECT count(*) FROM exacttest WHERE k = 42;
+SELECT count(*) FROM exacttest WHERE k IS NULL;
+RESET enable_bitmapscan;
+RESET enable_seqscan;
+CREATE INDEX ON exacttest USING cuckoo (k)
+  WITH (exact_keys = on, layout = hashed);
+ALTER TABLE exacttest ADD COLUMN t text;
+CREATE INDEX ON exacttest USING cuckoo (t) WITH (exact_keys = on);
+SELECT cuckoo_reorganize('cuckooidx_exact');
+DROP TABLE exacttest;
+-- exclusion constraints are not supported
+CREATE TABLE excltest (k int4, EXCLUDE USING cuckoo (k WITH =));
+CREATE TABLE excltest (k int4,
+  EXCLUDE USING cuckoo (k WITH =) WITH (exact_keys = on));
+
+--
+-- Lookup cache
+--
+CREATE TABLE cachetest (k int4);
+INSERT INTO cachetest SELECT i % 100 FROM generate_series(1, 1000) i;
+CREATE INDEX cuckooidx_cache ON cachetest USING cuckoo (k)
+  WITH (lookup_cache = on);
+SET enable_seqscan = off;
+SELECT count(*) FROM cachetest WHERE k = 42;
+-- the same lookup again, from the cache
+SELECT count(*) FROM cachetest WHERE k = 42;
+-- an insert makes the cached lookups stale
+INSERT INTO cachetest VALUES (42);
+SELECT count(*) FROM cachetest WHERE k = 42;
+-- and so does a VACUUM that removes entries
+DELETE FROM cachetest WHERE k = 42;
+VACUUM cachetest;
+SELECT count(*) FROM cachetest WHERE k = 42;
+SET cuckoo.lookup_cache_size = 0;
+SELECT count(*) FROM cachetest WHERE k = 7;
+RESET cuckoo.lookup_cache_size;
+RESET enable_seqscan;
+CREATE INDEX ON cachetest USING cuckoo (k)
+  WITH (lookup_cache = on, pages_per_range = 4);
+DROP TABLE cachetest;
+
+--
+-- Long strings
+--
+CREATE TABLE longtest (t text);
+ALTER TABLE longtest ALTER COLUMN t SET STORAGE EXTERNAL;
+INSERT INTO longtest SELECT repeat(i::text, 300000) FROM generate_series(1, 3) i;
+INSERT INTO longtest VALUES ('short');
+CREATE INDEX cuckooidx_long ON longtest USING cuckoo (t);
+-- a compressed copy hashes like the value read block by block
+ALTER TABLE longtest ALTER COLUMN t SET STORAGE EXTENDED;
+INSERT INTO longtest VALUES (repeat('2', 300000));
+SET enable_seqscan = off;
+SELECT count(*) FROM longtest WHERE t = repeat('2', 300000);
+SELECT count(*) FROM longtest WHERE t = repeat('2', 299999);
+SELECT count(*) FROM longtest WHERE t = 'short';
+RESET enable_seqscan;
+DROP TABLE longtest;
+
+--
+-- Tuning advisor
+--
+CREATE TABLE advtest (i int4, a int4[]);
+INSERT INTO advtest SELECT i, ARRAY[i] FROM generate_series(1, 10000) i;
+SELECT count(*) FROM cuckoo_advise('advtest', 'i', 100);
+SELECT count(*) FROM cuckoo_advise('advtest', 'i', 100) WHERE recommended;
+SELECT bool_and(fpr > 0.5) FROM cuckoo_advise('advtest', 'i', 100)
+  WHERE bits_per_tag = 8;
+SELECT bool_and(fpr < 0.01) FROM cuckoo_advise('advtest', 'i', 100)
+  WHERE bits_per_tag = 32;
+SELECT * FROM cuckoo_advise('advtest', 'nosuch', 100);
+SELECT * FROM cuckoo_advise('advtest', 'a', 100);
+SELECT * FROM cuckoo_advise('advtest', 'i', 0);
+DROP TABLE advtest;
+
 --
 -- relation options
 --
@@ -219,6 +715,12 @@ CREATE INDEX cuckooidx_i ON tst USING cuckoo (i) WITH (bits_per_tag=20, tags_per
 SELECT reloptions FROM pg_class WHERE oid = 'cuckooidx_i'::regclass;
 SELECT count(*) FROM tst WHERE i = 7;
 
+-- let the build choose the tag width
+DROP INDEX cuckooidx_i;
+CREATE INDEX cuckooidx_i ON tst USING cuckoo (i) WITH (target_fpr=0.01);
+SELECT reloptions FROM pg_class WHERE oid = 'cuckooidx_i'::regclass;
+SELECT count(*) FROM tst WHERE i = 7;
+
 -- check for min and max values
 \set VERBOSITY terse
 CREATE INDEX cuckooidx2 ON tst USING cuckoo (i) WITH (bits_per_tag=0);
@@ -227,6 +729,21 @@ CREATE INDEX cuckooidx2 ON tst USING cuckoo (i) WITH (tags_per_bucket=1);
 CREATE INDEX cuckooidx2 ON tst USING cuckoo (i) WITH (tags_per_bucket=10);
 CREATE INDEX cuckooidx2 ON tst USING cuckoo (i) WITH (max_kicks=10);
 CREATE INDEX cuckooidx2 ON tst USING cuckoo (i) WITH (max_kicks=5000);
+CREATE INDEX cuckooidx2 ON tst USING cuckoo (i) WITH (layout=tree);
+CREATE INDEX cuckooidx2 ON tst USING cuckoo (i) WITH (target_fpr=-1);
+CREATE INDEX cuckooidx2 ON tst USING cuckoo (i) WITH (target_fpr=2);
+CREATE INDEX cuckooidx2 ON tst USING cuckoo (i) WITH (summary=on, layout=hashed);
+SELECT cuckoo_freeze('tst');
+CREATE INDEX cuckooidx2 ON tst USING cuckoo (i) WITH (pages_per_range=-1);
+CREATE INDEX cuckooidx2 ON tst USING cuckoo (i) WITH (pages_per_range=4, layout=hashed);
+CREATE INDEX cuckooidx2 ON tst USING cuckoo (i) WITH (pages_per_range=4, summary=on);
+SELECT cuckoo_may_contain('tst', 1);
+SELECT cuckoo_estimate_count('tst', 1);
+SELECT cuckoo_estimate_count('cuckooidx_i', 1, 2);
+SELECT cuckoo_ndistinct('tst');
+SELECT cuckoo_reorganize('tst');
+SELECT cuckoo_reorganize('cuckooidx_i', 3);
+SELECT cuckoo_build_indexes('tstu', ARRAY['cuckooidx_i']::regclass[]);
 
 -- cleanup
 DROP TABLE tst;
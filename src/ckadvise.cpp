@@ -0,0 +1,549 @@
+/**
+ * @file ckadvise.cpp
+ * @brief Recommending cuckoo index options from a sample of a column.
+ *
+ * cuckoo_advise() reads a block sample of a table, fingerprints the
+ * sampled values with computeFingerprint() as an index build would, and
+ * simulates each layout and tag width on the fingerprints. A fingerprint
+ * is the low bits of its row hash, so the sample is hashed once and
+ * narrowed to every width. For each candidate it reports:
+ *
+ * - the predicted index size, from the page layouts the builds write;
+ * - the false positive rate, measured by looking up random hashes,
+ *   standing in for absent values, among the sampled fingerprints and
+ *   extrapolated to the estimated number of distinct values;
+ * - the expected pages a lookup of an absent value reads, counting the
+ *   heap pages its false positives recheck.
+ *
+ * Rows for a btree and a hash index on the column, estimated from the
+ * width of the sampled values, show whether a cuckoo index is worth it.
+ *
+ * Copyright (c) 2025
+ * SPDX-License-Identifier: PostgreSQL
+ */
+#include "cuckoo.h"
+
+#include <cmath>
+
+extern "C" {
+#include "access/detoast.h"
+#include "access/table.h"
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
+#include "common/pg_prng.h"
+#include "executor/spi.h"
+#include "funcapi.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+
+PG_FUNCTION_INFO_V1(cuckoo_advise);
+}
+
+/* Random hashes looked up to measure the false positive rate */
+#define CUCKOO_ADVISE_PROBES 10000
+
+/* Rows fetched from the sample at a time */
+#define CUCKOO_ADVISE_BATCH 1000
+
+/* Fill factors of btree leaf pages and hash buckets, in percent */
+#define CUCKOO_ADVISE_BTREE_FILL 90
+#define CUCKOO_ADVISE_HASH_FILL 75
+
+/* Bytes of a page available to tuples */
+#define CUCKOO_ADVISE_PAGE_BYTES                                               \
+  (BLCKSZ - MAXALIGN(SizeOfPageHeaderData) -                                   \
+   MAXALIGN(sizeof(CuckooPageOpaqueData)))
+
+/* Tag widths simulated */
+static const int ck_advise_widths[] = {8, 12, 16, 20, 24, 32};
+
+/**
+ * @brief What the sample tells about a column.
+ */
+typedef struct CuckooSample {
+  uint32 *fingerprints; /**< 32-bit fingerprints of the non-NULL values */
+  int64 nvalues;        /**< Number of non-NULL values */
+  int64 nrows;          /**< Number of sampled rows, NULL or not */
+  double totalWidth;    /**< Stored bytes of the non-NULL values */
+  double maxWidth;      /**< Stored bytes of the widest value */
+} CuckooSample;
+
+/**
+ * @brief One row of the report.
+ */
+typedef struct CuckooAdvice {
+  const char *am;     /**< Access method */
+  const char *layout; /**< Cuckoo layout, or NULL */
+  bool summary;       /**< Cuckoo summary pages */
+  int bits;           /**< Cuckoo tag width, or 0 */
+  double pages;       /**< Predicted index pages */
+  double fpr;         /**< Chance an absent value rechecks a heap row */
+  double falseRows;   /**< Heap rows an absent value rechecks */
+  double lookupPages; /**< Pages a lookup of an absent value reads */
+} CuckooAdvice;
+
+/**
+ * @brief qsort comparator for fingerprints.
+ */
+static int cmpFingerprint(const void *a, const void *b) {
+  uint32 fa = *(const uint32 *)a;
+  uint32 fb = *(const uint32 *)b;
+
+  if (fa == fb)
+    return 0;
+  return (fa < fb) ? -1 : 1;
+}
+
+/**
+ * @brief Set up the cuckoo state a new index on a column would have.
+ *
+ * @param state Output: the state, with 32-bit tags.
+ * @param hashProc Hash support function of the column's operator class.
+ * @param collation Collation of the column.
+ */
+static void initColumnState(CuckooState *state, Oid hashProc, Oid collation) {
+  memset(state, 0, sizeof(*state));
+  fmgr_info(hashProc, &state->hashFn[0]);
+  state->collations[0] = collation;
+  state->nColumns = 1;
+  state->opts.bitsPerTag = DEFAULT_BITS_PER_TAG;
+  state->opts.tagsPerBucket = DEFAULT_TAGS_PER_BUCKET;
+  state->opts.maxKicks = DEFAULT_MAX_KICKS;
+  state->opts.layout = CUCKOO_LAYOUT_FLAT;
+  state->sizeOfCuckooTuple = sizeof(CuckooTuple);
+  state->tagsPerBucket = state->opts.tagsPerBucket;
+  state->maxKicks = state->opts.maxKicks;
+  state->streamed[0] = CuckooCanStreamHash(hashProc, collation);
+  CuckooSetTagWidth(state, MAX_BITS_PER_TAG);
+}
+
+/**
+ * @brief Fingerprint a block sample of a column.
+ *
+ * The sample is read through a cursor, so that only the fingerprints and
+ * widths of the rows are kept. The fingerprint array is allocated before
+ * connecting to SPI, so that it outlives SPI_finish().
+ *
+ * @param rel The table.
+ * @param attnum Column number.
+ * @param samplePct Percentage of the table's blocks to read.
+ * @param state Cuckoo state of the column.
+ * @param sample Output: the sample, allocated in the current context.
+ */
+static void sampleColumn(Relation rel, AttrNumber attnum, double samplePct,
+                         CuckooState *state, CuckooSample *sample) {
+  Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel), attnum - 1);
+  int64 maxValues = 1024;
+  Oid argtypes[1] = {FLOAT4OID};
+  Datum args[1] = {Float4GetDatum((float4)samplePct)};
+  Portal portal;
+  char *query;
+
+  memset(sample, 0, sizeof(*sample));
+  sample->fingerprints = (uint32 *)palloc(sizeof(uint32) * maxValues);
+
+  query = psprintf(
+      "SELECT %s FROM %s TABLESAMPLE SYSTEM ($1) REPEATABLE (0)",
+      quote_identifier(NameStr(attr->attname)),
+      quote_qualified_identifier(
+          get_namespace_name(RelationGetNamespace(rel)),
+          RelationGetRelationName(rel)));
+
+  if (SPI_connect() != SPI_OK_CONNECT)
+    elog(ERROR, "SPI_connect failed");
+
+  portal = SPI_cursor_open_with_args(NULL, query, 1, argtypes, args, NULL,
+                                     true, 0);
+
+  for (;;) {
+    SPI_cursor_fetch(portal, true, CUCKOO_ADVISE_BATCH);
+    if (SPI_processed == 0)
+      break;
+
+    for (uint64 i = 0; i < SPI_processed; i++) {
+      bool isnull;
+      Datum value = SPI_getbinval(SPI_tuptable->vals[i],
+                                  SPI_tuptable->tupdesc, 1, &isnull);
+      double width;
+
+      sample->nrows++;
+      if (isnull)
+        continue;
+
+      if (sample->nvalues == maxValues) {
+        maxValues *= 2;
+        sample->fingerprints = (uint32 *)repalloc_huge(
+            sample->fingerprints, sizeof(uint32) * maxValues);
+      }
+      sample->fingerprints[sample->nvalues++] =
+          computeFingerprint(state, &value, &isnull);
+
+      if (attr->attlen == -1)
+        width = toast_datum_size(value);
+      else if (attr->attlen == -2)
+        width = strlen(DatumGetCString(value)) + 1;
+      else
+        width = attr->attlen;
+      sample->totalWidth += width;
+      sample->maxWidth = Max(sample->maxWidth, width);
+    }
+
+    SPI_freetuptable(SPI_tuptable);
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  SPI_cursor_close(portal);
+  SPI_finish();
+}
+
+/**
+ * @brief Estimate the number of distinct values in the whole table.
+ *
+ * Uses the Duj1 estimator of ANALYZE on the 32-bit fingerprints, whose
+ * collisions are rare enough to ignore.
+ *
+ * @param sorted Sorted 32-bit fingerprints of the sample.
+ * @param n Number of sampled values.
+ * @param total Estimated number of non-NULL values in the table.
+ * @param sampleDistinct Output: distinct values in the sample.
+ * @return Estimated distinct values in the table, at least 1.
+ */
+static double estimateDistinct(const uint32 *sorted, int64 n, double total,
+                               double *sampleDistinct) {
+  double d = 0;
+  double f1 = 0;
+  double denom;
+
+  for (int64 i = 0; i < n;) {
+    int64 j = i + 1;
+
+    while (j < n && sorted[j] == sorted[i])
+      j++;
+    d++;
+    if (j - i == 1)
+      f1++;
+    i = j;
+  }
+
+  *sampleDistinct = d;
+  if (n == 0)
+    return 1.0;
+
+  denom = (double)n - f1 + f1 * (double)n / total;
+  return Max(1.0, Min(total, (double)n * d / denom));
+}
+
+/**
+ * @brief Look random absent values up among the sampled fingerprints.
+ *
+ * @param state Cuckoo state narrowed to the simulated width.
+ * @param wide Cuckoo state with 32-bit tags.
+ * @param sorted Sorted fingerprints of the sample at the simulated width.
+ * @param n Number of sampled values.
+ * @param hits Output: probes matching a sampled fingerprint.
+ * @param rows Output: sampled values matched by all probes together.
+ */
+static void probeFingerprints(CuckooState *state, CuckooState *wide,
+                              const uint32 *sorted, int64 n, int64 *hits,
+                              int64 *rows) {
+  pg_prng_state prng;
+
+  *hits = 0;
+  *rows = 0;
+  pg_prng_seed(&prng, UINT64CONST(0x5DEECE66D));
+
+  for (int p = 0; p < CUCKOO_ADVISE_PROBES; p++) {
+    uint32 fingerprint = CuckooNarrowFingerprint(
+        state, CuckooElementFingerprint(wide, pg_prng_uint32(&prng)));
+    int64 lo = 0;
+    int64 hi = n;
+
+    while (lo < hi) {
+      int64 mid = lo + (hi - lo) / 2;
+
+      if (sorted[mid] < fingerprint)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    if (lo < n && sorted[lo] == fingerprint) {
+      (*hits)++;
+      while (lo < n && sorted[lo] == fingerprint) {
+        (*rows)++;
+        lo++;
+      }
+    }
+  }
+}
+
+/**
+ * @brief Fill in the cuckoo candidates of one tag width.
+ *
+ * @param advice Output: flat, flat with summaries, hashed and frozen.
+ * @param bits Tag width.
+ * @param nrows Estimated rows of the table, NULL or not.
+ * @param distinct Estimated distinct values of the table.
+ * @param fpr Chance that a lookup of an absent value rechecks a heap row.
+ * @param falseRows Heap rows such a lookup rechecks.
+ * @param heapPages Pages of the table.
+ */
+static void adviseCuckoo(CuckooAdvice *advice, int bits, double nrows,
+                         double distinct, double fpr, double falseRows,
+                         double heapPages) {
+  double perPage = CUCKOO_MAX_TUPLES_PER_PAGE;
+  double dataPages = Max(1.0, ceil(nrows / perPage));
+  double heapRechecks = Min(falseRows, heapPages);
+  CuckooOptions opts;
+  uint32 group;
+  Size slotSize;
+  double buckets, fences, keys, filterPages;
+
+  for (int i = 0; i < 4; i++) {
+    advice[i].am = "cuckoo";
+    advice[i].summary = false;
+    advice[i].bits = bits;
+    advice[i].fpr = fpr;
+    advice[i].falseRows = falseRows;
+  }
+
+  /* A flat index reads every data page */
+  advice[0].layout = "flat";
+  advice[0].pages = 1 + dataPages;
+  advice[0].lookupPages = dataPages + heapRechecks;
+
+  /* Summaries lead only to the data pages holding a false positive */
+  memset(&opts, 0, sizeof(opts));
+  opts.layout = CUCKOO_LAYOUT_FLAT;
+  opts.summary = true;
+  opts.bitsPerTag = bits;
+  CuckooSummaryGeometry(&opts, &group, &slotSize);
+  advice[1].layout = "flat";
+  advice[1].summary = true;
+  advice[1].pages = 1 + dataPages + ceil(dataPages / group);
+  advice[1].lookupPages = ceil(dataPages / group) +
+                          Min(dataPages, falseRows) + heapRechecks;
+
+  /* A hashed lookup reads a directory page and a bucket */
+  buckets = Max(1.0, ceil(nrows * 100 / (perPage * CUCKOO_BUILD_FILL_PERCENT)));
+  advice[2].layout = "hashed";
+  advice[2].pages = 1 + buckets + ceil(buckets / CUCKOO_DIR_ENTRIES);
+  advice[2].lookupPages = 2 + heapRechecks;
+
+  /*
+   * A frozen lookup probes three bytes of the XOR filter, sized as
+   * CuckooFrozenWrite() sizes it, and only binary searches the fences when
+   * the filter passes: for a false positive, or 2^-8 of the time anyway.
+   */
+  fences = ceil(dataPages * sizeof(uint32) / CUCKOO_ADVISE_PAGE_BYTES);
+  keys = ldexp(1.0, bits) * -expm1(-distinct / ldexp(1.0, bits));
+  filterPages = ceil(3 * floor((32 + ceil(1.23 * keys) + 2) / 3) /
+                     CUCKOO_ADVISE_PAGE_BYTES);
+  advice[3].layout = "frozen";
+  advice[3].pages = 1 + dataPages + fences + filterPages;
+  advice[3].lookupPages =
+      Min(3.0, filterPages) +
+      (fpr + (1 - fpr) / 256) * (ceil(log2(fences + 1)) + 1) + heapRechecks;
+}
+
+/**
+ * @brief Fill in the btree and hash index estimates.
+ *
+ * Neither has false positives worth counting: a btree compares keys, and
+ * a hash index compares full 32-bit hash codes.
+ *
+ * @param advice Output: btree, then hash.
+ * @param nrows Estimated rows of the table.
+ * @param avgWidth Average stored width of the values.
+ * @param maxWidth Stored width of the widest sampled value.
+ * @return Number of rows filled in; no btree if a value is too wide.
+ */
+static int adviseOthers(CuckooAdvice *advice, double nrows, double avgWidth,
+                        double maxWidth) {
+  /* Both have a 16-byte special space */
+  double usable = BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - MAXALIGN(16);
+  double tupleBytes = MAXALIGN(sizeof(IndexTupleData) + (Size)ceil(avgWidth)) +
+                      sizeof(ItemIdData);
+  double fanout = Max(2.0, floor(usable / tupleBytes));
+  double leaves =
+      Max(1.0, ceil(nrows * tupleBytes * 100 /
+                    (usable * CUCKOO_ADVISE_BTREE_FILL)));
+  int n = 0;
+
+  /* A btree rejects keys wider than about a third of a page */
+  if (maxWidth < BLCKSZ / 3 - 32) {
+    advice[n].am = "btree";
+    advice[n].pages = 1 + leaves + ceil(leaves / fanout);
+    advice[n].lookupPages = 1 + ceil(log(leaves) / log(fanout));
+    n++;
+  }
+
+  /* Hash index tuples hold a 4-byte hash code */
+  tupleBytes = MAXALIGN(sizeof(IndexTupleData) + sizeof(uint32)) +
+               sizeof(ItemIdData);
+  advice[n].am = "hash";
+  advice[n].pages =
+      2 + Max(1.0, ceil(nrows * tupleBytes * 100 /
+                        (usable * CUCKOO_ADVISE_HASH_FILL)));
+  advice[n].lookupPages = 1;
+  n++;
+
+  for (int i = 0; i < n; i++) {
+    advice[i].layout = NULL;
+    advice[i].summary = false;
+    advice[i].bits = 0;
+    advice[i].fpr = 0;
+    advice[i].falseRows = 0;
+  }
+
+  return n;
+}
+
+/**
+ * @brief Recommend index options for a column from a sample of its table.
+ *
+ * The recommended row is the smallest index whose lookups read at most
+ * one page more than the cheapest lookups of all candidates.
+ *
+ * @param fcinfo Function call info: regclass table, text column, float8
+ *               percentage of the table's blocks to sample.
+ * @return One row per candidate: am, layout, summary, bits_per_tag,
+ *         index_bytes, fpr, false_rows, lookup_pages, recommended.
+ */
+extern "C" Datum cuckoo_advise(PG_FUNCTION_ARGS) {
+  Oid relid = PG_GETARG_OID(0);
+  char *column = text_to_cstring(PG_GETARG_TEXT_PP(1));
+  double samplePct = PG_GETARG_FLOAT8(2);
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  CuckooAdvice advice[lengthof(ck_advise_widths) * 4 + 2];
+  int nadvice = 0;
+  int best = -1;
+  double cheapest;
+  Relation rel;
+  AttrNumber attnum;
+  Oid typid, collation, opclass, hashProc;
+  int32 typmod;
+  CuckooState wide;
+  CuckooSample sample;
+  uint32 *narrowed;
+  double nrows, nvalues, distinct, sampleDistinct, heapPages;
+
+  if (!(samplePct > 0 && samplePct <= 100))
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("sample_pct must be greater than 0 and at most "
+                           "100")));
+
+  rel = table_open(relid, AccessShareLock);
+  if (rel->rd_rel->relkind != RELKIND_RELATION &&
+      rel->rd_rel->relkind != RELKIND_MATVIEW)
+    ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+                    errmsg("\"%s\" is not a table",
+                           RelationGetRelationName(rel))));
+
+  attnum = get_attnum(relid, column);
+  if (attnum <= 0)
+    ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+                    errmsg("column \"%s\" of relation \"%s\" does not exist",
+                           column, RelationGetRelationName(rel))));
+  get_atttypetypmodcoll(relid, attnum, &typid, &typmod, &collation);
+
+  opclass = GetDefaultOpClass(typid, get_index_am_oid("cuckoo", false));
+  hashProc = OidIsValid(opclass)
+                 ? get_opfamily_proc(get_opclass_family(opclass),
+                                     get_opclass_input_type(opclass),
+                                     get_opclass_input_type(opclass),
+                                     CUCKOO_HASH_PROC)
+                 : InvalidOid;
+  if (!OidIsValid(hashProc))
+    ereport(ERROR,
+            (errcode(ERRCODE_UNDEFINED_OBJECT),
+             errmsg("data type %s has no default whole-value operator class "
+                    "for access method \"cuckoo\"",
+                    format_type_be(typid))));
+
+  initColumnState(&wide, hashProc, collation);
+  sampleColumn(rel, attnum, samplePct, &wide, &sample);
+  heapPages = RelationGetNumberOfBlocks(rel);
+  table_close(rel, AccessShareLock);
+
+  if (sample.nrows == 0)
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("sample of \"%s\" is empty", get_rel_name(relid)),
+                    errhint("Use a larger sample_pct.")));
+
+  /* Scale the sample up to the table */
+  nrows = Max(1.0, (double)sample.nrows * 100 / samplePct);
+  nvalues = (double)sample.nvalues * 100 / samplePct;
+  narrowed = (uint32 *)palloc_extended(
+      sizeof(uint32) * Max(sample.nvalues, 1), MCXT_ALLOC_HUGE);
+  memcpy(narrowed, sample.fingerprints, sizeof(uint32) * sample.nvalues);
+  qsort(narrowed, sample.nvalues, sizeof(uint32), cmpFingerprint);
+  distinct = estimateDistinct(narrowed, sample.nvalues, Max(nvalues, 1.0),
+                              &sampleDistinct);
+
+  for (int w = 0; w < (int)lengthof(ck_advise_widths); w++) {
+    CuckooState state = wide;
+    int64 hits, rows;
+    double fpr;
+
+    CuckooSetTagWidth(&state, ck_advise_widths[w]);
+    for (int64 i = 0; i < sample.nvalues; i++)
+      narrowed[i] = CuckooNarrowFingerprint(&state, sample.fingerprints[i]);
+    qsort(narrowed, sample.nvalues, sizeof(uint32), cmpFingerprint);
+    probeFingerprints(&state, &wide, narrowed, sample.nvalues, &hits, &rows);
+
+    /* The miss rate compounds for every sample's worth of distinct values */
+    fpr = sampleDistinct > 0
+              ? -expm1(log1p(-(double)hits / CUCKOO_ADVISE_PROBES) *
+                       distinct / sampleDistinct)
+              : 0;
+    if (hits == CUCKOO_ADVISE_PROBES)
+      fpr = 1;
+    adviseCuckoo(&advice[nadvice], ck_advise_widths[w], nrows, distinct, fpr,
+                 (double)rows / CUCKOO_ADVISE_PROBES * 100 / samplePct,
+                 heapPages);
+    nadvice += 4;
+  }
+
+  nadvice += adviseOthers(&advice[nadvice], nrows,
+                          sample.nvalues > 0
+                              ? sample.totalWidth / sample.nvalues
+                              : 0,
+                          sample.maxWidth);
+
+  cheapest = advice[0].lookupPages;
+  for (int i = 1; i < nadvice; i++)
+    cheapest = Min(cheapest, advice[i].lookupPages);
+  for (int i = 0; i < nadvice; i++) {
+    if (advice[i].lookupPages <= cheapest + 1 &&
+        (best < 0 || advice[i].pages < advice[best].pages ||
+         (advice[i].pages == advice[best].pages &&
+          advice[i].lookupPages < advice[best].lookupPages)))
+      best = i;
+  }
+
+  InitMaterializedSRF(fcinfo, 0);
+  for (int i = 0; i < nadvice; i++) {
+    Datum values[9];
+    bool nulls[9] = {false};
+
+    values[0] = CStringGetTextDatum(advice[i].am);
+    if (advice[i].layout != NULL)
+      values[1] = CStringGetTextDatum(advice[i].layout);
+    else
+      nulls[1] = true;
+    values[2] = BoolGetDatum(advice[i].summary);
+    nulls[2] = advice[i].layout == NULL;
+    values[3] = Int32GetDatum(advice[i].bits);
+    nulls[3] = advice[i].bits == 0;
+    values[4] = Int64GetDatum((int64)advice[i].pages * BLCKSZ);
+    values[5] = Float8GetDatum(advice[i].fpr);
+    values[6] = Float8GetDatum(advice[i].falseRows);
+    values[7] = Float8GetDatum(advice[i].lookupPages);
+    values[8] = BoolGetDatum(i == best);
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  }
+
+  return (Datum)0;
+}
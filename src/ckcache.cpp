@@ -0,0 +1,299 @@
+/**
+ * @file ckcache.cpp
+ * @brief Backend-local cache of fingerprint lookups.
+ *
+ * Applications often look the same few values up over and over. When an
+ * index has lookup_cache set, each backend keeps the heap TIDs it found
+ * for its most recent fingerprints in a small LRU cache, and changes to
+ * the index bump a change counter on the metapage. A lookup reads the
+ * counter before anything else and reuses the cached TIDs if the index
+ * has not changed since they were collected; otherwise it reads the index
+ * and replaces the entry. Lookups that find nothing are cached too.
+ *
+ * Only the first change after a lookup has read the counter needs to bump
+ * it. Such a lookup sets the CUCKOO_CACHED flag of the metapage before
+ * reading the index, and the insert or VACUUM that bumps the counter
+ * clears it, so the inserts in between only look at the flag under a
+ * share lock. The flag is a hint: the caches it protects do not survive a
+ * crash, and a standby, which cannot set it, does not use them.
+ *
+ * Entries are keyed by the relfilenumber as well as the OID of the index,
+ * so that a REINDEX or cuckoo_reorganize(), which give the index new
+ * storage with a fresh counter, never revive the entries of the old one.
+ * Entries of dropped indexes simply age out.
+ *
+ * Copyright (c) 2025
+ * SPDX-License-Identifier: PostgreSQL
+ */
+#include "cuckoo.h"
+
+extern "C" {
+#include "access/generic_xlog.h"
+#include "access/xlog.h"
+#include "lib/ilist.h"
+#include "storage/bufmgr.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+}
+
+/* Lookups with more matches than this are not cached */
+#define CUCKOO_CACHE_MAX_TIDS 1024
+
+/* Fingerprints each backend caches the lookups of, 0 to disable */
+static int ck_lookup_cache_size = 256;
+
+/**
+ * @brief Key of a cached lookup.
+ */
+typedef struct CuckooCacheKey {
+  Oid indexOid;            /**< Index looked up */
+  RelFileNumber relNumber; /**< Storage of the index at the time */
+  uint32 fingerprint;      /**< Fingerprint looked up */
+} CuckooCacheKey;
+
+/**
+ * @brief Cached lookup.
+ */
+typedef struct CuckooCacheEntry {
+  CuckooCacheKey key;    /**< Hash key (must be first) */
+  dlist_node lru;        /**< Position in ck_cache_lru */
+  uint64 changeCount;    /**< Change counter the TIDs were collected at */
+  int ntids;             /**< Number of TIDs */
+  ItemPointerData *tids; /**< Matching heap TIDs, NULL if none */
+} CuckooCacheEntry;
+
+static HTAB *ck_cache = NULL;
+static MemoryContext ck_cache_cxt = NULL;
+
+/* Entries from the most to the least recently used */
+static dlist_head ck_cache_lru = DLIST_STATIC_INIT(ck_cache_lru);
+
+/**
+ * @brief Check whether scans of an index use the lookup cache.
+ *
+ * Element indexes and block range filters do not, and neither count
+ * their changes.
+ *
+ * @param state Cuckoo index state.
+ * @return true if the index counts its changes for the cache.
+ */
+bool CuckooLookupCacheUsed(CuckooState *state) {
+  return state->opts.lookupCache && !state->extractValues &&
+         state->opts.pagesPerRange == 0;
+}
+
+/**
+ * @brief Read the change counter of an index for a cached lookup.
+ *
+ * Sets the CUCKOO_CACHED flag first, unless it is set already, so that
+ * the next change to the index bumps the counter.
+ *
+ * @param index The index relation.
+ * @return The counter.
+ */
+uint64 CuckooWatchChangeCount(Relation index) {
+  Buffer buffer;
+  Page page;
+  uint64 changeCount;
+
+  Assert(!RecoveryInProgress());
+
+  buffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(buffer, BUFFER_LOCK_SHARE);
+  page = BufferGetPage(buffer);
+
+  if (!(CuckooPageGetOpaque(page)->flags & CUCKOO_CACHED)) {
+    LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+    LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+    if (!(CuckooPageGetOpaque(page)->flags & CUCKOO_CACHED)) {
+      CuckooPageGetOpaque(page)->flags |= CUCKOO_CACHED;
+      MarkBufferDirtyHint(buffer, true);
+    }
+  }
+
+  changeCount = CuckooPageGetMeta(page)->changeCount;
+  UnlockReleaseBuffer(buffer);
+
+  return changeCount;
+}
+
+/**
+ * @brief Bump the change counter of an index if a lookup has read it.
+ *
+ * Called after the change, so that a lookup that read the old counter
+ * cannot have missed it without its cache entry going stale. A lookup
+ * that sets the flag after this has seen it, since the flag is set before
+ * the index is read.
+ *
+ * @param index The index relation.
+ */
+void CuckooBumpChangeCount(Relation index) {
+  Buffer buffer;
+  GenericXLogState *state;
+  Page page;
+  bool cached;
+
+  buffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(buffer, BUFFER_LOCK_SHARE);
+  cached = (CuckooPageGetOpaque(BufferGetPage(buffer))->flags &
+            CUCKOO_CACHED) != 0;
+  LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+
+  if (cached) {
+    LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+    if (CuckooPageGetOpaque(BufferGetPage(buffer))->flags & CUCKOO_CACHED) {
+      state = GenericXLogStart(index);
+      page = GenericXLogRegisterBuffer(state, buffer, 0);
+      CuckooPageGetOpaque(page)->flags &= ~CUCKOO_CACHED;
+      CuckooPageGetMeta(page)->changeCount++;
+      GenericXLogFinish(state);
+    }
+    LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+  }
+
+  ReleaseBuffer(buffer);
+}
+
+/**
+ * @brief Fill in the cache key of a lookup.
+ *
+ * @param index The index relation.
+ * @param fingerprint Fingerprint looked up.
+ * @param key Output: the key.
+ */
+static void makeCacheKey(Relation index, uint32 fingerprint,
+                         CuckooCacheKey *key) {
+  memset(key, 0, sizeof(*key));
+  key->indexOid = RelationGetRelid(index);
+  key->relNumber = index->rd_locator.relNumber;
+  key->fingerprint = fingerprint;
+}
+
+/**
+ * @brief Remove an entry from the cache.
+ *
+ * @param entry Entry to remove.
+ */
+static void evictEntry(CuckooCacheEntry *entry) {
+  dlist_delete(&entry->lru);
+  if (entry->tids != NULL)
+    pfree(entry->tids);
+  hash_search(ck_cache, &entry->key, HASH_REMOVE, NULL);
+}
+
+/**
+ * @brief Add the cached TIDs of a lookup to a bitmap.
+ *
+ * @param index The index relation.
+ * @param fingerprint Fingerprint looked up.
+ * @param changeCount Change counter of the index, read before the lookup.
+ * @param tbm Bitmap to add the TIDs to.
+ * @param ntids Output: number of TIDs added.
+ * @return false if the lookup is not cached, or the index has changed.
+ */
+bool CuckooLookupCacheGet(Relation index, uint32 fingerprint,
+                          uint64 changeCount, TIDBitmap *tbm, int64 *ntids) {
+  CuckooCacheKey key;
+  CuckooCacheEntry *entry;
+
+  if (ck_cache == NULL || ck_lookup_cache_size == 0)
+    return false;
+
+  makeCacheKey(index, fingerprint, &key);
+  entry = (CuckooCacheEntry *)hash_search(ck_cache, &key, HASH_FIND, NULL);
+  if (entry == NULL || entry->changeCount != changeCount)
+    return false;
+
+  dlist_move_head(&ck_cache_lru, &entry->lru);
+  if (entry->ntids > 0)
+    tbm_add_tuples(tbm, entry->tids, entry->ntids, true);
+  *ntids = entry->ntids;
+
+  return true;
+}
+
+/**
+ * @brief Cache the TIDs a lookup found.
+ *
+ * Evicts the least recently used entries to stay within
+ * cuckoo.lookup_cache_size.
+ *
+ * @param index The index relation.
+ * @param fingerprint Fingerprint looked up.
+ * @param changeCount Change counter of the index, read before the lookup.
+ * @param tids Matching heap TIDs.
+ * @param ntids Number of TIDs.
+ */
+void CuckooLookupCachePut(Relation index, uint32 fingerprint,
+                          uint64 changeCount, const ItemPointerData *tids,
+                          int ntids) {
+  CuckooCacheKey key;
+  CuckooCacheEntry *entry;
+  bool found;
+
+  if (ck_lookup_cache_size == 0 || ntids > CUCKOO_CACHE_MAX_TIDS)
+    return;
+
+  if (ck_cache == NULL) {
+    HASHCTL ctl;
+
+    ck_cache_cxt = AllocSetContextCreate(
+        TopMemoryContext, "cuckoo lookup cache", ALLOCSET_DEFAULT_SIZES);
+    ctl.keysize = sizeof(CuckooCacheKey);
+    ctl.entrysize = sizeof(CuckooCacheEntry);
+    ctl.hcxt = ck_cache_cxt;
+    ck_cache = hash_create("cuckoo lookup cache", 256, &ctl,
+                           HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+  }
+
+  makeCacheKey(index, fingerprint, &key);
+  entry = (CuckooCacheEntry *)hash_search(ck_cache, &key, HASH_FIND, NULL);
+  if (entry != NULL)
+    evictEntry(entry);
+
+  while (hash_get_num_entries(ck_cache) >= ck_lookup_cache_size)
+    evictEntry(dlist_container(CuckooCacheEntry, lru,
+                               dlist_tail_node(&ck_cache_lru)));
+
+  entry = (CuckooCacheEntry *)hash_search(ck_cache, &key, HASH_ENTER, &found);
+  entry->changeCount = changeCount;
+  entry->ntids = ntids;
+  entry->tids = NULL;
+  if (ntids > 0) {
+    entry->tids = (ItemPointerData *)MemoryContextAlloc(
+        ck_cache_cxt, sizeof(ItemPointerData) * ntids);
+    memcpy(entry->tids, tids, sizeof(ItemPointerData) * ntids);
+  }
+  dlist_push_head(&ck_cache_lru, &entry->lru);
+}
+
+/**
+ * @brief Forget every cached lookup.
+ *
+ * A TRUNCATE in the transaction that created a table rebuilds its indexes
+ * in the storage they have, starting their change counters over, so
+ * builds call this. Only the building backend can have seen such an
+ * index.
+ */
+void CuckooLookupCacheReset(void) {
+  if (ck_cache == NULL)
+    return;
+
+  MemoryContextDelete(ck_cache_cxt);
+  ck_cache = NULL;
+  ck_cache_cxt = NULL;
+  dlist_init(&ck_cache_lru);
+}
+
+/**
+ * @brief Define the lookup cache's configuration parameter.
+ */
+void CuckooInitLookupCache(void) {
+  DefineCustomIntVariable(
+      "cuckoo.lookup_cache_size",
+      "Number of lookups each backend caches for indexes with lookup_cache.",
+      NULL, &ck_lookup_cache_size, 256, 0, 65536, PGC_USERSET, 0, NULL, NULL,
+      NULL);
+}
@@ -47,8 +47,10 @@ static double calculateFalsePositiveRate(int bitsPerTag, int tagsPerBucket) {
 /**
  * @brief Estimate the cost of a cuckoo index scan.
  *
- * Cuckoo indexes must scan all index pages (like bloom indexes),
+ * Flat cuckoo indexes must scan all index pages (like bloom indexes),
  * but have very fast per-tuple comparison (just fingerprint equality).
+ * Hashed and frozen indexes only read the pages that can hold the search
+ * fingerprint.
  * The selectivity is based on the theoretical false positive rate.
  *
  * @param root Planner information.
@@ -69,32 +71,34 @@ void ckcostestimate(PlannerInfo *root, IndexPath *path, double loop_count,
   CuckooOptions *opts;
   GenericCosts costs = {0};
   double falsePositiveRate;
+  bool fullScan;
+  int pagesPerRange;
 
   /*
-   * Read the index options to get bits_per_tag and tags_per_bucket
-   * for accurate false positive rate estimation.
+   * Read the options the index was built with to get bits_per_tag and
+   * tags_per_bucket for accurate false positive rate estimation. The tag
+   * width may have been chosen at build time from target_fpr.
    */
   indexRel = index_open(index->indexoid, AccessShareLock);
-
-  if (indexRel->rd_options) {
-    opts = (CuckooOptions *)indexRel->rd_options;
-  } else {
-    /* Use defaults if no options set */
-    static CuckooOptions defaultOpts = {
-        0, DEFAULT_BITS_PER_TAG, DEFAULT_TAGS_PER_BUCKET, DEFAULT_MAX_KICKS};
-    opts = &defaultOpts;
-  }
+  opts = CuckooGetOptions(indexRel);
 
   falsePositiveRate =
       calculateFalsePositiveRate(opts->bitsPerTag, opts->tagsPerBucket);
+  fullScan = opts->layout == CUCKOO_LAYOUT_FLAT;
+  pagesPerRange = opts->pagesPerRange;
 
   index_close(indexRel, AccessShareLock);
 
   /*
-   * Cuckoo indexes, like bloom indexes, must visit all index tuples.
+   * Flat cuckoo indexes, like bloom indexes, must visit all index tuples.
    * However, the per-tuple comparison is very fast (single integer compare).
+   * The hashed layout reads a single bucket and the frozen layout a few
+   * pages plus those inserted into since the build, so the generic
+   * estimate from the selectivity applies. With pages_per_range the
+   * index tuples are the range filters, all of which are probed.
    */
-  costs.numIndexTuples = index->tuples;
+  if (fullScan)
+    costs.numIndexTuples = index->tuples;
 
   /* Use generic estimate for the basics */
   genericcostestimate(root, path, loop_count, &costs);
@@ -108,6 +112,15 @@ void ckcostestimate(PlannerInfo *root, IndexPath *path, double loop_count,
     costs.indexSelectivity = falsePositiveRate;
   }
 
+  /*
+   * Range filters return whole block ranges, so at least one range's worth
+   * of the table is read.
+   */
+  if (pagesPerRange > 0 && index->rel->pages > 0)
+    costs.indexSelectivity =
+        Min(1.0, Max(costs.indexSelectivity,
+                     (double)pagesPerRange / index->rel->pages));
+
   *indexStartupCost = costs.indexStartupCost;
   *indexTotalCost = costs.indexTotalCost;
   *indexSelectivity = costs.indexSelectivity;
@@ -0,0 +1,317 @@
+/**
+ * @file ckextract.cpp
+ * @brief Extract-value procedures for cuckoo element operator classes.
+ *
+ * Element operator classes index each element of a composite value as a
+ * separate fingerprint, so containment style operators can be answered
+ * by combining the matches of the individual elements. The procedures in
+ * this file return the hash of each element; the access method turns
+ * them into fingerprints.
+ *
+ * Copyright (c) 2025
+ * SPDX-License-Identifier: PostgreSQL
+ */
+#include "cuckoo.h"
+
+extern "C" {
+#include "common/hashfn.h"
+#include "mb/pg_wchar.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/formatting.h"
+#include "utils/jsonb.h"
+#include "utils/lsyscache.h"
+#include "utils/typcache.h"
+#include "varatt.h"
+
+PG_FUNCTION_INFO_V1(ckarray_extract_value);
+PG_FUNCTION_INFO_V1(ckjsonb_path_extract_value);
+PG_FUNCTION_INFO_V1(cktext_trgm_extract_value);
+PG_FUNCTION_INFO_V1(cktext_trgm_extract_query);
+}
+
+/* Number of characters in a trigram */
+#define CUCKOO_TRGM_LEN 3
+
+/**
+ * @brief Stack of path hashes used while walking a jsonb document.
+ */
+typedef struct CuckooPathHashStack {
+  uint32 hash;
+  struct CuckooPathHashStack *parent;
+} CuckooPathHashStack;
+
+/**
+ * @brief Extract element hashes from an array.
+ *
+ * Each non-NULL element is hashed with the default hash function of the
+ * element type. NULL elements are skipped since they never satisfy the
+ * array containment operators. Used for both indexed values and queries.
+ *
+ * @param fcinfo Function call info: anyarray value, int32 *nentries.
+ * @return Palloc'd array of element hashes.
+ */
+extern "C" Datum ckarray_extract_value(PG_FUNCTION_ARGS) {
+  ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+  int32 *nentries = (int32 *)PG_GETARG_POINTER(1);
+  Oid elemtype = ARR_ELEMTYPE(array);
+  TypeCacheEntry *typentry;
+  Datum *elems;
+  bool *nulls;
+  int nelems;
+  uint32 *hashes;
+  int n = 0;
+
+  typentry = (TypeCacheEntry *)fcinfo->flinfo->fn_extra;
+  if (typentry == NULL || typentry->type_id != elemtype) {
+    typentry = lookup_type_cache(elemtype, TYPECACHE_HASH_PROC_FINFO);
+    if (!OidIsValid(typentry->hash_proc_finfo.fn_oid))
+      ereport(ERROR, (errcode(ERRCODE_UNDEFINED_FUNCTION),
+                      errmsg("could not identify a hash function for type %s",
+                             format_type_be(elemtype))));
+    fcinfo->flinfo->fn_extra = (void *)typentry;
+  }
+
+  deconstruct_array(array, elemtype, typentry->typlen, typentry->typbyval,
+                    typentry->typalign, &elems, &nulls, &nelems);
+
+  hashes = (uint32 *)palloc(sizeof(uint32) * Max(nelems, 1));
+
+  for (int i = 0; i < nelems; i++) {
+    if (nulls[i])
+      continue;
+
+    hashes[n++] = DatumGetUInt32(FunctionCall1Coll(
+        &typentry->hash_proc_finfo, PG_GET_COLLATION(), elems[i]));
+  }
+
+  *nentries = n;
+  PG_RETURN_POINTER(hashes);
+}
+
+/**
+ * @brief Reject trigram indexes on columns with a nondeterministic collation.
+ *
+ * Trigrams hash the bytes of the case-folded string, but such a collation
+ * can call strings with different bytes equal; the index would then miss
+ * rows that match a query, so it is refused when it is built.
+ *
+ * @param index The index relation being built.
+ */
+void CuckooCheckTrigramCollation(Relation index) {
+  for (int i = 0; i < IndexRelationGetNumberOfKeyAttributes(index); i++) {
+    Oid collation = index->rd_indcollation[i];
+
+    if (!OidIsValid(index_getprocid(index, i + 1, CUCKOO_EXTRACTVALUE_PROC)))
+      continue;
+    if (index_getprocinfo(index, i + 1, CUCKOO_EXTRACTVALUE_PROC)->fn_addr !=
+        cktext_trgm_extract_value)
+      continue;
+
+    if (OidIsValid(collation) && !get_collation_isdeterministic(collation))
+      ereport(ERROR,
+              (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+               errmsg("nondeterministic collations are not supported for "
+                      "operator class \"text_trgm_ops\"")));
+  }
+}
+
+/**
+ * @brief Extract (path, scalar value) hashes from a jsonb document.
+ *
+ * Every scalar is hashed together with the keys leading to it, following
+ * the same scheme as GIN's jsonb_path_ops: array positions are not part of
+ * the path, so a document contains a query exactly when it holds every
+ * pair of the query. Used for both indexed values and queries.
+ *
+ * @param fcinfo Function call info: jsonb value, int32 *nentries.
+ * @return Palloc'd array of pair hashes.
+ */
+extern "C" Datum ckjsonb_path_extract_value(PG_FUNCTION_ARGS) {
+  Jsonb *jb = PG_GETARG_JSONB_P(0);
+  int32 *nentries = (int32 *)PG_GETARG_POINTER(1);
+  JsonbIterator *it;
+  JsonbValue v;
+  JsonbIteratorToken r;
+  CuckooPathHashStack tail;
+  CuckooPathHashStack *stack;
+  CuckooPathHashStack *parent;
+  uint32 *hashes;
+  int maxEntries;
+  int n = 0;
+
+  maxEntries = Max(2 * JB_ROOT_COUNT(jb), 8);
+  hashes = (uint32 *)palloc(sizeof(uint32) * maxEntries);
+
+  tail.parent = NULL;
+  tail.hash = 0;
+  stack = &tail;
+
+  it = JsonbIteratorInit(&jb->root);
+  while ((r = JsonbIteratorNext(&it, &v, false)) != WJB_DONE) {
+    switch (r) {
+    case WJB_BEGIN_ARRAY:
+    case WJB_BEGIN_OBJECT:
+      parent = stack;
+      stack = (CuckooPathHashStack *)palloc(sizeof(CuckooPathHashStack));
+      stack->hash = parent->hash;
+      stack->parent = parent;
+      break;
+    case WJB_KEY:
+      JsonbHashScalarValue(&v, &stack->hash);
+      break;
+    case WJB_ELEM:
+    case WJB_VALUE:
+      if (n >= maxEntries) {
+        maxEntries *= 2;
+        hashes = (uint32 *)repalloc(hashes, sizeof(uint32) * maxEntries);
+      }
+      hashes[n] = stack->hash;
+      JsonbHashScalarValue(&v, &hashes[n]);
+      n++;
+      /* Reset the hash for the next key, value or container */
+      stack->hash = stack->parent->hash;
+      break;
+    case WJB_END_ARRAY:
+    case WJB_END_OBJECT:
+      parent = stack->parent;
+      pfree(stack);
+      stack = parent;
+      stack->hash = stack->parent ? stack->parent->hash : 0;
+      break;
+    default:
+      elog(ERROR, "invalid JsonbIteratorNext rc: %d", (int)r);
+    }
+  }
+
+  *nentries = n;
+  PG_RETURN_POINTER(hashes);
+}
+
+/**
+ * @brief Append the trigram hashes of a string to an array.
+ *
+ * The string is folded to lower case with the given collation, so the same
+ * trigrams serve both LIKE and ILIKE. Trigrams are taken over characters,
+ * not bytes, and are not padded: strings shorter than three characters
+ * produce none.
+ *
+ * @param str String to split (not NUL-terminated).
+ * @param len Length of the string in bytes.
+ * @param collation Collation used for case folding.
+ * @param hashes Array to append to, enlarged as needed.
+ * @param nhashes Number of hashes in the array, updated.
+ * @param maxhashes Allocated size of the array, updated.
+ */
+static void addTrigramHashes(const char *str, int len, Oid collation,
+                             uint32 **hashes, int *nhashes, int *maxhashes) {
+  char *lower;
+  int lowerlen;
+  int *offsets;
+  int nchars = 0;
+
+  if (len < CUCKOO_TRGM_LEN)
+    return;
+
+  lower = str_tolower(str, len, collation);
+  lowerlen = strlen(lower);
+
+  /* Record where each character starts, plus the end of the string */
+  offsets = (int *)palloc(sizeof(int) * (lowerlen + 1));
+  for (int off = 0; off < lowerlen; off += pg_mblen(lower + off))
+    offsets[nchars++] = off;
+  offsets[nchars] = lowerlen;
+
+  for (int i = 0; i + CUCKOO_TRGM_LEN <= nchars; i++) {
+    if (*nhashes >= *maxhashes) {
+      *maxhashes *= 2;
+      *hashes = (uint32 *)repalloc(*hashes, sizeof(uint32) * *maxhashes);
+    }
+    (*hashes)[(*nhashes)++] = DatumGetUInt32(
+        hash_any((const unsigned char *)lower + offsets[i],
+                 offsets[i + CUCKOO_TRGM_LEN] - offsets[i]));
+  }
+
+  pfree(offsets);
+  pfree(lower);
+}
+
+/**
+ * @brief Extract trigram hashes from a text value.
+ *
+ * @param fcinfo Function call info: text value, int32 *nentries.
+ * @return Palloc'd array of trigram hashes.
+ */
+extern "C" Datum cktext_trgm_extract_value(PG_FUNCTION_ARGS) {
+  text *value = PG_GETARG_TEXT_PP(0);
+  int32 *nentries = (int32 *)PG_GETARG_POINTER(1);
+  int maxhashes = Max(VARSIZE_ANY_EXHDR(value), 1);
+  uint32 *hashes = (uint32 *)palloc(sizeof(uint32) * maxhashes);
+  int n = 0;
+
+  addTrigramHashes(VARDATA_ANY(value), VARSIZE_ANY_EXHDR(value),
+                   PG_GET_COLLATION(), &hashes, &n, &maxhashes);
+
+  *nentries = n;
+  PG_RETURN_POINTER(hashes);
+}
+
+/**
+ * @brief Extract trigram hashes from an equality or LIKE/ILIKE query.
+ *
+ * Equality queries use every trigram of the value. For patterns, only the
+ * runs of literal characters between wildcards contribute trigrams, since
+ * any matching value must contain each of those runs. Backslash escapes
+ * are honoured. A pattern without a literal run of three characters
+ * extracts nothing and matches every row.
+ *
+ * @param fcinfo Function call info: text query, int32 *nentries,
+ *               int16 strategy.
+ * @return Palloc'd array of trigram hashes.
+ */
+extern "C" Datum cktext_trgm_extract_query(PG_FUNCTION_ARGS) {
+  text *query = PG_GETARG_TEXT_PP(0);
+  int32 *nentries = (int32 *)PG_GETARG_POINTER(1);
+  StrategyNumber strategy = PG_GETARG_UINT16(2);
+  const char *pattern = VARDATA_ANY(query);
+  int patlen = VARSIZE_ANY_EXHDR(query);
+  int maxhashes = Max(patlen, 1);
+  uint32 *hashes = (uint32 *)palloc(sizeof(uint32) * maxhashes);
+  char *run;
+  int runlen = 0;
+  int n = 0;
+
+  if (strategy != CUCKOO_LIKE_STRATEGY && strategy != CUCKOO_ILIKE_STRATEGY) {
+    addTrigramHashes(pattern, patlen, PG_GET_COLLATION(), &hashes, &n,
+                     &maxhashes);
+    *nentries = n;
+    PG_RETURN_POINTER(hashes);
+  }
+
+  run = (char *)palloc(patlen + 1);
+  for (int off = 0; off < patlen;) {
+    int clen;
+
+    if (pattern[off] == '%' || pattern[off] == '_') {
+      addTrigramHashes(run, runlen, PG_GET_COLLATION(), &hashes, &n,
+                       &maxhashes);
+      runlen = 0;
+      off++;
+      continue;
+    }
+
+    /* An escaped character is taken literally */
+    if (pattern[off] == '\\' && off + 1 < patlen)
+      off++;
+
+    clen = pg_mblen(pattern + off);
+    memcpy(run + runlen, pattern + off, clen);
+    runlen += clen;
+    off += clen;
+  }
+  addTrigramHashes(run, runlen, PG_GET_COLLATION(), &hashes, &n, &maxhashes);
+  pfree(run);
+
+  *nentries = n;
+  PG_RETURN_POINTER(hashes);
+}
@@ -0,0 +1,713 @@
+/**
+ * @file ckfrozen.cpp
+ * @brief Frozen layout for cuckoo indexes.
+ *
+ * A frozen index is written once by its build as a read-only structure:
+ * the tuples sorted by fingerprint on data pages, the first fingerprint of
+ * every data page on fence pages, and an XOR filter of the distinct
+ * fingerprints (about 9.8 bits per fingerprint) on filter pages.
+ *
+ * A lookup probes three filter bytes, which rejects almost every absent
+ * fingerprint without touching a data page, then binary searches the
+ * fences for the first data page that can hold the fingerprint. Tuples
+ * inserted after the build go to flat pages following the frozen region,
+ * which lookups scan in full, so a frozen index is meant for tables that
+ * rarely change. VACUUM removes tuples from the data pages in place but
+ * never frees or refills them, so they stay sorted; the filter may keep
+ * removed fingerprints, which only costs a data page read.
+ *
+ * See Graf and Lemire, "Xor Filters: Faster and Smaller Than Bloom and
+ * Cuckoo Filters" (2020).
+ *
+ * Copyright (c) 2025
+ * SPDX-License-Identifier: PostgreSQL
+ */
+#include "cuckoo.h"
+
+#include <cmath>
+
+extern "C" {
+#include "access/tableam.h"
+#include "access/tupdesc.h"
+#include "catalog/pg_operator.h"
+#include "catalog/pg_type.h"
+#include "executor/tuptable.h"
+#include "miscadmin.h"
+#include "nodes/tidbitmap.h"
+#include "storage/bufmgr.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/tuplesort.h"
+}
+
+/* Bytes of content on a fence or filter page */
+#define CUCKOO_FROZEN_PAGE_BYTES                                               \
+  (BLCKSZ - MAXALIGN(SizeOfPageHeaderData) -                                   \
+   MAXALIGN(sizeof(CuckooPageOpaqueData)))
+
+/* Seeds tried before giving up on building the XOR filter */
+#define CUCKOO_XOR_MAX_ATTEMPTS 100
+
+/* Entries of the XOR filter per distinct key */
+#define CUCKOO_XOR_ENTRIES_PER_KEY 1.23
+
+/**
+ * @brief State maintained during a frozen-layout index build.
+ */
+typedef struct CuckooFrozenBuildState {
+  CuckooState *ckstate;      /**< Cuckoo index state */
+  Tuplesortstate *sortstate; /**< Sorts tuples by fingerprint */
+  TupleTableSlot *slot;      /**< Slot used to feed the sort */
+  int64 indtuples;           /**< Total number of tuples indexed */
+  MemoryContext tmpCtx;      /**< Temporary memory context */
+} CuckooFrozenBuildState;
+
+/**
+ * @brief Peeling state of one XOR filter entry during construction.
+ */
+typedef struct CuckooXorSet {
+  uint32 xorMask; /**< XOR of the keys mapped to the entry */
+  uint32 count;   /**< Number of keys mapped to the entry */
+} CuckooXorSet;
+
+/**
+ * @brief A key peeled from the XOR filter and the entry it was peeled at.
+ */
+typedef struct CuckooXorPeeled {
+  uint32 key;   /**< Peeled key */
+  uint32 index; /**< Entry that will hold the key's fingerprint */
+} CuckooXorPeeled;
+
+/**
+ * @brief Mix a key with the filter seed (MurmurHash3 finalizer).
+ */
+static inline uint64 xorMix(uint32 key, uint64 seed) {
+  uint64 h = key + seed;
+
+  h ^= h >> 33;
+  h *= UINT64CONST(0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  h *= UINT64CONST(0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+  return h;
+}
+
+/**
+ * @brief Map a 32-bit value onto [0, n) without a division.
+ */
+static inline uint32 xorReduce(uint32 x, uint32 n) {
+  return (uint32)(((uint64)x * n) >> 32);
+}
+
+/**
+ * @brief Compute the three filter entries and the 8-bit tag of a key.
+ *
+ * Each entry lies in its own segment of the filter.
+ *
+ * @param key Key (an index fingerprint).
+ * @param seed Filter seed.
+ * @param segmentLength Entries per segment.
+ * @param h Output: the three entries.
+ * @return The key's filter tag.
+ */
+static inline uint8 xorHashes(uint32 key, uint64 seed, uint32 segmentLength,
+                              uint32 h[3]) {
+  uint64 hash = xorMix(key, seed);
+
+  h[0] = xorReduce((uint32)hash, segmentLength);
+  h[1] = xorReduce((uint32)((hash << 21) | (hash >> 43)), segmentLength) +
+         segmentLength;
+  h[2] = xorReduce((uint32)((hash << 42) | (hash >> 22)), segmentLength) +
+         2 * segmentLength;
+
+  return (uint8)(hash ^ (hash >> 32));
+}
+
+/**
+ * @brief Compute the XOR filter of a set of distinct keys.
+ *
+ * Repeatedly peels an entry that only one remaining key maps to, then
+ * assigns the entries in reverse peeling order so that the tags at the
+ * three entries of every key XOR to the key's tag. Fails if the keys
+ * cannot all be peeled with this seed.
+ *
+ * @param keys Distinct keys.
+ * @param nkeys Number of keys.
+ * @param seed Filter seed.
+ * @param segmentLength Entries per segment.
+ * @param filter Output: 3 * segmentLength filter entries.
+ * @return true on success.
+ */
+static bool xorPopulate(const uint32 *keys, uint32 nkeys, uint64 seed,
+                        uint32 segmentLength, uint8 *filter) {
+  Size capacity = (Size)segmentLength * 3;
+  CuckooXorSet *sets;
+  uint32 *queue;
+  CuckooXorPeeled *peeled;
+  Size qsize = 0;
+  uint32 npeeled = 0;
+  uint32 h[3];
+  bool ok;
+
+  sets = (CuckooXorSet *)palloc_extended(sizeof(CuckooXorSet) * capacity,
+                                         MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+  queue = (uint32 *)palloc_extended(sizeof(uint32) * capacity,
+                                    MCXT_ALLOC_HUGE);
+  peeled = (CuckooXorPeeled *)palloc_extended(sizeof(CuckooXorPeeled) *
+                                                  Max(nkeys, 1),
+                                              MCXT_ALLOC_HUGE);
+
+  for (uint32 i = 0; i < nkeys; i++) {
+    xorHashes(keys[i], seed, segmentLength, h);
+    for (int j = 0; j < 3; j++) {
+      sets[h[j]].xorMask ^= keys[i];
+      sets[h[j]].count++;
+    }
+  }
+
+  for (Size i = 0; i < capacity; i++)
+    if (sets[i].count == 1)
+      queue[qsize++] = (uint32)i;
+
+  while (qsize > 0) {
+    uint32 index = queue[--qsize];
+    uint32 key;
+
+    if (sets[index].count != 1)
+      continue;
+
+    key = sets[index].xorMask;
+    peeled[npeeled].key = key;
+    peeled[npeeled].index = index;
+    npeeled++;
+
+    xorHashes(key, seed, segmentLength, h);
+    for (int j = 0; j < 3; j++) {
+      sets[h[j]].xorMask ^= key;
+      if (--sets[h[j]].count == 1)
+        queue[qsize++] = h[j];
+    }
+
+    if ((npeeled & 0xFFFF) == 0)
+      CHECK_FOR_INTERRUPTS();
+  }
+
+  ok = npeeled == nkeys;
+  if (ok) {
+    memset(filter, 0, capacity);
+    while (npeeled > 0) {
+      CuckooXorPeeled *p = &peeled[--npeeled];
+      uint8 tag = xorHashes(p->key, seed, segmentLength, h);
+
+      filter[p->index] = tag ^ filter[h[0]] ^ filter[h[1]] ^ filter[h[2]];
+    }
+  }
+
+  pfree(sets);
+  pfree(queue);
+  pfree(peeled);
+
+  return ok;
+}
+
+/**
+ * @brief Write a page image to a new page at the end of the index.
+ *
+ * @param index The index relation.
+ * @param image Page contents.
+ * @return Block number of the page.
+ */
+static BlockNumber appendPageImage(Relation index, Page image) {
+  Buffer buffer =
+      ExtendBufferedRel(BMR_REL(index), MAIN_FORKNUM, NULL, EB_LOCK_FIRST);
+  BlockNumber blkno = BufferGetBlockNumber(buffer);
+  GenericXLogState *state;
+  Page page;
+
+  state = GenericXLogStart(index);
+  page = GenericXLogRegisterBuffer(state, buffer, GENERIC_XLOG_FULL_IMAGE);
+  memcpy(page, image, BLCKSZ);
+  GenericXLogFinish(state);
+  UnlockReleaseBuffer(buffer);
+
+  return blkno;
+}
+
+/**
+ * @brief Write an array as consecutive pages of raw content.
+ *
+ * @param index The index relation.
+ * @param flags Page flags.
+ * @param data Content to write.
+ * @param size Bytes of content.
+ * @return Block number of the first page.
+ */
+static BlockNumber appendContentPages(Relation index, uint16 flags,
+                                      const char *data, Size size) {
+  BlockNumber first = InvalidBlockNumber;
+  PGAlignedBlock image;
+
+  for (Size off = 0; off < size; off += CUCKOO_FROZEN_PAGE_BYTES) {
+    Size n = Min(size - off, (Size)CUCKOO_FROZEN_PAGE_BYTES);
+    BlockNumber blkno;
+
+    CuckooInitPage(image.data, flags);
+    memcpy(PageGetContents(image.data), data + off, n);
+    ((PageHeader)image.data)->pd_lower += n;
+
+    blkno = appendPageImage(index, image.data);
+    if (first == InvalidBlockNumber)
+      first = blkno;
+    else
+      Assert(blkno == first + off / CUCKOO_FROZEN_PAGE_BYTES);
+
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  return first;
+}
+
+/**
+ * @brief Callback for table_index_build_scan during a frozen build.
+ *
+ * Feeds the fingerprints of each heap tuple to the sort.
+ */
+static void frozenBuildCallback(Relation index, ItemPointer tid,
+                                Datum *values, bool *isnull,
+                                bool tupleIsAlive, void *state) {
+  CuckooFrozenBuildState *buildstate = (CuckooFrozenBuildState *)state;
+  TupleTableSlot *slot = buildstate->slot;
+  MemoryContext oldCtx;
+  uint32 *fingerprints;
+  int nfingerprints;
+
+  oldCtx = MemoryContextSwitchTo(buildstate->tmpCtx);
+
+  fingerprints = computeFingerprints(buildstate->ckstate, values, isnull,
+                                     &nfingerprints);
+
+  for (int i = 0; i < nfingerprints; i++) {
+    ExecClearTuple(slot);
+    slot->tts_values[0] = Int64GetDatum((int64)fingerprints[i]);
+    slot->tts_values[1] = PointerGetDatum(tid);
+    slot->tts_isnull[0] = false;
+    slot->tts_isnull[1] = false;
+    ExecStoreVirtualTuple(slot);
+    tuplesort_puttupleslot(buildstate->sortstate, slot);
+
+    buildstate->indtuples++;
+  }
+
+  MemoryContextSwitchTo(oldCtx);
+  MemoryContextReset(buildstate->tmpCtx);
+}
+
+/**
+ * @brief Compute how many distinct keys the XOR filter can be built for.
+ *
+ * Building the filter holds the keys, the peeling state of every entry
+ * and the peeled keys in memory at once, which must fit in
+ * maintenance_work_mem.
+ *
+ * @return Maximum number of distinct keys.
+ */
+static uint32 xorMaxKeys(void) {
+  double perKey = sizeof(uint32) + sizeof(CuckooXorPeeled) +
+                  CUCKOO_XOR_ENTRIES_PER_KEY *
+                      (sizeof(CuckooXorSet) + sizeof(uint32) + sizeof(uint8));
+
+  return (uint32)Min((double)maintenance_work_mem * 1024.0 / perKey,
+                     (double)PG_UINT32_MAX);
+}
+
+/**
+ * @brief Write the sorted tuples of a build as the frozen region.
+ *
+ * Also used by cuckoo_reorganize() to rewrite an index from its own
+ * tuples.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param sortstate Tuples sorted by fingerprint.
+ * @param tupdesc Descriptor of the sorted tuples.
+ * @param ntuples Number of sorted tuples.
+ */
+void CuckooFrozenWrite(Relation index, CuckooState *ckstate,
+                       Tuplesortstate *sortstate, TupleDesc tupdesc,
+                       int64 ntuples) {
+  Size perPage = CUCKOO_FROZEN_PAGE_BYTES / ckstate->sizeOfCuckooTuple;
+  CuckooFrozenMetaData frozen;
+  TupleTableSlot *slot;
+  PGAlignedBlock image;
+  uint32 *fences;
+  uint32 *keys;
+  uint32 nkeys = 0;
+  uint32 maxKeys = xorMaxKeys();
+  uint8 *filter;
+  bool pageStarted = false;
+  Buffer metaBuffer;
+  GenericXLogState *state;
+
+  memset(&frozen, 0, sizeof(frozen));
+  frozen.dataStart = CUCKOO_HEAD_BLKNO;
+  frozen.frozenEnd = CUCKOO_HEAD_BLKNO;
+
+  if (ntuples > 0) {
+    if ((uint64)ntuples > PG_UINT32_MAX)
+      ereport(ERROR,
+              (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+               errmsg("too many tuples for a frozen cuckoo index")));
+
+    fences = (uint32 *)palloc_extended(
+        sizeof(uint32) * ((ntuples + perPage - 1) / perPage), MCXT_ALLOC_HUGE);
+    keys = (uint32 *)palloc_extended(
+        sizeof(uint32) * Min((uint64)ntuples, (uint64)maxKeys),
+        MCXT_ALLOC_HUGE);
+
+    /* Data pages, with the distinct fingerprints and page fences */
+    slot = MakeSingleTupleTableSlot(tupdesc, &TTSOpsMinimalTuple);
+
+    while (tuplesort_gettupleslot(sortstate, true, false, slot, NULL)) {
+      CuckooTuple itup;
+      bool isnull;
+
+      itup.fingerprint = (uint32)DatumGetInt64(slot_getattr(slot, 1, &isnull));
+      itup.heapPtr =
+          *(ItemPointer)DatumGetPointer(slot_getattr(slot, 2, &isnull));
+
+      /* The tuples are sorted, so equal fingerprints are adjacent */
+      if (nkeys == 0 || keys[nkeys - 1] != itup.fingerprint) {
+        if (nkeys == maxKeys)
+          ereport(ERROR,
+                  (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                   errmsg("too many distinct values to freeze cuckoo index "
+                          "\"%s\"",
+                          RelationGetRelationName(index)),
+                   errdetail("The XOR filter for more than %u distinct "
+                             "fingerprints does not fit in "
+                             "maintenance_work_mem.",
+                             maxKeys),
+                   errhint("Increase maintenance_work_mem or use another "
+                           "layout.")));
+        keys[nkeys++] = itup.fingerprint;
+      }
+
+      if (pageStarted && !CuckooPageAddItem(ckstate, image.data, &itup)) {
+        BlockNumber blkno PG_USED_FOR_ASSERTS_ONLY;
+
+        /* Data pages must be contiguous for lookups to find them */
+        blkno = appendPageImage(index, image.data);
+        Assert(blkno == frozen.dataStart + frozen.nDataPages - 1);
+        pageStarted = false;
+      }
+
+      if (!pageStarted) {
+        CuckooInitPage(image.data, CUCKOO_FROZEN);
+        if (!CuckooPageAddItem(ckstate, image.data, &itup))
+          elog(ERROR, "could not add new cuckoo tuple to empty page");
+        fences[frozen.nDataPages++] = itup.fingerprint;
+        pageStarted = true;
+      }
+
+      CHECK_FOR_INTERRUPTS();
+    }
+
+    if (pageStarted)
+      appendPageImage(index, image.data);
+
+    ExecDropSingleTupleTableSlot(slot);
+
+    frozen.fenceStart =
+        appendContentPages(index, CUCKOO_FENCE, (const char *)fences,
+                           sizeof(uint32) * frozen.nDataPages);
+
+    /* The XOR filter over the distinct fingerprints */
+    frozen.nKeys = nkeys;
+    frozen.segmentLength =
+        (uint32)((32 + ceil(CUCKOO_XOR_ENTRIES_PER_KEY * nkeys) + 2) / 3);
+    filter = (uint8 *)palloc_extended((Size)frozen.segmentLength * 3,
+                                      MCXT_ALLOC_HUGE);
+
+    for (int attempt = 0;; attempt++) {
+      if (attempt == CUCKOO_XOR_MAX_ATTEMPTS)
+        elog(ERROR, "could not build XOR filter for cuckoo index \"%s\"",
+             RelationGetRelationName(index));
+
+      frozen.seed = UINT64CONST(0x9E3779B97F4A7C15) * (attempt + 1);
+      if (xorPopulate(keys, nkeys, frozen.seed, frozen.segmentLength, filter))
+        break;
+    }
+
+    frozen.filterStart =
+        appendContentPages(index, CUCKOO_FILTER, (const char *)filter,
+                           (Size)frozen.segmentLength * 3);
+    frozen.frozenEnd = RelationGetNumberOfBlocks(index);
+
+    pfree(fences);
+    pfree(keys);
+    pfree(filter);
+  }
+
+  metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(metaBuffer, BUFFER_LOCK_EXCLUSIVE);
+  state = GenericXLogStart(index);
+  CuckooPageGetMeta(GenericXLogRegisterBuffer(state, metaBuffer, 0))->frozen =
+      frozen;
+  GenericXLogFinish(state);
+  UnlockReleaseBuffer(metaBuffer);
+}
+
+/**
+ * @brief Build a frozen-layout index.
+ *
+ * @param heap The heap relation being indexed.
+ * @param index The index relation to build.
+ * @param indexInfo Index information.
+ * @param ckstate Cuckoo index state.
+ * @param indtuples Output: number of index tuples created.
+ * @return Number of heap tuples scanned.
+ */
+double CuckooFrozenBuild(Relation heap, Relation index, IndexInfo *indexInfo,
+                         CuckooState *ckstate, int64 *indtuples) {
+  CuckooFrozenBuildState buildstate;
+  TupleDesc tupdesc;
+  AttrNumber sortAttr = 1;
+  Oid sortOperator = Int8LessOperator;
+  Oid sortCollation = InvalidOid;
+  bool nullsFirst = false;
+  double reltuples;
+
+  tupdesc = CreateTemplateTupleDesc(2);
+  TupleDescInitEntry(tupdesc, (AttrNumber)1, "fingerprint", INT8OID, -1, 0);
+  TupleDescInitEntry(tupdesc, (AttrNumber)2, "tid", TIDOID, -1, 0);
+
+  memset(&buildstate, 0, sizeof(buildstate));
+  buildstate.ckstate = ckstate;
+  buildstate.tmpCtx = AllocSetContextCreate(CurrentMemoryContext,
+                                            "Cuckoo build temporary context",
+                                            ALLOCSET_DEFAULT_SIZES);
+  buildstate.slot = MakeSingleTupleTableSlot(tupdesc, &TTSOpsVirtual);
+  buildstate.sortstate =
+      tuplesort_begin_heap(tupdesc, 1, &sortAttr, &sortOperator,
+                           &sortCollation, &nullsFirst, maintenance_work_mem,
+                           NULL, TUPLESORT_NONE);
+
+  reltuples = table_index_build_scan(heap, index, indexInfo, true, true,
+                                     frozenBuildCallback, &buildstate, NULL);
+
+  tuplesort_performsort(buildstate.sortstate);
+  CuckooFrozenWrite(index, ckstate, buildstate.sortstate, tupdesc,
+                    buildstate.indtuples);
+
+  tuplesort_end(buildstate.sortstate);
+  ExecDropSingleTupleTableSlot(buildstate.slot);
+  MemoryContextDelete(buildstate.tmpCtx);
+
+  *indtuples = buildstate.indtuples;
+  return reltuples;
+}
+
+/**
+ * @brief Read one byte of content from a fence or filter page region.
+ *
+ * Keeps the last page read pinned in *buffer to serve nearby reads.
+ *
+ * @param index The index relation.
+ * @param start First page of the region.
+ * @param offset Byte offset within the region.
+ * @param buffer In/out: pinned page, or InvalidBuffer.
+ * @return Pointer to the byte; valid while *buffer stays pinned.
+ */
+static const char *frozenContent(Relation index, BlockNumber start,
+                                 uint64 offset, Buffer *buffer) {
+  BlockNumber blkno = start + (BlockNumber)(offset / CUCKOO_FROZEN_PAGE_BYTES);
+
+  if (!BufferIsValid(*buffer) || BufferGetBlockNumber(*buffer) != blkno) {
+    if (BufferIsValid(*buffer))
+      UnlockReleaseBuffer(*buffer);
+    *buffer = ReadBuffer(index, blkno);
+    LockBuffer(*buffer, BUFFER_LOCK_SHARE);
+  }
+
+  return PageGetContents(BufferGetPage(*buffer)) +
+         offset % CUCKOO_FROZEN_PAGE_BYTES;
+}
+
+/**
+ * @brief Check a fingerprint against the XOR filter.
+ *
+ * @param index The index relation.
+ * @param frozen Frozen region of the index.
+ * @param fingerprint Fingerprint to look up.
+ * @return false if the fingerprint is certainly not in the frozen region.
+ */
+static bool filterContains(Relation index, CuckooFrozenMetaData *frozen,
+                           uint32 fingerprint) {
+  Buffer buffer = InvalidBuffer;
+  uint32 h[3];
+  uint8 tag;
+
+  tag = xorHashes(fingerprint, frozen->seed, frozen->segmentLength, h);
+  for (int j = 0; j < 3; j++)
+    tag ^= *(const uint8 *)frozenContent(index, frozen->filterStart, h[j],
+                                         &buffer);
+
+  UnlockReleaseBuffer(buffer);
+
+  return tag == 0;
+}
+
+/**
+ * @brief Find the first data page that can hold a fingerprint.
+ *
+ * That is the page before the first one whose fence is not below the
+ * fingerprint, since that page's tail may already hold it.
+ *
+ * @param index The index relation.
+ * @param frozen Frozen region of the index.
+ * @param fingerprint Fingerprint to look up.
+ * @return Data page number, relative to frozen->dataStart.
+ */
+static uint32 firstDataPage(Relation index, CuckooFrozenMetaData *frozen,
+                            uint32 fingerprint) {
+  Buffer buffer = InvalidBuffer;
+  uint32 lo = 0;
+  uint32 hi = frozen->nDataPages;
+
+  while (lo < hi) {
+    uint32 mid = lo + (hi - lo) / 2;
+    uint32 fence;
+
+    memcpy(&fence,
+           frozenContent(index, frozen->fenceStart,
+                         (uint64)mid * sizeof(uint32), &buffer),
+           sizeof(uint32));
+    if (fence < fingerprint)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (BufferIsValid(buffer))
+    UnlockReleaseBuffer(buffer);
+
+  return lo > 0 ? lo - 1 : 0;
+}
+
+/**
+ * @brief Find the heap TIDs stored with a fingerprint in the frozen region.
+ *
+ * The caller scans the flat pages from *frozenEnd on for tuples inserted
+ * after the build.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param fingerprint Fingerprint to look up.
+ * @param callback Called with each matching tuple while its page is
+ *                 locked, or NULL to only count them.
+ * @param arg Argument passed to the callback.
+ * @param frozenEnd Output: first block after the frozen region.
+ * @return Number of matching TIDs.
+ */
+int64 CuckooFrozenForEachMatch(Relation index, CuckooState *ckstate,
+                               uint32 fingerprint, CuckooTupleCallback callback,
+                               void *arg, BlockNumber *frozenEnd) {
+  CuckooFrozenMetaData frozen;
+  Buffer buffer;
+  int64 ntids = 0;
+  bool done = false;
+
+  buffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(buffer, BUFFER_LOCK_SHARE);
+  frozen = CuckooPageGetMeta(BufferGetPage(buffer))->frozen;
+  UnlockReleaseBuffer(buffer);
+
+  *frozenEnd = Max(frozen.frozenEnd, CUCKOO_HEAD_BLKNO);
+
+  if (frozen.nKeys == 0 || !filterContains(index, &frozen, fingerprint))
+    return 0;
+
+  for (uint32 k = firstDataPage(index, &frozen, fingerprint);
+       k < frozen.nDataPages && !done; k++) {
+    Page page;
+    OffsetNumber maxOffset;
+
+    buffer = ReadBuffer(index, frozen.dataStart + k);
+    LockBuffer(buffer, BUFFER_LOCK_SHARE);
+    page = BufferGetPage(buffer);
+
+    maxOffset = CuckooPageGetMaxOffset(page);
+    for (OffsetNumber offset = 1; offset <= maxOffset; offset++) {
+      CuckooTuple *itup = CuckooPageGetTuple(ckstate, page, offset);
+
+      if (itup->fingerprint > fingerprint) {
+        done = true;
+        break;
+      }
+      if (itup->fingerprint == fingerprint) {
+        if (callback != NULL)
+          callback(itup, arg);
+        ntids++;
+      }
+    }
+
+    UnlockReleaseBuffer(buffer);
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  return ntids;
+}
+
+/**
+ * @brief Check a frozen index for a fingerprint.
+ *
+ * Probes the XOR filter for the frozen region, and scans the flat pages
+ * inserted into since the build only if the filter rules the fingerprint
+ * out.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param fingerprint Fingerprint to look up.
+ * @return false if the index holds no tuple with the fingerprint.
+ */
+bool CuckooFrozenMayContain(Relation index, CuckooState *ckstate,
+                            uint32 fingerprint) {
+  CuckooFrozenMetaData frozen;
+  Buffer buffer;
+  BlockNumber npages;
+
+  buffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(buffer, BUFFER_LOCK_SHARE);
+  frozen = CuckooPageGetMeta(BufferGetPage(buffer))->frozen;
+  UnlockReleaseBuffer(buffer);
+
+  if (frozen.nKeys > 0 && filterContains(index, &frozen, fingerprint))
+    return true;
+
+  npages = RelationGetNumberOfBlocks(index);
+  for (BlockNumber blkno = Max(frozen.frozenEnd, CUCKOO_HEAD_BLKNO);
+       blkno < npages; blkno++) {
+    Page page;
+    bool found = false;
+
+    buffer = ReadBuffer(index, blkno);
+    LockBuffer(buffer, BUFFER_LOCK_SHARE);
+    page = BufferGetPage(buffer);
+
+    if (!PageIsNew(page) && !CuckooPageIsDeleted(page)) {
+      OffsetNumber maxOffset = CuckooPageGetMaxOffset(page);
+
+      for (OffsetNumber offset = 1; offset <= maxOffset && !found; offset++)
+        found = CuckooPageGetTuple(ckstate, page, offset)->fingerprint ==
+                fingerprint;
+    }
+
+    UnlockReleaseBuffer(buffer);
+    if (found)
+      return true;
+
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  return false;
+}
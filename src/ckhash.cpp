@@ -0,0 +1,1325 @@
+/**
+ * @file ckhash.cpp
+ * @brief Hashed layout for cuckoo indexes.
+ *
+ * In the hashed layout every tuple lives in the bucket chosen by its
+ * fingerprint, so a lookup reads a single bucket instead of the whole
+ * index. A bucket is a primary page followed by a chain of overflow pages.
+ * The number of buckets grows one split at a time, linear hashing style,
+ * once overflow pages outnumber a fraction of the buckets, so the index
+ * keeps its lookup cost without a REINDEX as the table grows.
+ *
+ * Bucket primary pages are found through directory pages, whose block
+ * numbers are kept in the metapage's block array.
+ *
+ * Locking: a bucket is locked through its primary page, and the holder of
+ * that lock may read (share) or modify (exclusive) the whole chain. Locks
+ * are always taken bucket first, metapage second. A split holds both of its
+ * buckets exclusively from start to finish and copies tuples before
+ * removing them from the old bucket, tracking its progress in the
+ * metapage. A split interrupted by a crash is redone by the next backend
+ * that manages to lock both buckets; until then, lookups for the new
+ * bucket are redirected to the old one, which still holds everything.
+ *
+ * Copyright (c) 2025
+ * SPDX-License-Identifier: PostgreSQL
+ */
+#include "cuckoo.h"
+
+extern "C" {
+#include "access/genam.h"
+#include "access/tableam.h"
+#include "access/tupdesc.h"
+#include "catalog/pg_operator.h"
+#include "catalog/pg_type.h"
+#include "commands/vacuum.h"
+#include "common/hashfn.h"
+#include "executor/tuptable.h"
+#include "miscadmin.h"
+#include "port/pg_bitutils.h"
+#include "storage/bufmgr.h"
+#include "storage/indexfsm.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/tuplesort.h"
+}
+
+/*
+ * Split a bucket once overflow pages make up more than 1/N of the number
+ * of buckets.
+ */
+#define CUCKOO_SPLIT_OVERFLOW_RATIO 4
+
+/**
+ * @brief State maintained during a hashed-layout index build.
+ */
+typedef struct CuckooHashBuildState {
+  CuckooState *ckstate;      /**< Cuckoo index state */
+  Tuplesortstate *sortstate; /**< Sorts tuples into bucket order */
+  TupleTableSlot *slot;      /**< Slot used to feed the sort */
+  int64 indtuples;           /**< Total number of tuples indexed */
+  MemoryContext tmpCtx;      /**< Temporary memory context */
+} CuckooHashBuildState;
+
+/**
+ * @brief Map a fingerprint to its bucket.
+ *
+ * @param hash Bucket state from the metapage.
+ * @param fingerprint Fingerprint to map.
+ * @return Bucket number.
+ */
+uint32 CuckooHashBucket(CuckooHashMetaData *hash, uint32 fingerprint) {
+  uint32 bucket = murmurhash32(fingerprint) & hash->highMask;
+
+  if (bucket > hash->maxBucket)
+    bucket &= hash->lowMask;
+
+  return bucket;
+}
+
+/**
+ * @brief Set the bucket masks for a given highest bucket number.
+ *
+ * @param hash Bucket state to update.
+ * @param maxBucket Highest bucket number.
+ */
+static void setBucketMasks(CuckooHashMetaData *hash, uint32 maxBucket) {
+  hash->maxBucket = maxBucket;
+  hash->highMask = pg_nextpower2_32(maxBucket + 1) - 1;
+  hash->lowMask = hash->highMask >> 1;
+}
+
+/**
+ * @brief Bucket to read or write for a fingerprint.
+ *
+ * Fingerprints of a bucket whose split hasn't finished are still looked
+ * up in the bucket being split.
+ *
+ * @param hash Bucket state from the metapage.
+ * @param fingerprint Fingerprint to map.
+ * @return Bucket number.
+ */
+static uint32 targetBucket(CuckooHashMetaData *hash, uint32 fingerprint) {
+  uint32 bucket = CuckooHashBucket(hash, fingerprint);
+
+  if (bucket == hash->splitBucket)
+    bucket = hash->splitFrom;
+
+  return bucket;
+}
+
+/**
+ * @brief Largest number of buckets an index can have.
+ *
+ * Bounded by the directory capacity, and by the number of distinct
+ * fingerprints since buckets beyond that would stay empty.
+ *
+ * @param ckstate Cuckoo index state.
+ * @return Maximum bucket count.
+ */
+static uint32 maxBucketCount(CuckooState *ckstate) {
+  uint64 limit = (uint64)CuckooMetaBlockN * CUCKOO_DIR_ENTRIES;
+
+  if (ckstate->opts.bitsPerTag < 32)
+    limit = Min(limit, UINT64CONST(1) << ckstate->opts.bitsPerTag);
+
+  return (uint32)limit;
+}
+
+/**
+ * @brief Decide whether the index has outgrown its buckets.
+ *
+ * @param hash Bucket state from the metapage.
+ * @param ckstate Cuckoo index state.
+ * @return true if a bucket should be split.
+ */
+static bool splitWanted(CuckooHashMetaData *hash, CuckooState *ckstate) {
+  uint64 nBuckets = (uint64)hash->maxBucket + 1;
+  uint64 nOverflow = hash->nPages - nBuckets;
+
+  return nOverflow * CUCKOO_SPLIT_OVERFLOW_RATIO > nBuckets &&
+         nBuckets < maxBucketCount(ckstate);
+}
+
+/**
+ * @brief Initialize an empty directory page.
+ *
+ * @param page Page to initialize.
+ */
+static void initDirectoryPage(Page page) {
+  BlockNumber *entries;
+
+  CuckooInitPage(page, CUCKOO_DIRECTORY);
+  entries = (BlockNumber *)PageGetContents(page);
+  for (Size i = 0; i < CUCKOO_DIR_ENTRIES; i++)
+    entries[i] = InvalidBlockNumber;
+
+  ((PageHeader)page)->pd_lower = (Pointer)(entries + CUCKOO_DIR_ENTRIES) - page;
+}
+
+/**
+ * @brief Look up the primary page of a bucket.
+ *
+ * The caller must hold a lock on the metapage.
+ *
+ * @param index The index relation.
+ * @param meta Metapage contents.
+ * @param bucket Bucket number.
+ * @return Block number of the bucket's primary page.
+ */
+static BlockNumber bucketPrimaryBlock(Relation index, CuckooMetaPageData *meta,
+                                      uint32 bucket) {
+  Buffer buffer;
+  BlockNumber blkno;
+
+  buffer = ReadBuffer(index, meta->notFullPage[bucket / CUCKOO_DIR_ENTRIES]);
+  LockBuffer(buffer, BUFFER_LOCK_SHARE);
+  blkno = ((BlockNumber *)PageGetContents(
+      BufferGetPage(buffer)))[bucket % CUCKOO_DIR_ENTRIES];
+  UnlockReleaseBuffer(buffer);
+
+  Assert(BlockNumberIsValid(blkno));
+  return blkno;
+}
+
+/**
+ * @brief Write a page image to a buffer.
+ *
+ * @param index The index relation.
+ * @param buffer Exclusively locked buffer.
+ * @param image Page contents.
+ */
+static void writePageImage(Relation index, Buffer buffer, Page image) {
+  GenericXLogState *state;
+  Page page;
+
+  state = GenericXLogStart(index);
+  page = GenericXLogRegisterBuffer(state, buffer, GENERIC_XLOG_FULL_IMAGE);
+  memcpy(page, image, BLCKSZ);
+  GenericXLogFinish(state);
+}
+
+/**
+ * @brief Write a page image that links to a newly allocated page.
+ *
+ * The new page is initialized empty and counted in hash.nPages in the
+ * same WAL record, so the link never points past the end of the relation
+ * after a crash and the page count always matches the chains.
+ *
+ * @param index The index relation.
+ * @param metaBuffer Pinned metapage, not locked.
+ * @param buffer Exclusively locked buffer to write.
+ * @param image Page contents, already linked to nextBuffer.
+ * @param nextBuffer Exclusively locked new page.
+ */
+static void writeLinkedPageImage(Relation index, Buffer metaBuffer,
+                                 Buffer buffer, Page image, Buffer nextBuffer) {
+  GenericXLogState *state;
+  Page page;
+
+  LockBuffer(metaBuffer, BUFFER_LOCK_EXCLUSIVE);
+  state = GenericXLogStart(index);
+  page = GenericXLogRegisterBuffer(state, buffer, GENERIC_XLOG_FULL_IMAGE);
+  memcpy(page, image, BLCKSZ);
+  page = GenericXLogRegisterBuffer(state, nextBuffer, GENERIC_XLOG_FULL_IMAGE);
+  CuckooInitPage(page, CUCKOO_OVERFLOW);
+  CuckooPageGetMeta(GenericXLogRegisterBuffer(state, metaBuffer, 0))
+      ->hash.nPages++;
+  GenericXLogFinish(state);
+  LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
+}
+
+/**
+ * @brief Create the first bucket of an empty index.
+ *
+ * @param index The index relation.
+ */
+static void createFirstBucket(Relation index) {
+  Buffer metaBuffer, dirBuffer, bucketBuffer;
+  GenericXLogState *state;
+  CuckooMetaPageData *meta;
+  Page dirPage, bucketPage;
+
+  metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(metaBuffer, BUFFER_LOCK_EXCLUSIVE);
+
+  /* Somebody else may have beaten us to it */
+  if (CuckooPageGetMeta(BufferGetPage(metaBuffer))->hash.nDirPages > 0) {
+    UnlockReleaseBuffer(metaBuffer);
+    return;
+  }
+
+  dirBuffer = CuckooNewBuffer(index);
+  bucketBuffer = CuckooNewBuffer(index);
+
+  state = GenericXLogStart(index);
+  meta = CuckooPageGetMeta(GenericXLogRegisterBuffer(state, metaBuffer, 0));
+  dirPage =
+      GenericXLogRegisterBuffer(state, dirBuffer, GENERIC_XLOG_FULL_IMAGE);
+  bucketPage =
+      GenericXLogRegisterBuffer(state, bucketBuffer, GENERIC_XLOG_FULL_IMAGE);
+
+  CuckooInitPage(bucketPage, CUCKOO_BUCKET);
+  initDirectoryPage(dirPage);
+  ((BlockNumber *)PageGetContents(dirPage))[0] =
+      BufferGetBlockNumber(bucketBuffer);
+
+  meta->notFullPage[0] = BufferGetBlockNumber(dirBuffer);
+  meta->hash.nDirPages = 1;
+  meta->hash.nPages = 1;
+  meta->hash.splitBucket = CUCKOO_NO_SPLIT;
+  meta->hash.splitFrom = CUCKOO_NO_SPLIT;
+  setBucketMasks(&meta->hash, 0);
+
+  GenericXLogFinish(state);
+
+  UnlockReleaseBuffer(bucketBuffer);
+  UnlockReleaseBuffer(dirBuffer);
+  UnlockReleaseBuffer(metaBuffer);
+}
+
+/**
+ * @brief Lock the primary page of the bucket holding a fingerprint.
+ *
+ * The bucket is looked up without holding the metapage lock while waiting
+ * for the bucket, then checked again, since a split may have moved the
+ * fingerprint in the meantime.
+ *
+ * @param index The index relation.
+ * @param fingerprint Fingerprint to look up.
+ * @param mode BUFFER_LOCK_SHARE or BUFFER_LOCK_EXCLUSIVE.
+ * @return Locked primary page, or InvalidBuffer if there are no buckets.
+ */
+static Buffer lockBucket(Relation index, uint32 fingerprint, int mode) {
+  Buffer metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  CuckooMetaPageData *meta = CuckooPageGetMeta(BufferGetPage(metaBuffer));
+
+  for (;;) {
+    Buffer buffer;
+    BlockNumber blkno;
+    uint32 bucket;
+    bool moved;
+
+    LockBuffer(metaBuffer, BUFFER_LOCK_SHARE);
+    if (meta->hash.nDirPages == 0) {
+      UnlockReleaseBuffer(metaBuffer);
+      return InvalidBuffer;
+    }
+    bucket = targetBucket(&meta->hash, fingerprint);
+    blkno = bucketPrimaryBlock(index, meta, bucket);
+    LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
+
+    buffer = ReadBuffer(index, blkno);
+    LockBuffer(buffer, mode);
+
+    LockBuffer(metaBuffer, BUFFER_LOCK_SHARE);
+    moved = targetBucket(&meta->hash, fingerprint) != bucket;
+    LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
+
+    if (!moved) {
+      ReleaseBuffer(metaBuffer);
+      return buffer;
+    }
+
+    UnlockReleaseBuffer(buffer);
+  }
+}
+
+/**
+ * @brief Add a tuple to a new overflow page at the end of a bucket chain.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param tailBuffer Exclusively locked last page of the chain.
+ * @param tuple Tuple to add.
+ * @return true if the index has outgrown its buckets.
+ */
+static bool addOverflowPage(Relation index, CuckooState *ckstate,
+                            Buffer tailBuffer, CuckooTuple *tuple) {
+  Buffer buffer, metaBuffer;
+  GenericXLogState *state;
+  CuckooMetaPageData *meta;
+  Page tailPage, page;
+  bool needSplit;
+
+  buffer = CuckooNewBuffer(index);
+  metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(metaBuffer, BUFFER_LOCK_EXCLUSIVE);
+
+  state = GenericXLogStart(index);
+  tailPage = GenericXLogRegisterBuffer(state, tailBuffer, 0);
+  page = GenericXLogRegisterBuffer(state, buffer, GENERIC_XLOG_FULL_IMAGE);
+  meta = CuckooPageGetMeta(GenericXLogRegisterBuffer(state, metaBuffer, 0));
+
+  CuckooInitPage(page, CUCKOO_OVERFLOW);
+  if (!CuckooPageAddItem(ckstate, page, tuple))
+    elog(ERROR, "could not add new cuckoo tuple to empty page");
+  CuckooPageGetOpaque(tailPage)->nextBlkno = BufferGetBlockNumber(buffer);
+
+  meta->hash.nPages++;
+  needSplit = splitWanted(&meta->hash, ckstate);
+
+  GenericXLogFinish(state);
+
+  UnlockReleaseBuffer(buffer);
+  UnlockReleaseBuffer(metaBuffer);
+
+  return needSplit;
+}
+
+/**
+ * @brief Insert one tuple into its bucket.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param tuple Tuple to insert.
+ * @return true if the index has outgrown its buckets.
+ */
+static bool insertTuple(Relation index, CuckooState *ckstate,
+                        CuckooTuple *tuple) {
+  Buffer primary, buffer;
+  bool needSplit = false;
+
+  while ((primary = lockBucket(index, tuple->fingerprint,
+                               BUFFER_LOCK_EXCLUSIVE)) == InvalidBuffer)
+    createFirstBucket(index);
+
+  /* Walk the chain up to the first page with room */
+  buffer = primary;
+  for (;;) {
+    Page page = BufferGetPage(buffer);
+    BlockNumber next;
+    Buffer nextBuffer;
+
+    if (CuckooPageGetFreeSpace(ckstate, page) >= ckstate->sizeOfCuckooTuple) {
+      GenericXLogState *state = GenericXLogStart(index);
+
+      page = GenericXLogRegisterBuffer(state, buffer, 0);
+      CuckooPageAddItem(ckstate, page, tuple);
+      GenericXLogFinish(state);
+      break;
+    }
+
+    next = CuckooPageGetOpaque(page)->nextBlkno;
+    if (next == InvalidBlockNumber) {
+      needSplit = addOverflowPage(index, ckstate, buffer, tuple);
+      break;
+    }
+
+    nextBuffer = ReadBuffer(index, next);
+    LockBuffer(nextBuffer, BUFFER_LOCK_EXCLUSIVE);
+    if (buffer != primary)
+      UnlockReleaseBuffer(buffer);
+    buffer = nextBuffer;
+  }
+
+  if (buffer != primary)
+    UnlockReleaseBuffer(buffer);
+  UnlockReleaseBuffer(primary);
+
+  return needSplit;
+}
+
+/**
+ * @brief Allocate the new bucket of a split and record the split.
+ *
+ * The caller holds the old bucket and the metapage exclusively.
+ *
+ * @param index The index relation.
+ * @param metaBuffer Exclusively locked metapage.
+ * @param oldBucket Bucket being split.
+ * @param newBucket New bucket number.
+ * @return Exclusively locked primary page of the new bucket.
+ */
+static Buffer startSplit(Relation index, Buffer metaBuffer, uint32 oldBucket,
+                         uint32 newBucket) {
+  uint32 dirIndex = newBucket / CUCKOO_DIR_ENTRIES;
+  Buffer dirBuffer, newBuffer;
+  GenericXLogState *state;
+  CuckooMetaPageData *meta;
+  Page dirPage, newPage;
+
+  /* Add a directory page first if the new bucket needs one */
+  meta = CuckooPageGetMeta(BufferGetPage(metaBuffer));
+  if (dirIndex >= meta->hash.nDirPages) {
+    dirBuffer = CuckooNewBuffer(index);
+
+    state = GenericXLogStart(index);
+    meta = CuckooPageGetMeta(GenericXLogRegisterBuffer(state, metaBuffer, 0));
+    dirPage =
+        GenericXLogRegisterBuffer(state, dirBuffer, GENERIC_XLOG_FULL_IMAGE);
+    initDirectoryPage(dirPage);
+    meta->notFullPage[dirIndex] = BufferGetBlockNumber(dirBuffer);
+    meta->hash.nDirPages = dirIndex + 1;
+    GenericXLogFinish(state);
+
+    UnlockReleaseBuffer(dirBuffer);
+  }
+
+  newBuffer = CuckooNewBuffer(index);
+  meta = CuckooPageGetMeta(BufferGetPage(metaBuffer));
+  dirBuffer = ReadBuffer(index, meta->notFullPage[dirIndex]);
+  LockBuffer(dirBuffer, BUFFER_LOCK_EXCLUSIVE);
+
+  state = GenericXLogStart(index);
+  meta = CuckooPageGetMeta(GenericXLogRegisterBuffer(state, metaBuffer, 0));
+  dirPage = GenericXLogRegisterBuffer(state, dirBuffer, 0);
+  newPage =
+      GenericXLogRegisterBuffer(state, newBuffer, GENERIC_XLOG_FULL_IMAGE);
+
+  CuckooInitPage(newPage, CUCKOO_BUCKET);
+  ((BlockNumber *)PageGetContents(dirPage))[newBucket % CUCKOO_DIR_ENTRIES] =
+      BufferGetBlockNumber(newBuffer);
+
+  meta->hash.maxBucket = newBucket;
+  if (newBucket > meta->hash.highMask) {
+    meta->hash.lowMask = meta->hash.highMask;
+    meta->hash.highMask = newBucket | meta->hash.lowMask;
+  }
+  meta->hash.nPages++;
+  meta->hash.splitBucket = newBucket;
+  meta->hash.splitFrom = oldBucket;
+
+  GenericXLogFinish(state);
+  UnlockReleaseBuffer(dirBuffer);
+
+  return newBuffer;
+}
+
+/**
+ * @brief Empty the new bucket of an interrupted split.
+ *
+ * Overflow pages are unlinked one at a time from the head of the chain,
+ * so the chain stays intact if this is interrupted too, and each leaves
+ * hash.nPages in the same WAL record.
+ *
+ * @param index The index relation.
+ * @param metaBuffer Pinned metapage, not locked.
+ * @param primary Exclusively locked primary page of the bucket.
+ */
+static void resetBucket(Relation index, Buffer metaBuffer, Buffer primary) {
+  GenericXLogState *state;
+  Page page;
+
+  for (;;) {
+    BlockNumber blkno = CuckooPageGetOpaque(BufferGetPage(primary))->nextBlkno;
+    Buffer buffer;
+    Page victim;
+
+    if (blkno == InvalidBlockNumber)
+      break;
+
+    buffer = ReadBuffer(index, blkno);
+    LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+    LockBuffer(metaBuffer, BUFFER_LOCK_EXCLUSIVE);
+
+    state = GenericXLogStart(index);
+    page = GenericXLogRegisterBuffer(state, primary, 0);
+    victim = GenericXLogRegisterBuffer(state, buffer, 0);
+    CuckooPageGetOpaque(page)->nextBlkno =
+        PageIsNew(victim) ? InvalidBlockNumber
+                          : CuckooPageGetOpaque(victim)->nextBlkno;
+    CuckooInitPage(victim, CUCKOO_DELETED);
+    CuckooPageGetMeta(GenericXLogRegisterBuffer(state, metaBuffer, 0))
+        ->hash.nPages--;
+    GenericXLogFinish(state);
+
+    LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
+    UnlockReleaseBuffer(buffer);
+    RecordFreeIndexPage(index, blkno);
+  }
+
+  state = GenericXLogStart(index);
+  page = GenericXLogRegisterBuffer(state, primary, GENERIC_XLOG_FULL_IMAGE);
+  CuckooInitPage(page, CUCKOO_BUCKET);
+  GenericXLogFinish(state);
+}
+
+/**
+ * @brief Copy the tuples moving to a new bucket out of the old one.
+ *
+ * The new bucket's pages are filled in memory and written as full images.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param hash Bucket state after the split.
+ * @param metaBuffer Pinned metapage, not locked.
+ * @param oldPrimary Exclusively locked primary page of the old bucket.
+ * @param newPrimary Exclusively locked, empty primary page of the new bucket.
+ * @param newBucket New bucket number.
+ */
+static void copySplitTuples(Relation index, CuckooState *ckstate,
+                            CuckooHashMetaData *hash, Buffer metaBuffer,
+                            Buffer oldPrimary, Buffer newPrimary,
+                            uint32 newBucket) {
+  PGAlignedBlock image;
+  Buffer target = newPrimary;
+  Buffer buffer = oldPrimary;
+
+  CuckooInitPage(image.data, CUCKOO_BUCKET);
+
+  for (;;) {
+    Page page = BufferGetPage(buffer);
+    OffsetNumber maxOffset = CuckooPageGetMaxOffset(page);
+    BlockNumber next = CuckooPageGetOpaque(page)->nextBlkno;
+
+    for (OffsetNumber offset = 1; offset <= maxOffset; offset++) {
+      CuckooTuple *itup = CuckooPageGetTuple(ckstate, page, offset);
+      Buffer nextTarget;
+
+      if (CuckooHashBucket(hash, itup->fingerprint) != newBucket)
+        continue;
+
+      if (CuckooPageAddItem(ckstate, image.data, itup))
+        continue;
+
+      /* Page is full, chain a new one */
+      nextTarget = CuckooNewBuffer(index);
+      CuckooPageGetOpaque(image.data)->nextBlkno =
+          BufferGetBlockNumber(nextTarget);
+      writeLinkedPageImage(index, metaBuffer, target, image.data, nextTarget);
+      if (target != newPrimary)
+        UnlockReleaseBuffer(target);
+      target = nextTarget;
+
+      CuckooInitPage(image.data, CUCKOO_OVERFLOW);
+      if (!CuckooPageAddItem(ckstate, image.data, itup))
+        elog(ERROR, "could not add new cuckoo tuple to empty page");
+    }
+
+    if (buffer != oldPrimary)
+      UnlockReleaseBuffer(buffer);
+    if (next == InvalidBlockNumber)
+      break;
+
+    buffer = ReadBuffer(index, next);
+    LockBuffer(buffer, BUFFER_LOCK_SHARE);
+  }
+
+  writePageImage(index, target, image.data);
+  if (target != newPrimary)
+    UnlockReleaseBuffer(target);
+}
+
+/**
+ * @brief Remove tuples from a bucket chain and unlink emptied pages.
+ *
+ * Tuples are removed if they no longer map to the bucket (left behind by
+ * a split), or if the callback reports their heap tuple as dead. Overflow
+ * pages left empty are unlinked and returned to the free space map.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param primary Exclusively locked primary page of the bucket.
+ * @param bucket Bucket number.
+ * @param hash Bucket state used to find misplaced tuples, or NULL to keep
+ *             them (while the bucket takes part in an unfinished split).
+ * @param callback Dead tuple callback, or NULL.
+ * @param callback_state State to pass to the callback.
+ * @param stats Vacuum statistics to update, or NULL.
+ */
+static void cleanupBucket(Relation index, CuckooState *ckstate, Buffer primary,
+                          uint32 bucket, CuckooHashMetaData *hash,
+                          IndexBulkDeleteCallback callback,
+                          void *callback_state, IndexBulkDeleteResult *stats) {
+  Buffer prev = InvalidBuffer;
+  Buffer buffer = primary;
+
+  for (;;) {
+    GenericXLogState *state = GenericXLogStart(index);
+    Page page = GenericXLogRegisterBuffer(state, buffer, 0);
+    CuckooTuple *itup, *itupPtr, *itupEnd;
+    BlockNumber next = CuckooPageGetOpaque(page)->nextBlkno;
+
+    itup = itupPtr = CuckooPageGetTuple(ckstate, page, FirstOffsetNumber);
+    itupEnd = CuckooPageGetTuple(
+        ckstate, page, OffsetNumberNext(CuckooPageGetMaxOffset(page)));
+
+    while (itup < itupEnd) {
+      bool remove = false;
+
+      if (hash && CuckooHashBucket(hash, itup->fingerprint) != bucket) {
+        remove = true;
+      } else if (callback && callback(&itup->heapPtr, callback_state)) {
+        remove = true;
+        if (stats)
+          stats->tuples_removed += 1;
+      }
+
+      if (remove) {
+        CuckooPageGetOpaque(page)->maxoff--;
+      } else {
+        if (itupPtr != itup)
+          memmove((Pointer)itupPtr, (Pointer)itup, ckstate->sizeOfCuckooTuple);
+        itupPtr = CuckooPageGetNextTuple(ckstate, itupPtr);
+      }
+
+      itup = CuckooPageGetNextTuple(ckstate, itup);
+    }
+    ((PageHeader)page)->pd_lower = (Pointer)itupPtr - page;
+
+    if (buffer != primary && CuckooPageGetMaxOffset(page) == 0) {
+      /* Unlink the empty overflow page */
+      BlockNumber blkno = BufferGetBlockNumber(buffer);
+      Buffer metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+      Page prevPage;
+
+      LockBuffer(metaBuffer, BUFFER_LOCK_EXCLUSIVE);
+      prevPage = GenericXLogRegisterBuffer(state, prev, 0);
+      CuckooPageGetOpaque(prevPage)->nextBlkno = next;
+      CuckooPageSetDeleted(page);
+      CuckooPageGetMeta(GenericXLogRegisterBuffer(state, metaBuffer, 0))
+          ->hash.nPages--;
+      GenericXLogFinish(state);
+
+      UnlockReleaseBuffer(metaBuffer);
+      UnlockReleaseBuffer(buffer);
+      RecordFreeIndexPage(index, blkno);
+      buffer = InvalidBuffer;
+    } else if (itupPtr != itupEnd) {
+      GenericXLogFinish(state);
+    } else {
+      GenericXLogAbort(state);
+    }
+
+    if (next == InvalidBlockNumber)
+      break;
+
+    if (BufferIsValid(buffer)) {
+      if (BufferIsValid(prev) && prev != primary)
+        UnlockReleaseBuffer(prev);
+      prev = buffer;
+    }
+
+    buffer = ReadBuffer(index, next);
+    LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+  }
+
+  if (BufferIsValid(buffer) && buffer != primary)
+    UnlockReleaseBuffer(buffer);
+  if (BufferIsValid(prev) && prev != primary)
+    UnlockReleaseBuffer(prev);
+}
+
+/**
+ * @brief Split a bucket, or finish a split interrupted by a crash.
+ *
+ * Gives up quietly if the buckets involved are locked, since whoever holds
+ * them is either splitting them already or will trigger a split later.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param startNew Whether to start a new split if the index needs one, or
+ *                 only finish an interrupted one.
+ */
+static void splitBucket(Relation index, CuckooState *ckstate, bool startNew) {
+  Buffer metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  CuckooMetaPageData *meta = CuckooPageGetMeta(BufferGetPage(metaBuffer));
+  Buffer oldBuffer, newBuffer = InvalidBuffer;
+  BlockNumber oldBlkno, newBlkno = InvalidBlockNumber;
+  uint32 oldBucket, newBucket;
+  CuckooHashMetaData hash;
+  GenericXLogState *state;
+  bool resume;
+
+  LockBuffer(metaBuffer, BUFFER_LOCK_SHARE);
+
+  if (meta->hash.nDirPages == 0) {
+    UnlockReleaseBuffer(metaBuffer);
+    return;
+  }
+
+  resume = meta->hash.splitBucket != CUCKOO_NO_SPLIT;
+  if (resume) {
+    newBucket = meta->hash.splitBucket;
+    oldBucket = meta->hash.splitFrom;
+    newBlkno = bucketPrimaryBlock(index, meta, newBucket);
+  } else if (startNew && splitWanted(&meta->hash, ckstate)) {
+    newBucket = meta->hash.maxBucket + 1;
+    oldBucket = newBucket & meta->hash.lowMask;
+  } else {
+    UnlockReleaseBuffer(metaBuffer);
+    return;
+  }
+  oldBlkno = bucketPrimaryBlock(index, meta, oldBucket);
+  LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
+
+  oldBuffer = ReadBuffer(index, oldBlkno);
+  if (!ConditionalLockBuffer(oldBuffer)) {
+    ReleaseBuffer(oldBuffer);
+    ReleaseBuffer(metaBuffer);
+    return;
+  }
+  if (resume) {
+    newBuffer = ReadBuffer(index, newBlkno);
+    if (!ConditionalLockBuffer(newBuffer)) {
+      ReleaseBuffer(newBuffer);
+      UnlockReleaseBuffer(oldBuffer);
+      ReleaseBuffer(metaBuffer);
+      return;
+    }
+  }
+
+  /* Check again now that the buckets are ours */
+  LockBuffer(metaBuffer, BUFFER_LOCK_EXCLUSIVE);
+  if (resume ? meta->hash.splitBucket != newBucket
+             : (meta->hash.splitBucket != CUCKOO_NO_SPLIT ||
+                meta->hash.maxBucket + 1 != newBucket ||
+                !splitWanted(&meta->hash, ckstate))) {
+    LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
+    if (BufferIsValid(newBuffer))
+      UnlockReleaseBuffer(newBuffer);
+    UnlockReleaseBuffer(oldBuffer);
+    ReleaseBuffer(metaBuffer);
+    return;
+  }
+
+  if (!resume)
+    newBuffer = startSplit(index, metaBuffer, oldBucket, newBucket);
+  hash = meta->hash;
+  LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
+
+  /* A resumed split starts over from an empty new bucket */
+  if (resume)
+    resetBucket(index, metaBuffer, newBuffer);
+
+  copySplitTuples(index, ckstate, &hash, metaBuffer, oldBuffer, newBuffer,
+                  newBucket);
+
+  /* The new bucket is complete */
+  LockBuffer(metaBuffer, BUFFER_LOCK_EXCLUSIVE);
+  state = GenericXLogStart(index);
+  meta = CuckooPageGetMeta(GenericXLogRegisterBuffer(state, metaBuffer, 0));
+  meta->hash.splitBucket = CUCKOO_NO_SPLIT;
+  meta->hash.splitFrom = CUCKOO_NO_SPLIT;
+  GenericXLogFinish(state);
+  LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
+
+  /* Drop the copied tuples from the old bucket */
+  cleanupBucket(index, ckstate, oldBuffer, oldBucket, &hash, NULL, NULL,
+                NULL);
+
+  UnlockReleaseBuffer(newBuffer);
+  UnlockReleaseBuffer(oldBuffer);
+  ReleaseBuffer(metaBuffer);
+}
+
+/**
+ * @brief Insert tuples into a hashed-layout index.
+ *
+ * Each tuple goes to the bucket of its fingerprint. If the index has
+ * outgrown its buckets, one bucket is split afterwards.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param tuples Array of tuples to insert.
+ * @param ntuples Number of tuples in the array.
+ */
+void CuckooHashInsert(Relation index, CuckooState *ckstate,
+                      CuckooTuple *tuples, int ntuples) {
+  bool needSplit = false;
+
+  for (int i = 0; i < ntuples; i++)
+    needSplit |= insertTuple(
+        index, ckstate,
+        (CuckooTuple *)((Pointer)tuples + i * ckstate->sizeOfCuckooTuple));
+
+  if (needSplit)
+    splitBucket(index, ckstate, true);
+}
+
+/**
+ * @brief Collect heap TIDs from a bucket chain.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param primary Locked primary page of the bucket.
+ * @param fingerprint Fingerprint to look for, or NULL to collect all.
+ * @param tids Growable TID array.
+ * @param ntids Number of TIDs in the array, updated.
+ * @param maxtids Allocated size of the array, updated.
+ */
+static void collectBucketTids(Relation index, CuckooState *ckstate,
+                              Buffer primary, const uint32 *fingerprint,
+                              ItemPointerData **tids, int *ntids,
+                              int *maxtids) {
+  Buffer buffer = primary;
+
+  for (;;) {
+    Page page = BufferGetPage(buffer);
+    OffsetNumber maxOffset = CuckooPageGetMaxOffset(page);
+    BlockNumber next = CuckooPageGetOpaque(page)->nextBlkno;
+
+    for (OffsetNumber offset = 1; offset <= maxOffset; offset++) {
+      CuckooTuple *itup = CuckooPageGetTuple(ckstate, page, offset);
+
+      if (fingerprint && itup->fingerprint != *fingerprint)
+        continue;
+
+      if (*ntids >= *maxtids) {
+        *maxtids = Max(*maxtids * 2, 64);
+        if (*tids)
+          *tids = (ItemPointerData *)repalloc(
+              *tids, sizeof(ItemPointerData) * *maxtids);
+        else
+          *tids =
+              (ItemPointerData *)palloc(sizeof(ItemPointerData) * *maxtids);
+      }
+      (*tids)[(*ntids)++] = itup->heapPtr;
+    }
+
+    if (buffer != primary)
+      UnlockReleaseBuffer(buffer);
+    if (next == InvalidBlockNumber)
+      break;
+
+    buffer = ReadBuffer(index, next);
+    LockBuffer(buffer, BUFFER_LOCK_SHARE);
+  }
+}
+
+/**
+ * @brief Find the heap TIDs stored with a fingerprint.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param fingerprint Fingerprint to look up.
+ * @param ntids Output: number of TIDs returned.
+ * @return Palloc'd array of TIDs, or NULL if there are none.
+ */
+ItemPointerData *CuckooHashLookup(Relation index, CuckooState *ckstate,
+                                  uint32 fingerprint, int *ntids) {
+  ItemPointerData *tids = NULL;
+  int maxtids = 0;
+  Buffer primary;
+
+  *ntids = 0;
+
+  primary = lockBucket(index, fingerprint, BUFFER_LOCK_SHARE);
+  if (!BufferIsValid(primary))
+    return NULL;
+
+  collectBucketTids(index, ckstate, primary, &fingerprint, &tids, ntids,
+                    &maxtids);
+  UnlockReleaseBuffer(primary);
+
+  return tids;
+}
+
+/**
+ * @brief Collect the heap TIDs of every tuple in the index.
+ *
+ * Buckets are visited in order rather than reading the relation page by
+ * page, so tuples moved by a concurrent split are seen at least once.
+ * Tuples copied by a split may be returned twice.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param ntids Output: number of TIDs returned.
+ * @return Palloc'd array of TIDs, or NULL if there are none.
+ */
+ItemPointerData *CuckooHashLookupAll(Relation index, CuckooState *ckstate,
+                                     int *ntids) {
+  Buffer metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  CuckooMetaPageData *meta = CuckooPageGetMeta(BufferGetPage(metaBuffer));
+  ItemPointerData *tids = NULL;
+  int maxtids = 0;
+
+  *ntids = 0;
+
+  for (uint32 bucket = 0;; bucket++) {
+    BlockNumber blkno;
+    Buffer buffer;
+
+    LockBuffer(metaBuffer, BUFFER_LOCK_SHARE);
+    if (meta->hash.nDirPages == 0 || bucket > meta->hash.maxBucket) {
+      LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
+      break;
+    }
+    blkno = bucketPrimaryBlock(index, meta, bucket);
+    LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
+
+    buffer = ReadBuffer(index, blkno);
+    LockBuffer(buffer, BUFFER_LOCK_SHARE);
+    collectBucketTids(index, ckstate, buffer, NULL, &tids, ntids, &maxtids);
+    UnlockReleaseBuffer(buffer);
+
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  ReleaseBuffer(metaBuffer);
+
+  return tids;
+}
+
+/**
+ * @brief Pass every tuple of a hashed-layout index to a callback.
+ *
+ * Tuples left behind in a bucket by a split, and the partial copies in
+ * the new bucket of an unfinished split, are skipped, so that each tuple
+ * is seen once. The caller must keep the index from changing.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param callback Function called with each tuple.
+ * @param arg Argument passed to the callback.
+ */
+void CuckooHashForEachTuple(Relation index, CuckooState *ckstate,
+                            CuckooTupleCallback callback, void *arg) {
+  Buffer metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  CuckooMetaPageData *meta;
+  CuckooHashMetaData hash;
+
+  LockBuffer(metaBuffer, BUFFER_LOCK_SHARE);
+  meta = CuckooPageGetMeta(BufferGetPage(metaBuffer));
+  hash = meta->hash;
+
+  for (uint32 bucket = 0; hash.nDirPages > 0 && bucket <= hash.maxBucket;
+       bucket++) {
+    BlockNumber blkno = bucketPrimaryBlock(index, meta, bucket);
+
+    while (blkno != InvalidBlockNumber) {
+      Buffer buffer = ReadBuffer(index, blkno);
+      Page page;
+
+      LockBuffer(buffer, BUFFER_LOCK_SHARE);
+      page = BufferGetPage(buffer);
+
+      for (OffsetNumber offset = 1; offset <= CuckooPageGetMaxOffset(page);
+           offset++) {
+        CuckooTuple *itup = CuckooPageGetTuple(ckstate, page, offset);
+
+        if (targetBucket(&hash, itup->fingerprint) == bucket)
+          callback(itup, arg);
+      }
+
+      blkno = CuckooPageGetOpaque(page)->nextBlkno;
+      UnlockReleaseBuffer(buffer);
+    }
+
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  UnlockReleaseBuffer(metaBuffer);
+}
+
+/**
+ * @brief Bulk delete for a hashed-layout index.
+ *
+ * Visits the buckets in order, removing dead tuples and tuples left behind
+ * by splits. Buckets created while this runs are visited too, so tuples
+ * copied out of a bucket not yet visited are not missed.
+ *
+ * @param info Vacuum information.
+ * @param stats Vacuum statistics to update.
+ * @param callback Function to check if a TID should be deleted.
+ * @param callback_state State to pass to callback.
+ */
+void CuckooHashBulkDelete(IndexVacuumInfo *info, IndexBulkDeleteResult *stats,
+                          IndexBulkDeleteCallback callback,
+                          void *callback_state) {
+  Relation index = info->index;
+  CuckooState ckstate;
+  Buffer metaBuffer;
+  CuckooMetaPageData *meta;
+
+  initCuckooState(&ckstate, index);
+
+  /* Don't leave a crashed split in the way */
+  splitBucket(index, &ckstate, false);
+
+  metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  meta = CuckooPageGetMeta(BufferGetPage(metaBuffer));
+
+  for (uint32 bucket = 0;; bucket++) {
+    CuckooHashMetaData hash;
+    BlockNumber blkno;
+    Buffer buffer;
+    bool inSplit;
+
+    LockBuffer(metaBuffer, BUFFER_LOCK_SHARE);
+    if (meta->hash.nDirPages == 0 || bucket > meta->hash.maxBucket) {
+      LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
+      break;
+    }
+    blkno = bucketPrimaryBlock(index, meta, bucket);
+    LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
+
+    CuckooVacuumDelayPoint();
+
+    buffer = ReadBufferExtended(index, MAIN_FORKNUM, blkno, RBM_NORMAL,
+                                info->strategy);
+    LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+
+    LockBuffer(metaBuffer, BUFFER_LOCK_SHARE);
+    hash = meta->hash;
+    LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
+
+    inSplit = hash.splitBucket == bucket || hash.splitFrom == bucket;
+    cleanupBucket(index, &ckstate, buffer, bucket, inSplit ? NULL : &hash,
+                  callback, callback_state, stats);
+
+    UnlockReleaseBuffer(buffer);
+  }
+
+  ReleaseBuffer(metaBuffer);
+}
+
+/**
+ * @brief Reverse the bits of a 32-bit value.
+ */
+static inline uint32 reverseBits32(uint32 x) {
+  x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+  x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+  x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+  x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+/**
+ * @brief Sort key that groups fingerprints by bucket.
+ *
+ * Buckets are selected by the low bits of the fingerprint's hash, so
+ * sorting on the bit-reversed hash keeps every bucket contiguous whatever
+ * the final bucket count turns out to be. The fingerprint itself is kept
+ * in the low half of the key.
+ *
+ * @param fingerprint Fingerprint to encode.
+ * @return Sort key.
+ */
+int64 CuckooHashSortKey(uint32 fingerprint) {
+  return (int64)(((uint64)reverseBits32(murmurhash32(fingerprint)) << 32) |
+                 fingerprint);
+}
+
+/**
+ * @brief Callback for table_index_build_scan during a hashed build.
+ *
+ * Feeds the fingerprints of each heap tuple to the sort.
+ */
+static void hashBuildCallback(Relation index, ItemPointer tid, Datum *values,
+                              bool *isnull, bool tupleIsAlive, void *state) {
+  CuckooHashBuildState *buildstate = (CuckooHashBuildState *)state;
+  TupleTableSlot *slot = buildstate->slot;
+  MemoryContext oldCtx;
+  uint32 *fingerprints;
+  int nfingerprints;
+
+  oldCtx = MemoryContextSwitchTo(buildstate->tmpCtx);
+
+  fingerprints = computeFingerprints(buildstate->ckstate, values, isnull,
+                                     &nfingerprints);
+
+  for (int i = 0; i < nfingerprints; i++) {
+    ExecClearTuple(slot);
+    slot->tts_values[0] = Int64GetDatum(CuckooHashSortKey(fingerprints[i]));
+    slot->tts_values[1] = PointerGetDatum(tid);
+    slot->tts_isnull[0] = false;
+    slot->tts_isnull[1] = false;
+    ExecStoreVirtualTuple(slot);
+    tuplesort_puttupleslot(buildstate->sortstate, slot);
+
+    buildstate->indtuples++;
+  }
+
+  MemoryContextSwitchTo(oldCtx);
+  MemoryContextReset(buildstate->tmpCtx);
+}
+
+/**
+ * @brief Write the sorted tuples of a build into buckets.
+ *
+ * Also used by cuckoo_reorganize() to rewrite an index from its own
+ * tuples.
+ *
+ * The bucket count is chosen from the number of tuples so that pages end
+ * up about CUCKOO_BUILD_FILL_PERCENT full.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param sortstate Tuples sorted by CuckooHashSortKey().
+ * @param tupdesc Descriptor of the sorted tuples.
+ * @param ntuples Number of sorted tuples.
+ */
+void CuckooHashWriteBuckets(Relation index, CuckooState *ckstate,
+                            Tuplesortstate *sortstate, TupleDesc tupdesc,
+                            int64 ntuples) {
+  Size perPage = (BLCKSZ - MAXALIGN(SizeOfPageHeaderData) -
+                  MAXALIGN(sizeof(CuckooPageOpaqueData))) /
+                 ckstate->sizeOfCuckooTuple;
+  TupleTableSlot *slot;
+  CuckooHashMetaData hash;
+  BlockNumber *primaries;
+  BlockNumber dirBlocks[CuckooMetaBlockN];
+  PGAlignedBlock image;
+  Buffer buffer = InvalidBuffer;
+  Buffer metaBuffer;
+  GenericXLogState *state;
+  CuckooMetaPageData *meta;
+  uint32 curBucket = CUCKOO_NO_SPLIT;
+  uint64 nBuckets;
+
+  /* An empty index gets its first bucket on first insert */
+  if (ntuples == 0)
+    return;
+
+  nBuckets = (ntuples * 100 + perPage * CUCKOO_BUILD_FILL_PERCENT - 1) /
+             (perPage * CUCKOO_BUILD_FILL_PERCENT);
+  nBuckets = Max(nBuckets, 1);
+  nBuckets = Min(nBuckets, maxBucketCount(ckstate));
+
+  setBucketMasks(&hash, (uint32)(nBuckets - 1));
+  hash.nPages = 0;
+  hash.splitBucket = CUCKOO_NO_SPLIT;
+  hash.splitFrom = CUCKOO_NO_SPLIT;
+  hash.nDirPages =
+      (uint32)((nBuckets + CUCKOO_DIR_ENTRIES - 1) / CUCKOO_DIR_ENTRIES);
+
+  primaries = (BlockNumber *)palloc(sizeof(BlockNumber) * nBuckets);
+  for (uint64 b = 0; b < nBuckets; b++)
+    primaries[b] = InvalidBlockNumber;
+
+  slot = MakeSingleTupleTableSlot(tupdesc, &TTSOpsMinimalTuple);
+
+  while (tuplesort_gettupleslot(sortstate, true, false, slot, NULL)) {
+    CuckooTuple itup;
+    uint32 bucket;
+    bool isnull;
+
+    itup.fingerprint = (uint32)DatumGetInt64(slot_getattr(slot, 1, &isnull));
+    itup.heapPtr =
+        *(ItemPointer)DatumGetPointer(slot_getattr(slot, 2, &isnull));
+    bucket = CuckooHashBucket(&hash, itup.fingerprint);
+
+    if (bucket != curBucket) {
+      /* Start the chain of the next bucket */
+      if (BufferIsValid(buffer)) {
+        writePageImage(index, buffer, image.data);
+        UnlockReleaseBuffer(buffer);
+      }
+
+      Assert(primaries[bucket] == InvalidBlockNumber);
+      buffer = CuckooNewBuffer(index);
+      primaries[bucket] = BufferGetBlockNumber(buffer);
+      hash.nPages++;
+      CuckooInitPage(image.data, CUCKOO_BUCKET);
+      curBucket = bucket;
+    }
+
+    if (!CuckooPageAddItem(ckstate, image.data, &itup)) {
+      Buffer next = CuckooNewBuffer(index);
+
+      CuckooPageGetOpaque(image.data)->nextBlkno = BufferGetBlockNumber(next);
+      writePageImage(index, buffer, image.data);
+      UnlockReleaseBuffer(buffer);
+      buffer = next;
+      hash.nPages++;
+
+      CuckooInitPage(image.data, CUCKOO_OVERFLOW);
+      if (!CuckooPageAddItem(ckstate, image.data, &itup))
+        elog(ERROR, "could not add new cuckoo tuple to empty page");
+    }
+
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  if (BufferIsValid(buffer)) {
+    writePageImage(index, buffer, image.data);
+    UnlockReleaseBuffer(buffer);
+  }
+
+  ExecDropSingleTupleTableSlot(slot);
+
+  /* Buckets that received no tuples still need a primary page */
+  CuckooInitPage(image.data, CUCKOO_BUCKET);
+  for (uint64 b = 0; b < nBuckets; b++) {
+    if (primaries[b] != InvalidBlockNumber)
+      continue;
+
+    buffer = CuckooNewBuffer(index);
+    primaries[b] = BufferGetBlockNumber(buffer);
+    hash.nPages++;
+    writePageImage(index, buffer, image.data);
+    UnlockReleaseBuffer(buffer);
+  }
+
+  /* Write the directory */
+  for (uint32 d = 0; d < hash.nDirPages; d++) {
+    BlockNumber *entries;
+
+    initDirectoryPage(image.data);
+    entries = (BlockNumber *)PageGetContents(image.data);
+    for (uint64 b = (uint64)d * CUCKOO_DIR_ENTRIES;
+         b < nBuckets && b < (uint64)(d + 1) * CUCKOO_DIR_ENTRIES; b++)
+      entries[b % CUCKOO_DIR_ENTRIES] = primaries[b];
+
+    buffer = CuckooNewBuffer(index);
+    dirBlocks[d] = BufferGetBlockNumber(buffer);
+    writePageImage(index, buffer, image.data);
+    UnlockReleaseBuffer(buffer);
+  }
+
+  metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(metaBuffer, BUFFER_LOCK_EXCLUSIVE);
+  state = GenericXLogStart(index);
+  meta = CuckooPageGetMeta(GenericXLogRegisterBuffer(state, metaBuffer, 0));
+  meta->hash = hash;
+  memcpy(meta->notFullPage, dirBlocks, sizeof(BlockNumber) * hash.nDirPages);
+  GenericXLogFinish(state);
+  UnlockReleaseBuffer(metaBuffer);
+
+  pfree(primaries);
+}
+
+/**
+ * @brief Build a hashed-layout index.
+ *
+ * Tuples are sorted into bucket order, then each bucket is written as one
+ * run of pages, instead of inserting tuple by tuple.
+ *
+ * @param heap The heap relation being indexed.
+ * @param index The index relation to build.
+ * @param indexInfo Index information.
+ * @param ckstate Cuckoo index state.
+ * @param indtuples Output: number of index tuples created.
+ * @return Number of heap tuples scanned.
+ */
+double CuckooHashBuild(Relation heap, Relation index, IndexInfo *indexInfo,
+                       CuckooState *ckstate, int64 *indtuples) {
+  CuckooHashBuildState buildstate;
+  TupleDesc tupdesc;
+  AttrNumber sortAttr = 1;
+  Oid sortOperator = Int8LessOperator;
+  Oid sortCollation = InvalidOid;
+  bool nullsFirst = false;
+  double reltuples;
+
+  tupdesc = CreateTemplateTupleDesc(2);
+  TupleDescInitEntry(tupdesc, (AttrNumber)1, "key", INT8OID, -1, 0);
+  TupleDescInitEntry(tupdesc, (AttrNumber)2, "tid", TIDOID, -1, 0);
+
+  memset(&buildstate, 0, sizeof(buildstate));
+  buildstate.ckstate = ckstate;
+  buildstate.tmpCtx = AllocSetContextCreate(CurrentMemoryContext,
+                                            "Cuckoo build temporary context",
+                                            ALLOCSET_DEFAULT_SIZES);
+  buildstate.slot = MakeSingleTupleTableSlot(tupdesc, &TTSOpsVirtual);
+  buildstate.sortstate =
+      tuplesort_begin_heap(tupdesc, 1, &sortAttr, &sortOperator,
+                           &sortCollation, &nullsFirst, maintenance_work_mem,
+                           NULL, TUPLESORT_NONE);
+
+  reltuples = table_index_build_scan(heap, index, indexInfo, true, true,
+                                     hashBuildCallback, &buildstate, NULL);
+
+  tuplesort_performsort(buildstate.sortstate);
+  CuckooHashWriteBuckets(index, ckstate, buildstate.sortstate, tupdesc,
+                         buildstate.indtuples);
+
+  tuplesort_end(buildstate.sortstate);
+  ExecDropSingleTupleTableSlot(buildstate.slot);
+  MemoryContextDelete(buildstate.tmpCtx);
+
+  *indtuples = buildstate.indtuples;
+  return reltuples;
+}
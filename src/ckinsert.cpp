@@ -11,14 +11,32 @@
 #include "cuckoo.h"
 
 extern "C" {
+#include "access/amapi.h"
 #include "access/genam.h"
 #include "access/generic_xlog.h"
+#include "access/htup_details.h"
+#include "access/multixact.h"
+#include "access/table.h"
 #include "access/tableam.h"
+#include "access/transam.h"
+#include "access/visibilitymap.h"
+#include "access/xlog.h"
+#include "catalog/index.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "commands/tablecmds.h"
+#include "commands/vacuum.h"
 #include "miscadmin.h"
 #include "nodes/execnodes.h"
 #include "storage/bufmgr.h"
+#include "utils/acl.h"
+#include "utils/array.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/syscache.h"
+#include "utils/uuid.h"
 
 #if PG_VERSION_NUM >= 170000
 #include "access/parallel.h"
@@ -29,12 +47,15 @@ extern "C" {
 #include "storage/smgr.h"
 #include "tcop/tcopprot.h"
 #include "utils/tuplesort.h"
+#include "utils/wait_event.h"
 #endif
 }
 
 /* Module magic for PostgreSQL extension */
 extern "C" {
 PG_MODULE_MAGIC;
+
+PG_FUNCTION_INFO_V1(cuckoo_build_indexes);
 }
 
 #if PG_VERSION_NUM >= 170000
@@ -49,17 +70,28 @@ static void _ck_end_parallel(CuckooParallelBuildState *buildstate);
 static void
 _ck_leader_participate_as_worker(CuckooParallelBuildState *buildstate,
                                  Relation heap, Relation index);
+
+/* Wait event of the leader waiting for its workers, once registered */
+static uint32 ck_wait_event_build_merge = 0;
 #endif
 
 /**
  * @brief State maintained during index build.
  */
 typedef struct CuckooBuildState {
-  CuckooState ckstate;  /**< Cuckoo index state */
-  int64 indtuples;      /**< Total number of tuples indexed */
-  MemoryContext tmpCtx; /**< Temporary memory context */
-  PGAlignedBlock data;  /**< Cached page data */
-  int count;            /**< Number of tuples in cached page */
+  CuckooState ckstate;   /**< Cuckoo index state */
+  int64 indtuples;       /**< Total number of tuples indexed */
+  MemoryContext tmpCtx;  /**< Temporary memory context */
+  PGAlignedBlock data;   /**< Cached page data */
+  int count;             /**< Number of tuples in cached page */
+  int batchKind;         /**< CUCKOO_BATCH_* kind of the index */
+  int nbatch;            /**< Number of tuples in the batch */
+  ItemPointerData *tids; /**< Heap TIDs of the batch */
+  Datum *keys;           /**< Keys of the batch, unless kind is NONE */
+  bool *keyIsNull;       /**< Whether each key is NULL */
+  pg_uuid_t *uuids;      /**< Copies of uuid keys */
+  uint32 *fingerprints;  /**< Fingerprints of the batch */
+  CuckooSketch sketch;   /**< Distinct row hashes */
 } CuckooBuildState;
 
 /**
@@ -70,13 +102,21 @@ typedef struct CuckooBuildState {
  */
 static void flushCachedPage(Relation index, CuckooBuildState *buildstate) {
   Page page;
-  Buffer buffer = CuckooNewBuffer(index);
+  Buffer buffer = CuckooNewDataBuffer(index, &buildstate->ckstate);
+  Buffer summaryBuffer;
   GenericXLogState *state;
 
   state = GenericXLogStart(index);
   page = GenericXLogRegisterBuffer(state, buffer, GENERIC_XLOG_FULL_IMAGE);
   memcpy(page, buildstate->data.data, BLCKSZ);
+  summaryBuffer =
+      CuckooSummaryUpdate(index, &buildstate->ckstate, state,
+                          BufferGetBlockNumber(buffer), page);
   GenericXLogFinish(state);
+  if (BufferIsValid(summaryBuffer))
+    UnlockReleaseBuffer(summaryBuffer);
+  TRACE_CUCKOO_BUILD_FLUSH(RelationGetRelid(index),
+                           BufferGetBlockNumber(buffer), buildstate->count);
   UnlockReleaseBuffer(buffer);
 }
 
@@ -90,11 +130,94 @@ static void initCachedPage(CuckooBuildState *buildstate) {
   buildstate->count = 0;
 }
 
+/**
+ * @brief Allocate the batch buffers of a build.
+ *
+ * @param buildstate Build state with an initialized cuckoo state.
+ */
+static void initBuildBatch(CuckooBuildState *buildstate) {
+  buildstate->batchKind = CuckooGetBatchKind(&buildstate->ckstate);
+  buildstate->nbatch = 0;
+  buildstate->tids = (ItemPointerData *)palloc(CUCKOO_BUILD_BATCH *
+                                               sizeof(ItemPointerData));
+  buildstate->fingerprints =
+      (uint32 *)palloc(CUCKOO_BUILD_BATCH * sizeof(uint32));
+
+  if (buildstate->batchKind != CUCKOO_BATCH_NONE ||
+      buildstate->ckstate.opts.exactKeys) {
+    buildstate->keys = (Datum *)palloc(CUCKOO_BUILD_BATCH * sizeof(Datum));
+    buildstate->keyIsNull = (bool *)palloc(CUCKOO_BUILD_BATCH * sizeof(bool));
+  }
+  if (buildstate->batchKind == CUCKOO_BATCH_UUID)
+    buildstate->uuids =
+        (pg_uuid_t *)palloc(CUCKOO_BUILD_BATCH * sizeof(pg_uuid_t));
+}
+
+/**
+ * @brief Fingerprint the batch and append it to the cached page.
+ *
+ * Tuples are written straight into the cached page, a page's worth at a
+ * time, flushing pages as they fill up.
+ *
+ * @param index The index relation.
+ * @param buildstate Build state holding the batch.
+ */
+static void flushBuildBatch(Relation index, CuckooBuildState *buildstate) {
+  CuckooState *ckstate = &buildstate->ckstate;
+  Page page = buildstate->data.data;
+  int done = 0;
+
+  if (buildstate->batchKind != CUCKOO_BATCH_NONE)
+    CuckooBatchFingerprints(ckstate, buildstate->batchKind, buildstate->keys,
+                            buildstate->keyIsNull, buildstate->nbatch,
+                            buildstate->fingerprints);
+
+  while (done < buildstate->nbatch) {
+    CuckooPageOpaque opaque = CuckooPageGetOpaque(page);
+    int room = (int)(CuckooPageGetFreeSpace(ckstate, page) /
+                     ckstate->sizeOfCuckooTuple);
+    int n = Min(room, buildstate->nbatch - done);
+    CuckooTuple *itup;
+
+    if (n == 0) {
+      /* Page is full, flush it and start a new one */
+      flushCachedPage(index, buildstate);
+
+      CHECK_FOR_INTERRUPTS();
+
+      initCachedPage(buildstate);
+      continue;
+    }
+
+    itup = CuckooPageGetTuple(ckstate, page, opaque->maxoff + 1);
+    for (int i = done; i < done + n; i++) {
+      itup->heapPtr = buildstate->tids[i];
+      itup->fingerprint = buildstate->fingerprints[i];
+      if (ckstate->opts.exactKeys) {
+        Datum key = buildstate->keyIsNull[i] ? (Datum)0 : buildstate->keys[i];
+
+        memcpy(CuckooTupleGetKey(itup), &key, sizeof(Datum));
+      }
+      itup = CuckooPageGetNextTuple(ckstate, itup);
+    }
+
+    opaque->maxoff += n;
+    ((PageHeader)page)->pd_lower = (Pointer)itup - page;
+    buildstate->count += n;
+    done += n;
+  }
+
+  buildstate->indtuples += buildstate->nbatch;
+  buildstate->nbatch = 0;
+}
+
 /**
  * @brief Callback for table_index_build_scan during index build.
  *
- * Called for each tuple in the heap. Creates a cuckoo tuple and adds
- * it to the current page, flushing pages as needed.
+ * Called for each tuple in the heap. Adds the row to the current batch,
+ * appending the batch to the cached page when it fills up. Keys of the
+ * fixed-width batch kinds are only stored here; other rows are
+ * fingerprinted right away, since their values do not outlive the call.
  *
  * @param index The index relation.
  * @param tid Tuple ID of the heap tuple.
@@ -107,36 +230,86 @@ static void cuckooBuildCallback(Relation index, ItemPointer tid, Datum *values,
                                 bool *isnull, bool tupleIsAlive, void *state) {
   CuckooBuildState *buildstate = (CuckooBuildState *)state;
   MemoryContext oldCtx;
-  CuckooTuple *itup;
+  uint32 *fingerprints;
+  int nfingerprints;
+  int n;
+
+  if (buildstate->batchKind != CUCKOO_BATCH_NONE) {
+    n = buildstate->nbatch++;
+    buildstate->tids[n] = *tid;
+    buildstate->keyIsNull[n] = isnull[0];
+
+    if (buildstate->batchKind == CUCKOO_BATCH_UUID && !isnull[0]) {
+      buildstate->uuids[n] = *DatumGetUUIDP(values[0]);
+      buildstate->keys[n] = UUIDPGetDatum(&buildstate->uuids[n]);
+    } else {
+      buildstate->keys[n] = values[0];
+    }
 
-  oldCtx = MemoryContextSwitchTo(buildstate->tmpCtx);
+    if (buildstate->nbatch == CUCKOO_BUILD_BATCH)
+      flushBuildBatch(index, buildstate);
+    return;
+  }
 
-  itup = CuckooFormTuple(&buildstate->ckstate, tid, values, isnull);
+  oldCtx = MemoryContextSwitchTo(buildstate->tmpCtx);
 
-  /* Try to add tuple to cached page */
-  if (CuckooPageAddItem(&buildstate->ckstate, buildstate->data.data, itup)) {
-    buildstate->count++;
-  } else {
-    /* Page is full, flush it and start a new one */
-    flushCachedPage(index, buildstate);
+  fingerprints = computeFingerprints(&buildstate->ckstate, values, isnull,
+                                     &nfingerprints);
 
-    CHECK_FOR_INTERRUPTS();
+  for (int i = 0; i < nfingerprints; i++) {
+    if (buildstate->nbatch == CUCKOO_BUILD_BATCH)
+      flushBuildBatch(index, buildstate);
 
-    initCachedPage(buildstate);
+    n = buildstate->nbatch++;
+    buildstate->tids[n] = *tid;
+    buildstate->fingerprints[n] = fingerprints[i];
 
-    if (!CuckooPageAddItem(&buildstate->ckstate, buildstate->data.data, itup)) {
-      elog(ERROR, "could not add new cuckoo tuple to empty page");
+    /* Exact keys are single pass-by-value columns, so they outlive the call */
+    if (buildstate->ckstate.opts.exactKeys) {
+      buildstate->keys[n] = values[0];
+      buildstate->keyIsNull[n] = isnull[0];
     }
-
-    buildstate->count++;
   }
 
-  buildstate->indtuples++;
-
   MemoryContextSwitchTo(oldCtx);
   MemoryContextReset(buildstate->tmpCtx);
 }
 
+/**
+ * @brief Initialize the state of a serial flat-layout build.
+ *
+ * @param buildstate Build state to initialize.
+ * @param index The index relation, with an initialized metapage.
+ */
+static void initBuildState(CuckooBuildState *buildstate, Relation index) {
+  memset(buildstate, 0, sizeof(CuckooBuildState));
+  initCuckooState(&buildstate->ckstate, index);
+  buildstate->ckstate.sketch = &buildstate->sketch;
+  buildstate->tmpCtx = AllocSetContextCreate(CurrentMemoryContext,
+                                             "Cuckoo build temporary context",
+                                             ALLOCSET_DEFAULT_SIZES);
+  initCachedPage(buildstate);
+  initBuildBatch(buildstate);
+}
+
+/**
+ * @brief Write out what is left of a serial flat-layout build.
+ *
+ * Appends the last batch, flushes the last page if it has any tuples and
+ * stores the sketch.
+ *
+ * @param index The index relation.
+ * @param buildstate Build state.
+ */
+static void finishBuildState(Relation index, CuckooBuildState *buildstate) {
+  flushBuildBatch(index, buildstate);
+  if (buildstate->count > 0)
+    flushCachedPage(index, buildstate);
+  CuckooSketchWrite(index, &buildstate->sketch);
+
+  MemoryContextDelete(buildstate->tmpCtx);
+}
+
 /**
  * @brief Build a new cuckoo index.
  *
@@ -156,8 +329,58 @@ IndexBuildResult *ckbuild(Relation heap, Relation index, IndexInfo *indexInfo) {
     elog(ERROR, "index \"%s\" already contains data",
          RelationGetRelationName(index));
 
+  /*
+   * Exclusion checks fetch tuples one at a time, which only exact_keys
+   * indexes can do, and that option can be changed later with ALTER INDEX.
+   */
+  if (indexInfo->ii_ExclusionOps != NULL)
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("access method \"cuckoo\" does not support exclusion "
+                    "constraints")));
+
+  CuckooCheckTrigramCollation(index);
+
   /* Initialize the metapage */
   CuckooInitMetapage(index, MAIN_FORKNUM);
+  CuckooApplyTargetFpr(heap, index);
+  CuckooLookupCacheReset();
+
+  /*
+   * The hashed and frozen layouts sort tuples rather than appending them,
+   * and block range filters keep no tuples at all, so they have builds of
+   * their own.
+   */
+  {
+    CuckooState ckstate;
+    CuckooSketch sketch;
+
+    initCuckooState(&ckstate, index);
+    memset(&sketch, 0, sizeof(sketch));
+    ckstate.sketch = &sketch;
+
+    if (ckstate.opts.layout != CUCKOO_LAYOUT_FLAT ||
+        ckstate.opts.pagesPerRange > 0) {
+      int64 indtuples;
+
+      if (ckstate.opts.pagesPerRange > 0)
+        reltuples =
+            CuckooRangeBuild(heap, index, indexInfo, &ckstate, &indtuples);
+      else if (ckstate.opts.layout == CUCKOO_LAYOUT_HASHED)
+        reltuples =
+            CuckooHashBuild(heap, index, indexInfo, &ckstate, &indtuples);
+      else
+        reltuples =
+            CuckooFrozenBuild(heap, index, indexInfo, &ckstate, &indtuples);
+      CuckooSketchWrite(index, &sketch);
+
+      result = (IndexBuildResult *)palloc(sizeof(IndexBuildResult));
+      result->heap_tuples = reltuples;
+      result->index_tuples = indtuples;
+
+      return result;
+    }
+  }
 
 #if PG_VERSION_NUM >= 170000
   /*
@@ -174,6 +397,7 @@ IndexBuildResult *ckbuild(Relation heap, Relation index, IndexInfo *indexInfo) {
       /* Initialize parallel build state */
       memset(&pstate, 0, sizeof(pstate));
       initCuckooState(&pstate.ckstate, index);
+      pstate.ckstate.sketch = &pstate.sketch;
       pstate.tmpCtx = AllocSetContextCreate(CurrentMemoryContext,
                                             "Cuckoo parallel build context",
                                             ALLOCSET_DEFAULT_SIZES);
@@ -187,6 +411,7 @@ IndexBuildResult *ckbuild(Relation heap, Relation index, IndexInfo *indexInfo) {
 
       /* Merge results and write pages */
       _ck_parallel_merge(&pstate, heap, index);
+      CuckooSketchWrite(index, &pstate.leader->shared->sketch);
 
       /* Clean up */
       _ck_end_parallel(&pstate);
@@ -208,23 +433,13 @@ IndexBuildResult *ckbuild(Relation heap, Relation index, IndexInfo *indexInfo) {
   {
     CuckooBuildState buildstate;
 
-    /* Initialize build state */
-    memset(&buildstate, 0, sizeof(buildstate));
-    initCuckooState(&buildstate.ckstate, index);
-    buildstate.tmpCtx = AllocSetContextCreate(CurrentMemoryContext,
-                                              "Cuckoo build temporary context",
-                                              ALLOCSET_DEFAULT_SIZES);
-    initCachedPage(&buildstate);
+    initBuildState(&buildstate, index);
 
     /* Scan the heap and build index */
     reltuples = table_index_build_scan(heap, index, indexInfo, true, true,
                                        cuckooBuildCallback, &buildstate, NULL);
 
-    /* Flush last page if it has any tuples */
-    if (buildstate.count > 0)
-      flushCachedPage(index, &buildstate);
-
-    MemoryContextDelete(buildstate.tmpCtx);
+    finishBuildState(index, &buildstate);
 
     result = (IndexBuildResult *)palloc(sizeof(IndexBuildResult));
     result->heap_tuples = reltuples;
@@ -234,6 +449,298 @@ IndexBuildResult *ckbuild(Relation heap, Relation index, IndexInfo *indexInfo) {
   }
 }
 
+/*
+ * Building several indexes of a table with one heap scan
+ */
+
+/**
+ * @brief An index built by a shared heap scan.
+ */
+typedef struct CuckooSharedBuildMember {
+  Relation index;              /**< The index relation */
+  int firstAttr;               /**< Its first column among the scan's */
+  CuckooBuildState buildstate; /**< Its build state */
+} CuckooSharedBuildMember;
+
+/**
+ * @brief The indexes fed by one heap scan.
+ */
+typedef struct CuckooSharedBuildState {
+  CuckooSharedBuildMember *members; /**< Indexes being built */
+  int nmembers;                     /**< Number of indexes */
+} CuckooSharedBuildState;
+
+/**
+ * @brief Callback for a heap scan shared by several index builds.
+ *
+ * The scan computes the columns of every index; each index gets its own
+ * slice of them and appends to its own pages.
+ */
+static void sharedBuildCallback(Relation index, ItemPointer tid,
+                                Datum *values, bool *isnull,
+                                bool tupleIsAlive, void *state) {
+  CuckooSharedBuildState *shared = (CuckooSharedBuildState *)state;
+
+  for (int i = 0; i < shared->nmembers; i++) {
+    CuckooSharedBuildMember *member = &shared->members[i];
+
+    cuckooBuildCallback(member->index, tid, values + member->firstAttr,
+                        isnull + member->firstAttr, tupleIsAlive,
+                        &member->buildstate);
+  }
+}
+
+/**
+ * @brief Check whether an index can be built by a shared heap scan.
+ *
+ * Only flat indexes without block range filters are built from a plain
+ * stream of rows; partial indexes would need their own predicate.
+ *
+ * @param index The index relation.
+ * @param indexInfo Index information.
+ * @return true if the index can share a scan.
+ */
+static bool canShareBuildScan(Relation index, IndexInfo *indexInfo) {
+  CuckooOptions *opts = (CuckooOptions *)index->rd_options;
+
+  return indexInfo->ii_Predicate == NIL &&
+         (opts == NULL || (opts->layout == CUCKOO_LAYOUT_FLAT &&
+                           opts->pagesPerRange == 0));
+}
+
+/**
+ * @brief Record the size of a relation after a rebuild.
+ *
+ * Does what index_update_stats() does for REINDEX, which is private to
+ * index.c, with the in-place update VACUUM and ANALYZE use.
+ *
+ * @param rel The table or index.
+ * @param reltuples Number of tuples it now holds.
+ */
+static void updateBuildStats(Relation rel, double reltuples) {
+  BlockNumber relallvisible = 0;
+  BlockNumber relallfrozen = 0;
+  bool isIndex = rel->rd_rel->relkind == RELKIND_INDEX;
+
+  if (!isIndex)
+    visibilitymap_count(rel, &relallvisible, &relallfrozen);
+
+  vac_update_relstats(rel, RelationGetNumberOfBlocks(rel), reltuples,
+                      relallvisible,
+#if PG_VERSION_NUM >= 180000
+                      relallfrozen,
+#endif
+                      !isIndex, InvalidTransactionId, InvalidMultiXactId,
+                      NULL, NULL, true);
+}
+
+/**
+ * @brief Build several indexes with one scan of their table.
+ *
+ * The scan computes the columns of all indexes at once, as if they were
+ * the columns of one wide index.
+ *
+ * @param heap The heap relation.
+ * @param members Indexes to build, with initialized metapages.
+ * @param infos Index information of each index.
+ * @param nmembers Number of indexes.
+ * @return Number of heap tuples scanned.
+ */
+static double sharedBuild(Relation heap, CuckooSharedBuildMember *members,
+                          IndexInfo **infos, int nmembers) {
+  CuckooSharedBuildState shared;
+  IndexInfo *combined;
+  double reltuples;
+  int nattrs = 0;
+
+  combined = (IndexInfo *)palloc(sizeof(IndexInfo));
+  *combined = *infos[0];
+  combined->ii_Expressions = NIL;
+  combined->ii_ExpressionsState = NIL;
+
+  for (int i = 0; i < nmembers; i++) {
+    members[i].firstAttr = nattrs;
+    for (int j = 0; j < infos[i]->ii_NumIndexAttrs; j++)
+      combined->ii_IndexAttrNumbers[nattrs++] =
+          infos[i]->ii_IndexAttrNumbers[j];
+    combined->ii_Expressions =
+        list_concat(combined->ii_Expressions, infos[i]->ii_Expressions);
+
+    initBuildState(&members[i].buildstate, members[i].index);
+  }
+  combined->ii_NumIndexAttrs = nattrs;
+  combined->ii_NumIndexKeyAttrs = nattrs;
+
+  shared.members = members;
+  shared.nmembers = nmembers;
+  reltuples = table_index_build_scan(heap, members[0].index, combined, true,
+                                     true, sharedBuildCallback, &shared, NULL);
+
+  for (int i = 0; i < nmembers; i++) {
+    finishBuildState(members[i].index, &members[i].buildstate);
+    updateBuildStats(members[i].index, members[i].buildstate.indtuples);
+  }
+
+  return reltuples;
+}
+
+/**
+ * @brief Collect the cuckoo indexes a call to cuckoo_build_indexes() names.
+ *
+ * @param heap The table.
+ * @param indexes Array of regclass, or NULL for all cuckoo indexes of the
+ *                table.
+ * @return OIDs of the indexes, sorted so that they are locked in a fixed
+ *         order.
+ */
+static List *sharedBuildIndexOids(Relation heap, ArrayType *indexes) {
+  List *oids = NIL;
+  ListCell *lc;
+
+  if (indexes == NULL) {
+    foreach (lc, RelationGetIndexList(heap)) {
+      Oid indexOid = lfirst_oid(lc);
+      HeapTuple tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(indexOid));
+      Oid amOid;
+
+      if (!HeapTupleIsValid(tuple))
+        elog(ERROR, "cache lookup failed for relation %u", indexOid);
+      amOid = ((Form_pg_class)GETSTRUCT(tuple))->relam;
+      ReleaseSysCache(tuple);
+
+      if (GetIndexAmRoutineByAmId(amOid, false)->ambuild == ckbuild)
+        oids = lappend_oid(oids, indexOid);
+    }
+  } else {
+    Datum *elems;
+    bool *nulls;
+    int nelems;
+
+    deconstruct_array(indexes, REGCLASSOID, sizeof(Oid), true, TYPALIGN_INT,
+                      &elems, &nulls, &nelems);
+    for (int i = 0; i < nelems; i++) {
+      Oid indexOid = DatumGetObjectId(elems[i]);
+
+      if (nulls[i])
+        continue;
+      if (IndexGetRelation(indexOid, true) != RelationGetRelid(heap))
+        ereport(ERROR,
+                (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+                 errmsg("\"%s\" is not an index of table \"%s\"",
+                        get_rel_name(indexOid),
+                        RelationGetRelationName(heap))));
+      oids = list_append_unique_oid(oids, indexOid);
+    }
+  }
+
+  list_sort(oids, list_oid_cmp);
+
+  return oids;
+}
+
+/**
+ * @brief Rebuild cuckoo indexes of a table with one heap scan.
+ *
+ * Each index gets new storage, as with REINDEX, and the flat ones are
+ * filled from a single scan of the table. Hashed, frozen, block range
+ * and partial indexes are built separately, each with a scan of its own.
+ * Takes the locks of REINDEX and, like it, requires ownership of the table
+ * and evaluates index expressions and predicates as the table owner in a
+ * security-restricted operation. The sizes of the table and the indexes
+ * in pg_class are brought up to date.
+ *
+ * @param fcinfo Function call info: regclass table, regclass[] indexes or
+ *               NULL for all cuckoo indexes of the table.
+ * @return Number of indexes rebuilt.
+ */
+extern "C" Datum cuckoo_build_indexes(PG_FUNCTION_ARGS) {
+  Oid heapOid;
+  Relation heap;
+  List *oids;
+  CuckooSharedBuildMember *members;
+  IndexInfo **infos;
+  Relation *indexes;
+  double reltuples = 0;
+  int nmembers = 0;
+  int nindexes = 0;
+  int nattrs = 0;
+  Oid saveUserid;
+  int saveSecContext;
+  int saveNestLevel;
+  ListCell *lc;
+
+  if (PG_ARGISNULL(0))
+    PG_RETURN_NULL();
+
+  heapOid = PG_GETARG_OID(0);
+  if (!object_ownercheck(RelationRelationId, heapOid, GetUserId()))
+    aclcheck_error(ACLCHECK_NOT_OWNER, OBJECT_TABLE, get_rel_name(heapOid));
+
+  heap = table_open(heapOid, ShareLock);
+
+  /* Run user-defined code as the table owner, as REINDEX does */
+  GetUserIdAndSecContext(&saveUserid, &saveSecContext);
+  SetUserIdAndSecContext(heap->rd_rel->relowner,
+                         saveSecContext | SECURITY_RESTRICTED_OPERATION);
+  saveNestLevel = NewGUCNestLevel();
+#if PG_VERSION_NUM >= 170000
+  RestrictSearchPath();
+#endif
+
+  oids = sharedBuildIndexOids(
+      heap, PG_ARGISNULL(1) ? NULL : PG_GETARG_ARRAYTYPE_P(1));
+
+  members = (CuckooSharedBuildMember *)palloc(
+      sizeof(CuckooSharedBuildMember) * Max(list_length(oids), 1));
+  infos = (IndexInfo **)palloc(sizeof(IndexInfo *) * Max(list_length(oids), 1));
+  indexes = (Relation *)palloc(sizeof(Relation) * Max(list_length(oids), 1));
+
+  foreach (lc, oids) {
+    Relation index = CuckooOpenIndex(lfirst_oid(lc), AccessExclusiveLock);
+    IndexInfo *indexInfo;
+
+    CheckTableNotInUse(index, "cuckoo_build_indexes");
+    indexInfo = BuildIndexInfo(index);
+    CuckooResetStorage(index);
+    indexes[nindexes++] = index;
+
+    if (!canShareBuildScan(index, indexInfo)) {
+      IndexBuildResult *result = ckbuild(heap, index, indexInfo);
+
+      updateBuildStats(index, result->index_tuples);
+      reltuples = result->heap_tuples;
+      continue;
+    }
+
+    /* The scan computes at most INDEX_MAX_KEYS columns */
+    if (nattrs + indexInfo->ii_NumIndexAttrs > INDEX_MAX_KEYS) {
+      reltuples = sharedBuild(heap, members, infos, nmembers);
+      nmembers = 0;
+      nattrs = 0;
+    }
+
+    CuckooInitMetapage(index, MAIN_FORKNUM);
+    CuckooApplyTargetFpr(heap, index);
+    members[nmembers].index = index;
+    infos[nmembers++] = indexInfo;
+    nattrs += indexInfo->ii_NumIndexAttrs;
+  }
+
+  if (nmembers > 0)
+    reltuples = sharedBuild(heap, members, infos, nmembers);
+  if (nindexes > 0)
+    updateBuildStats(heap, reltuples);
+
+  AtEOXact_GUC(false, saveNestLevel);
+  SetUserIdAndSecContext(saveUserid, saveSecContext);
+
+  for (int i = 0; i < nindexes; i++)
+    index_close(indexes[i], NoLock);
+  table_close(heap, NoLock);
+
+  PG_RETURN_INT32(nindexes);
+}
+
 /*
  * Parallel index build support (PG17+)
  */
@@ -255,13 +762,21 @@ IndexBuildResult *ckbuild(Relation heap, Relation index, IndexInfo *indexInfo) {
 static void flushCachedPageParallel(Relation index,
                                     CuckooParallelBuildState *buildstate) {
   Page page;
-  Buffer buffer = CuckooNewBuffer(index);
+  Buffer buffer = CuckooNewDataBuffer(index, &buildstate->ckstate);
+  Buffer summaryBuffer;
   GenericXLogState *state;
 
   state = GenericXLogStart(index);
   page = GenericXLogRegisterBuffer(state, buffer, GENERIC_XLOG_FULL_IMAGE);
   memcpy(page, buildstate->data.data, BLCKSZ);
+  summaryBuffer =
+      CuckooSummaryUpdate(index, &buildstate->ckstate, state,
+                          BufferGetBlockNumber(buffer), page);
   GenericXLogFinish(state);
+  if (BufferIsValid(summaryBuffer))
+    UnlockReleaseBuffer(summaryBuffer);
+  TRACE_CUCKOO_BUILD_FLUSH(RelationGetRelid(index),
+                           BufferGetBlockNumber(buffer), buildstate->count);
   UnlockReleaseBuffer(buffer);
 }
 
@@ -281,6 +796,10 @@ static void initCachedPageParallel(CuckooParallelBuildState *buildstate) {
  * @return Number of parallel workers to request, or 0 for serial build.
  */
 static int ck_compute_parallel_workers(Relation heap, Relation index) {
+  /* Workers pass fingerprints to the leader, not keys */
+  if (CuckooGetOptions(index)->exactKeys)
+    return 0;
+
   /*
    * Use plan_create_index_workers to determine the number of workers.
    * This considers table size, maintenance_work_mem, and
@@ -302,17 +821,24 @@ static void cuckooParallelBuildCallback(Relation index, ItemPointer tid,
   CuckooParallelBuildState *buildstate = (CuckooParallelBuildState *)state;
   MemoryContext oldCtx;
   CuckooTuple itup;
+  uint32 *fingerprints;
+  int nfingerprints;
 
   oldCtx = MemoryContextSwitchTo(buildstate->tmpCtx);
 
-  /* Form tuple directly on stack to avoid palloc overhead */
-  itup.heapPtr = *tid;
-  itup.fingerprint = computeFingerprint(&buildstate->ckstate, values, isnull);
+  fingerprints = computeFingerprints(&buildstate->ckstate, values, isnull,
+                                     &nfingerprints);
+
+  for (int i = 0; i < nfingerprints; i++) {
+    /* Form tuple directly on stack to avoid palloc overhead */
+    itup.heapPtr = *tid;
+    itup.fingerprint = fingerprints[i];
 
-  /* Write tuple to shared tuplesort */
-  tuplesort_putdatum(buildstate->sortstate, PointerGetDatum(&itup), false);
+    /* Write tuple to shared tuplesort */
+    tuplesort_putdatum(buildstate->sortstate, PointerGetDatum(&itup), false);
 
-  buildstate->indtuples++;
+    buildstate->indtuples++;
+  }
 
   MemoryContextSwitchTo(oldCtx);
   MemoryContextReset(buildstate->tmpCtx);
@@ -474,7 +1000,8 @@ static void _ck_begin_parallel(CuckooParallelBuildState *buildstate,
  * @brief Wait for all workers to complete and merge their results.
  *
  * Leader waits on condition variable, then reads all tuples from
- * the shared tuplesort and writes them to index pages.
+ * the shared tuplesort and writes them to index pages. The wait shows in
+ * pg_stat_activity as the Extension wait event CuckooBuildMerge.
  */
 static void _ck_parallel_merge(CuckooParallelBuildState *buildstate,
                                Relation heap, Relation index) {
@@ -485,8 +1012,13 @@ static void _ck_parallel_merge(CuckooParallelBuildState *buildstate,
   bool isnull;
 
   /*
-   * Wait for all workers to finish.
+   * Wait for all workers to finish. The wait event is registered on first
+   * use, since shared memory is not yet there when the library is
+   * preloaded.
    */
+  if (ck_wait_event_build_merge == 0)
+    ck_wait_event_build_merge = WaitEventExtensionNew("CuckooBuildMerge");
+
   for (;;) {
     SpinLockAcquire(&ckshared->mutex);
     if (ckshared->nparticipantsdone >= leader->nparticipanttuplesorts) {
@@ -496,7 +1028,7 @@ static void _ck_parallel_merge(CuckooParallelBuildState *buildstate,
     SpinLockRelease(&ckshared->mutex);
 
     ConditionVariableSleep(&ckshared->workersdonecv,
-                           WAIT_EVENT_PARALLEL_CREATE_INDEX_SCAN);
+                           ck_wait_event_build_merge);
   }
   ConditionVariableCancelSleep();
 
@@ -608,6 +1140,7 @@ _ck_leader_participate_as_worker(CuckooParallelBuildState *buildstate,
   ckshared->nparticipantsdone++;
   ckshared->reltuples += reltuples;
   ckshared->indtuples += buildstate->indtuples;
+  CuckooSketchMerge(&ckshared->sketch, &buildstate->sketch);
   SpinLockRelease(&ckshared->mutex);
 
   ConditionVariableSignal(&ckshared->workersdonecv);
@@ -658,6 +1191,7 @@ void _ck_parallel_build_main(dsm_segment *seg, shm_toc *toc) {
    */
   memset(&buildstate, 0, sizeof(buildstate));
   initCuckooState(&buildstate.ckstate, index);
+  buildstate.ckstate.sketch = &buildstate.sketch;
   buildstate.tmpCtx =
       AllocSetContextCreate(CurrentMemoryContext, "Cuckoo parallel build temp",
                             ALLOCSET_DEFAULT_SIZES);
@@ -700,6 +1234,7 @@ void _ck_parallel_build_main(dsm_segment *seg, shm_toc *toc) {
   ckshared->nparticipantsdone++;
   ckshared->reltuples += reltuples;
   ckshared->indtuples += buildstate.indtuples;
+  CuckooSketchMerge(&ckshared->sketch, &buildstate.sketch);
   SpinLockRelease(&ckshared->mutex);
 
   /*
@@ -726,40 +1261,164 @@ void _ck_parallel_build_main(dsm_segment *seg, shm_toc *toc) {
 void ckbuildempty(Relation index) { CuckooInitMetapage(index, INIT_FORKNUM); }
 
 /**
- * @brief Insert a new tuple into the cuckoo index.
+ * @brief Add as many tuples as fit to a page.
+ *
+ * @param state Cuckoo index state.
+ * @param page Page to add tuples to.
+ * @param tuples Array of tuples to add.
+ * @param ntuples Number of tuples in the array.
+ * @return Number of leading tuples that were added.
+ */
+static int addTuplesToPage(CuckooState *state, Page page, CuckooTuple *tuples,
+                           int ntuples) {
+  int nadded = 0;
+
+  while (nadded < ntuples &&
+         CuckooPageAddItem(state, page,
+                           (CuckooTuple *)((Pointer)tuples +
+                                           nadded * state->sizeOfCuckooTuple)))
+    nadded++;
+
+  return nadded;
+}
+
+/**
+ * @brief Remove the tuples of a full page whose heap rows are dead.
+ *
+ * An insert that leaves the indexed columns unchanged adds another version
+ * of a row whose older versions are often already dead. Before a new page
+ * is allocated, the table AM is asked which TIDs on the page can go; tuples
+ * with one of the new fingerprints are marked promising, as they most
+ * likely belong to earlier versions of the same row.
+ *
+ * A generic WAL record cannot carry a recovery conflict, so when a hot
+ * standby may be reading the index, tuples are only removed if the heap
+ * versions of all deletable tuples were already pruned, which logged the
+ * conflict. table_index_delete_tuples() reports one horizon for the whole
+ * batch, so a single dead but unpruned version keeps every tuple. Under
+ * the default wal_level this reclaims only a small part of the dead
+ * entries; the rest wait for VACUUM.
  *
  * @param index The index relation.
- * @param values Array of indexed values.
- * @param isnull Array indicating NULL values.
- * @param ht_ctid Heap tuple ID.
  * @param heapRel The heap relation.
- * @param checkUnique Uniqueness check mode (ignored for cuckoo).
- * @param indexUnchanged Whether index columns are unchanged.
- * @param indexInfo Index information.
- * @return Always returns false (no unique constraint violations).
+ * @param state Cuckoo index state.
+ * @param page Page registered for modification, locked exclusively.
+ * @param blkno Block number of the page.
+ * @param tuples Tuples waiting to be inserted.
+ * @param ntuples Number of tuples in the array.
+ * @return true if any tuples were removed.
  */
-bool ckinsert(Relation index, Datum *values, bool *isnull, ItemPointer ht_ctid,
-              Relation heapRel, IndexUniqueCheck checkUnique,
-              bool indexUnchanged, IndexInfo *indexInfo) {
-  CuckooState ckstate;
-  CuckooTuple *itup;
-  MemoryContext oldCtx;
-  MemoryContext insertCtx;
+static bool bottomUpDelete(Relation index, Relation heapRel,
+                           CuckooState *state, Page page, BlockNumber blkno,
+                           CuckooTuple *tuples, int ntuples) {
+  OffsetNumber maxoff = CuckooPageGetMaxOffset(page);
+  TM_IndexDeleteOp delstate;
+  TransactionId conflictHorizon;
+  CuckooTuple *itup, *itupPtr;
+  bool *deletable;
+  int ndeletable = 0;
+
+  if (maxoff == 0 || (CuckooPageGetOpaque(page)->flags & CUCKOO_FROZEN))
+    return false;
+
+  delstate.irel = index;
+  delstate.iblknum = blkno;
+  delstate.bottomup = true;
+  delstate.bottomupfreespace =
+      Max(BLCKSZ / 16, ntuples * state->sizeOfCuckooTuple);
+  delstate.ndeltids = 0;
+  delstate.deltids =
+      (TM_IndexDelete *)palloc(maxoff * sizeof(TM_IndexDelete));
+  delstate.status = (TM_IndexStatus *)palloc(maxoff * sizeof(TM_IndexStatus));
+
+  for (OffsetNumber off = FirstOffsetNumber; off <= maxoff; off++) {
+    TM_IndexDelete *deltid = &delstate.deltids[delstate.ndeltids];
+    TM_IndexStatus *status = &delstate.status[delstate.ndeltids];
+
+    itup = CuckooPageGetTuple(state, page, off);
+    deltid->tid = itup->heapPtr;
+    deltid->id = delstate.ndeltids;
+    status->idxoffnum = off;
+    status->knowndeletable = false;
+    status->promising = false;
+    status->freespace = state->sizeOfCuckooTuple;
+
+    for (int i = 0; i < ntuples; i++) {
+      CuckooTuple *tuple =
+          (CuckooTuple *)((Pointer)tuples + i * state->sizeOfCuckooTuple);
+
+      if (tuple->fingerprint == itup->fingerprint) {
+        status->promising = true;
+        break;
+      }
+    }
+
+    delstate.ndeltids++;
+  }
+
+  conflictHorizon = table_index_delete_tuples(heapRel, &delstate);
+
+  deletable = (bool *)palloc0((maxoff + 1) * sizeof(bool));
+  if (!TransactionIdIsValid(conflictHorizon) || !XLogStandbyInfoActive() ||
+      !RelationNeedsWAL(index)) {
+    for (int i = 0; i < delstate.ndeltids; i++) {
+      TM_IndexStatus *status = &delstate.status[delstate.deltids[i].id];
+
+      if (status->knowndeletable) {
+        deletable[status->idxoffnum] = true;
+        ndeletable++;
+      }
+    }
+  }
+
+  if (ndeletable > 0) {
+    /* Compact the surviving tuples, as ckbulkdelete() does */
+    itup = itupPtr = CuckooPageGetTuple(state, page, FirstOffsetNumber);
+    for (OffsetNumber off = FirstOffsetNumber; off <= maxoff; off++) {
+      if (!deletable[off]) {
+        if (itupPtr != itup)
+          memmove((Pointer)itupPtr, (Pointer)itup, state->sizeOfCuckooTuple);
+        itupPtr = CuckooPageGetNextTuple(state, itupPtr);
+      }
+      itup = CuckooPageGetNextTuple(state, itup);
+    }
+
+    CuckooPageGetOpaque(page)->maxoff = maxoff - ndeletable;
+    ((PageHeader)page)->pd_lower = (Pointer)itupPtr - page;
+  }
+
+  pfree(deletable);
+  pfree(delstate.deltids);
+  pfree(delstate.status);
+
+  return ndeletable > 0;
+}
+
+/**
+ * @brief Insert a group of tuples into the index.
+ *
+ * All tuples of one heap row are placed together, spilling onto further
+ * pages only when the current one fills up.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param tuples Array of tuples to insert.
+ * @param ntuples Number of tuples in the array.
+ * @param heapRel The heap relation.
+ * @param indexUnchanged Whether the insert is a new version of a row whose
+ *        indexed columns did not change.
+ */
+static void cuckooInsertTuples(Relation index, CuckooState *ckstate,
+                               CuckooTuple *tuples, int ntuples,
+                               Relation heapRel, bool indexUnchanged) {
   CuckooMetaPageData *metaData;
-  Buffer buffer, metaBuffer;
+  Buffer buffer, metaBuffer, summaryBuffer;
   Page page, metaPage;
   BlockNumber blkno = InvalidBlockNumber;
   OffsetNumber nStart;
   GenericXLogState *state;
-
-  insertCtx = AllocSetContextCreate(CurrentMemoryContext,
-                                    "Cuckoo insert temporary context",
-                                    ALLOCSET_DEFAULT_SIZES);
-
-  oldCtx = MemoryContextSwitchTo(insertCtx);
-
-  initCuckooState(&ckstate, index);
-  itup = CuckooFormTuple(&ckstate, ht_ctid, values, isnull);
+  int ninserted = 0;
+  int nadded;
 
   /*
    * First, try to insert into the first page in notFullPage array.
@@ -785,17 +1444,36 @@ bool ckinsert(Relation index, Datum *values, bool *isnull, ItemPointer ht_ctid,
     if (PageIsNew(page) || CuckooPageIsDeleted(page))
       CuckooInitPage(page, 0);
 
-    if (CuckooPageAddItem(&ckstate, page, itup)) {
-      GenericXLogFinish(state);
-      UnlockReleaseBuffer(buffer);
-      ReleaseBuffer(metaBuffer);
-      MemoryContextSwitchTo(oldCtx);
-      MemoryContextDelete(insertCtx);
-      return false;
+    ninserted = addTuplesToPage(ckstate, page, tuples, ntuples);
+
+    /* Make room by removing dead versions before moving on */
+    if (ninserted < ntuples && indexUnchanged &&
+        bottomUpDelete(index, heapRel, ckstate, page, blkno, tuples,
+                       ntuples)) {
+      ninserted += addTuplesToPage(
+          ckstate, page,
+          (CuckooTuple *)((Pointer)tuples +
+                          ninserted * ckstate->sizeOfCuckooTuple),
+          ntuples - ninserted);
     }
 
-    GenericXLogAbort(state);
+    /* Freed space always takes a tuple, so this also logs any removal */
+    if (ninserted > 0) {
+      summaryBuffer = CuckooSummaryUpdate(index, ckstate, state, blkno, page);
+      GenericXLogFinish(state);
+      if (BufferIsValid(summaryBuffer))
+        UnlockReleaseBuffer(summaryBuffer);
+      TRACE_CUCKOO_INSERT_PAGE(RelationGetRelid(index), blkno, false,
+                               ninserted);
+    } else {
+      GenericXLogAbort(state);
+    }
     UnlockReleaseBuffer(buffer);
+
+    if (ninserted == ntuples) {
+      ReleaseBuffer(metaBuffer);
+      return;
+    }
   } else {
     LockBuffer(metaBuffer, BUFFER_LOCK_UNLOCK);
   }
@@ -809,7 +1487,8 @@ bool ckinsert(Relation index, Datum *values, bool *isnull, ItemPointer ht_ctid,
   nStart = metaData->nStart;
 
   /* Skip first page if we already tried it */
-  if (nStart < metaData->nEnd && blkno == metaData->notFullPage[nStart])
+  if (nStart < metaData->nEnd &&
+      blkno == metaData->notFullPage[nStart])
     nStart++;
 
   for (;;) {
@@ -831,42 +1510,129 @@ bool ckinsert(Relation index, Datum *values, bool *isnull, ItemPointer ht_ctid,
     if (PageIsNew(page) || CuckooPageIsDeleted(page))
       CuckooInitPage(page, 0);
 
-    if (CuckooPageAddItem(&ckstate, page, itup)) {
+    nadded = addTuplesToPage(
+        ckstate, page,
+        (CuckooTuple *)((Pointer)tuples +
+                        ninserted * ckstate->sizeOfCuckooTuple),
+        ntuples - ninserted);
+
+    if (nadded > 0) {
+      ninserted += nadded;
       metaData->nStart = nStart;
+      summaryBuffer = CuckooSummaryUpdate(index, ckstate, state, blkno, page);
       GenericXLogFinish(state);
+      if (BufferIsValid(summaryBuffer))
+        UnlockReleaseBuffer(summaryBuffer);
+      UnlockReleaseBuffer(buffer);
+      TRACE_CUCKOO_INSERT_PAGE(RelationGetRelid(index), blkno, false, nadded);
+
+      if (ninserted == ntuples) {
+        UnlockReleaseBuffer(metaBuffer);
+        return;
+      }
+    } else {
+      GenericXLogAbort(state);
       UnlockReleaseBuffer(buffer);
-      UnlockReleaseBuffer(metaBuffer);
-      MemoryContextSwitchTo(oldCtx);
-      MemoryContextDelete(insertCtx);
-      return false;
     }
 
-    GenericXLogAbort(state);
-    UnlockReleaseBuffer(buffer);
     nStart++;
   }
 
   /*
-   * No space in existing pages, allocate a new one.
+   * No space in existing pages, allocate new ones.
    */
-  buffer = CuckooNewBuffer(index);
+  for (;;) {
+    buffer = CuckooNewDataBuffer(index, ckstate);
 
-  page = GenericXLogRegisterBuffer(state, buffer, GENERIC_XLOG_FULL_IMAGE);
-  CuckooInitPage(page, 0);
+    page = GenericXLogRegisterBuffer(state, buffer, GENERIC_XLOG_FULL_IMAGE);
+    CuckooInitPage(page, 0);
 
-  if (!CuckooPageAddItem(&ckstate, page, itup)) {
-    elog(ERROR, "could not add new cuckoo tuple to empty page");
-  }
+    nadded = addTuplesToPage(
+        ckstate, page,
+        (CuckooTuple *)((Pointer)tuples +
+                        ninserted * ckstate->sizeOfCuckooTuple),
+        ntuples - ninserted);
 
-  /* Reset notFullPage array to contain just this new page */
-  metaData->nStart = 0;
-  metaData->nEnd = 1;
-  metaData->notFullPage[0] = BufferGetBlockNumber(buffer);
+    if (nadded == 0) {
+      elog(ERROR, "could not add new cuckoo tuple to empty page");
+    }
+    ninserted += nadded;
 
-  GenericXLogFinish(state);
+    /* Reset notFullPage array to contain just this new page */
+    metaData->nStart = 0;
+    metaData->nEnd = 1;
+    metaData->notFullPage[0] = BufferGetBlockNumber(buffer);
+
+    summaryBuffer = CuckooSummaryUpdate(index, ckstate, state,
+                                        BufferGetBlockNumber(buffer), page);
+    GenericXLogFinish(state);
+    if (BufferIsValid(summaryBuffer))
+      UnlockReleaseBuffer(summaryBuffer);
+
+    TRACE_CUCKOO_INSERT_PAGE(RelationGetRelid(index),
+                             BufferGetBlockNumber(buffer), true, nadded);
+    UnlockReleaseBuffer(buffer);
+
+    if (ninserted == ntuples)
+      break;
+
+    state = GenericXLogStart(index);
+    metaPage = GenericXLogRegisterBuffer(state, metaBuffer, 0);
+    metaData = CuckooPageGetMeta(metaPage);
+  }
 
-  UnlockReleaseBuffer(buffer);
   UnlockReleaseBuffer(metaBuffer);
+}
+
+/**
+ * @brief Insert a new tuple into the cuckoo index.
+ *
+ * Element opclasses may produce several index tuples for one heap tuple.
+ *
+ * @param index The index relation.
+ * @param values Array of indexed values.
+ * @param isnull Array indicating NULL values.
+ * @param ht_ctid Heap tuple ID.
+ * @param heapRel The heap relation.
+ * @param checkUnique Uniqueness check mode (ignored for cuckoo).
+ * @param indexUnchanged Whether index columns are unchanged.
+ * @param indexInfo Index information.
+ * @return Always returns false (no unique constraint violations).
+ */
+bool ckinsert(Relation index, Datum *values, bool *isnull, ItemPointer ht_ctid,
+              Relation heapRel, IndexUniqueCheck checkUnique,
+              bool indexUnchanged, IndexInfo *indexInfo) {
+  CuckooState ckstate;
+  CuckooTuple *itups;
+  int ntuples;
+  MemoryContext oldCtx;
+  MemoryContext insertCtx;
+
+  insertCtx = AllocSetContextCreate(CurrentMemoryContext,
+                                    "Cuckoo insert temporary context",
+                                    ALLOCSET_DEFAULT_SIZES);
+
+  oldCtx = MemoryContextSwitchTo(insertCtx);
+
+  initCuckooState(&ckstate, index);
+  itups = CuckooFormTuples(&ckstate, ht_ctid, values, isnull, &ntuples);
+  TRACE_CUCKOO_INSERT_START(RelationGetRelid(index), ntuples);
+
+  if (ntuples > 0) {
+    if (ckstate.opts.pagesPerRange > 0)
+      CuckooRangeInsert(index, &ckstate, itups, ntuples);
+    else if (ckstate.opts.layout == CUCKOO_LAYOUT_HASHED)
+      CuckooHashInsert(index, &ckstate, itups, ntuples);
+    else
+      cuckooInsertTuples(index, &ckstate, itups, ntuples, heapRel,
+                         indexUnchanged);
+  }
+
+  if (ckstate.hasRowHash)
+    CuckooSketchInsert(index, ckstate.rowHash);
+  if (ntuples > 0 && CuckooLookupCacheUsed(&ckstate))
+    CuckooBumpChangeCount(index);
+  TRACE_CUCKOO_INSERT_DONE(RelationGetRelid(index), ntuples);
 
   MemoryContextSwitchTo(oldCtx);
   MemoryContextDelete(insertCtx);
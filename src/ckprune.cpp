@@ -0,0 +1,330 @@
+/**
+ * @file ckprune.cpp
+ * @brief Partition pruning from the filters of cuckoo indexes.
+ *
+ * An equality condition on a column that is not the partition key cannot
+ * prune partitions, so every partition's index is scanned. When a
+ * partition has a cuckoo index on the column whose layout can rule out a
+ * value cheaply (a hashed bucket, the XOR filter of a frozen index,
+ * summary pages or block range filters), the planner hook below adds a
+ * one-time filter calling cuckoo_may_contain() to the partition's scan.
+ * The executor evaluates it once at startup, with the current contents of
+ * the index and the values of any parameters, and skips the partition
+ * entirely when the index proves the value absent.
+ *
+ * The check is not made at plan time, since a cached plan outlives the
+ * index contents it would be based on.
+ *
+ * Copyright (c) 2025
+ * SPDX-License-Identifier: PostgreSQL
+ */
+#include "cuckoo.h"
+
+extern "C" {
+#include "access/genam.h"
+#include "access/relation.h"
+#include "access/skey.h"
+#include "access/table.h"
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "commands/extension.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/paths.h"
+#include "optimizer/restrictinfo.h"
+#include "parser/parse_func.h"
+#include "storage/predicate.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+
+PG_FUNCTION_INFO_V1(cuckoo_may_contain);
+}
+
+/* Whether the planner adds cuckoo_may_contain() filters to partitions */
+static bool ck_enable_partition_pruning = true;
+
+/* Hook this module replaces */
+static set_rel_pathlist_hook_type prev_set_rel_pathlist_hook = NULL;
+
+/**
+ * @brief Check whether an index can rule out a fingerprint cheaply.
+ *
+ * A plain flat index would have to read all of its pages.
+ *
+ * @param state Cuckoo index state.
+ * @return true if the index has a layout or summary that can be probed.
+ */
+static bool canProbe(CuckooState *state) {
+  return !state->extractValues && state->nColumns == 1 &&
+         (state->opts.layout != CUCKOO_LAYOUT_FLAT ||
+          state->summaryGroup > 0 || state->opts.pagesPerRange > 0);
+}
+
+/**
+ * @brief Check whether an index may hold a fingerprint.
+ *
+ * @param index The index relation.
+ * @param state Cuckoo index state.
+ * @param fingerprint Fingerprint to look up.
+ * @return false if the index proves that no row has the fingerprint.
+ */
+static bool mayContain(Relation index, CuckooState *state,
+                       uint32 fingerprint) {
+  int ntids;
+
+  if (state->opts.pagesPerRange > 0)
+    return CuckooRangeMayContain(index, state, fingerprint);
+  if (state->opts.layout == CUCKOO_LAYOUT_HASHED) {
+    CuckooHashLookup(index, state, fingerprint, &ntids);
+    return ntids > 0;
+  }
+  if (state->opts.layout == CUCKOO_LAYOUT_FROZEN)
+    return CuckooFrozenMayContain(index, state, fingerprint);
+  if (state->summaryGroup > 0)
+    return CuckooSummaryMayContain(index, state, fingerprint);
+
+  return true;
+}
+
+/**
+ * @brief Check whether a cuckoo index may hold a value.
+ *
+ * Only single-column indexes on whole values can rule a value out; for
+ * other indexes, and for flat indexes without summaries, which would have
+ * to be read in full, the result is always true.
+ *
+ * The caller needs read access to the indexed column; the planner only
+ * adds calls the user could make directly. Under serializable isolation,
+ * a false result takes a predicate lock on the whole table, standing in
+ * for the scan it lets the caller skip.
+ *
+ * @param fcinfo Function call info: regclass index, anyelement value.
+ * @return false if no row of the indexed table can equal the value.
+ */
+extern "C" Datum cuckoo_may_contain(PG_FUNCTION_ARGS) {
+  Oid indexOid = PG_GETARG_OID(0);
+  Datum value = PG_GETARG_DATUM(1);
+  Oid valueType = get_fn_expr_argtype(fcinfo->flinfo, 1);
+  Relation index;
+  CuckooState state;
+  ScanKeyData skey;
+  uint32 fingerprint;
+  bool result = true;
+
+  index = CuckooOpenIndex(indexOid, AccessShareLock);
+  CuckooCheckReadAccess(index);
+  initCuckooState(&state, index);
+  if (canProbe(&state)) {
+    ScanKeyEntryInitialize(&skey, 0, 1, CUCKOO_EQUAL_STRATEGY,
+                           CuckooKeySubtype(index, 0, valueType), InvalidOid,
+                           InvalidOid, value);
+    if (CuckooKeysFingerprint(index, &state, &skey, 1, &fingerprint))
+      result = mayContain(index, &state, fingerprint);
+  }
+
+  if (!result && IsolationIsSerializable()) {
+    Relation heap = table_open(index->rd_index->indrelid, AccessShareLock);
+
+    PredicateLockRelation(heap, GetActiveSnapshot());
+    table_close(heap, AccessShareLock);
+  }
+
+  relation_close(index, AccessShareLock);
+
+  PG_RETURN_BOOL(result);
+}
+
+/**
+ * @brief Look up cuckoo_may_contain() in the extension's schema.
+ *
+ * @return Its OID, or InvalidOid if the extension is not installed.
+ */
+static Oid lookupMayContain(void) {
+  Oid extOid = get_extension_oid("cuckoo", true);
+  Oid argtypes[2] = {REGCLASSOID, ANYELEMENTOID};
+  char *schema;
+
+  if (!OidIsValid(extOid))
+    return InvalidOid;
+
+  schema = get_namespace_name(get_extension_schema(extOid));
+  if (schema == NULL)
+    return InvalidOid;
+
+  return LookupFuncName(list_make2(makeString(schema),
+                                   makeString(pstrdup("cuckoo_may_contain"))),
+                        2, argtypes, true);
+}
+
+/**
+ * @brief Find the value compared for equality with an index column.
+ *
+ * @param rel The relation being scanned.
+ * @param info The index.
+ * @param rinfo A restriction of the relation.
+ * @return The other operand, coerced to the operator's input type, or
+ *         NULL if the restriction is not an equality on the column with an
+ *         expression that is fixed during a scan.
+ */
+static Expr *equalityArgument(RelOptInfo *rel, IndexOptInfo *info,
+                              RestrictInfo *rinfo) {
+  OpExpr *op;
+  Oid inputTypes[2];
+
+  if (rinfo->pseudoconstant || !IsA(rinfo->clause, OpExpr))
+    return NULL;
+
+  op = (OpExpr *)rinfo->clause;
+  if (list_length(op->args) != 2 ||
+      get_op_opfamily_strategy(op->opno, info->opfamily[0]) !=
+          CUCKOO_EQUAL_STRATEGY)
+    return NULL;
+
+  /* The index hashes values under its own collation */
+  if (OidIsValid(info->indexcollations[0]) &&
+      info->indexcollations[0] != op->inputcollid)
+    return NULL;
+
+  op_input_types(op->opno, &inputTypes[0], &inputTypes[1]);
+
+  for (int side = 0; side < 2; side++) {
+    Node *key = (Node *)list_nth(op->args, side);
+    Node *other = (Node *)list_nth(op->args, 1 - side);
+    Oid otherType = inputTypes[1 - side];
+    Var *var;
+
+    if (key && IsA(key, RelabelType))
+      key = (Node *)((RelabelType *)key)->arg;
+    if (key == NULL || !IsA(key, Var))
+      continue;
+
+    var = (Var *)key;
+    if (var->varno != (int)rel->relid || var->varlevelsup != 0 ||
+        var->varattno != info->indexkeys[0])
+      continue;
+
+    if (contain_var_clause(other) || contain_volatile_functions(other) ||
+        contain_subplans(other))
+      continue;
+
+    /* Hash the value with the function of the operator's input type */
+    if (exprType(other) != otherType)
+      other = (Node *)makeRelabelType((Expr *)other, otherType, -1,
+                                      InvalidOid, COERCE_IMPLICIT_CAST);
+
+    return (Expr *)other;
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Check whether a partition's cuckoo index is worth probing.
+ *
+ * @param info The index.
+ * @return true if the index can rule out values cheaply and the current
+ *         user may call cuckoo_may_contain() on it.
+ */
+static bool indexCanProbe(IndexOptInfo *info) {
+  Relation index;
+  CuckooState state;
+  bool result;
+
+  /* The planner already holds a lock on the index */
+  index = index_open(info->indexoid, NoLock);
+  initCuckooState(&state, index);
+  result = canProbe(&state) && CuckooHasReadAccess(index);
+  index_close(index, NoLock);
+
+  return result;
+}
+
+/**
+ * @brief Add cuckoo_may_contain() filters to the scans of a partition.
+ *
+ * For each cuckoo index of the partition that can be probed and has an
+ * equality restriction on its column, adds a pseudoconstant restriction
+ * calling cuckoo_may_contain(). The planner turns it into a one-time
+ * filter above the partition's scan.
+ *
+ * This is the first hook that sees the partition's restrictions, which
+ * are copied from the parent after get_relation_info() has run. Marking
+ * the partition dummy instead would decide at plan time, and cached plans
+ * outlive the index contents. Since the call checks the privileges of the
+ * user running it, the plan is replanned for other users.
+ */
+static void cuckooSetRelPathlist(PlannerInfo *root, RelOptInfo *rel,
+                                 Index rti, RangeTblEntry *rte) {
+  Oid funcOid = InvalidOid;
+  ListCell *lc;
+
+  if (prev_set_rel_pathlist_hook)
+    prev_set_rel_pathlist_hook(root, rel, rti, rte);
+
+  if (!ck_enable_partition_pruning ||
+      rel->reloptkind != RELOPT_OTHER_MEMBER_REL ||
+      rte->rtekind != RTE_RELATION || rel->baserestrictinfo == NIL ||
+      IS_DUMMY_REL(rel))
+    return;
+
+  foreach (lc, rel->indexlist) {
+    IndexOptInfo *info = (IndexOptInfo *)lfirst(lc);
+    ListCell *lc2;
+
+    /* A partial index says nothing about the rows it leaves out */
+    if (info->amcostestimate != ckcostestimate || info->ncolumns != 1 ||
+        info->indexkeys[0] == 0 || info->indpred != NIL)
+      continue;
+
+    foreach (lc2, rel->baserestrictinfo) {
+      Expr *arg = equalityArgument(rel, info, (RestrictInfo *)lfirst(lc2));
+      Expr *clause;
+
+      if (arg == NULL)
+        continue;
+      if (!indexCanProbe(info))
+        break;
+
+      if (!OidIsValid(funcOid)) {
+        funcOid = lookupMayContain();
+        if (!OidIsValid(funcOid))
+          return;
+      }
+
+      clause = (Expr *)makeFuncExpr(
+          funcOid, BOOLOID,
+          list_make2(makeConst(REGCLASSOID, -1, InvalidOid, sizeof(Oid),
+                               ObjectIdGetDatum(info->indexoid), false, true),
+                     copyObject(arg)),
+          InvalidOid, InvalidOid, COERCE_EXPLICIT_CALL);
+
+      rel->baserestrictinfo = lappend(
+          rel->baserestrictinfo,
+          make_restrictinfo(root, clause, true, false, false, true, 0, NULL,
+                            NULL, NULL));
+      root->hasPseudoConstantQuals = true;
+      root->glob->dependsOnRole = true;
+      break;
+    }
+  }
+}
+
+/**
+ * @brief Install the partition pruning hook and its setting.
+ *
+ * Called from _PG_init().
+ */
+void CuckooInitPruning(void) {
+  DefineCustomBoolVariable(
+      "cuckoo.enable_partition_pruning",
+      "Skips partitions whose cuckoo index proves an equality value absent.",
+      NULL, &ck_enable_partition_pruning, true, PGC_USERSET, 0, NULL, NULL,
+      NULL);
+  MarkGUCPrefixReserved("cuckoo");
+
+  prev_set_rel_pathlist_hook = set_rel_pathlist_hook;
+  set_rel_pathlist_hook = cuckooSetRelPathlist;
+}
@@ -0,0 +1,1220 @@
+/**
+ * @file ckrange.cpp
+ * @brief Block range filters for cuckoo indexes.
+ *
+ * With pages_per_range, the index keeps no heap TIDs. Instead it keeps one
+ * small cuckoo filter of fingerprints per range of heap blocks, like a BRIN
+ * index keeps one summary per range, and a scan returns every block of the
+ * matching ranges as lossy bitmap pages. The filters are found through
+ * directory pages, whose block numbers are kept in the metapage's block
+ * array.
+ *
+ * Inserts add their fingerprints to the filter of their range. A filter
+ * with no room left is marked overflowed and, like a range that has no
+ * filter yet, matches every query until VACUUM summarizes it again from
+ * the heap. Filters are never shrunk on delete, so dead values only cost
+ * false positives.
+ *
+ * A filter of several pages occupies a run of consecutive pages. The run
+ * of a filter replaced by summarization is returned to the free space map
+ * and taken again by a later filter that fits in it.
+ *
+ * Locking: the directory page holding a range's entry locks the range.
+ * Scans hold it shared while probing the filter, inserts exclusively while
+ * modifying it, so a tag moved between buckets is never missed. An insert
+ * changes at most MAX_GENERIC_XLOG_PAGES filter pages in one WAL record,
+ * and marks the range overflowed if it would need more. Summarizing a
+ * range first flags its entry, scans the heap range without the lock, and
+ * installs the new filter only if no insert arrived in the meantime.
+ *
+ * Copyright (c) 2025
+ * SPDX-License-Identifier: PostgreSQL
+ */
+#include "cuckoo.h"
+
+extern "C" {
+#include "access/table.h"
+#include "access/tableam.h"
+#include "catalog/index.h"
+#include "commands/vacuum.h"
+#include "common/hashfn.h"
+#include "common/pg_prng.h"
+#include "miscadmin.h"
+#include "nodes/tidbitmap.h"
+#include "port/pg_bitutils.h"
+#include "storage/bufmgr.h"
+#include "storage/freespace.h"
+#include "storage/indexfsm.h"
+#include "storage/lmgr.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+}
+
+/* Bytes of content on a directory or filter page */
+#define CUCKOO_RANGE_PAGE_BYTES                                                \
+  (BLCKSZ - MAXALIGN(SizeOfPageHeaderData) -                                   \
+   MAXALIGN(sizeof(CuckooPageOpaqueData)))
+
+/* Load factor range filters are sized for, in percent */
+#define CUCKOO_RANGE_FILL_PERCENT 80
+
+/* Largest range filter, in buckets */
+#define CUCKOO_RANGE_MAX_BUCKETS (UINT32CONST(1) << 24)
+
+/* Free pages tried as the start of a run before extending the index */
+#define CUCKOO_RANGE_RUN_ATTEMPTS 8
+
+/**
+ * @brief A range filter being built in memory or modified on disk.
+ */
+typedef struct CuckooRangeFilter {
+  CuckooState *state;     /**< Cuckoo index state */
+  uint32 nBuckets;        /**< Number of buckets (a power of two) */
+  Size bucketBytes;       /**< Bytes per bucket */
+  uint32 bucketsPerPage;  /**< Buckets per filter page */
+  uint8 *data;            /**< In-memory filter, or NULL if on disk */
+  Relation index;         /**< Index holding the on-disk filter */
+  BlockNumber start;      /**< First page of the on-disk filter */
+  GenericXLogState *xlog; /**< WAL record the filter pages are changed in */
+  int nbuffers;           /**< Filter pages registered in xlog */
+  Buffer buffers[MAX_GENERIC_XLOG_PAGES]; /**< Registered filter pages */
+  Page pages[MAX_GENERIC_XLOG_PAGES];     /**< Their images in xlog */
+} CuckooRangeFilter;
+
+/**
+ * @brief State maintained while collecting the fingerprints of ranges.
+ */
+typedef struct CuckooRangeBuildState {
+  CuckooState *ckstate;      /**< Cuckoo index state */
+  Relation index;            /**< The index relation */
+  BlockNumber heapBlocks;    /**< Heap size when the scan started */
+  uint32 curRange;           /**< Range being collected */
+  uint32 *fingerprints;      /**< Fingerprints of the current range */
+  int nfingerprints;         /**< Number of entries in fingerprints */
+  int maxfingerprints;       /**< Allocated size of fingerprints */
+  CuckooRangeEntry *entries; /**< Entries of finished ranges (build) */
+  uint32 maxentries;         /**< Allocated size of entries */
+  int64 indtuples;           /**< Total number of fingerprints collected */
+  MemoryContext tmpCtx;      /**< Temporary memory context */
+} CuckooRangeBuildState;
+
+/**
+ * @brief Initialize the geometry of a range filter.
+ *
+ * @param filter Filter to initialize.
+ * @param state Cuckoo index state.
+ * @param nBuckets Number of buckets.
+ */
+static void initFilter(CuckooRangeFilter *filter, CuckooState *state,
+                       uint32 nBuckets) {
+  memset(filter, 0, sizeof(CuckooRangeFilter));
+  filter->state = state;
+  filter->nBuckets = nBuckets;
+  filter->bucketBytes =
+      (state->tagsPerBucket * state->opts.bitsPerTag + 7) / 8;
+  filter->bucketsPerPage =
+      (uint32)(CUCKOO_RANGE_PAGE_BYTES / filter->bucketBytes);
+  filter->start = InvalidBlockNumber;
+}
+
+/**
+ * @brief Number of pages a filter occupies.
+ */
+static uint32 filterPages(CuckooRangeFilter *filter) {
+  return (filter->nBuckets + filter->bucketsPerPage - 1) /
+         filter->bucketsPerPage;
+}
+
+/**
+ * @brief Read a packed tag of a bucket.
+ *
+ * @param bucket Bucket bytes.
+ * @param i Slot within the bucket.
+ * @param bits Bits per tag.
+ * @return The tag, 0 for an empty slot.
+ */
+static inline uint32 bucketGetTag(const uint8 *bucket, int i, int bits) {
+  uint32 bit = (uint32)i * bits;
+  const uint8 *p = bucket + (bit >> 3);
+  int shift = bit & 7;
+  int nbytes = (shift + bits + 7) >> 3;
+  uint64 v = 0;
+
+  for (int k = 0; k < nbytes; k++)
+    v |= (uint64)p[k] << (8 * k);
+
+  return (uint32)((v >> shift) & ((UINT64CONST(1) << bits) - 1));
+}
+
+/**
+ * @brief Write a packed tag of a bucket.
+ *
+ * @param bucket Bucket bytes.
+ * @param i Slot within the bucket.
+ * @param bits Bits per tag.
+ * @param tag Tag to store.
+ */
+static inline void bucketSetTag(uint8 *bucket, int i, int bits, uint32 tag) {
+  uint32 bit = (uint32)i * bits;
+  uint8 *p = bucket + (bit >> 3);
+  int shift = bit & 7;
+  int nbytes = (shift + bits + 7) >> 3;
+  uint64 mask = ((UINT64CONST(1) << bits) - 1) << shift;
+  uint64 v = 0;
+
+  for (int k = 0; k < nbytes; k++)
+    v |= (uint64)p[k] << (8 * k);
+  v = (v & ~mask) | ((uint64)tag << shift);
+  for (int k = 0; k < nbytes; k++)
+    p[k] = (uint8)(v >> (8 * k));
+}
+
+/**
+ * @brief First candidate bucket of a fingerprint.
+ */
+static inline uint32 primaryBucket(CuckooRangeFilter *filter,
+                                   uint32 fingerprint) {
+  return murmurhash32(fingerprint) & (filter->nBuckets - 1);
+}
+
+/**
+ * @brief The other candidate bucket of a fingerprint stored in a bucket.
+ *
+ * Partial-key cuckoo hashing: the alternate bucket depends only on the
+ * current bucket and the tag, so a tag can be moved without its key.
+ */
+static inline uint32 altBucket(CuckooRangeFilter *filter, uint32 bucket,
+                               uint32 fingerprint) {
+  return (bucket ^ murmurhash32(fingerprint ^ 0x5bd1e995)) &
+         (filter->nBuckets - 1);
+}
+
+/**
+ * @brief Get a bucket of a filter for modification.
+ *
+ * For an on-disk filter, registers the bucket's page in the filter's WAL
+ * record on first use.
+ *
+ * @param filter The filter.
+ * @param b Bucket number.
+ * @return The bucket, or NULL if the WAL record has no room for its page.
+ */
+static uint8 *filterBucket(CuckooRangeFilter *filter, uint32 b) {
+  BlockNumber blkno;
+  Buffer buffer;
+  int i;
+
+  if (filter->data)
+    return filter->data + (Size)b * filter->bucketBytes;
+
+  blkno = filter->start + b / filter->bucketsPerPage;
+  for (i = 0; i < filter->nbuffers; i++) {
+    if (BufferGetBlockNumber(filter->buffers[i]) == blkno)
+      break;
+  }
+
+  if (i == filter->nbuffers) {
+    if (filter->nbuffers == MAX_GENERIC_XLOG_PAGES)
+      return NULL;
+
+    buffer = ReadBuffer(filter->index, blkno);
+    LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+    filter->buffers[i] = buffer;
+    filter->pages[i] = GenericXLogRegisterBuffer(filter->xlog, buffer, 0);
+    filter->nbuffers++;
+  }
+
+  return (uint8 *)PageGetContents(filter->pages[i]) +
+         (b % filter->bucketsPerPage) * filter->bucketBytes;
+}
+
+/**
+ * @brief Check whether a bucket holds a tag.
+ */
+static bool bucketContains(CuckooRangeFilter *filter, const uint8 *bucket,
+                           uint32 tag) {
+  for (int i = 0; i < filter->state->tagsPerBucket; i++) {
+    if (bucketGetTag(bucket, i, filter->state->opts.bitsPerTag) == tag)
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * @brief Store a tag in a free slot of a bucket.
+ *
+ * @return false if the bucket is full.
+ */
+static bool bucketAdd(CuckooRangeFilter *filter, uint8 *bucket, uint32 tag) {
+  for (int i = 0; i < filter->state->tagsPerBucket; i++) {
+    if (bucketGetTag(bucket, i, filter->state->opts.bitsPerTag) == 0) {
+      bucketSetTag(bucket, i, filter->state->opts.bitsPerTag, tag);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @brief Add a fingerprint to a filter.
+ *
+ * Fingerprints already present are not added twice. When both candidate
+ * buckets are full, tags are kicked to their alternate buckets up to
+ * max_kicks times.
+ *
+ * @param filter The filter.
+ * @param fingerprint Fingerprint to add (never 0).
+ * @return false if the filter is full, in which case a tag has been lost
+ *         and the filter must be discarded.
+ */
+static bool filterInsert(CuckooRangeFilter *filter, uint32 fingerprint) {
+  int bits = filter->state->opts.bitsPerTag;
+  uint32 b1 = primaryBucket(filter, fingerprint);
+  uint32 b2 = altBucket(filter, b1, fingerprint);
+  uint8 *bucket1 = filterBucket(filter, b1);
+  uint8 *bucket2 = filterBucket(filter, b2);
+  uint32 b;
+  uint32 tag = fingerprint;
+
+  if (bucket1 == NULL || bucket2 == NULL)
+    return false;
+  if (bucketContains(filter, bucket1, tag) ||
+      bucketContains(filter, bucket2, tag))
+    return true;
+  if (bucketAdd(filter, bucket1, tag) || bucketAdd(filter, bucket2, tag))
+    return true;
+
+  b = (pg_prng_uint32(&pg_global_prng_state) & 1) ? b1 : b2;
+  for (int kick = 0; kick < filter->state->maxKicks; kick++) {
+    uint8 *bucket = filterBucket(filter, b);
+    int slot =
+        (int)(pg_prng_uint32(&pg_global_prng_state) %
+              (uint32)filter->state->tagsPerBucket);
+    uint32 victim = bucketGetTag(bucket, slot, bits);
+
+    bucketSetTag(bucket, slot, bits, tag);
+    tag = victim;
+    b = altBucket(filter, b, tag);
+
+    bucket = filterBucket(filter, b);
+    if (bucket == NULL)
+      return false;
+    if (bucketAdd(filter, bucket, tag))
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * @brief Read-only check for a fingerprint in an on-disk range filter.
+ *
+ * @param index The index relation.
+ * @param filter Filter geometry, with start set.
+ * @param fingerprint Fingerprint to look up.
+ * @return true if the filter may hold the fingerprint.
+ */
+static bool filterContains(Relation index, CuckooRangeFilter *filter,
+                           uint32 fingerprint) {
+  uint32 b1 = primaryBucket(filter, fingerprint);
+  uint32 buckets[2] = {b1, altBucket(filter, b1, fingerprint)};
+
+  for (int i = 0; i < 2; i++) {
+    Buffer buffer;
+    const uint8 *bucket;
+    bool found;
+
+    buffer = ReadBuffer(index, filter->start +
+                                   buckets[i] / filter->bucketsPerPage);
+    LockBuffer(buffer, BUFFER_LOCK_SHARE);
+    bucket = (const uint8 *)PageGetContents(BufferGetPage(buffer)) +
+             (buckets[i] % filter->bucketsPerPage) * filter->bucketBytes;
+    found = bucketContains(filter, bucket, fingerprint);
+    UnlockReleaseBuffer(buffer);
+
+    if (found)
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * @brief Take a run of consecutive free pages from the free space map.
+ *
+ * Filters freed by summarization leave such runs behind. Each free page
+ * the map offers is tried as the start of a run; the pages following it
+ * must be recorded free as well.
+ *
+ * @param index The index relation.
+ * @param npages Number of pages.
+ * @param buffers Output: pinned, unlocked buffers of the pages.
+ * @return Block number of the first page, or InvalidBlockNumber.
+ */
+static BlockNumber reuseFreeRun(Relation index, uint32 npages,
+                                Buffer *buffers) {
+  for (int attempt = 0; attempt < CUCKOO_RANGE_RUN_ATTEMPTS; attempt++) {
+    BlockNumber first = GetFreeIndexPage(index);
+    uint32 n = 1;
+    uint32 nbuffers = 0;
+
+    if (first == InvalidBlockNumber)
+      break;
+
+    while (n < npages &&
+           GetRecordedFreeSpace(index, first + n) >= BLCKSZ / 2)
+      n++;
+    if (n < npages) {
+      RecordFreeIndexPage(index, first);
+      continue;
+    }
+
+    for (uint32 p = 1; p < npages; p++)
+      RecordUsedIndexPage(index, first + p);
+
+    /* The map may be out of date, so check that the pages are free */
+    while (nbuffers < npages) {
+      Buffer buffer = ReadBuffer(index, first + nbuffers);
+      bool isFree = false;
+
+      if (ConditionalLockBuffer(buffer)) {
+        Page page = BufferGetPage(buffer);
+
+        isFree = PageIsNew(page) || CuckooPageIsDeleted(page);
+        LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+      }
+      if (!isFree) {
+        ReleaseBuffer(buffer);
+        break;
+      }
+      buffers[nbuffers++] = buffer;
+    }
+
+    if (nbuffers == npages)
+      return first;
+
+    /* Give back the pages checked so far, and the ones not reached */
+    for (uint32 p = 0; p < npages; p++) {
+      if (p < nbuffers)
+        ReleaseBuffer(buffers[p]);
+      if (p != nbuffers)
+        RecordFreeIndexPage(index, first + p);
+    }
+    FreeSpaceMapVacuumRange(index, first, first + npages);
+  }
+
+  return InvalidBlockNumber;
+}
+
+/**
+ * @brief Allocate consecutive new pages at the end of the index.
+ *
+ * Holds the extension lock throughout, so no other backend's pages are
+ * interleaved.
+ *
+ * @param index The index relation.
+ * @param npages Number of pages.
+ * @param buffers Output: pinned, unlocked buffers of the new pages.
+ * @return Block number of the first page.
+ */
+static BlockNumber extendContiguous(Relation index, uint32 npages,
+                                    Buffer *buffers) {
+  BlockNumber first = InvalidBlockNumber;
+  uint32 done = 0;
+
+  LockRelationForExtension(index, ExclusiveLock);
+  while (done < npages) {
+    uint32 extended;
+    BlockNumber blkno;
+
+    blkno = ExtendBufferedRelBy(BMR_REL(index), MAIN_FORKNUM, NULL,
+                                EB_SKIP_EXTENSION_LOCK, npages - done,
+                                buffers + done, &extended);
+    if (done == 0)
+      first = blkno;
+    done += extended;
+  }
+  UnlockRelationForExtension(index, ExclusiveLock);
+
+  return first;
+}
+
+/**
+ * @brief Build a range filter from fingerprints and write it to new pages.
+ *
+ * @param index The index relation.
+ * @param state Cuckoo index state.
+ * @param fingerprints Fingerprints of the range (sorted and distinct).
+ * @param nfingerprints Number of fingerprints.
+ * @param expected Number of fingerprints to size the filter for.
+ * @return Directory entry describing the filter.
+ */
+static CuckooRangeEntry writeRangeFilter(Relation index, CuckooState *state,
+                                         const uint32 *fingerprints,
+                                         int nfingerprints, double expected) {
+  CuckooRangeFilter filter;
+  CuckooRangeEntry entry;
+  double wanted;
+  uint32 nBuckets;
+  uint32 npages;
+  Buffer *buffers;
+
+  wanted = expected * 100.0 /
+           (state->tagsPerBucket * CUCKOO_RANGE_FILL_PERCENT);
+  nBuckets = (uint32)pg_nextpower2_32(
+      (uint32)Min(Max(wanted, 1.0), (double)CUCKOO_RANGE_MAX_BUCKETS));
+
+  /* Grow the filter until every fingerprint finds a place */
+  for (;;) {
+    bool ok = true;
+
+    initFilter(&filter, state, nBuckets);
+    filter.data = (uint8 *)palloc0((Size)nBuckets * filter.bucketBytes);
+
+    for (int i = 0; i < nfingerprints && ok; i++)
+      ok = filterInsert(&filter, fingerprints[i]);
+    if (ok)
+      break;
+
+    if (nBuckets >= CUCKOO_RANGE_MAX_BUCKETS)
+      elog(ERROR, "could not build block range filter for cuckoo index \"%s\"",
+           RelationGetRelationName(index));
+    pfree(filter.data);
+    nBuckets *= 2;
+  }
+
+  /* Larger filters need a run of pages, reused if one has been freed */
+  npages = filterPages(&filter);
+  buffers = (Buffer *)palloc(sizeof(Buffer) * npages);
+  if (npages == 1) {
+    buffers[0] = CuckooNewBuffer(index);
+    entry.filterStart = BufferGetBlockNumber(buffers[0]);
+  } else {
+    entry.filterStart = reuseFreeRun(index, npages, buffers);
+    if (entry.filterStart == InvalidBlockNumber)
+      entry.filterStart = extendContiguous(index, npages, buffers);
+  }
+
+  for (uint32 p = 0; p < npages; p++) {
+    GenericXLogState *xlog;
+    Page page;
+    uint32 first = p * filter.bucketsPerPage;
+    Size size =
+        (Size)(Min(nBuckets - first, filter.bucketsPerPage)) *
+        filter.bucketBytes;
+
+    if (npages > 1)
+      LockBuffer(buffers[p], BUFFER_LOCK_EXCLUSIVE);
+    xlog = GenericXLogStart(index);
+    page = GenericXLogRegisterBuffer(xlog, buffers[p],
+                                     GENERIC_XLOG_FULL_IMAGE);
+    CuckooInitPage(page, CUCKOO_RANGE);
+    memcpy(PageGetContents(page),
+           filter.data + (Size)first * filter.bucketBytes, size);
+    ((PageHeader)page)->pd_lower += size;
+    GenericXLogFinish(xlog);
+    UnlockReleaseBuffer(buffers[p]);
+  }
+
+  pfree(buffers);
+  pfree(filter.data);
+
+  entry.nBuckets = nBuckets;
+  entry.flags = 0;
+  return entry;
+}
+
+/**
+ * @brief Release the pages of a range filter that is no longer referenced.
+ *
+ * @param index The index relation.
+ * @param state Cuckoo index state.
+ * @param entry Entry that described the filter.
+ */
+static void freeRangeFilter(Relation index, CuckooState *state,
+                            CuckooRangeEntry *entry) {
+  CuckooRangeFilter filter;
+
+  if (entry->filterStart == InvalidBlockNumber)
+    return;
+
+  initFilter(&filter, state, entry->nBuckets);
+  for (uint32 p = 0; p < filterPages(&filter); p++) {
+    BlockNumber blkno = entry->filterStart + p;
+    Buffer buffer = ReadBuffer(index, blkno);
+    GenericXLogState *xlog;
+
+    LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+    xlog = GenericXLogStart(index);
+    CuckooPageSetDeleted(GenericXLogRegisterBuffer(xlog, buffer, 0));
+    GenericXLogFinish(xlog);
+    UnlockReleaseBuffer(buffer);
+
+    RecordFreeIndexPage(index, blkno);
+  }
+
+  /* Make the run visible to the next filter's search of the map */
+  FreeSpaceMapVacuumRange(index, entry->filterStart,
+                          entry->filterStart + filterPages(&filter));
+}
+
+/**
+ * @brief Sort and deduplicate the collected fingerprints of a range.
+ *
+ * @param buildstate Collection state.
+ * @param start First heap block of the range.
+ * @param expected Output: number of fingerprints to size the filter for.
+ * @return Number of distinct fingerprints.
+ */
+static int finishRangeFingerprints(CuckooRangeBuildState *buildstate,
+                                   BlockNumber start, double *expected) {
+  uint32 pagesPerRange = buildstate->ckstate->opts.pagesPerRange;
+  int n = CuckooUniqueFingerprints(buildstate->fingerprints,
+                                   buildstate->nfingerprints);
+
+  /* Leave room for the rest of a range the heap has not filled yet */
+  *expected = n;
+  if (start + pagesPerRange > buildstate->heapBlocks &&
+      buildstate->heapBlocks > start)
+    *expected = n * (double)pagesPerRange / (buildstate->heapBlocks - start);
+
+  return n;
+}
+
+/**
+ * @brief Write the filter of the range being collected by a build.
+ *
+ * @param buildstate Build state.
+ */
+static void flushBuildRange(CuckooRangeBuildState *buildstate) {
+  BlockNumber start =
+      buildstate->curRange * buildstate->ckstate->opts.pagesPerRange;
+  double expected;
+  int n = finishRangeFingerprints(buildstate, start, &expected);
+
+  if (buildstate->curRange >= buildstate->maxentries) {
+    buildstate->maxentries *= 2;
+    buildstate->entries = (CuckooRangeEntry *)repalloc_huge(
+        buildstate->entries,
+        sizeof(CuckooRangeEntry) * buildstate->maxentries);
+  }
+
+  buildstate->entries[buildstate->curRange] =
+      writeRangeFilter(buildstate->index, buildstate->ckstate,
+                       buildstate->fingerprints, n, expected);
+  buildstate->curRange++;
+  buildstate->nfingerprints = 0;
+}
+
+/**
+ * @brief Callback collecting the fingerprints of heap tuples by range.
+ *
+ * The build scans the heap in block order, so a range is finished as soon
+ * as a tuple of a later range shows up.
+ */
+static void rangeBuildCallback(Relation index, ItemPointer tid, Datum *values,
+                               bool *isnull, bool tupleIsAlive, void *state) {
+  CuckooRangeBuildState *buildstate = (CuckooRangeBuildState *)state;
+  uint32 range = ItemPointerGetBlockNumber(tid) /
+                 buildstate->ckstate->opts.pagesPerRange;
+  MemoryContext oldCtx;
+  uint32 *fingerprints;
+  int nfingerprints;
+
+  /* Only a build finishes ranges; summarization scans a single range */
+  if (buildstate->entries) {
+    while (buildstate->curRange < range)
+      flushBuildRange(buildstate);
+  }
+
+  oldCtx = MemoryContextSwitchTo(buildstate->tmpCtx);
+  fingerprints = computeFingerprints(buildstate->ckstate, values, isnull,
+                                     &nfingerprints);
+  MemoryContextSwitchTo(oldCtx);
+
+  if (buildstate->nfingerprints + nfingerprints > buildstate->maxfingerprints) {
+    buildstate->maxfingerprints =
+        Max(buildstate->maxfingerprints * 2,
+            buildstate->nfingerprints + nfingerprints);
+    buildstate->fingerprints = (uint32 *)repalloc_huge(
+        buildstate->fingerprints,
+        sizeof(uint32) * buildstate->maxfingerprints);
+  }
+  memcpy(buildstate->fingerprints + buildstate->nfingerprints, fingerprints,
+         sizeof(uint32) * nfingerprints);
+  buildstate->nfingerprints += nfingerprints;
+  buildstate->indtuples += nfingerprints;
+
+  MemoryContextReset(buildstate->tmpCtx);
+}
+
+/**
+ * @brief Initialize the state for collecting range fingerprints.
+ */
+static void initRangeBuildState(CuckooRangeBuildState *buildstate,
+                                Relation heap, Relation index,
+                                CuckooState *ckstate) {
+  memset(buildstate, 0, sizeof(CuckooRangeBuildState));
+  buildstate->ckstate = ckstate;
+  buildstate->index = index;
+  buildstate->heapBlocks = RelationGetNumberOfBlocks(heap);
+  buildstate->maxfingerprints = 1024;
+  buildstate->fingerprints =
+      (uint32 *)palloc(sizeof(uint32) * buildstate->maxfingerprints);
+  buildstate->tmpCtx = AllocSetContextCreate(CurrentMemoryContext,
+                                             "Cuckoo range temporary context",
+                                             ALLOCSET_DEFAULT_SIZES);
+}
+
+/**
+ * @brief Write directory pages for the range entries of a build.
+ *
+ * @param index The index relation.
+ * @param entries Range entries.
+ * @param nRanges Number of ranges.
+ */
+static void writeDirectory(Relation index, CuckooRangeEntry *entries,
+                           uint32 nRanges) {
+  CuckooRangeMetaData range;
+  BlockNumber dirBlocks[CuckooMetaBlockN];
+  Buffer metaBuffer;
+  GenericXLogState *xlog;
+  CuckooMetaPageData *meta;
+
+  range.nRanges = nRanges;
+  range.nDirPages = (nRanges + CUCKOO_RANGE_ENTRIES - 1) / CUCKOO_RANGE_ENTRIES;
+  if (range.nDirPages > CuckooMetaBlockN)
+    ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                    errmsg("too many block ranges for cuckoo index \"%s\"",
+                           RelationGetRelationName(index)),
+                    errhint("Increase pages_per_range.")));
+
+  for (uint32 d = 0; d < range.nDirPages; d++) {
+    Buffer buffer = CuckooNewBuffer(index);
+    uint32 first = d * CUCKOO_RANGE_ENTRIES;
+    uint32 n = Min(nRanges - first, (uint32)CUCKOO_RANGE_ENTRIES);
+    Page page;
+
+    xlog = GenericXLogStart(index);
+    page = GenericXLogRegisterBuffer(xlog, buffer, GENERIC_XLOG_FULL_IMAGE);
+    CuckooInitPage(page, CUCKOO_DIRECTORY);
+    memcpy(PageGetContents(page), entries + first,
+           sizeof(CuckooRangeEntry) * n);
+    ((PageHeader)page)->pd_lower +=
+        sizeof(CuckooRangeEntry) * CUCKOO_RANGE_ENTRIES;
+    GenericXLogFinish(xlog);
+
+    dirBlocks[d] = BufferGetBlockNumber(buffer);
+    UnlockReleaseBuffer(buffer);
+  }
+
+  metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(metaBuffer, BUFFER_LOCK_EXCLUSIVE);
+  xlog = GenericXLogStart(index);
+  meta = CuckooPageGetMeta(GenericXLogRegisterBuffer(xlog, metaBuffer, 0));
+  meta->range = range;
+  memcpy(meta->notFullPage, dirBlocks, sizeof(BlockNumber) * range.nDirPages);
+  GenericXLogFinish(xlog);
+  UnlockReleaseBuffer(metaBuffer);
+}
+
+/**
+ * @brief Build an index with block range filters.
+ *
+ * @param heap The heap relation being indexed.
+ * @param index The index relation to build.
+ * @param indexInfo Index information.
+ * @param ckstate Cuckoo index state.
+ * @param indtuples Output: number of fingerprints collected.
+ * @return Number of heap tuples scanned.
+ */
+double CuckooRangeBuild(Relation heap, Relation index, IndexInfo *indexInfo,
+                        CuckooState *ckstate, int64 *indtuples) {
+  CuckooRangeBuildState buildstate;
+  uint32 nRanges;
+  double reltuples;
+
+  initRangeBuildState(&buildstate, heap, index, ckstate);
+  buildstate.maxentries = 64;
+  buildstate.entries = (CuckooRangeEntry *)palloc(sizeof(CuckooRangeEntry) *
+                                                  buildstate.maxentries);
+
+  /* Ranges are finished in block order, so no synchronized scan */
+  reltuples = table_index_build_scan(heap, index, indexInfo, false, true,
+                                     rangeBuildCallback, &buildstate, NULL);
+
+  /* Ranges up to the end of the heap, including empty ones, get a filter */
+  nRanges = (buildstate.heapBlocks + ckstate->opts.pagesPerRange - 1) /
+            ckstate->opts.pagesPerRange;
+  while (buildstate.curRange < nRanges)
+    flushBuildRange(&buildstate);
+
+  writeDirectory(index, buildstate.entries, buildstate.curRange);
+
+  MemoryContextDelete(buildstate.tmpCtx);
+  pfree(buildstate.fingerprints);
+  pfree(buildstate.entries);
+
+  *indtuples = buildstate.indtuples;
+  return reltuples;
+}
+
+/**
+ * @brief Read the block range state and directory blocks from the metapage.
+ *
+ * @param index The index relation.
+ * @param range Output: block range state.
+ * @param dirBlocks Output: directory page block numbers.
+ */
+static void readRangeMeta(Relation index, CuckooRangeMetaData *range,
+                          BlockNumber *dirBlocks) {
+  Buffer buffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  CuckooMetaPageData *meta;
+
+  LockBuffer(buffer, BUFFER_LOCK_SHARE);
+  meta = CuckooPageGetMeta(BufferGetPage(buffer));
+  *range = meta->range;
+  memcpy(dirBlocks, meta->notFullPage, sizeof(BlockNumber) * range->nDirPages);
+  UnlockReleaseBuffer(buffer);
+}
+
+/**
+ * @brief Get a range's directory entry on a locked directory page.
+ */
+static inline CuckooRangeEntry *pageGetEntry(Page page, uint32 range) {
+  return (CuckooRangeEntry *)PageGetContents(page) +
+         range % CUCKOO_RANGE_ENTRIES;
+}
+
+/**
+ * @brief Set flags on a range entry, WAL-logged.
+ *
+ * @param index The index relation.
+ * @param dirBuffer Exclusively locked directory page.
+ * @param range Range number.
+ * @param set Flags to set.
+ * @param clear Flags to clear.
+ */
+static void setEntryFlags(Relation index, Buffer dirBuffer, uint32 range,
+                          uint32 set, uint32 clear) {
+  GenericXLogState *xlog = GenericXLogStart(index);
+  Page page = GenericXLogRegisterBuffer(xlog, dirBuffer, 0);
+  CuckooRangeEntry *entry = pageGetEntry(page, range);
+
+  entry->flags = (entry->flags & ~clear) | set;
+  GenericXLogFinish(xlog);
+}
+
+/**
+ * @brief Add the fingerprints of a heap tuple to its range filter.
+ *
+ * Ranges without a filter are left alone; VACUUM summarizes them.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param tuples Tuples of one heap tuple.
+ * @param ntuples Number of tuples.
+ */
+void CuckooRangeInsert(Relation index, CuckooState *ckstate,
+                       CuckooTuple *tuples, int ntuples) {
+  uint32 range = ItemPointerGetBlockNumber(&tuples[0].heapPtr) /
+                 ckstate->opts.pagesPerRange;
+  CuckooRangeMetaData rangeMeta;
+  BlockNumber dirBlocks[CuckooMetaBlockN];
+  CuckooRangeFilter filter;
+  CuckooRangeEntry *entry;
+  Buffer dirBuffer;
+  bool ok = true;
+
+  readRangeMeta(index, &rangeMeta, dirBlocks);
+  if (range >= rangeMeta.nRanges)
+    return;
+
+  dirBuffer = ReadBuffer(index, dirBlocks[range / CUCKOO_RANGE_ENTRIES]);
+  LockBuffer(dirBuffer, BUFFER_LOCK_EXCLUSIVE);
+  entry = pageGetEntry(BufferGetPage(dirBuffer), range);
+
+  /* Make a running summarization discard what it found */
+  if (entry->flags & CUCKOO_RANGE_SUMMARIZING) {
+    if (!(entry->flags & CUCKOO_RANGE_DIRTY))
+      setEntryFlags(index, dirBuffer, range, CUCKOO_RANGE_DIRTY, 0);
+    UnlockReleaseBuffer(dirBuffer);
+    return;
+  }
+
+  if (CuckooRangeMatchesAll(entry)) {
+    UnlockReleaseBuffer(dirBuffer);
+    return;
+  }
+
+  initFilter(&filter, ckstate, entry->nBuckets);
+  filter.index = index;
+  filter.start = entry->filterStart;
+  filter.xlog = GenericXLogStart(index);
+
+  for (int i = 0; i < ntuples && ok; i++)
+    ok = filterInsert(&filter, tuples[i].fingerprint);
+
+  if (ok)
+    GenericXLogFinish(filter.xlog);
+  else
+    GenericXLogAbort(filter.xlog);
+  for (int i = 0; i < filter.nbuffers; i++)
+    UnlockReleaseBuffer(filter.buffers[i]);
+
+  if (!ok)
+    setEntryFlags(index, dirBuffer, range, CUCKOO_RANGE_OVERFLOWED, 0);
+
+  UnlockReleaseBuffer(dirBuffer);
+}
+
+/**
+ * @brief Check a range entry against the query keys.
+ *
+ * The caller holds the directory page locked.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param entry Range entry.
+ * @param keys Query keys.
+ * @param nkeys Number of query keys.
+ * @return false if no row of the range can match.
+ */
+static bool rangeMatches(Relation index, CuckooState *ckstate,
+                         CuckooRangeEntry *entry, CuckooQueryKey *keys,
+                         int nkeys) {
+  CuckooRangeFilter filter;
+
+  if (CuckooRangeMatchesAll(entry))
+    return true;
+
+  initFilter(&filter, ckstate, entry->nBuckets);
+  filter.start = entry->filterStart;
+
+  for (int k = 0; k < nkeys; k++) {
+    CuckooQueryKey *key = &keys[k];
+    bool found = !key->matchAny;
+
+    if (key->nfingerprints == 0)
+      continue;
+
+    for (int i = 0; i < key->nfingerprints; i++) {
+      bool contains = filterContains(index, &filter, key->fingerprints[i]);
+
+      if (key->matchAny && contains) {
+        found = true;
+        break;
+      }
+      if (!key->matchAny && !contains) {
+        found = false;
+        break;
+      }
+    }
+
+    if (!found)
+      return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Find the heap blocks of the ranges matching the query keys.
+ *
+ * Every key must match: an overlap key needs any of its fingerprints in a
+ * range's filter, other keys all of them. Blocks are added to the bitmap
+ * as lossy pages.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param keys Query keys.
+ * @param nkeys Number of query keys.
+ * @param tbm Bitmap to add matching pages to.
+ * @return Rough number of heap tuples in the matching pages.
+ */
+int64 CuckooRangeGetBitmap(Relation index, CuckooState *ckstate,
+                           CuckooQueryKey *keys, int nkeys, TIDBitmap *tbm) {
+  uint32 pagesPerRange = ckstate->opts.pagesPerRange;
+  CuckooRangeMetaData rangeMeta;
+  BlockNumber dirBlocks[CuckooMetaBlockN];
+  Buffer dirBuffer = InvalidBuffer;
+  Relation heap;
+  BlockNumber nblocks;
+  int64 npages = 0;
+
+  heap = table_open(IndexGetRelation(RelationGetRelid(index), false),
+                    AccessShareLock);
+  nblocks = RelationGetNumberOfBlocks(heap);
+  table_close(heap, AccessShareLock);
+
+  readRangeMeta(index, &rangeMeta, dirBlocks);
+
+  for (BlockNumber start = 0; start < nblocks; start += pagesPerRange) {
+    uint32 range = start / pagesPerRange;
+    bool match = true;
+
+    if (range < rangeMeta.nRanges) {
+      BlockNumber dirBlkno = dirBlocks[range / CUCKOO_RANGE_ENTRIES];
+
+      if (!BufferIsValid(dirBuffer) ||
+          BufferGetBlockNumber(dirBuffer) != dirBlkno) {
+        if (BufferIsValid(dirBuffer))
+          ReleaseBuffer(dirBuffer);
+        dirBuffer = ReadBuffer(index, dirBlkno);
+      }
+
+      LockBuffer(dirBuffer, BUFFER_LOCK_SHARE);
+      match = rangeMatches(index, ckstate,
+                           pageGetEntry(BufferGetPage(dirBuffer), range), keys,
+                           nkeys);
+      LockBuffer(dirBuffer, BUFFER_LOCK_UNLOCK);
+    }
+
+    if (match) {
+      for (BlockNumber blkno = start;
+           blkno < nblocks && blkno < start + pagesPerRange; blkno++) {
+        tbm_add_page(tbm, blkno);
+        npages++;
+      }
+    }
+
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  if (BufferIsValid(dirBuffer))
+    ReleaseBuffer(dirBuffer);
+
+  /*
+   * Like BRIN, we only know how many pages match, not how many tuples;
+   * return a guess.
+   */
+  return npages * 10;
+}
+
+/**
+ * @brief Check whether any block range may hold a fingerprint.
+ *
+ * Stops at the first range that matches; ranges without a usable filter
+ * always match.
+ *
+ * @param index The index relation.
+ * @param ckstate Cuckoo index state.
+ * @param fingerprint Fingerprint to look up.
+ * @return false if no range holds the fingerprint.
+ */
+bool CuckooRangeMayContain(Relation index, CuckooState *ckstate,
+                           uint32 fingerprint) {
+  uint32 pagesPerRange = ckstate->opts.pagesPerRange;
+  CuckooQueryKey key = {&fingerprint, 1, false};
+  CuckooRangeMetaData rangeMeta;
+  BlockNumber dirBlocks[CuckooMetaBlockN];
+  Relation heap;
+  BlockNumber nblocks;
+  bool found = false;
+
+  heap = table_open(IndexGetRelation(RelationGetRelid(index), false),
+                    AccessShareLock);
+  nblocks = RelationGetNumberOfBlocks(heap);
+  table_close(heap, AccessShareLock);
+
+  readRangeMeta(index, &rangeMeta, dirBlocks);
+  if ((uint64)rangeMeta.nRanges * pagesPerRange < nblocks)
+    return true;
+
+  for (uint32 range = 0; range < rangeMeta.nRanges && !found; range++) {
+    Buffer dirBuffer;
+
+    dirBuffer = ReadBuffer(index, dirBlocks[range / CUCKOO_RANGE_ENTRIES]);
+    LockBuffer(dirBuffer, BUFFER_LOCK_SHARE);
+    found = rangeMatches(index, ckstate,
+                         pageGetEntry(BufferGetPage(dirBuffer), range), &key,
+                         1);
+    UnlockReleaseBuffer(dirBuffer);
+
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  return found;
+}
+
+/**
+ * @brief Give the next range a directory entry, flagged as summarizing.
+ *
+ * @param index The index relation.
+ * @param range Range number; must equal the current number of ranges.
+ */
+static void appendRangeEntry(Relation index, uint32 range) {
+  Buffer metaBuffer, dirBuffer;
+  GenericXLogState *xlog;
+  CuckooMetaPageData *meta;
+  CuckooRangeEntry *entry;
+  Page dirPage;
+  bool newDirPage = range % CUCKOO_RANGE_ENTRIES == 0;
+
+  metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(metaBuffer, BUFFER_LOCK_EXCLUSIVE);
+  meta = CuckooPageGetMeta(BufferGetPage(metaBuffer));
+  Assert(meta->range.nRanges == range);
+
+  if (newDirPage) {
+    if (meta->range.nDirPages >= CuckooMetaBlockN)
+      ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                      errmsg("too many block ranges for cuckoo index \"%s\"",
+                             RelationGetRelationName(index)),
+                      errhint("Increase pages_per_range.")));
+    dirBuffer = CuckooNewBuffer(index);
+  } else {
+    dirBuffer = ReadBuffer(index,
+                           meta->notFullPage[range / CUCKOO_RANGE_ENTRIES]);
+    LockBuffer(dirBuffer, BUFFER_LOCK_EXCLUSIVE);
+  }
+
+  xlog = GenericXLogStart(index);
+  meta = CuckooPageGetMeta(GenericXLogRegisterBuffer(xlog, metaBuffer, 0));
+  dirPage = GenericXLogRegisterBuffer(
+      xlog, dirBuffer, newDirPage ? GENERIC_XLOG_FULL_IMAGE : 0);
+  if (newDirPage) {
+    CuckooInitPage(dirPage, CUCKOO_DIRECTORY);
+    ((PageHeader)dirPage)->pd_lower +=
+        sizeof(CuckooRangeEntry) * CUCKOO_RANGE_ENTRIES;
+    meta->notFullPage[meta->range.nDirPages++] =
+        BufferGetBlockNumber(dirBuffer);
+  }
+
+  entry = pageGetEntry(dirPage, range);
+  entry->filterStart = InvalidBlockNumber;
+  entry->nBuckets = 0;
+  entry->flags = CUCKOO_RANGE_SUMMARIZING;
+  meta->range.nRanges = range + 1;
+
+  GenericXLogFinish(xlog);
+  UnlockReleaseBuffer(dirBuffer);
+  UnlockReleaseBuffer(metaBuffer);
+}
+
+/**
+ * @brief Summarize one range from the heap and install its new filter.
+ *
+ * The range's entry must already be flagged as summarizing. If an insert
+ * reached the range during the heap scan, the new filter may miss its
+ * value and is discarded; the range keeps matching everything.
+ *
+ * @param index The index relation.
+ * @param heap The heap relation.
+ * @param indexInfo Index information.
+ * @param ckstate Cuckoo index state.
+ * @param dirBlkno Directory page of the range.
+ * @param range Range number.
+ * @return true if the new filter was installed.
+ */
+static bool summarizeRange(Relation index, Relation heap,
+                           IndexInfo *indexInfo, CuckooState *ckstate,
+                           BlockNumber dirBlkno, uint32 range) {
+  CuckooRangeBuildState buildstate;
+  BlockNumber start = range * ckstate->opts.pagesPerRange;
+  CuckooRangeEntry newEntry, oldEntry;
+  CuckooRangeEntry *entry;
+  GenericXLogState *xlog;
+  Buffer dirBuffer;
+  double expected;
+  bool installed;
+  int n;
+
+  initRangeBuildState(&buildstate, heap, index, ckstate);
+
+  /*
+   * Tuples inserted by transactions still in progress must be included,
+   * so the scan runs in "any visible" mode, as BRIN's does.
+   */
+  table_index_build_range_scan(
+      heap, index, indexInfo, false, true, false, start,
+      Min(ckstate->opts.pagesPerRange, buildstate.heapBlocks - start),
+      rangeBuildCallback, &buildstate, NULL);
+
+  n = finishRangeFingerprints(&buildstate, start, &expected);
+  newEntry = writeRangeFilter(index, ckstate, buildstate.fingerprints, n,
+                              expected);
+
+  dirBuffer = ReadBuffer(index, dirBlkno);
+  LockBuffer(dirBuffer, BUFFER_LOCK_EXCLUSIVE);
+  xlog = GenericXLogStart(index);
+  entry = pageGetEntry(GenericXLogRegisterBuffer(xlog, dirBuffer, 0), range);
+  oldEntry = *entry;
+
+  installed = !(entry->flags & CUCKOO_RANGE_DIRTY);
+  if (installed)
+    *entry = newEntry;
+  else
+    entry->flags &= ~(CUCKOO_RANGE_SUMMARIZING | CUCKOO_RANGE_DIRTY);
+
+  GenericXLogFinish(xlog);
+  UnlockReleaseBuffer(dirBuffer);
+
+  /* No scan can reach the filter that lost out any more */
+  freeRangeFilter(index, ckstate, installed ? &oldEntry : &newEntry);
+
+  MemoryContextDelete(buildstate.tmpCtx);
+  pfree(buildstate.fingerprints);
+
+  return installed;
+}
+
+/**
+ * @brief Summarize the ranges that match everything.
+ *
+ * Ranges past the end of the directory are given an entry, and ranges
+ * without a usable filter are summarized from the heap. Called by VACUUM,
+ * which runs one at a time per table.
+ *
+ * @param index The index relation.
+ * @param heap The heap relation.
+ * @param ckstate Cuckoo index state.
+ * @return Number of ranges with a usable filter.
+ */
+uint32 CuckooRangeSummarize(Relation index, Relation heap,
+                            CuckooState *ckstate) {
+  uint32 pagesPerRange = ckstate->opts.pagesPerRange;
+  IndexInfo *indexInfo = BuildIndexInfo(index);
+  BlockNumber nblocks = RelationGetNumberOfBlocks(heap);
+  uint32 nRanges = (nblocks + pagesPerRange - 1) / pagesPerRange;
+  uint32 nsummarized = 0;
+
+  for (uint32 range = 0; range < nRanges; range++) {
+    CuckooRangeMetaData rangeMeta;
+    BlockNumber dirBlocks[CuckooMetaBlockN];
+    BlockNumber dirBlkno;
+    Buffer dirBuffer;
+    CuckooRangeEntry *entry;
+    bool summarize;
+
+    CuckooVacuumDelayPoint();
+
+    readRangeMeta(index, &rangeMeta, dirBlocks);
+    if (range >= rangeMeta.nRanges) {
+      appendRangeEntry(index, range);
+      readRangeMeta(index, &rangeMeta, dirBlocks);
+    }
+    dirBlkno = dirBlocks[range / CUCKOO_RANGE_ENTRIES];
+
+    /*
+     * A summarizing flag left behind by a crashed VACUUM is taken over,
+     * since no other summarization can be running.
+     */
+    dirBuffer = ReadBuffer(index, dirBlkno);
+    LockBuffer(dirBuffer, BUFFER_LOCK_EXCLUSIVE);
+    entry = pageGetEntry(BufferGetPage(dirBuffer), range);
+    summarize = CuckooRangeMatchesAll(entry);
+    if (summarize)
+      setEntryFlags(index, dirBuffer, range, CUCKOO_RANGE_SUMMARIZING,
+                    CUCKOO_RANGE_DIRTY);
+    UnlockReleaseBuffer(dirBuffer);
+
+    if (!summarize ||
+        summarizeRange(index, heap, indexInfo, ckstate, dirBlkno, range))
+      nsummarized++;
+  }
+
+  return nsummarized;
+}
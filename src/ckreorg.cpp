@@ -0,0 +1,331 @@
+/**
+ * @file ckreorg.cpp
+ * @brief Rewriting a cuckoo index from its own tuples.
+ *
+ * A fingerprint is the low bits of a row hash, so every fingerprint an
+ * index needs can be derived from the fingerprints it already holds, as
+ * long as the tags do not get wider. cuckoo_reorganize() reads the tuples
+ * of an index, optionally narrows their tags, sorts them by fingerprint
+ * and writes them to new storage in the index's layout, without visiting
+ * the table. Pages emptied by VACUUM are dropped, flat pages come out
+ * full and sorted, which helps summary pages reject values, and hashed
+ * and frozen indexes get the bucket count or frozen region their build
+ * would have given them.
+ *
+ * Block range filters keep no tuples to rewrite them from.
+ *
+ * Copyright (c) 2025
+ * SPDX-License-Identifier: PostgreSQL
+ */
+#include "cuckoo.h"
+
+extern "C" {
+#include "access/relation.h"
+#include "access/table.h"
+#include "access/tupdesc.h"
+#include "catalog/index.h"
+#include "catalog/pg_operator.h"
+#include "catalog/pg_type.h"
+#include "commands/tablecmds.h"
+#include "executor/tuptable.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "utils/acl.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/tuplesort.h"
+
+PG_FUNCTION_INFO_V1(cuckoo_reorganize);
+}
+
+/**
+ * @brief State of a reorganization while the old tuples are read.
+ */
+typedef struct CuckooReorgState {
+  CuckooState *target;       /**< State of the rewritten index */
+  Tuplesortstate *sortstate; /**< Sorts tuples for the target layout */
+  TupleTableSlot *slot;      /**< Slot used to feed the sort */
+  int64 ntuples;             /**< Tuples read */
+} CuckooReorgState;
+
+/**
+ * @brief Feed one tuple of the old index to the sort.
+ *
+ * @param itup Tuple of the old index.
+ * @param arg Reorganization state.
+ */
+static void reorgAddTuple(CuckooTuple *itup, void *arg) {
+  CuckooReorgState *reorg = (CuckooReorgState *)arg;
+  TupleTableSlot *slot = reorg->slot;
+  uint32 fingerprint =
+      CuckooNarrowFingerprint(reorg->target, itup->fingerprint);
+  int64 key = reorg->target->opts.layout == CUCKOO_LAYOUT_HASHED
+                  ? CuckooHashSortKey(fingerprint)
+                  : (int64)fingerprint;
+
+  ExecClearTuple(slot);
+  slot->tts_values[0] = Int64GetDatum(key);
+  slot->tts_values[1] = PointerGetDatum(&itup->heapPtr);
+  slot->tts_isnull[0] = false;
+  slot->tts_isnull[1] = false;
+  ExecStoreVirtualTuple(slot);
+  tuplesort_puttupleslot(reorg->sortstate, slot);
+
+  reorg->ntuples++;
+}
+
+/**
+ * @brief Read every tuple of a flat or frozen index.
+ *
+ * Tuples live on flat data pages and, in a frozen index, on the sorted
+ * data pages of the frozen region.
+ *
+ * @param index The index relation.
+ * @param state Cuckoo state of the index.
+ * @param reorg Reorganization state.
+ */
+static void readPages(Relation index, CuckooState *state,
+                      CuckooReorgState *reorg) {
+  BlockNumber nblocks = RelationGetNumberOfBlocks(index);
+
+  for (BlockNumber blkno = CUCKOO_HEAD_BLKNO; blkno < nblocks; blkno++) {
+    Buffer buffer = ReadBuffer(index, blkno);
+    Page page;
+
+    LockBuffer(buffer, BUFFER_LOCK_SHARE);
+    page = BufferGetPage(buffer);
+
+    if (!PageIsNew(page) && (CuckooPageGetOpaque(page)->flags == 0 ||
+                             CuckooPageGetOpaque(page)->flags ==
+                                 CUCKOO_FROZEN)) {
+      for (OffsetNumber offset = 1; offset <= CuckooPageGetMaxOffset(page);
+           offset++)
+        reorgAddTuple(CuckooPageGetTuple(state, page, offset), reorg);
+    }
+
+    UnlockReleaseBuffer(buffer);
+
+    CHECK_FOR_INTERRUPTS();
+  }
+}
+
+/**
+ * @brief Write a page image to a new data page of a flat index.
+ *
+ * @param index The index relation.
+ * @param state Cuckoo index state.
+ * @param image Page image.
+ */
+static void writeFlatPage(Relation index, CuckooState *state, Page image) {
+  Buffer buffer = CuckooNewDataBuffer(index, state);
+  Buffer summaryBuffer;
+  GenericXLogState *xlogState;
+  Page page;
+
+  xlogState = GenericXLogStart(index);
+  page = GenericXLogRegisterBuffer(xlogState, buffer, GENERIC_XLOG_FULL_IMAGE);
+  memcpy(page, image, BLCKSZ);
+  summaryBuffer = CuckooSummaryUpdate(index, state, xlogState,
+                                      BufferGetBlockNumber(buffer), page);
+  GenericXLogFinish(xlogState);
+  if (BufferIsValid(summaryBuffer))
+    UnlockReleaseBuffer(summaryBuffer);
+  UnlockReleaseBuffer(buffer);
+}
+
+/**
+ * @brief Write sorted tuples as full flat data pages.
+ *
+ * @param index The index relation.
+ * @param state Cuckoo index state.
+ * @param sortstate Tuples sorted by fingerprint.
+ * @param tupdesc Descriptor of the sorted tuples.
+ */
+static void writeFlat(Relation index, CuckooState *state,
+                      Tuplesortstate *sortstate, TupleDesc tupdesc) {
+  TupleTableSlot *slot = MakeSingleTupleTableSlot(tupdesc, &TTSOpsMinimalTuple);
+  PGAlignedBlock image;
+
+  CuckooInitPage(image.data, 0);
+
+  while (tuplesort_gettupleslot(sortstate, true, false, slot, NULL)) {
+    CuckooTuple itup;
+    bool isnull;
+
+    itup.fingerprint = (uint32)DatumGetInt64(slot_getattr(slot, 1, &isnull));
+    itup.heapPtr =
+        *(ItemPointer)DatumGetPointer(slot_getattr(slot, 2, &isnull));
+
+    if (!CuckooPageAddItem(state, image.data, &itup)) {
+      writeFlatPage(index, state, image.data);
+      CuckooInitPage(image.data, 0);
+      if (!CuckooPageAddItem(state, image.data, &itup))
+        elog(ERROR, "could not add new cuckoo tuple to empty page");
+    }
+
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  if (CuckooPageGetMaxOffset(image.data) > 0)
+    writeFlatPage(index, state, image.data);
+
+  ExecDropSingleTupleTableSlot(slot);
+}
+
+/**
+ * @brief Give an index new, empty storage with a metapage.
+ *
+ * The metapage gets the given options rather than the reloptions, which
+ * may have changed since the index was built.
+ *
+ * @param index The index relation.
+ * @param opts Options of the rewritten index.
+ * @param sketch Distinct-value sketch to keep, or NULL.
+ */
+static void resetStorage(Relation index, CuckooOptions *opts,
+                         CuckooSketch *sketch) {
+  GenericXLogState *state;
+  Page metaPage;
+  CuckooMetaPageData *meta;
+  Buffer metaBuffer;
+
+  CuckooResetStorage(index);
+  CuckooInitMetapage(index, MAIN_FORKNUM);
+
+  metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(metaBuffer, BUFFER_LOCK_EXCLUSIVE);
+  state = GenericXLogStart(index);
+  metaPage = GenericXLogRegisterBuffer(state, metaBuffer, 0);
+  meta = CuckooPageGetMeta(metaPage);
+  meta->opts = *opts;
+  if (sketch)
+    meta->sketch = *sketch;
+  GenericXLogFinish(state);
+  UnlockReleaseBuffer(metaBuffer);
+
+  if (index->rd_amcache) {
+    pfree(index->rd_amcache);
+    index->rd_amcache = NULL;
+  }
+}
+
+/**
+ * @brief Rewrite a cuckoo index from its own tuples.
+ *
+ * Takes the locks of REINDEX: writes to the table wait until the rewrite
+ * commits, and the index cannot be used meanwhile. Only the owner of the
+ * index may reorganize it.
+ *
+ * @param fcinfo Function call info: regclass index, int4 bits_per_tag or
+ *               NULL to keep the current width.
+ * @return Number of tuples written.
+ */
+extern "C" Datum cuckoo_reorganize(PG_FUNCTION_ARGS) {
+  Oid indexOid;
+  Oid heapOid;
+  Relation heap = NULL;
+  Relation index;
+  CuckooState state;
+  CuckooState target;
+  CuckooSketch sketch;
+  bool haveSketch;
+  CuckooReorgState reorg;
+  TupleDesc tupdesc;
+  AttrNumber sortAttr = 1;
+  Oid sortOperator = Int8LessOperator;
+  Oid sortCollation = InvalidOid;
+  bool nullsFirst = false;
+  int bits;
+
+  if (PG_ARGISNULL(0))
+    PG_RETURN_NULL();
+
+  indexOid = PG_GETARG_OID(0);
+  heapOid = IndexGetRelation(indexOid, true);
+
+  /* Check ownership before queueing for the exclusive lock */
+  if (!object_ownercheck(RelationRelationId, indexOid, GetUserId()))
+    aclcheck_error(ACLCHECK_NOT_OWNER, OBJECT_INDEX, get_rel_name(indexOid));
+
+  /* Lock the table before its index, as REINDEX does */
+  if (OidIsValid(heapOid))
+    heap = table_open(heapOid, ShareLock);
+  index = CuckooOpenIndex(indexOid, AccessExclusiveLock);
+  CheckTableNotInUse(index, "cuckoo_reorganize");
+
+  initCuckooState(&state, index);
+  bits = PG_ARGISNULL(1) ? state.opts.bitsPerTag : PG_GETARG_INT32(1);
+
+  if (state.opts.pagesPerRange > 0)
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("cannot reorganize index \"%s\"",
+                    RelationGetRelationName(index)),
+             errdetail("Block range filters keep no tuples to rewrite the "
+                       "index from."),
+             errhint("Use REINDEX instead.")));
+  if (state.opts.exactKeys)
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("cannot reorganize index \"%s\"",
+                    RelationGetRelationName(index)),
+             errdetail("The rewrite does not carry the keys of an index with "
+                       "exact_keys."),
+             errhint("Use REINDEX instead.")));
+  if (bits < MIN_BITS_PER_TAG || bits > MAX_BITS_PER_TAG)
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("bits_per_tag must be between %d and %d",
+                           MIN_BITS_PER_TAG, MAX_BITS_PER_TAG)));
+  if (bits > state.opts.bitsPerTag)
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("cannot widen the tags of index \"%s\" from %d to %d bits",
+                    RelationGetRelationName(index), state.opts.bitsPerTag,
+                    bits),
+             errhint("Set bits_per_tag with ALTER INDEX and rebuild the "
+                     "index with REINDEX.")));
+
+  target = state;
+  CuckooSetTagWidth(&target, bits);
+  haveSketch = CuckooSketchRead(index, &sketch);
+
+  /* Read and sort the old tuples */
+  tupdesc = CreateTemplateTupleDesc(2);
+  TupleDescInitEntry(tupdesc, (AttrNumber)1, "key", INT8OID, -1, 0);
+  TupleDescInitEntry(tupdesc, (AttrNumber)2, "tid", TIDOID, -1, 0);
+
+  memset(&reorg, 0, sizeof(reorg));
+  reorg.target = &target;
+  reorg.slot = MakeSingleTupleTableSlot(tupdesc, &TTSOpsVirtual);
+  reorg.sortstate =
+      tuplesort_begin_heap(tupdesc, 1, &sortAttr, &sortOperator,
+                           &sortCollation, &nullsFirst, maintenance_work_mem,
+                           NULL, TUPLESORT_NONE);
+
+  if (state.opts.layout == CUCKOO_LAYOUT_HASHED)
+    CuckooHashForEachTuple(index, &state, reorgAddTuple, &reorg);
+  else
+    readPages(index, &state, &reorg);
+
+  tuplesort_performsort(reorg.sortstate);
+
+  /* Write them to new storage */
+  resetStorage(index, &target.opts, haveSketch ? &sketch : NULL);
+
+  if (target.opts.layout == CUCKOO_LAYOUT_HASHED)
+    CuckooHashWriteBuckets(index, &target, reorg.sortstate, tupdesc,
+                           reorg.ntuples);
+  else if (target.opts.layout == CUCKOO_LAYOUT_FROZEN)
+    CuckooFrozenWrite(index, &target, reorg.sortstate, tupdesc,
+                      reorg.ntuples);
+  else
+    writeFlat(index, &target, reorg.sortstate, tupdesc);
+
+  tuplesort_end(reorg.sortstate);
+  ExecDropSingleTupleTableSlot(reorg.slot);
+
+  relation_close(index, NoLock);
+  table_close(heap, NoLock);
+
+  PG_RETURN_INT64(reorg.ntuples);
+}
@@ -11,12 +11,39 @@
 #include "cuckoo.h"
 
 extern "C" {
+#include "access/relation.h"
 #include "access/relscan.h"
+#include "access/table.h"
+#include "access/xlog.h"
+#include "catalog/index.h"
+#include "executor/instrument.h"
+#include "funcapi.h"
 #include "miscadmin.h"
+#include "optimizer/plancat.h"
+#include "parser/parse_coerce.h"
 #include "pgstat.h"
 #include "storage/bufmgr.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+PG_FUNCTION_INFO_V1(cuckoo_estimate_count);
+PG_FUNCTION_INFO_V1(cuckoo_estimate_error);
 }
 
+/* Hook this module replaces */
+static get_relation_info_hook_type prev_get_relation_info_hook = NULL;
+
+/**
+ * @brief Per-heap-tuple match counts for multi-key element scans.
+ */
+typedef struct CuckooTidMatch {
+  ItemPointerData tid;                    /**< Hash key: heap tuple */
+  int32 nmatched[FLEXIBLE_ARRAY_MEMBER]; /**< Matched fingerprints per key */
+} CuckooTidMatch;
+
 /**
  * @brief Begin a scan of a cuckoo index.
  *
@@ -37,8 +64,16 @@ IndexScanDesc ckbeginscan(Relation r, int nkeys, int norderbys) {
   initCuckooState(&so->state, scan->indexRelation);
   so->fingerprint = 0;
   so->fingerprintValid = false;
+  so->allRows = false;
+  so->queryKeys = NULL;
+  so->nQueryKeys = 0;
+  so->matches = NULL;
+  so->nMatches = 0;
+  so->maxMatches = 0;
+  so->nextMatch = 0;
 
   scan->opaque = so;
+  scan->xs_itupdesc = RelationGetDescr(r);
 
   return scan;
 }
@@ -56,8 +91,10 @@ void ckrescan(IndexScanDesc scan, ScanKey scankey, int nscankeys,
               ScanKey orderbys, int norderbys) {
   CuckooScanOpaque so = (CuckooScanOpaque)scan->opaque;
 
-  /* Invalidate cached fingerprint */
+  /* Invalidate cached fingerprint and matches */
   so->fingerprintValid = false;
+  so->nMatches = 0;
+  so->nextMatch = 0;
 
   if (scankey && scan->numberOfKeys > 0)
     memcpy(scan->keyData, scankey, scan->numberOfKeys * sizeof(ScanKeyData));
@@ -76,71 +113,220 @@ void ckendscan(IndexScanDesc scan) {
 }
 
 /**
- * @brief Get all matching tuples as a bitmap.
+ * @brief Check whether a fingerprint belongs to a query key.
+ *
+ * @param key Query key with sorted fingerprints.
+ * @param fingerprint Fingerprint to look up.
+ * @return true if the key contains the fingerprint.
+ */
+static inline bool queryKeyContains(CuckooQueryKey *key, uint32 fingerprint) {
+  int lo = 0;
+  int hi = key->nfingerprints - 1;
+
+  while (lo <= hi) {
+    int mid = lo + (hi - lo) / 2;
+
+    if (key->fingerprints[mid] == fingerprint)
+      return true;
+    if (key->fingerprints[mid] < fingerprint)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+
+  return false;
+}
+
+/**
+ * @brief Add every block of the indexed table to a bitmap.
+ *
+ * Used for IS NULL and IS NOT NULL searches the index cannot narrow down.
+ * The blocks are lossy, so the executor checks every row.
+ *
+ * @param index The index relation.
+ * @param tbm Bitmap to add the blocks to.
+ * @return Rough number of heap tuples in the blocks.
+ */
+static int64 allHeapBlocks(Relation index, TIDBitmap *tbm) {
+  Relation heap;
+  BlockNumber nblocks;
+
+  heap = table_open(IndexGetRelation(RelationGetRelid(index), false),
+                    AccessShareLock);
+  nblocks = RelationGetNumberOfBlocks(heap);
+  table_close(heap, AccessShareLock);
+
+  for (BlockNumber blkno = 0; blkno < nblocks; blkno++)
+    tbm_add_page(tbm, blkno);
+
+  return (int64)nblocks * 10;
+}
+
+/**
+ * @brief Check whether a whole-value scan has to return every row.
  *
- * Scans all index pages and returns TIDs of tuples whose fingerprints
- * match the search fingerprint. Note that this may return false positives
- * which will be filtered out by PostgreSQL when accessing the heap.
+ * The fingerprint covers all columns together, so a column searched only
+ * with IS NOT NULL leaves nothing to look up.
  *
  * @param scan The scan descriptor.
- * @param tbm Bitmap to add matching TIDs to.
- * @return Number of matching tuples found.
+ * @return true if some column has no key but IS NOT NULL.
  */
-int64 ckgetbitmap(IndexScanDesc scan, TIDBitmap *tbm) {
-  int64 ntids = 0;
-  BlockNumber blkno = CUCKOO_HEAD_BLKNO;
-  BlockNumber npages;
-  BufferAccessStrategy bas;
+static bool scanNeedsAllRows(IndexScanDesc scan) {
+  bool notNull[INDEX_MAX_KEYS] = {false};
+  bool keyed[INDEX_MAX_KEYS] = {false};
+
+  for (int i = 0; i < scan->numberOfKeys; i++) {
+    ScanKey skey = &scan->keyData[i];
+    int attno = skey->sk_attno - 1;
+
+    if (skey->sk_flags & SK_SEARCHNOTNULL)
+      notNull[attno] = true;
+    else
+      keyed[attno] = true;
+  }
+
+  for (int i = 0; i < INDEX_MAX_KEYS; i++) {
+    if (notNull[i] && !keyed[i])
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * @brief Extract the query fingerprints of an element index scan.
+ *
+ * Each scan key is passed through the opclass extract-query procedure.
+ * Overlap keys match when any extracted fingerprint is present; all other
+ * strategies need every fingerprint. An equality key without elements
+ * looks for the empty-item placeholder. IS NULL looks for the NULL tag and
+ * IS NOT NULL accepts every row, since every non-NULL value has tuples.
+ *
+ * @param scan The scan descriptor.
+ * @param allRows Output: whether the index cannot narrow the scan down.
+ * @return false if the keys can never match.
+ */
+static bool extractQueryKeys(IndexScanDesc scan, bool *allRows) {
   CuckooScanOpaque so = (CuckooScanOpaque)scan->opaque;
+  ScanKey skey = scan->keyData;
 
-  /* Compute search fingerprint if not already done */
-  if (!so->fingerprintValid) {
-    ScanKey skey = scan->keyData;
-    Datum *values;
-    bool *isnull;
+  so->queryKeys = (CuckooQueryKey *)palloc(sizeof(CuckooQueryKey) *
+                                           Max(scan->numberOfKeys, 1));
+  so->nQueryKeys = 0;
+  *allRows = false;
 
-    values = (Datum *)palloc(sizeof(Datum) * so->state.nColumns);
-    isnull = (bool *)palloc(sizeof(bool) * so->state.nColumns);
+  for (int i = 0; i < scan->numberOfKeys; i++, skey++) {
+    CuckooQueryKey *key = &so->queryKeys[so->nQueryKeys++];
+    uint32 *hashes;
+    int32 nentries = 0;
 
-    /* Initialize all columns as NULL */
-    for (int i = 0; i < so->state.nColumns; i++) {
-      values[i] = (Datum)0;
-      isnull[i] = true;
-    }
+    if (skey->sk_flags & (SK_SEARCHNULL | SK_SEARCHNOTNULL)) {
+      key->matchAny = false;
+      key->fingerprints = (uint32 *)palloc(sizeof(uint32));
+      key->nfingerprints = 0;
 
-    /* Fill in values from scan keys */
-    for (int i = 0; i < scan->numberOfKeys; i++) {
-      /*
-       * Cuckoo-indexable operators are assumed to be strict,
-       * so NULL key means no matches.
-       */
-      if (skey->sk_flags & SK_ISNULL) {
-        pfree(values);
-        pfree(isnull);
-        return 0;
+      if (skey->sk_flags & SK_SEARCHNULL) {
+        key->fingerprints[0] = CUCKOO_NULL_FINGERPRINT;
+        key->nfingerprints = 1;
       }
+      continue;
+    }
 
-      /* Set value for this column (sk_attno is 1-based) */
-      int attno = skey->sk_attno - 1;
-      values[attno] = skey->sk_argument;
-      isnull[attno] = false;
+    /* Element operators are strict, so a NULL key matches nothing */
+    if (skey->sk_flags & SK_ISNULL)
+      return false;
 
-      skey++;
+    hashes = (uint32 *)DatumGetPointer(FunctionCall3Coll(
+        &so->state.extractQueryFn, so->state.collations[0],
+        skey->sk_argument, PointerGetDatum(&nentries),
+        UInt16GetDatum(skey->sk_strategy)));
+
+    key->matchAny = (skey->sk_strategy == CUCKOO_OVERLAP_STRATEGY);
+    key->fingerprints =
+        (uint32 *)palloc(sizeof(uint32) * Max(nentries, 1));
+
+    if (nentries <= 0 && skey->sk_strategy == CUCKOO_EQUAL_STRATEGY) {
+      key->fingerprints[0] =
+          CuckooElementFingerprint(&so->state, CUCKOO_EMPTY_ITEM_HASH);
+      key->nfingerprints = 1;
+      continue;
     }
 
-    so->fingerprint = computeFingerprint(&so->state, values, isnull);
-    so->fingerprintValid = true;
+    for (int j = 0; j < nentries; j++)
+      key->fingerprints[j] = CuckooElementFingerprint(&so->state, hashes[j]);
+    key->nfingerprints =
+        CuckooUniqueFingerprints(key->fingerprints, Max(nentries, 0));
 
-    pfree(values);
-    pfree(isnull);
+    /* Overlap with nothing is always false */
+    if (key->matchAny && key->nfingerprints == 0)
+      return false;
   }
 
-  /*
-   * Scan the entire index using bulk read strategy.
-   */
+  return true;
+}
+
+/**
+ * @brief Apply one index tuple of an element index to the scan.
+ *
+ * The tuple goes straight to the bitmap when it decides the match on its
+ * own; otherwise it is counted against its heap tuple in matches.
+ *
+ * @param so Scan state.
+ * @param matches Per-heap-tuple match counts, or NULL when every tuple
+ *                decides on its own.
+ * @param tid Heap tuple of the index tuple.
+ * @param fingerprint Fingerprint of the index tuple.
+ * @param tbm Bitmap to add matching TIDs to.
+ * @return Number of TIDs added to the bitmap.
+ */
+static int64 matchElement(CuckooScanOpaque so, HTAB *matches, ItemPointer tid,
+                          uint32 fingerprint, TIDBitmap *tbm) {
+  CuckooTidMatch *entry = NULL;
+
+  if (matches == NULL) {
+    if (so->nQueryKeys > 0 && so->queryKeys[0].nfingerprints > 0 &&
+        !queryKeyContains(&so->queryKeys[0], fingerprint))
+      return 0;
+
+    tbm_add_tuples(tbm, tid, 1, true);
+    return 1;
+  }
+
+  for (int k = 0; k < so->nQueryKeys; k++) {
+    bool found;
+
+    if (!queryKeyContains(&so->queryKeys[k], fingerprint))
+      continue;
+
+    if (entry == NULL) {
+      entry = (CuckooTidMatch *)hash_search(matches, tid, HASH_ENTER, &found);
+      if (!found)
+        memset(entry->nmatched, 0, sizeof(int32) * so->nQueryKeys);
+    }
+    entry->nmatched[k]++;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Feed every tuple of a flat-layout element index to the scan.
+ *
+ * @param scan The scan descriptor.
+ * @param matches Per-heap-tuple match counts, or NULL.
+ * @param tbm Bitmap to add matching TIDs to.
+ * @return Number of TIDs added to the bitmap.
+ */
+static int64 elementPageScan(IndexScanDesc scan, HTAB *matches,
+                             TIDBitmap *tbm) {
+  CuckooScanOpaque so = (CuckooScanOpaque)scan->opaque;
+  int64 ntids = 0;
+  BlockNumber blkno;
+  BlockNumber npages;
+  BufferAccessStrategy bas;
+
   bas = GetAccessStrategy(BAS_BULKREAD);
   npages = RelationGetNumberOfBlocks(scan->indexRelation);
-  pgstat_count_index_scan(scan->indexRelation);
 
   for (blkno = CUCKOO_HEAD_BLKNO; blkno < npages; blkno++) {
     Buffer buffer;
@@ -159,14 +345,330 @@ int64 ckgetbitmap(IndexScanDesc scan, TIDBitmap *tbm) {
       for (offset = 1; offset <= maxOffset; offset++) {
         CuckooTuple *itup = CuckooPageGetTuple(&so->state, page, offset);
 
+        ntids += matchElement(so, matches, &itup->heapPtr, itup->fingerprint,
+                              tbm);
+      }
+    }
+
+    UnlockReleaseBuffer(buffer);
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  FreeAccessStrategy(bas);
+
+  return ntids;
+}
+
+/**
+ * @brief Feed the tuples of a hashed-layout element index to the scan.
+ *
+ * Only the buckets of the query fingerprints are read. A scan that
+ * accepts every row reads all buckets.
+ *
+ * @param scan The scan descriptor.
+ * @param matchAll Whether every row matches.
+ * @param matches Per-heap-tuple match counts, or NULL.
+ * @param tbm Bitmap to add matching TIDs to.
+ * @return Number of TIDs added to the bitmap.
+ */
+static int64 elementHashLookup(IndexScanDesc scan, bool matchAll,
+                               HTAB *matches, TIDBitmap *tbm) {
+  CuckooScanOpaque so = (CuckooScanOpaque)scan->opaque;
+  uint32 *fingerprints;
+  int nfingerprints = 0;
+  int64 ntids = 0;
+
+  if (matchAll) {
+    ItemPointerData *tids =
+        CuckooHashLookupAll(scan->indexRelation, &so->state, &nfingerprints);
+
+    if (nfingerprints > 0)
+      tbm_add_tuples(tbm, tids, nfingerprints, true);
+    return nfingerprints;
+  }
+
+  /* Each distinct fingerprint of any key is looked up once */
+  for (int k = 0; k < so->nQueryKeys; k++)
+    nfingerprints += so->queryKeys[k].nfingerprints;
+  fingerprints = (uint32 *)palloc(sizeof(uint32) * Max(nfingerprints, 1));
+  nfingerprints = 0;
+  for (int k = 0; k < so->nQueryKeys; k++) {
+    memcpy(fingerprints + nfingerprints, so->queryKeys[k].fingerprints,
+           sizeof(uint32) * so->queryKeys[k].nfingerprints);
+    nfingerprints += so->queryKeys[k].nfingerprints;
+  }
+  nfingerprints = CuckooUniqueFingerprints(fingerprints, nfingerprints);
+
+  for (int i = 0; i < nfingerprints; i++) {
+    ItemPointerData *tids;
+    int n;
+
+    tids = CuckooHashLookup(scan->indexRelation, &so->state, fingerprints[i],
+                            &n);
+    for (int j = 0; j < n; j++)
+      ntids += matchElement(so, matches, &tids[j], fingerprints[i], tbm);
+
+    if (tids)
+      pfree(tids);
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  pfree(fingerprints);
+
+  return ntids;
+}
+
+/**
+ * @brief Scan an element index, combining per-element matches.
+ *
+ * Every row of an element index owns one tuple per distinct element
+ * fingerprint. A heap tuple qualifies when, for every scan key, it owns
+ * all (or for overlap keys, any) of the key's fingerprints. Keys that
+ * extracted no fingerprints accept every row.
+ *
+ * @param scan The scan descriptor.
+ * @param tbm Bitmap to add matching TIDs to.
+ * @return Number of matching TIDs added.
+ */
+static int64 elementGetBitmap(IndexScanDesc scan, TIDBitmap *tbm) {
+  CuckooScanOpaque so = (CuckooScanOpaque)scan->opaque;
+  int64 ntids;
+  bool matchAll = true;
+  bool direct;
+  HTAB *matches = NULL;
+
+  /* Range filters decide whole block ranges at once */
+  if (so->state.opts.pagesPerRange > 0) {
+    pgstat_count_index_scan(scan->indexRelation);
+    return CuckooRangeGetBitmap(scan->indexRelation, &so->state,
+                                so->queryKeys, so->nQueryKeys, tbm);
+  }
+
+  for (int k = 0; k < so->nQueryKeys; k++) {
+    if (so->queryKeys[k].nfingerprints > 0)
+      matchAll = false;
+  }
+
+  /*
+   * A lone key needing a single fingerprint, or any of several, is decided
+   * by each index tuple on its own. Everything else has to gather the
+   * matches of each heap tuple first.
+   */
+  direct = so->nQueryKeys == 1 && (so->queryKeys[0].matchAny ||
+                                   so->queryKeys[0].nfingerprints == 1);
+
+  if (!matchAll && !direct) {
+    HASHCTL ctl;
+
+    ctl.keysize = sizeof(ItemPointerData);
+    ctl.entrysize =
+        offsetof(CuckooTidMatch, nmatched) + sizeof(int32) * so->nQueryKeys;
+    ctl.hcxt = CurrentMemoryContext;
+    matches = hash_create("cuckoo element matches", 1024, &ctl,
+                          HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+  }
+
+  pgstat_count_index_scan(scan->indexRelation);
+
+  if (so->state.opts.layout == CUCKOO_LAYOUT_HASHED)
+    ntids = elementHashLookup(scan, matchAll, matches, tbm);
+  else
+    ntids = elementPageScan(scan, matches, tbm);
+
+  if (matches) {
+    HASH_SEQ_STATUS status;
+    CuckooTidMatch *entry;
+
+    hash_seq_init(&status, matches);
+    while ((entry = (CuckooTidMatch *)hash_seq_search(&status)) != NULL) {
+      bool ok = true;
+
+      for (int k = 0; k < so->nQueryKeys && ok; k++) {
+        CuckooQueryKey *key = &so->queryKeys[k];
+
+        if (key->matchAny)
+          ok = entry->nmatched[k] > 0;
+        else
+          ok = entry->nmatched[k] >= key->nfingerprints;
+      }
+
+      if (ok) {
+        tbm_add_tuples(tbm, &entry->tid, 1, true);
+        ntids++;
+      }
+    }
+
+    hash_destroy(matches);
+  }
+
+  return ntids;
+}
+
+/**
+ * @brief Choose the scan key subtype for a value given to a SQL function.
+ *
+ * The functions that take values of any type look them up like an
+ * equality scan would. A value of a type the operator family has a hash
+ * function for is hashed with it, as for a cross-type operator; a value of
+ * a binary-coercible type, such as varchar for text_ops or an enum for a
+ * polymorphic operator class, is hashed as the column's type.
+ *
+ * @param index The index relation.
+ * @param attno Column number (0-based).
+ * @param valueType Type of the value.
+ * @return Subtype for the scan key.
+ */
+Oid CuckooKeySubtype(Relation index, int attno, Oid valueType) {
+  Oid opcintype = index->rd_opcintype[attno];
+
+  if (valueType == opcintype ||
+      OidIsValid(get_opfamily_proc(index->rd_opfamily[attno], valueType,
+                                   valueType, CUCKOO_HASH_PROC)))
+    return valueType;
+
+  if (IsBinaryCoercible(valueType, opcintype))
+    return opcintype;
+
+  ereport(ERROR,
+          (errcode(ERRCODE_DATATYPE_MISMATCH),
+           errmsg("cannot look up a value of type %s in index \"%s\"",
+                  format_type_be(valueType), RelationGetRelationName(index)),
+           errdetail("Column %d of the index has type %s.", attno + 1,
+                     format_type_be(opcintype))));
+  return InvalidOid; /* keep compiler quiet */
+}
+
+/**
+ * @brief Compute the search fingerprint from the scan keys.
+ *
+ * Keys whose type differs from the column's opclass input type come from
+ * a cross-type operator of the operator family, e.g. int4 = int8. They are
+ * hashed with the family's hash function for the key type, which the
+ * family guarantees to agree with the column's hash for equal values.
+ *
+ * @param index The index relation.
+ * @param state Cuckoo index state.
+ * @param keys Equality scan keys.
+ * @param nkeys Number of scan keys.
+ * @param fingerprint Output: the search fingerprint.
+ * @return false if the keys can never match.
+ */
+bool CuckooKeysFingerprint(Relation index, CuckooState *state, ScanKey keys,
+                           int nkeys, uint32 *fingerprint) {
+  ScanKey skey = keys;
+  uint32 colHashes[INDEX_MAX_KEYS];
+  bool isnull[INDEX_MAX_KEYS];
+
+  /* Initialize all columns as NULL */
+  for (int i = 0; i < state->nColumns; i++)
+    isnull[i] = true;
+
+  /* Fill in hashes from scan keys */
+  for (int i = 0; i < nkeys; i++, skey++) {
+    /* Set value for this column (sk_attno is 1-based) */
+    int attno = skey->sk_attno - 1;
+    FmgrInfo *hashFn = &state->hashFn[attno];
+    FmgrInfo crossHashFn;
+
+    /*
+     * IS NULL leaves the column NULL, as in the row being searched for,
+     * and IS NOT NULL narrows nothing down (see ckgetbitmap()).
+     * Cuckoo-indexable operators are assumed to be strict, so any other
+     * NULL key means no matches.
+     */
+    if (skey->sk_flags & (SK_SEARCHNULL | SK_SEARCHNOTNULL))
+      continue;
+    if (skey->sk_flags & SK_ISNULL)
+      return false;
+
+    if (OidIsValid(skey->sk_subtype) &&
+        skey->sk_subtype != index->rd_opcintype[attno]) {
+      Oid hashProc = get_opfamily_proc(index->rd_opfamily[attno],
+                                       skey->sk_subtype, skey->sk_subtype,
+                                       CUCKOO_HASH_PROC);
+
+      if (!OidIsValid(hashProc))
+        elog(ERROR,
+             "missing support function %d(%u,%u) in opfamily %u",
+             CUCKOO_HASH_PROC, skey->sk_subtype, skey->sk_subtype,
+             index->rd_opfamily[attno]);
+      fmgr_info(hashProc, &crossHashFn);
+      hashFn = &crossHashFn;
+    }
+
+    colHashes[attno] =
+        CuckooHashColumn(state, attno, hashFn, skey->sk_argument);
+    isnull[attno] = false;
+  }
+
+  *fingerprint = CuckooCombineHashes(state, colHashes, isnull);
+  return true;
+}
+
+/**
+ * @brief Add the heap TID of a tuple to a bitmap.
+ *
+ * @param itup Matching tuple.
+ * @param arg The TIDBitmap.
+ */
+static void addToBitmap(CuckooTuple *itup, void *arg) {
+  tbm_add_tuples((TIDBitmap *)arg, &itup->heapPtr, 1, true);
+}
+
+/**
+ * @brief Pass the tuples of the data pages with a fingerprint to a callback.
+ *
+ * Reads every page from blkno on using a bulk read strategy, skipping
+ * summary pages.
+ *
+ * @param index The index relation.
+ * @param state Cuckoo index state.
+ * @param fingerprint Fingerprint to look up, or 0 (never a fingerprint) for
+ *                    every tuple.
+ * @param blkno First block to read.
+ * @param callback Called with each matching tuple while its page is
+ *                 locked, or NULL to only count them.
+ * @param arg Argument passed to the callback.
+ * @return Number of matching tuples.
+ */
+static int64 pageScanForEach(Relation index, CuckooState *state,
+                             uint32 fingerprint, BlockNumber blkno,
+                             CuckooTupleCallback callback, void *arg) {
+  int64 ntids = 0;
+  BlockNumber npages;
+  BufferAccessStrategy bas;
+
+  bas = GetAccessStrategy(BAS_BULKREAD);
+  npages = RelationGetNumberOfBlocks(index);
+
+  for (; blkno < npages; blkno++) {
+    Buffer buffer;
+    Page page;
+
+    if (CuckooIsSummaryBlock(state->summaryGroup, blkno))
+      continue;
+
+    buffer = ReadBufferExtended(index, MAIN_FORKNUM, blkno, RBM_NORMAL, bas);
+
+    LockBuffer(buffer, BUFFER_LOCK_SHARE);
+    page = BufferGetPage(buffer);
+
+    if (!PageIsNew(page) && !CuckooPageIsDeleted(page)) {
+      OffsetNumber offset;
+      OffsetNumber maxOffset = CuckooPageGetMaxOffset(page);
+
+      for (offset = 1; offset <= maxOffset; offset++) {
+        CuckooTuple *itup = CuckooPageGetTuple(state, page, offset);
+
         /*
          * Check if fingerprint matches.
          * This is the core of the cuckoo filter lookup:
          * we simply compare the stored fingerprint with the
          * search fingerprint.
          */
-        if (itup->fingerprint == so->fingerprint) {
-          tbm_add_tuples(tbm, &itup->heapPtr, 1, true);
+        if (itup->fingerprint == fingerprint || fingerprint == 0) {
+          if (callback != NULL)
+            callback(itup, arg);
           ntids++;
         }
       }
@@ -180,3 +682,448 @@ int64 ckgetbitmap(IndexScanDesc scan, TIDBitmap *tbm) {
 
   return ntids;
 }
+
+/**
+ * @brief Pass the tuples stored with a fingerprint to a callback.
+ *
+ * Scans all index pages, just the fingerprint's bucket in the hashed
+ * layout, or the summary pages and matching data pages when the index has
+ * summaries.
+ *
+ * @param index The index relation.
+ * @param state Cuckoo index state of a whole-value index without ranges.
+ * @param fingerprint Fingerprint to look up.
+ * @param callback Called with each matching tuple, or NULL to only count
+ *                 them.
+ * @param arg Argument passed to the callback.
+ * @return Number of matching TIDs.
+ */
+static int64 fingerprintForEach(Relation index, CuckooState *state,
+                                uint32 fingerprint,
+                                CuckooTupleCallback callback, void *arg) {
+  int64 ntids = 0;
+  BlockNumber blkno = CUCKOO_HEAD_BLKNO;
+
+  /* The hashed layout only needs the bucket of the fingerprint */
+  if (state->opts.layout == CUCKOO_LAYOUT_HASHED) {
+    ItemPointerData *tids;
+    CuckooTuple itup;
+    int n;
+
+    tids = CuckooHashLookup(index, state, fingerprint, &n);
+    itup.fingerprint = fingerprint;
+    for (int i = 0; i < n && callback != NULL; i++) {
+      itup.heapPtr = tids[i];
+      callback(&itup, arg);
+    }
+
+    return n;
+  }
+
+  /* With summary pages, only data pages holding the fingerprint are read */
+  if (state->summaryGroup > 0)
+    return CuckooSummaryForEachMatch(index, state, fingerprint, callback,
+                                     arg);
+
+  /*
+   * A frozen index looks the fingerprint up in its frozen region, leaving
+   * only the pages inserted into since the build to scan.
+   */
+  if (state->opts.layout == CUCKOO_LAYOUT_FROZEN)
+    ntids = CuckooFrozenForEachMatch(index, state, fingerprint, callback, arg,
+                                     &blkno);
+
+  return ntids +
+         pageScanForEach(index, state, fingerprint, blkno, callback, arg);
+}
+
+/**
+ * @brief TIDs collected by a lookup for the lookup cache.
+ */
+typedef struct CuckooTidList {
+  ItemPointerData *tids; /**< Matching heap TIDs */
+  int ntids;             /**< Number of TIDs */
+  int maxTids;           /**< Allocated length of tids */
+} CuckooTidList;
+
+/**
+ * @brief Append the heap TID of a tuple to a list.
+ *
+ * @param itup Matching tuple.
+ * @param arg The CuckooTidList.
+ */
+static void addToTidList(CuckooTuple *itup, void *arg) {
+  CuckooTidList *list = (CuckooTidList *)arg;
+
+  if (list->ntids == list->maxTids) {
+    list->maxTids *= 2;
+    list->tids = (ItemPointerData *)repalloc(
+        list->tids, sizeof(ItemPointerData) * list->maxTids);
+  }
+  list->tids[list->ntids++] = itup->heapPtr;
+}
+
+/**
+ * @brief Find the heap TIDs stored with a fingerprint.
+ *
+ * An index with lookup_cache answers repeated lookups from the backend's
+ * lookup cache while its change counter stays the same (see ckcache.cpp).
+ *
+ * @param index The index relation.
+ * @param state Cuckoo index state of a whole-value index without ranges.
+ * @param fingerprint Fingerprint to look up.
+ * @param tbm Bitmap to add matching TIDs to, or NULL to only count them.
+ * @return Number of matching TIDs.
+ */
+static int64 fingerprintGetBitmap(Relation index, CuckooState *state,
+                                  uint32 fingerprint, TIDBitmap *tbm) {
+  CuckooTidList list;
+  uint64 changeCount;
+  int64 ntids;
+
+  /* A standby cannot ask the primary to count its changes */
+  if (tbm == NULL || !CuckooLookupCacheUsed(state) || RecoveryInProgress())
+    return fingerprintForEach(index, state, fingerprint,
+                              tbm != NULL ? addToBitmap : NULL, tbm);
+
+  /* The counter is read first, so that changes made meanwhile count */
+  changeCount = CuckooWatchChangeCount(index);
+  if (CuckooLookupCacheGet(index, fingerprint, changeCount, tbm, &ntids))
+    return ntids;
+
+  list.ntids = 0;
+  list.maxTids = 64;
+  list.tids =
+      (ItemPointerData *)palloc(sizeof(ItemPointerData) * list.maxTids);
+  ntids = fingerprintForEach(index, state, fingerprint, addToTidList, &list);
+
+  if (list.ntids > 0)
+    tbm_add_tuples(tbm, list.tids, list.ntids, true);
+  CuckooLookupCachePut(index, fingerprint, changeCount, list.tids,
+                       list.ntids);
+  pfree(list.tids);
+
+  return ntids;
+}
+
+/**
+ * @brief Find the matching tuples of a scan.
+ *
+ * Returns TIDs of tuples whose fingerprints match the search fingerprint.
+ * With pages_per_range it returns lossy pages of the matching block ranges
+ * instead. Note that this may return false positives which will be
+ * filtered out by PostgreSQL when accessing the heap.
+ *
+ * Rows whose indexed columns are all NULL are stored with
+ * CUCKOO_NULL_FINGERPRINT, which IS NULL searches look up. A search the
+ * index cannot narrow down, such as IS NOT NULL alone, returns every block
+ * of the table as lossy pages.
+ *
+ * @param scan The scan descriptor.
+ * @param tbm Bitmap to add matching TIDs to.
+ * @return Number of matching tuples found.
+ */
+static int64 scanGetBitmap(IndexScanDesc scan, TIDBitmap *tbm) {
+  CuckooScanOpaque so = (CuckooScanOpaque)scan->opaque;
+
+  /* Element indexes combine the matches of several fingerprints */
+  if (so->state.extractValues) {
+    bool allRows;
+
+    if (!so->fingerprintValid) {
+      if (!extractQueryKeys(scan, &allRows))
+        return 0;
+      so->allRows = allRows;
+      so->fingerprintValid = true;
+    }
+
+    if (so->allRows) {
+      pgstat_count_index_scan(scan->indexRelation);
+      return allHeapBlocks(scan->indexRelation, tbm);
+    }
+
+    return elementGetBitmap(scan, tbm);
+  }
+
+  /* Compute search fingerprint if not already done */
+  if (!so->fingerprintValid) {
+    if (!CuckooKeysFingerprint(scan->indexRelation, &so->state,
+                               scan->keyData, scan->numberOfKeys,
+                               &so->fingerprint))
+      return 0;
+    so->allRows = scanNeedsAllRows(scan);
+    so->fingerprintValid = true;
+  }
+
+  pgstat_count_index_scan(scan->indexRelation);
+
+  if (so->allRows)
+    return allHeapBlocks(scan->indexRelation, tbm);
+
+  /* Range filters return every block of the ranges that may match */
+  if (so->state.opts.pagesPerRange > 0) {
+    CuckooQueryKey key = {&so->fingerprint, 1, false};
+
+    return CuckooRangeGetBitmap(scan->indexRelation, &so->state, &key, 1,
+                                tbm);
+  }
+
+  return fingerprintGetBitmap(scan->indexRelation, &so->state,
+                              so->fingerprint, tbm);
+}
+
+/**
+ * @brief Get all matching tuples as a bitmap.
+ *
+ * See scanGetBitmap(). With tracing probes, the pages read are counted as
+ * the shared buffer accesses of the scan.
+ *
+ * @param scan The scan descriptor.
+ * @param tbm Bitmap to add matching TIDs to.
+ * @return Number of matching tuples found.
+ */
+int64 ckgetbitmap(IndexScanDesc scan, TIDBitmap *tbm) {
+  int64 ntids;
+#ifdef CUCKOO_PROBES
+  int64 nbuffers =
+      pgBufferUsage.shared_blks_hit + pgBufferUsage.shared_blks_read;
+#endif
+
+  TRACE_CUCKOO_SCAN_START(RelationGetRelid(scan->indexRelation),
+                          scan->numberOfKeys);
+  ntids = scanGetBitmap(scan, tbm);
+  TRACE_CUCKOO_SCAN_DONE(RelationGetRelid(scan->indexRelation),
+                         pgBufferUsage.shared_blks_hit +
+                             pgBufferUsage.shared_blks_read - nbuffers,
+                         ntids);
+
+  return ntids;
+}
+
+/**
+ * @brief Copy a tuple found by an amgettuple scan into the scan state.
+ *
+ * @param itup Matching tuple.
+ * @param arg The scan state.
+ */
+static void collectMatch(CuckooTuple *itup, void *arg) {
+  CuckooScanOpaque so = (CuckooScanOpaque)arg;
+  Size size = so->state.sizeOfCuckooTuple;
+
+  if (so->nMatches == so->maxMatches) {
+    so->maxMatches = Max(so->maxMatches * 2, 64);
+    if (so->matches == NULL)
+      so->matches = (Pointer)MemoryContextAlloc(GetMemoryChunkContext(so),
+                                                size * so->maxMatches);
+    else
+      so->matches = (Pointer)repalloc(so->matches, size * so->maxMatches);
+  }
+
+  memcpy(so->matches + so->nMatches * size, itup, size);
+  so->nMatches++;
+}
+
+/**
+ * @brief Return the next matching tuple of an index with exact keys.
+ *
+ * The matching tuples are all collected on the first call, like
+ * ckgetbitmap() collects TIDs. Each is returned with its key, so that an
+ * index-only scan only visits the heap for blocks that are not
+ * all-visible. Fingerprints collide, so the executor always rechecks the
+ * key. The planner only runs these scans on indexes with exact keys (see
+ * cuckooGetRelationInfo()); other indexes reject them with an error.
+ *
+ * @param scan The scan descriptor.
+ * @param dir Scan direction, always forward.
+ * @return false when there are no more tuples.
+ */
+bool ckgettuple(IndexScanDesc scan, ScanDirection dir) {
+  CuckooScanOpaque so = (CuckooScanOpaque)scan->opaque;
+  Relation index = scan->indexRelation;
+  CuckooTuple *itup;
+
+  if (!so->state.opts.exactKeys)
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("cuckoo index \"%s\" only supports bitmap scans",
+                    RelationGetRelationName(index)),
+             errhint("Create the index with exact_keys = on for plain and "
+                     "index-only scans.")));
+
+  if (!so->fingerprintValid) {
+    so->nMatches = 0;
+    so->nextMatch = 0;
+
+    if (CuckooKeysFingerprint(index, &so->state, scan->keyData,
+                              scan->numberOfKeys, &so->fingerprint)) {
+      pgstat_count_index_scan(index);
+
+      /* Recheck drops the NULL rows that IS NOT NULL returns */
+      if (scanNeedsAllRows(scan))
+        pageScanForEach(index, &so->state, 0, CUCKOO_HEAD_BLKNO, collectMatch,
+                        so);
+      else if (so->state.summaryGroup > 0)
+        CuckooSummaryForEachMatch(index, &so->state, so->fingerprint,
+                                  collectMatch, so);
+      else
+        pageScanForEach(index, &so->state, so->fingerprint, CUCKOO_HEAD_BLKNO,
+                        collectMatch, so);
+    }
+    so->fingerprintValid = true;
+  }
+
+  if (so->nextMatch >= so->nMatches)
+    return false;
+
+  itup = (CuckooTuple *)(so->matches +
+                         so->nextMatch * so->state.sizeOfCuckooTuple);
+  so->nextMatch++;
+
+  scan->xs_heaptid = itup->heapPtr;
+  scan->xs_recheck = true;
+
+  if (scan->xs_want_itup) {
+    Datum key;
+    bool isnull = itup->fingerprint == CUCKOO_NULL_FINGERPRINT;
+
+    memcpy(&key, CuckooTupleGetKey(itup), sizeof(Datum));
+    if (scan->xs_itup)
+      pfree(scan->xs_itup);
+    scan->xs_itup = index_form_tuple(scan->xs_itupdesc, &key, &isnull);
+  }
+
+  return true;
+}
+
+/**
+ * @brief Check whether index-only scans can return a column.
+ *
+ * @param index The index relation.
+ * @param attno Column number (unused, exact keys have one column).
+ * @return true if the index stores exact keys.
+ */
+bool ckcanreturn(Relation index, int attno) {
+  return CuckooGetOptions(index)->exactKeys;
+}
+
+/**
+ * @brief Keep the planner from using amgettuple on most cuckoo indexes.
+ *
+ * amgettuple belongs to the access method, but only indexes with exact
+ * keys can return tuples one at a time; the others keep bitmap scans only.
+ * These are the indexes that cannot return their column.
+ */
+static void cuckooGetRelationInfo(PlannerInfo *root, Oid relationObjectId,
+                                  bool inhparent, RelOptInfo *rel) {
+  ListCell *lc;
+
+  if (prev_get_relation_info_hook)
+    prev_get_relation_info_hook(root, relationObjectId, inhparent, rel);
+
+  foreach (lc, rel->indexlist) {
+    IndexOptInfo *info = (IndexOptInfo *)lfirst(lc);
+
+    if (info->amcostestimate == ckcostestimate && !info->canreturn[0])
+      info->amhasgettuple = false;
+  }
+}
+
+/**
+ * @brief Install the planner hook limiting amgettuple scans.
+ *
+ * Called from _PG_init().
+ */
+void CuckooInitScanHooks(void) {
+  prev_get_relation_info_hook = get_relation_info_hook;
+  get_relation_info_hook = cuckooGetRelationInfo;
+}
+
+/**
+ * @brief Count the index tuples that may match a value.
+ *
+ * Looks the values up like an equality scan of every column would and
+ * returns the number of candidate heap TIDs without visiting the heap.
+ * The count is an upper bound: besides the matching rows it includes
+ * dead rows not yet vacuumed and false positives, about
+ * reltuples / 2^bits_per_tag of them (see cuckoo_estimate_error()).
+ *
+ * @param fcinfo Function call info: regclass index, VARIADIC "any" values.
+ * @return Number of candidate TIDs.
+ */
+extern "C" Datum cuckoo_estimate_count(PG_FUNCTION_ARGS) {
+  Relation index;
+  CuckooState state;
+  ScanKeyData skeys[INDEX_MAX_KEYS];
+  Datum *args;
+  Oid *types;
+  bool *nulls;
+  int nargs;
+  uint32 fingerprint;
+  int64 count = 0;
+
+  if (PG_ARGISNULL(0))
+    PG_RETURN_NULL();
+
+  index = CuckooOpenIndex(PG_GETARG_OID(0), AccessShareLock);
+  CuckooCheckReadAccess(index);
+  initCuckooState(&state, index);
+
+  if (state.extractValues || state.opts.pagesPerRange > 0)
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("cannot estimate counts from index \"%s\"",
+                    RelationGetRelationName(index)),
+             state.extractValues
+                 ? errdetail("Element operator classes do not index whole "
+                             "values.")
+                 : errdetail("Block range filters keep no heap TIDs.")));
+
+  nargs = extract_variadic_args(fcinfo, 1, true, &args, &types, &nulls);
+  if (nargs != state.nColumns)
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("wrong number of values for index \"%s\"",
+                    RelationGetRelationName(index)),
+             errdetail("The index has %d columns, but %d values were given.",
+                       state.nColumns, Max(nargs, 0))));
+
+  for (int i = 0; i < nargs; i++)
+    ScanKeyEntryInitialize(
+        &skeys[i], nulls[i] ? SK_ISNULL : 0, i + 1, CUCKOO_EQUAL_STRATEGY,
+        nulls[i] ? InvalidOid : CuckooKeySubtype(index, i, types[i]),
+        InvalidOid, InvalidOid, args[i]);
+
+  /* A NULL value equals nothing */
+  if (CuckooKeysFingerprint(index, &state, skeys, nargs, &fingerprint))
+    count = fingerprintGetBitmap(index, &state, fingerprint, NULL);
+
+  relation_close(index, AccessShareLock);
+
+  PG_RETURN_INT64(count);
+}
+
+/**
+ * @brief Expected number of false positives in a candidate count.
+ *
+ * Each tuple stored with another value shares the looked-up fingerprint
+ * with probability 2^-bits_per_tag.
+ *
+ * @param fcinfo Function call info: regclass index.
+ * @return reltuples of the index divided by the number of fingerprints.
+ */
+extern "C" Datum cuckoo_estimate_error(PG_FUNCTION_ARGS) {
+  Relation index;
+  CuckooState state;
+  double ntuples;
+
+  index = CuckooOpenIndex(PG_GETARG_OID(0), AccessShareLock);
+  CuckooCheckReadAccess(index);
+  initCuckooState(&state, index);
+
+  /* reltuples is -1 until the index has been vacuumed or analyzed */
+  ntuples = Max(index->rd_rel->reltuples, 0);
+
+  relation_close(index, AccessShareLock);
+
+  PG_RETURN_FLOAT8(ntuples / ((double)state.tagMask + 1));
+}
@@ -0,0 +1,539 @@
+/**
+ * @file cksketch.cpp
+ * @brief Distinct-value sketch of a cuckoo index.
+ *
+ * The metapage of a whole-value index holds a HyperLogLog sketch of the
+ * row hashes its fingerprints are cut from. Builds and inserts raise its
+ * registers, and VACUUM rebuilds it from the heap once enough rows have
+ * been deleted. cuckoo_ndistinct() reports the estimate, and the planner
+ * hooks below substitute it for the n_distinct ANALYZE sampled for the
+ * columns and index expressions the index covers, or offer it alone
+ * before the first ANALYZE.
+ *
+ * Copyright (c) 2025
+ * SPDX-License-Identifier: PostgreSQL
+ */
+#include "cuckoo.h"
+
+#include <cmath>
+
+extern "C" {
+#include "access/genam.h"
+#include "access/generic_xlog.h"
+#include "access/htup_details.h"
+#include "access/relation.h"
+#include "access/table.h"
+#include "access/tableam.h"
+#include "catalog/index.h"
+#include "catalog/pg_statistic.h"
+#include "miscadmin.h"
+#include "port/pg_bitutils.h"
+#include "storage/bufmgr.h"
+#include "utils/acl.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/rel.h"
+#include "utils/selfuncs.h"
+#include "utils/syscache.h"
+
+PG_FUNCTION_INFO_V1(cuckoo_ndistinct);
+}
+
+/* Hooks this module replaces */
+static get_relation_stats_hook_type prev_get_relation_stats_hook = NULL;
+static get_index_stats_hook_type prev_get_index_stats_hook = NULL;
+
+/**
+ * @brief Whether an index can answer the planner from its sketch.
+ */
+typedef struct CuckooSketchIndex {
+  Oid indexOid; /**< Hash key */
+  bool usable;  /**< Single-column, non-partial cuckoo index with a sketch */
+} CuckooSketchIndex;
+
+/* Answers for the indexes the planner has asked about */
+static HTAB *ck_sketch_indexes = NULL;
+
+/**
+ * @brief Find the register a row hash goes to and the rank it offers.
+ *
+ * The top CUCKOO_SKETCH_BITS bits choose the register; the rank is the
+ * position of the first set bit among the remaining bits.
+ *
+ * @param hash Row hash.
+ * @param reg Output: register number.
+ * @return Rank of the hash.
+ */
+static inline uint8 sketchRank(uint32 hash, uint32 *reg) {
+  uint32 rest = hash << CUCKOO_SKETCH_BITS;
+
+  *reg = hash >> (32 - CUCKOO_SKETCH_BITS);
+  return (uint8)(rest == 0 ? 32 - CUCKOO_SKETCH_BITS + 1
+                           : 32 - pg_leftmost_one_pos32(rest));
+}
+
+/**
+ * @brief Add a row hash to a sketch.
+ *
+ * Each register keeps the largest rank among the hashes it was given.
+ *
+ * @param sketch Sketch to update.
+ * @param hash Row hash.
+ */
+void CuckooSketchAdd(CuckooSketch *sketch, uint32 hash) {
+  uint32 reg;
+  uint8 rank = sketchRank(hash, &reg);
+
+  if (rank > sketch->registers[reg])
+    sketch->registers[reg] = rank;
+}
+
+/**
+ * @brief Merge one sketch into another.
+ *
+ * @param dst Sketch to update.
+ * @param src Sketch to merge.
+ */
+void CuckooSketchMerge(CuckooSketch *dst, const CuckooSketch *src) {
+  for (int i = 0; i < CUCKOO_SKETCH_REGISTERS; i++)
+    dst->registers[i] = Max(dst->registers[i], src->registers[i]);
+}
+
+/**
+ * @brief Estimate the number of distinct row hashes added to a sketch.
+ *
+ * The HyperLogLog estimate, with linear counting for small cardinalities
+ * and the correction for collisions of 32-bit hashes for large ones.
+ *
+ * @param sketch Sketch to read.
+ * @return Estimated number of distinct values.
+ */
+double CuckooSketchEstimate(const CuckooSketch *sketch) {
+  const double m = CUCKOO_SKETCH_REGISTERS;
+  const double hashSpace = 4294967296.0;
+  double sum = 0;
+  int zeros = 0;
+  double estimate;
+
+  for (int i = 0; i < CUCKOO_SKETCH_REGISTERS; i++) {
+    sum += ldexp(1.0, -sketch->registers[i]);
+    if (sketch->registers[i] == 0)
+      zeros++;
+  }
+
+  estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+  if (estimate <= 2.5 * m && zeros > 0)
+    estimate = m * log(m / zeros);
+  else if (estimate > hashSpace / 30)
+    estimate = -hashSpace * log(1 - Min(estimate / hashSpace, 0.999999));
+
+  return estimate;
+}
+
+/**
+ * @brief Read the sketch of an index.
+ *
+ * @param index The index relation.
+ * @param sketch Output: copy of the sketch.
+ * @return false if the index keeps no sketch (element opclasses).
+ */
+bool CuckooSketchRead(Relation index, CuckooSketch *sketch) {
+  CuckooState state;
+  Buffer buffer;
+
+  initCuckooState(&state, index);
+  if (state.extractValues)
+    return false;
+
+  buffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(buffer, BUFFER_LOCK_SHARE);
+  *sketch = CuckooPageGetMeta(BufferGetPage(buffer))->sketch;
+  UnlockReleaseBuffer(buffer);
+
+  return true;
+}
+
+/**
+ * @brief Replace the sketch in the metapage.
+ *
+ * @param index The index relation.
+ * @param sketch Sketch to store.
+ */
+void CuckooSketchWrite(Relation index, const CuckooSketch *sketch) {
+  Buffer buffer;
+  GenericXLogState *state;
+
+  buffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+  state = GenericXLogStart(index);
+  CuckooPageGetMeta(GenericXLogRegisterBuffer(state, buffer, 0))->sketch =
+      *sketch;
+  GenericXLogFinish(state);
+  UnlockReleaseBuffer(buffer);
+}
+
+/**
+ * @brief Add the row hash of an inserted row to the sketch in the metapage.
+ *
+ * Only the one register the hash goes to is compared, under a share lock.
+ * The metapage is written only if that register grows, which after the
+ * first rows of an index is rare.
+ *
+ * @param index The index relation.
+ * @param hash Row hash.
+ */
+void CuckooSketchInsert(Relation index, uint32 hash) {
+  Buffer buffer;
+  GenericXLogState *state;
+  CuckooSketch *stored;
+  uint32 reg;
+  uint8 rank = sketchRank(hash, &reg);
+  bool grows;
+
+  buffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(buffer, BUFFER_LOCK_SHARE);
+  grows = rank >
+          CuckooPageGetMeta(BufferGetPage(buffer))->sketch.registers[reg];
+  LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+
+  if (grows) {
+    LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+    stored = &CuckooPageGetMeta(BufferGetPage(buffer))->sketch;
+
+    /* Another insert may have raised it meanwhile */
+    if (rank > stored->registers[reg]) {
+      state = GenericXLogStart(index);
+      stored = &CuckooPageGetMeta(GenericXLogRegisterBuffer(state, buffer, 0))
+                    ->sketch;
+      stored->registers[reg] = rank;
+      GenericXLogFinish(state);
+    }
+    LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+  }
+
+  ReleaseBuffer(buffer);
+}
+
+/**
+ * @brief Callback feeding the rows of the heap to a sketch.
+ */
+static void sketchBuildCallback(Relation index, ItemPointer tid,
+                                Datum *values, bool *isnull,
+                                bool tupleIsAlive, void *state) {
+  CuckooState *ckstate = (CuckooState *)state;
+
+  (void)computeFingerprint(ckstate, values, isnull);
+}
+
+/**
+ * @brief Rebuild the sketch of an index from the heap.
+ *
+ * A sketch cannot forget the values of deleted rows, so VACUUM calls this
+ * after removing many tuples. Rows inserted while the heap is scanned may
+ * be missed; the estimate catches up as further rows arrive. Indexes
+ * without a sketch are left alone, without scanning the heap.
+ *
+ * @param index The index relation.
+ * @param heap The heap relation.
+ */
+void CuckooSketchRebuild(Relation index, Relation heap) {
+  IndexInfo *indexInfo;
+  CuckooState state;
+  CuckooSketch sketch;
+
+  initCuckooState(&state, index);
+  if (state.extractValues)
+    return;
+
+  indexInfo = BuildIndexInfo(index);
+  memset(&sketch, 0, sizeof(sketch));
+  state.sketch = &sketch;
+
+  table_index_build_range_scan(heap, index, indexInfo, true, true, false, 0,
+                               InvalidBlockNumber, sketchBuildCallback, &state,
+                               NULL);
+
+  CuckooSketchWrite(index, &sketch);
+}
+
+/**
+ * @brief Estimate the number of distinct values of a cuckoo index.
+ *
+ * @param fcinfo Function call info: regclass index.
+ * @return Estimated number of distinct non-NULL rows, or NULL for element
+ *         opclasses, which keep no sketch.
+ */
+extern "C" Datum cuckoo_ndistinct(PG_FUNCTION_ARGS) {
+  Relation index;
+  CuckooSketch sketch;
+  bool valid;
+
+  index = CuckooOpenIndex(PG_GETARG_OID(0), AccessShareLock);
+  CuckooCheckReadAccess(index);
+  valid = CuckooSketchRead(index, &sketch);
+  relation_close(index, AccessShareLock);
+
+  if (!valid)
+    PG_RETURN_NULL();
+
+  PG_RETURN_INT64((int64)rint(CuckooSketchEstimate(&sketch)));
+}
+
+/**
+ * @brief Forget the cached answers for an index, or for all of them.
+ *
+ * Relcache invalidation callback; a dropped index's OID may be reused.
+ */
+static void sketchIndexesInvalidate(Datum arg, Oid relid) {
+  HASH_SEQ_STATUS status;
+  CuckooSketchIndex *entry;
+
+  if (ck_sketch_indexes == NULL)
+    return;
+
+  if (OidIsValid(relid)) {
+    hash_search(ck_sketch_indexes, &relid, HASH_REMOVE, NULL);
+    return;
+  }
+
+  hash_seq_init(&status, ck_sketch_indexes);
+  while ((entry = (CuckooSketchIndex *)hash_seq_search(&status)) != NULL)
+    hash_search(ck_sketch_indexes, &entry->indexOid, HASH_REMOVE, NULL);
+}
+
+/**
+ * @brief Check whether an index can answer the planner from its sketch.
+ *
+ * The planner asks about every index with expressions, most of which are
+ * not cuckoo indexes, so the answer is cached per index OID instead of
+ * opening the index each time.
+ *
+ * @param indexOid The index; the planner already holds a lock on it.
+ * @return true for a single-column, non-partial cuckoo index that keeps a
+ *         sketch.
+ */
+static bool indexHasSketch(Oid indexOid) {
+  CuckooSketchIndex *entry;
+  Relation index;
+  bool usable;
+
+  if (ck_sketch_indexes == NULL) {
+    HASHCTL ctl;
+
+    ctl.keysize = sizeof(Oid);
+    ctl.entrysize = sizeof(CuckooSketchIndex);
+    ck_sketch_indexes = hash_create("cuckoo sketch indexes", 64, &ctl,
+                                    HASH_ELEM | HASH_BLOBS);
+    CacheRegisterRelcacheCallback(sketchIndexesInvalidate, (Datum)0);
+  }
+
+  entry = (CuckooSketchIndex *)hash_search(ck_sketch_indexes, &indexOid,
+                                           HASH_FIND, NULL);
+  if (entry != NULL)
+    return entry->usable;
+
+  index = index_open(indexOid, NoLock);
+  usable = index->rd_indam->ambuild == ckbuild &&
+           IndexRelationGetNumberOfKeyAttributes(index) == 1 &&
+           RelationGetIndexPredicate(index) == NIL &&
+           !OidIsValid(index_getprocid(index, 1, CUCKOO_EXTRACTVALUE_PROC));
+  index_close(index, NoLock);
+
+  entry = (CuckooSketchIndex *)hash_search(ck_sketch_indexes, &indexOid,
+                                           HASH_ENTER, NULL);
+  entry->usable = usable;
+
+  return usable;
+}
+
+/**
+ * @brief Offer the sketch of an index as column statistics.
+ *
+ * Takes the pg_statistic tuple ANALYZE stored and replaces only its
+ * stadistinct, using ANALYZE's convention of a negative fraction when the
+ * values look like they scale with the table. For a column that has never
+ * been analyzed, a tuple holding only stadistinct is made up, with no
+ * NULLs, no width and no histogram or most common values.
+ *
+ * @param indexOid The cuckoo index, which keeps a sketch.
+ * @param starelid Relation the statistics describe.
+ * @param attnum Column the statistics describe.
+ * @param aclOk Whether the user may see the statistics.
+ * @param vardata Variable data to fill in.
+ * @return true if a statistics tuple was supplied.
+ */
+static bool sketchStats(Oid indexOid, Oid starelid, AttrNumber attnum,
+                        bool aclOk, VariableStatData *vardata) {
+  Datum values[Natts_pg_statistic];
+  bool nulls[Natts_pg_statistic];
+  bool replace[Natts_pg_statistic];
+  HeapTuple statsTuple;
+  Relation index, statRel;
+  CuckooSketch sketch;
+  double ndistinct, reltuples;
+
+  /* The planner already holds a lock on the index */
+  index = index_open(indexOid, NoLock);
+  CuckooSketchRead(index, &sketch);
+  reltuples = index->rd_rel->reltuples;
+  index_close(index, NoLock);
+
+  ndistinct = rint(CuckooSketchEstimate(&sketch));
+  if (ndistinct < 1)
+    return false;
+  if (reltuples > 0 && ndistinct > 0.1 * reltuples)
+    ndistinct = -Min(ndistinct / reltuples, 1.0);
+
+  memset(values, 0, sizeof(values));
+  memset(nulls, false, sizeof(nulls));
+  memset(replace, false, sizeof(replace));
+  values[Anum_pg_statistic_stadistinct - 1] = Float4GetDatum(ndistinct);
+  replace[Anum_pg_statistic_stadistinct - 1] = true;
+
+  statRel = table_open(StatisticRelationId, AccessShareLock);
+  statsTuple = SearchSysCache3(STATRELATTINH, ObjectIdGetDatum(starelid),
+                               Int16GetDatum(attnum), BoolGetDatum(false));
+  if (HeapTupleIsValid(statsTuple)) {
+    vardata->statsTuple = heap_modify_tuple(
+        statsTuple, RelationGetDescr(statRel), values, nulls, replace);
+    ReleaseSysCache(statsTuple);
+  } else {
+    values[Anum_pg_statistic_starelid - 1] = ObjectIdGetDatum(starelid);
+    values[Anum_pg_statistic_staattnum - 1] = Int16GetDatum(attnum);
+    values[Anum_pg_statistic_stainherit - 1] = BoolGetDatum(false);
+    values[Anum_pg_statistic_stanullfrac - 1] = Float4GetDatum(0.0);
+    values[Anum_pg_statistic_stawidth - 1] = Int32GetDatum(0);
+    for (int i = 0; i < STATISTIC_NUM_SLOTS; i++) {
+      values[Anum_pg_statistic_stakind1 - 1 + i] = Int16GetDatum(0);
+      values[Anum_pg_statistic_staop1 - 1 + i] = ObjectIdGetDatum(InvalidOid);
+      values[Anum_pg_statistic_stacoll1 - 1 + i] =
+          ObjectIdGetDatum(InvalidOid);
+      nulls[Anum_pg_statistic_stanumbers1 - 1 + i] = true;
+      nulls[Anum_pg_statistic_stavalues1 - 1 + i] = true;
+    }
+    vardata->statsTuple =
+        heap_form_tuple(RelationGetDescr(statRel), values, nulls);
+  }
+  table_close(statRel, AccessShareLock);
+  vardata->freefunc = heap_freetuple;
+  vardata->acl_ok = aclOk;
+
+  return true;
+}
+
+/**
+ * @brief Find the planner's entry for the table of an index.
+ *
+ * @param root Planner state.
+ * @param indexOid The index.
+ * @return The table's RelOptInfo, or NULL if no table in the query has it.
+ */
+static RelOptInfo *findIndexRel(PlannerInfo *root, Oid indexOid) {
+  for (int i = 1; i < root->simple_rel_array_size; i++) {
+    RelOptInfo *rel = root->simple_rel_array[i];
+    ListCell *lc;
+
+    if (rel == NULL)
+      continue;
+    foreach (lc, rel->indexlist) {
+      if (((IndexOptInfo *)lfirst(lc))->indexoid == indexOid)
+        return rel;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Sharpen n_distinct of analyzed columns with a cuckoo index.
+ *
+ * A column is answered from a single-column, non-partial cuckoo index on
+ * it, the rest of its statistics coming from ANALYZE as usual. Access to
+ * the statistics is checked the way the planner checks it itself.
+ */
+static bool cuckooGetRelationStats(PlannerInfo *root, RangeTblEntry *rte,
+                                   AttrNumber attnum,
+                                   VariableStatData *vardata) {
+  RelOptInfo *rel = NULL;
+  ListCell *lc;
+
+  if (prev_get_relation_stats_hook &&
+      prev_get_relation_stats_hook(root, rte, attnum, vardata))
+    return true;
+
+  if (rte->rtekind != RTE_RELATION || rte->inh || attnum <= 0)
+    return false;
+
+  for (int i = 1; i < root->simple_rel_array_size; i++) {
+    if (root->simple_rte_array[i] == rte) {
+      rel = root->simple_rel_array[i];
+      break;
+    }
+  }
+  if (rel == NULL)
+    return false;
+
+  foreach (lc, rel->indexlist) {
+    IndexOptInfo *info = (IndexOptInfo *)lfirst(lc);
+
+    if (info->amcostestimate == ckcostestimate && info->ncolumns == 1 &&
+        info->indexkeys[0] == attnum && info->indpred == NIL &&
+        indexHasSketch(info->indexoid)) {
+      Oid userid = OidIsValid(rel->userid) ? rel->userid : GetUserId();
+      bool aclOk =
+          rte->securityQuals == NIL &&
+          (pg_class_aclcheck(rte->relid, userid, ACL_SELECT) == ACLCHECK_OK ||
+           pg_attribute_aclcheck(rte->relid, attnum, userid, ACL_SELECT) ==
+               ACLCHECK_OK);
+
+      return sketchStats(info->indexoid, rte->relid, attnum, aclOk, vardata);
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @brief Sharpen n_distinct of the expression of a cuckoo index.
+ *
+ * The planner asks for the statistics ANALYZE gathered on an index
+ * expression; the sketch replaces their n_distinct. Seeing them requires
+ * SELECT on the whole table, as for the planner's own lookup.
+ */
+static bool cuckooGetIndexStats(PlannerInfo *root, Oid indexOid,
+                                AttrNumber indexattnum,
+                                VariableStatData *vardata) {
+  RelOptInfo *rel;
+  bool aclOk = false;
+
+  if (prev_get_index_stats_hook &&
+      prev_get_index_stats_hook(root, indexOid, indexattnum, vardata))
+    return true;
+
+  if (!indexHasSketch(indexOid))
+    return false;
+
+  rel = findIndexRel(root, indexOid);
+  if (rel != NULL) {
+    RangeTblEntry *rte = planner_rt_fetch(rel->relid, root);
+    Oid userid = OidIsValid(rel->userid) ? rel->userid : GetUserId();
+
+    aclOk = rte->securityQuals == NIL &&
+            pg_class_aclcheck(rte->relid, userid, ACL_SELECT) == ACLCHECK_OK;
+  }
+
+  return sketchStats(indexOid, indexOid, indexattnum, aclOk, vardata);
+}
+
+/**
+ * @brief Install the planner statistics hooks.
+ *
+ * Called from _PG_init().
+ */
+void CuckooInitStatsHooks(void) {
+  prev_get_relation_stats_hook = get_relation_stats_hook;
+  get_relation_stats_hook = cuckooGetRelationStats;
+  prev_get_index_stats_hook = get_index_stats_hook;
+  get_index_stats_hook = cuckooGetIndexStats;
+}
@@ -0,0 +1,169 @@
+/**
+ * @file ckstream.cpp
+ * @brief Hashing long strings without materializing them.
+ *
+ * hashtext() detoasts its argument into a palloc'd copy before hashing
+ * it, so fingerprinting a multi-megabyte value costs a copy of it. For
+ * strings that compare bytewise (text and name under a deterministic
+ * collation), cuckoo indexes hash the bytes in CUCKOO_STREAM_BLOCK sized
+ * blocks instead, each seeded with the hash of the blocks before it. A
+ * value stored out of line without compression is then read one slice of
+ * TOAST chunks at a time; compressed values still have to be decompressed
+ * first, but hash the same way. Builds, inserts and scans all hash
+ * through CuckooHashColumn(), so they agree.
+ *
+ * Other types, such as jsonb, whose equal values need not be equal bytes,
+ * keep their opclass hash function.
+ *
+ * Copyright (c) 2025
+ * SPDX-License-Identifier: PostgreSQL
+ */
+#include "cuckoo.h"
+
+extern "C" {
+#include "access/detoast.h"
+#include "common/hashfn.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "varatt.h"
+}
+
+/*
+ * Bytes hashed at a time.  Part of the fingerprint format: changing it
+ * changes the fingerprint of every value longer than one block.
+ */
+#define CUCKOO_STREAM_BLOCK (256 * 1024)
+
+/**
+ * @brief Check whether values hashed by a function can be streamed.
+ *
+ * @param hashProc Hash support function of the column.
+ * @param collation Collation of the column.
+ * @return true for hashtext() and hashname() under a deterministic
+ *         collation, where equal strings are equal bytes.
+ */
+bool CuckooCanStreamHash(Oid hashProc, Oid collation) {
+  if (hashProc != F_HASHTEXT && hashProc != F_HASHNAME)
+    return false;
+
+  return !OidIsValid(collation) || get_collation_isdeterministic(collation);
+}
+
+/**
+ * @brief Fold a 64-bit block hash into a column hash.
+ *
+ * @param hash Hash of the last block.
+ * @return Column hash.
+ */
+static inline uint32 foldStreamHash(uint64 hash) {
+  return (uint32)hash ^ (uint32)(hash >> 32);
+}
+
+/**
+ * @brief Hash bytes in memory block by block.
+ *
+ * @param data Bytes to hash.
+ * @param len Number of bytes.
+ * @return Column hash.
+ */
+static uint32 streamHashBytes(const char *data, int32 len) {
+  uint64 hash = (uint64)len;
+  int32 offset = 0;
+
+  do {
+    int32 n = Min(len - offset, CUCKOO_STREAM_BLOCK);
+
+    hash = hash_bytes_extended((const unsigned char *)data + offset, n, hash);
+    offset += n;
+  } while (offset < len);
+
+  return foldStreamHash(hash);
+}
+
+/**
+ * @brief Hash a text value block by block.
+ *
+ * A value stored out of line without compression is fetched one block at
+ * a time, so no more than a block of it is in memory at once.
+ *
+ * @param value The text Datum, possibly toasted.
+ * @return Column hash, equal to that of the detoasted value.
+ */
+static uint32 streamHashText(Datum value) {
+  struct varlena *attr = (struct varlena *)DatumGetPointer(value);
+  text *detoasted;
+  uint32 hash;
+
+  if (VARATT_IS_EXTERNAL_ONDISK(attr)) {
+    struct varatt_external toast_pointer;
+
+    VARATT_EXTERNAL_GET_POINTER(toast_pointer, attr);
+    if (!VARATT_EXTERNAL_IS_COMPRESSED(toast_pointer)) {
+      int32 len = VARATT_EXTERNAL_GET_EXTSIZE(toast_pointer);
+      uint64 blockHash = (uint64)len;
+      int32 offset = 0;
+
+      do {
+        int32 n = Min(len - offset, CUCKOO_STREAM_BLOCK);
+        struct varlena *slice = detoast_attr_slice(attr, offset, n);
+
+        blockHash = hash_bytes_extended(
+            (const unsigned char *)VARDATA_ANY(slice),
+            VARSIZE_ANY_EXHDR(slice), blockHash);
+        pfree(slice);
+        offset += n;
+      } while (offset < len);
+
+      return foldStreamHash(blockHash);
+    }
+  }
+
+  detoasted = DatumGetTextPP(value);
+  hash = streamHashBytes(VARDATA_ANY(detoasted),
+                         VARSIZE_ANY_EXHDR(detoasted));
+  if ((Pointer)detoasted != DatumGetPointer(value))
+    pfree(detoasted);
+
+  return hash;
+}
+
+/**
+ * @brief Hash a string value block by block.
+ *
+ * @param hashProc hashtext() or hashname(), telling the type of value.
+ * @param value Value to hash.
+ * @return Column hash.
+ */
+static uint32 streamHash(Oid hashProc, Datum value) {
+  if (hashProc == F_HASHNAME) {
+    const char *name = NameStr(*DatumGetName(value));
+
+    return streamHashBytes(name, (int32)strlen(name));
+  }
+
+  return streamHashText(value);
+}
+
+/**
+ * @brief Hash the value of an indexed column.
+ *
+ * Columns whose values compare bytewise are hashed block by block;
+ * everything else goes through the opclass hash function.
+ *
+ * @param state Cuckoo index state.
+ * @param attno Column number (0-based).
+ * @param hashFn Hash function for the value: the column's, or a
+ *               cross-type one from its operator family.
+ * @param value Value to hash.
+ * @return Column hash.
+ */
+uint32 CuckooHashColumn(CuckooState *state, int attno, FmgrInfo *hashFn,
+                        Datum value) {
+  if (state->streamed[attno] &&
+      (hashFn->fn_oid == F_HASHTEXT || hashFn->fn_oid == F_HASHNAME))
+    return streamHash(hashFn->fn_oid, value);
+
+  return DatumGetUInt32(
+      FunctionCall1Coll(hashFn, state->collations[attno], value));
+}
@@ -0,0 +1,327 @@
+/**
+ * @file cksummary.cpp
+ * @brief Fingerprint summary pages for flat-layout cuckoo indexes.
+ *
+ * A summary page holds the fingerprints of a group of data pages, packed
+ * at bits_per_tag bits each, without their heap TIDs. A lookup reads the
+ * summary pages and only visits the data pages whose summary slot holds
+ * the search fingerprint, reading a fraction of the bytes of a full scan.
+ *
+ * Each data page change rewrites the page's summary slot in the same WAL
+ * record, so a summary always agrees with its data pages. Data pages are
+ * locked before their summary page.
+ *
+ * Copyright (c) 2025
+ * SPDX-License-Identifier: PostgreSQL
+ */
+#include "cuckoo.h"
+
+extern "C" {
+#include "miscadmin.h"
+#include "nodes/tidbitmap.h"
+#include "storage/bufmgr.h"
+}
+
+/**
+ * @brief Compute the summary layout for a set of index options.
+ *
+ * A slot holds a uint16 tuple count followed by the packed fingerprints
+ * of a full data page.
+ *
+ * @param opts Index options.
+ * @param group Output: data pages per summary page, 0 if disabled.
+ * @param slotSize Output: bytes per slot.
+ */
+void CuckooSummaryGeometry(const CuckooOptions *opts, uint32 *group,
+                           Size *slotSize) {
+  Size usable = BLCKSZ - MAXALIGN(SizeOfPageHeaderData) -
+                MAXALIGN(sizeof(CuckooPageOpaqueData));
+
+  if (!opts->summary || opts->layout != CUCKOO_LAYOUT_FLAT) {
+    *group = 0;
+    *slotSize = 0;
+    return;
+  }
+
+  *slotSize = SHORTALIGN(sizeof(uint16) +
+                         (CUCKOO_MAX_TUPLES_PER_PAGE * opts->bitsPerTag + 7) /
+                             8);
+  *group = (uint32)(usable / *slotSize);
+}
+
+/**
+ * @brief Read a packed fingerprint.
+ *
+ * @param tags Packed fingerprints.
+ * @param i Index of the fingerprint.
+ * @param bits Bits per fingerprint.
+ * @return The fingerprint.
+ */
+static inline uint32 summaryGetTag(const uint8 *tags, int i, int bits) {
+  uint64 bit = (uint64)i * bits;
+  const uint8 *p = tags + (bit >> 3);
+  int shift = bit & 7;
+  int nbytes = (shift + bits + 7) >> 3;
+  uint64 v = 0;
+
+  for (int k = 0; k < nbytes; k++)
+    v |= (uint64)p[k] << (8 * k);
+
+  return (uint32)((v >> shift) & ((UINT64CONST(1) << bits) - 1));
+}
+
+/**
+ * @brief Initialize an empty summary page.
+ *
+ * @param state Cuckoo index state.
+ * @param page Page to initialize.
+ */
+static void initSummaryPage(CuckooState *state, Page page) {
+  Size size = state->summaryGroup * state->summarySlotSize;
+
+  CuckooInitPage(page, CUCKOO_SUMMARY);
+  memset(PageGetContents(page), 0, size);
+  ((PageHeader)page)->pd_lower += size;
+}
+
+/**
+ * @brief Write a data page's fingerprints to its summary slot.
+ *
+ * @param state Cuckoo index state.
+ * @param slot Summary slot.
+ * @param page Data page, or NULL to clear the slot.
+ */
+static void fillSlot(CuckooState *state, Pointer slot, Page page) {
+  uint16 count = 0;
+  uint8 *tags = (uint8 *)slot + sizeof(uint16);
+  int bits = state->opts.bitsPerTag;
+  uint64 acc = 0;
+  int nacc = 0;
+
+  memset(slot, 0, state->summarySlotSize);
+
+  if (page && !PageIsNew(page) && !CuckooPageIsDeleted(page))
+    count = CuckooPageGetMaxOffset(page);
+
+  for (OffsetNumber offset = 1; offset <= count; offset++) {
+    acc |= (uint64)CuckooPageGetTuple(state, page, offset)->fingerprint
+           << nacc;
+    nacc += bits;
+    while (nacc >= 8) {
+      *tags++ = (uint8)acc;
+      acc >>= 8;
+      nacc -= 8;
+    }
+  }
+  if (nacc > 0)
+    *tags = (uint8)acc;
+
+  memcpy(slot, &count, sizeof(uint16));
+}
+
+/**
+ * @brief Allocate a data page, skipping summary page positions.
+ *
+ * Summary pages are initialized as the relation is extended past them.
+ *
+ * @param index The index relation.
+ * @param state Cuckoo index state.
+ * @return Buffer for the new page (pinned and locked).
+ */
+Buffer CuckooNewDataBuffer(Relation index, CuckooState *state) {
+  for (;;) {
+    Buffer buffer = CuckooNewBuffer(index);
+    GenericXLogState *xlogState;
+    Page page;
+
+    if (!CuckooIsSummaryBlock(state->summaryGroup,
+                              BufferGetBlockNumber(buffer)))
+      return buffer;
+
+    if (PageIsNew(BufferGetPage(buffer))) {
+      xlogState = GenericXLogStart(index);
+      page = GenericXLogRegisterBuffer(xlogState, buffer,
+                                       GENERIC_XLOG_FULL_IMAGE);
+      initSummaryPage(state, page);
+      GenericXLogFinish(xlogState);
+    }
+
+    UnlockReleaseBuffer(buffer);
+  }
+}
+
+/**
+ * @brief Register the summary page of a data page in a WAL record.
+ *
+ * Rewrites the data page's summary slot from its contents, which the
+ * caller has already updated. The caller must release the returned
+ * buffer after finishing the record.
+ *
+ * @param index The index relation.
+ * @param state Cuckoo index state.
+ * @param xlogState WAL record the data page is registered in.
+ * @param blkno Block number of the data page.
+ * @param page Data page contents, or NULL if the page is being emptied.
+ * @return Locked summary buffer, or InvalidBuffer without summaries.
+ */
+Buffer CuckooSummaryUpdate(Relation index, CuckooState *state,
+                           GenericXLogState *xlogState, BlockNumber blkno,
+                           Page page) {
+  BlockNumber summaryBlkno;
+  Buffer buffer;
+  Page summaryPage;
+  bool isNew;
+
+  if (state->summaryGroup == 0)
+    return InvalidBuffer;
+
+  Assert(!CuckooIsSummaryBlock(state->summaryGroup, blkno));
+  summaryBlkno = CuckooSummaryBlock(state->summaryGroup, blkno);
+
+  buffer = ReadBuffer(index, summaryBlkno);
+  LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+
+  /* The extension that reached the summary page may have crashed */
+  isNew = PageIsNew(BufferGetPage(buffer));
+  summaryPage = GenericXLogRegisterBuffer(
+      xlogState, buffer, isNew ? GENERIC_XLOG_FULL_IMAGE : 0);
+  if (isNew)
+    initSummaryPage(state, summaryPage);
+
+  fillSlot(state,
+           PageGetContents(summaryPage) +
+               (blkno - summaryBlkno - 1) * state->summarySlotSize,
+           page);
+
+  return buffer;
+}
+
+/**
+ * @brief Find the tuples stored with a fingerprint using the summaries.
+ *
+ * @param index The index relation.
+ * @param state Cuckoo index state.
+ * @param fingerprint Fingerprint to look up.
+ * @param callback Called with each matching tuple while its page is
+ *                 locked, or NULL to only count them.
+ * @param arg Argument passed to the callback.
+ * @return Number of matching tuples.
+ */
+int64 CuckooSummaryForEachMatch(Relation index, CuckooState *state,
+                                uint32 fingerprint,
+                                CuckooTupleCallback callback, void *arg) {
+  BlockNumber *matches;
+  BlockNumber npages;
+  BufferAccessStrategy bas;
+  int bits = state->opts.bitsPerTag;
+  int64 ntids = 0;
+
+  matches = (BlockNumber *)palloc(sizeof(BlockNumber) * state->summaryGroup);
+  bas = GetAccessStrategy(BAS_BULKREAD);
+  npages = RelationGetNumberOfBlocks(index);
+
+  for (BlockNumber summaryBlkno = CUCKOO_HEAD_BLKNO; summaryBlkno < npages;
+       summaryBlkno += state->summaryGroup + 1) {
+    Buffer buffer;
+    Page page;
+    int nmatches = 0;
+
+    buffer = ReadBufferExtended(index, MAIN_FORKNUM, summaryBlkno, RBM_NORMAL,
+                                bas);
+    LockBuffer(buffer, BUFFER_LOCK_SHARE);
+    page = BufferGetPage(buffer);
+
+    /* A summary page never initialized has no data pages behind it */
+    if (!PageIsNew(page)) {
+      for (uint32 i = 0; i < state->summaryGroup; i++) {
+        Pointer slot = PageGetContents(page) + i * state->summarySlotSize;
+        const uint8 *tags = (const uint8 *)slot + sizeof(uint16);
+        uint16 count;
+
+        memcpy(&count, slot, sizeof(uint16));
+        for (int j = 0; j < count; j++) {
+          if (summaryGetTag(tags, j, bits) == fingerprint) {
+            matches[nmatches++] = summaryBlkno + 1 + i;
+            break;
+          }
+        }
+      }
+    }
+
+    UnlockReleaseBuffer(buffer);
+
+    /* Visit the data pages that hold the fingerprint */
+    for (int m = 0; m < nmatches; m++) {
+      OffsetNumber maxOffset;
+
+      buffer = ReadBufferExtended(index, MAIN_FORKNUM, matches[m], RBM_NORMAL,
+                                  bas);
+      LockBuffer(buffer, BUFFER_LOCK_SHARE);
+      page = BufferGetPage(buffer);
+
+      if (!PageIsNew(page) && !CuckooPageIsDeleted(page)) {
+        maxOffset = CuckooPageGetMaxOffset(page);
+        for (OffsetNumber offset = 1; offset <= maxOffset; offset++) {
+          CuckooTuple *itup = CuckooPageGetTuple(state, page, offset);
+
+          if (itup->fingerprint == fingerprint) {
+            if (callback != NULL)
+              callback(itup, arg);
+            ntids++;
+          }
+        }
+      }
+
+      UnlockReleaseBuffer(buffer);
+    }
+
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  FreeAccessStrategy(bas);
+  pfree(matches);
+
+  return ntids;
+}
+
+/**
+ * @brief Check the summaries for a fingerprint without reading data pages.
+ *
+ * @param index The index relation.
+ * @param state Cuckoo index state.
+ * @param fingerprint Fingerprint to look up.
+ * @return false if no data page holds the fingerprint.
+ */
+bool CuckooSummaryMayContain(Relation index, CuckooState *state,
+                             uint32 fingerprint) {
+  BlockNumber npages = RelationGetNumberOfBlocks(index);
+  int bits = state->opts.bitsPerTag;
+  bool found = false;
+
+  for (BlockNumber summaryBlkno = CUCKOO_HEAD_BLKNO;
+       summaryBlkno < npages && !found;
+       summaryBlkno += state->summaryGroup + 1) {
+    Buffer buffer = ReadBuffer(index, summaryBlkno);
+    Page page;
+
+    LockBuffer(buffer, BUFFER_LOCK_SHARE);
+    page = BufferGetPage(buffer);
+
+    if (!PageIsNew(page)) {
+      for (uint32 i = 0; i < state->summaryGroup && !found; i++) {
+        Pointer slot = PageGetContents(page) + i * state->summarySlotSize;
+        const uint8 *tags = (const uint8 *)slot + sizeof(uint16);
+        uint16 count;
+
+        memcpy(&count, slot, sizeof(uint16));
+        for (int j = 0; j < count && !found; j++)
+          found = summaryGetTag(tags, j, bits) == fingerprint;
+      }
+    }
+
+    UnlockReleaseBuffer(buffer);
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  return found;
+}
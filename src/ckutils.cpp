@@ -11,12 +11,34 @@
  */
 #include "cuckoo.h"
 
+#include <cmath>
+
 extern "C" {
+#include "access/genam.h"
+#include "access/htup_details.h"
+#include "access/relation.h"
 #include "access/reloptions.h"
+#include "access/tableam.h"
+#include "catalog/pg_statistic.h"
+#include "catalog/storage_xlog.h"
 #include "commands/vacuum.h"
+#include "common/hashfn.h"
+#include "lib/qunique.h"
+#include "miscadmin.h"
+#include "port/pg_bitutils.h"
 #include "storage/bufmgr.h"
+#include "storage/freespace.h"
 #include "storage/indexfsm.h"
+#include "storage/smgr.h"
+#include "utils/acl.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
 #include "utils/memutils.h"
+#include "utils/relcache.h"
+#include "utils/rls.h"
+#include "utils/timestamp.h"
+#include "utils/syscache.h"
+#include "utils/uuid.h"
 #include "varatt.h"
 }
 
@@ -25,11 +47,38 @@ extern "C" {
 PG_FUNCTION_INFO_V1(ckhandler);
 }
 
+/* Largest number of pages an index is extended by at once */
+#define CUCKOO_MAX_EXTEND_BATCH 64
+
+/* Extensions closer together than this grow the next batch */
+#define CUCKOO_EXTEND_INTERVAL_MS 1000
+
+/**
+ * @brief How this backend last extended an index.
+ *
+ * Only the most recently extended index is tracked; extending another
+ * one starts over from a single page.
+ */
+typedef struct CuckooExtendState {
+  Oid relid;        /**< Index last extended */
+  TimestampTz last; /**< When it was extended */
+  uint32 batch;     /**< Pages it was extended by */
+} CuckooExtendState;
+
+static CuckooExtendState ck_extend = {InvalidOid, 0, 1};
+
 /* Kind of relation options for cuckoo index */
 static relopt_kind ck_relopt_kind;
 
-/* Parse table for fillRelOptions - 3 options */
-static relopt_parse_elt ck_relopt_tab[3];
+/* Parse table for fillRelOptions - 9 options */
+static relopt_parse_elt ck_relopt_tab[9];
+
+/* Values of the layout option */
+static relopt_enum_elt_def ck_layout_values[] = {
+    {"flat", CUCKOO_LAYOUT_FLAT},
+    {"hashed", CUCKOO_LAYOUT_HASHED},
+    {"frozen", CUCKOO_LAYOUT_FROZEN},
+    {(const char *)NULL}};
 
 /**
  * @brief Construct default cuckoo options.
@@ -40,6 +89,8 @@ static CuckooOptions *makeDefaultCuckooOptions(void) {
   opts->bitsPerTag = DEFAULT_BITS_PER_TAG;
   opts->tagsPerBucket = DEFAULT_TAGS_PER_BUCKET;
   opts->maxKicks = DEFAULT_MAX_KICKS;
+  opts->layout = CUCKOO_LAYOUT_FLAT;
+  opts->targetFpr = 0.0;
   SET_VARSIZE(opts, sizeof(CuckooOptions));
   return opts;
 }
@@ -48,7 +99,7 @@ static CuckooOptions *makeDefaultCuckooOptions(void) {
  * @brief Module initialization function.
  *
  * Called when the extension is loaded. Registers reloptions for the
- * cuckoo index access method.
+ * cuckoo index access method and installs the partition pruning hook.
  */
 extern "C" void _PG_init(void) {
   ck_relopt_kind = add_reloption_kind();
@@ -80,6 +131,66 @@ extern "C" void _PG_init(void) {
   ck_relopt_tab[2].optname = "max_kicks";
   ck_relopt_tab[2].opttype = RELOPT_TYPE_INT;
   ck_relopt_tab[2].offset = offsetof(CuckooOptions, maxKicks);
+
+  /* Option for the page layout */
+  add_enum_reloption(ck_relopt_kind, "layout",
+                     "Page layout of the index (flat, hashed or frozen)",
+                     ck_layout_values, CUCKOO_LAYOUT_FLAT,
+                     "Valid values are \"flat\", \"hashed\" and \"frozen\".",
+                     AccessExclusiveLock);
+  ck_relopt_tab[3].optname = "layout";
+  ck_relopt_tab[3].opttype = RELOPT_TYPE_ENUM;
+  ck_relopt_tab[3].offset = offsetof(CuckooOptions, layout);
+
+  /* Option for choosing bits_per_tag from a false positive rate */
+  add_real_reloption(ck_relopt_kind, "target_fpr",
+                     "False positive rate to size fingerprint tags for at "
+                     "build time (0 = use bits_per_tag)",
+                     0.0, 0.0, 1.0, AccessExclusiveLock);
+  ck_relopt_tab[4].optname = "target_fpr";
+  ck_relopt_tab[4].opttype = RELOPT_TYPE_REAL;
+  ck_relopt_tab[4].offset = offsetof(CuckooOptions, targetFpr);
+
+  /* Option for fingerprint summary pages */
+  add_bool_reloption(ck_relopt_kind, "summary",
+                     "Keep fingerprint summary pages that scans read before "
+                     "data pages",
+                     false, AccessExclusiveLock);
+  ck_relopt_tab[5].optname = "summary";
+  ck_relopt_tab[5].opttype = RELOPT_TYPE_BOOL;
+  ck_relopt_tab[5].offset = offsetof(CuckooOptions, summary);
+
+  /* Option for block range filters */
+  add_int_reloption(ck_relopt_kind, "pages_per_range",
+                    "Number of heap blocks summarized by each range filter "
+                    "(0 = store heap TIDs)",
+                    0, 0, 131072, AccessExclusiveLock);
+  ck_relopt_tab[6].optname = "pages_per_range";
+  ck_relopt_tab[6].opttype = RELOPT_TYPE_INT;
+  ck_relopt_tab[6].offset = offsetof(CuckooOptions, pagesPerRange);
+
+  /* Option for storing keys that index-only scans return */
+  add_bool_reloption(ck_relopt_kind, "exact_keys",
+                     "Store each key next to its fingerprint so that "
+                     "index-only scans can return it",
+                     false, AccessExclusiveLock);
+  ck_relopt_tab[7].optname = "exact_keys";
+  ck_relopt_tab[7].opttype = RELOPT_TYPE_BOOL;
+  ck_relopt_tab[7].offset = offsetof(CuckooOptions, exactKeys);
+
+  /* Option for counting changes that invalidate backend lookup caches */
+  add_bool_reloption(ck_relopt_kind, "lookup_cache",
+                     "Count changes to the index so that backends can cache "
+                     "the results of repeated lookups",
+                     false, AccessExclusiveLock);
+  ck_relopt_tab[8].optname = "lookup_cache";
+  ck_relopt_tab[8].opttype = RELOPT_TYPE_BOOL;
+  ck_relopt_tab[8].offset = offsetof(CuckooOptions, lookupCache);
+
+  CuckooInitLookupCache();
+  CuckooInitPruning();
+  CuckooInitStatsHooks();
+  CuckooInitScanHooks();
 }
 
 /**
@@ -105,7 +216,7 @@ extern "C" Datum ckhandler(PG_FUNCTION_ARGS) {
   amroutine->amcanmulticol = true;
   amroutine->amoptionalkey = true;
   amroutine->amsearcharray = false;
-  amroutine->amsearchnulls = false;
+  amroutine->amsearchnulls = true;
   amroutine->amstorage = false;
   amroutine->amclusterable = false;
   amroutine->ampredlocks = false;
@@ -127,7 +238,7 @@ extern "C" Datum ckhandler(PG_FUNCTION_ARGS) {
   amroutine->aminsert = ckinsert;
   amroutine->ambulkdelete = ckbulkdelete;
   amroutine->amvacuumcleanup = ckvacuumcleanup;
-  amroutine->amcanreturn = NULL;
+  amroutine->amcanreturn = ckcanreturn;
   amroutine->amcostestimate = ckcostestimate;
   amroutine->amoptions = ckoptions;
   amroutine->amproperty = NULL;
@@ -136,7 +247,7 @@ extern "C" Datum ckhandler(PG_FUNCTION_ARGS) {
   amroutine->amadjustmembers = NULL;
   amroutine->ambeginscan = ckbeginscan;
   amroutine->amrescan = ckrescan;
-  amroutine->amgettuple = NULL;
+  amroutine->amgettuple = ckgettuple;
   amroutine->amgetbitmap = ckgetbitmap;
   amroutine->amendscan = ckendscan;
   amroutine->ammarkpos = NULL;
@@ -149,40 +260,46 @@ extern "C" Datum ckhandler(PG_FUNCTION_ARGS) {
 }
 
 /**
- * @brief Initialize CuckooState structure for an index.
- *
- * Reads the index metadata and initializes hash functions for each
- * indexed column.
- *
- * @param state Pointer to CuckooState to initialize.
- * @param index Relation descriptor for the index.
+ * @brief What the metapage tells about an index, cached in rd_amcache.
  */
-void initCuckooState(CuckooState *state, Relation index) {
-  state->nColumns = index->rd_att->natts;
-
-  /* Initialize hash function for each attribute */
-  for (int i = 0; i < index->rd_att->natts; i++) {
-    fmgr_info_copy(&(state->hashFn[i]),
-                   index_getprocinfo(index, i + 1, CUCKOO_HASH_PROC),
-                   CurrentMemoryContext);
-    state->collations[i] = index->rd_indcollation[i];
-  }
+typedef struct CuckooMetaCache {
+  CuckooOptions opts; /**< Options the index was built with */
+} CuckooMetaCache;
 
-  /* Initialize amcache if needed with options from metapage */
+/**
+ * @brief Read the metapage of an index into its rd_amcache.
+ *
+ * @param index The index relation.
+ * @return The cached metapage contents.
+ */
+static CuckooMetaCache *getMetaCache(Relation index) {
   if (!index->rd_amcache) {
     Buffer buffer;
     Page page;
     CuckooMetaPageData *meta;
-    CuckooOptions *opts;
+    CuckooMetaCache *cache;
 
-    opts = (CuckooOptions *)MemoryContextAlloc(index->rd_indexcxt,
-                                               sizeof(CuckooOptions));
+    cache = (CuckooMetaCache *)MemoryContextAlloc(index->rd_indexcxt,
+                                                  sizeof(CuckooMetaCache));
 
     buffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
     LockBuffer(buffer, BUFFER_LOCK_SHARE);
 
     page = BufferGetPage(buffer);
 
+    /*
+     * Pages written by cuckoo 1.0 have a smaller special space, with the
+     * flags at another offset, and a different metapage. They cannot be
+     * read in place.
+     */
+    if (PageGetSpecialSize(page) != MAXALIGN(sizeof(CuckooPageOpaqueData)))
+      ereport(ERROR,
+              (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+               errmsg("index \"%s\" was built by cuckoo 1.0 and must be "
+                      "rebuilt",
+                      RelationGetRelationName(index)),
+               errhint("REINDEX the index.")));
+
     if (!CuckooPageIsMeta(page))
       elog(ERROR, "Relation is not a cuckoo index");
 
@@ -191,24 +308,187 @@ void initCuckooState(CuckooState *state, Relation index) {
     if (meta->magicNumber != CUCKOO_MAGIC_NUMBER)
       elog(ERROR, "Relation is not a cuckoo index");
 
-    *opts = meta->opts;
+    if (CuckooPageGetVersion(page) != CUCKOO_PAGE_VERSION)
+      ereport(ERROR,
+              (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+               errmsg("index \"%s\" has unsupported page format version %u",
+                      RelationGetRelationName(index),
+                      CuckooPageGetVersion(page)),
+               errhint("Update the cuckoo extension.")));
+
+    cache->opts = meta->opts;
 
     UnlockReleaseBuffer(buffer);
 
-    index->rd_amcache = opts;
+    index->rd_amcache = cache;
   }
 
-  memcpy(&state->opts, index->rd_amcache, sizeof(state->opts));
+  return (CuckooMetaCache *)index->rd_amcache;
+}
+
+/**
+ * @brief Get the options an index was built with.
+ *
+ * The options are read from the metapage, since the tag width may have
+ * been chosen at build time, and cached in rd_amcache.
+ *
+ * @param index The index relation.
+ * @return Options from the metapage.
+ */
+CuckooOptions *CuckooGetOptions(Relation index) {
+  return &getMetaCache(index)->opts;
+}
+
+/**
+ * @brief Initialize CuckooState structure for an index.
+ *
+ * Reads the index metadata and initializes hash functions for each
+ * indexed column.
+ *
+ * @param state Pointer to CuckooState to initialize.
+ * @param index Relation descriptor for the index.
+ */
+void initCuckooState(CuckooState *state, Relation index) {
+  state->nColumns = index->rd_att->natts;
+  state->extractValues = false;
+
+  /* Initialize hash function for each attribute */
+  for (int i = 0; i < index->rd_att->natts; i++) {
+    state->collations[i] = index->rd_indcollation[i];
+
+    /*
+     * Element opclasses provide an extract-value procedure instead of a
+     * whole-value hash; each extracted element gets its own tuple.
+     */
+    if (OidIsValid(index_getprocid(index, i + 1, CUCKOO_EXTRACTVALUE_PROC))) {
+      if (index->rd_att->natts > 1)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("cuckoo element operator classes do not support "
+                        "multicolumn indexes")));
+
+      state->extractValues = true;
+      fmgr_info_copy(&state->extractValueFn,
+                     index_getprocinfo(index, i + 1, CUCKOO_EXTRACTVALUE_PROC),
+                     CurrentMemoryContext);
+
+      /* Queries are extracted like values unless told otherwise */
+      if (OidIsValid(index_getprocid(index, i + 1, CUCKOO_EXTRACTQUERY_PROC)))
+        fmgr_info_copy(
+            &state->extractQueryFn,
+            index_getprocinfo(index, i + 1, CUCKOO_EXTRACTQUERY_PROC),
+            CurrentMemoryContext);
+      else
+        fmgr_info_copy(&state->extractQueryFn, &state->extractValueFn,
+                       CurrentMemoryContext);
+      continue;
+    }
+
+    fmgr_info_copy(&(state->hashFn[i]),
+                   index_getprocinfo(index, i + 1, CUCKOO_HASH_PROC),
+                   CurrentMemoryContext);
+  }
+
+  state->opts = *CuckooGetOptions(index);
+  for (int i = 0; i < state->nColumns; i++)
+    state->streamed[i] = !state->extractValues &&
+                         CuckooCanStreamHash(state->hashFn[i].fn_oid,
+                                             state->collations[i]);
   state->sizeOfCuckooTuple = sizeof(CuckooTuple);
-  state->tagMask = (1U << state->opts.bitsPerTag) - 1;
+  if (state->opts.exactKeys) {
+    if (state->nColumns != 1 || state->extractValues ||
+        !TupleDescAttr(index->rd_att, 0)->attbyval)
+      ereport(ERROR,
+              (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+               errmsg("exact_keys requires a single column of a "
+                      "pass-by-value type")));
+    state->sizeOfCuckooTuple += sizeof(Datum);
+  }
   state->tagsPerBucket = state->opts.tagsPerBucket;
   state->maxKicks = state->opts.maxKicks;
+  CuckooSetTagWidth(state, state->opts.bitsPerTag);
+  state->sketch = NULL;
+  state->hasRowHash = false;
+}
+
+/**
+ * @brief Set the fingerprint width of a cuckoo state.
+ *
+ * Updates the tag mask and the summary geometry, which depend on it.
+ *
+ * @param state Cuckoo index state.
+ * @param bits Bits per fingerprint tag.
+ */
+void CuckooSetTagWidth(CuckooState *state, int bits) {
+  state->opts.bitsPerTag = bits;
+  state->tagMask = bits >= 32 ? PG_UINT32_MAX : (1U << bits) - 1;
+  CuckooSummaryGeometry(&state->opts, &state->summaryGroup,
+                        &state->summarySlotSize);
+}
+
+/**
+ * @brief Mix one column hash into a running row hash.
+ *
+ * @param hash Running hash.
+ * @param colHash Hash of the next column.
+ * @return Combined hash.
+ */
+static inline uint32 mixColumnHash(uint32 hash, uint32 colHash) {
+  hash ^= colHash;
+  hash *= 0x5bd1e995; /* MurmurHash2 mixing constant */
+  hash ^= hash >> 15;
+  return hash;
+}
+
+/**
+ * @brief Reduce a hash to a fingerprint.
+ *
+ * Neither zero nor CUCKOO_NULL_FINGERPRINT is ever the fingerprint of a
+ * hash: both are moved up by two, which keeps the fingerprint of a
+ * narrower tag derivable from a wider one.
+ *
+ * @param state Cuckoo index state.
+ * @param hash Hash value.
+ * @return Fingerprint bits of the hash.
+ */
+static inline uint32 hashToFingerprint(CuckooState *state, uint32 hash) {
+  uint32 fingerprint = hash & state->tagMask;
+
+  return fingerprint < 2 ? fingerprint + 2 : fingerprint;
+}
+
+/**
+ * @brief Combine per-column hashes into a row hash.
+ *
+ * @param state Cuckoo index state.
+ * @param colHashes Hash of each column.
+ * @param isnull Array indicating which columns are NULL.
+ * @param allNull Output: whether every column is NULL.
+ * @return Row hash, of which the fingerprint keeps the low bits.
+ */
+static uint32 combineRowHash(CuckooState *state, uint32 *colHashes,
+                             bool *isnull, bool *allNull) {
+  uint32 hash = 0;
+
+  *allNull = true;
+  for (int i = 0; i < state->nColumns; i++) {
+    if (isnull[i])
+      continue;
+
+    /* Combine hashes using mixing function */
+    hash = mixColumnHash(hash, colHashes[i]);
+    *allNull = false;
+  }
+
+  return hash;
 }
 
 /**
  * @brief Compute fingerprint for a set of values.
  *
  * Hashes all non-null values and combines them into a single fingerprint.
+ * The row hash of rows with a non-null value is kept in the state, and
+ * feeds the state's sketch, if any.
  *
  * @param state Cuckoo index state.
  * @param values Array of Datum values to hash.
@@ -216,46 +496,330 @@ void initCuckooState(CuckooState *state, Relation index) {
  * @return Computed fingerprint value.
  */
 uint32 computeFingerprint(CuckooState *state, Datum *values, bool *isnull) {
-  uint32 hash = 0;
+  uint32 colHashes[INDEX_MAX_KEYS];
+  uint32 hash;
+  bool allNull;
 
   for (int i = 0; i < state->nColumns; i++) {
     if (isnull[i])
       continue;
 
-    uint32 colHash = DatumGetInt32(
-        FunctionCall1Coll(&state->hashFn[i], state->collations[i], values[i]));
+    colHashes[i] = CuckooHashColumn(state, i, &state->hashFn[i], values[i]);
+  }
+
+  hash = combineRowHash(state, colHashes, isnull, &allNull);
+  if (allNull)
+    return CUCKOO_NULL_FINGERPRINT;
 
-    /* Combine hashes using mixing function */
-    hash ^= colHash;
-    hash *= 0x5bd1e995; /* MurmurHash2 mixing constant */
-    hash ^= hash >> 15;
+  state->rowHash = hash;
+  state->hasRowHash = true;
+  if (state->sketch != NULL)
+    CuckooSketchAdd(state->sketch, hash);
+
+  return hashToFingerprint(state, hash);
+}
+
+/**
+ * @brief Combine per-column hashes into a fingerprint.
+ *
+ * Used directly by scans whose keys are hashed with a cross-type hash
+ * function; computeFingerprint() hashes the columns itself.
+ *
+ * @param state Cuckoo index state.
+ * @param colHashes Hash of each column.
+ * @param isnull Array indicating which columns are NULL.
+ * @return Computed fingerprint value.
+ */
+uint32 CuckooCombineHashes(CuckooState *state, uint32 *colHashes,
+                           bool *isnull) {
+  bool allNull;
+  uint32 hash = combineRowHash(state, colHashes, isnull, &allNull);
+
+  return allNull ? CUCKOO_NULL_FINGERPRINT : hashToFingerprint(state, hash);
+}
+
+/**
+ * @brief Compute the fingerprint of one extracted element.
+ *
+ * Elements are mixed exactly like a single-column row, so an element
+ * fingerprint depends only on the element hash and the tag width.
+ *
+ * @param state Cuckoo index state.
+ * @param hash Element hash returned by an extract procedure.
+ * @return Fingerprint of the element.
+ */
+uint32 CuckooElementFingerprint(CuckooState *state, uint32 hash) {
+  return hashToFingerprint(state, mixColumnHash(0, hash));
+}
+
+/**
+ * @brief Narrow a fingerprint to the tag width of a state.
+ *
+ * A fingerprint is the low bits of its row hash, so the fingerprint a
+ * narrower tag would have given is the low bits of the wider one.
+ * CUCKOO_NULL_FINGERPRINT stands for NULL rows at every width.
+ *
+ * @param state Cuckoo index state with the narrower width.
+ * @param fingerprint Fingerprint of a wider width.
+ * @return Fingerprint of the state's width.
+ */
+uint32 CuckooNarrowFingerprint(CuckooState *state, uint32 fingerprint) {
+  if (fingerprint == CUCKOO_NULL_FINGERPRINT)
+    return CUCKOO_NULL_FINGERPRINT;
+
+  return hashToFingerprint(state, fingerprint);
+}
+
+/**
+ * @brief Choose how a build can fingerprint batches of rows.
+ *
+ * @param state Cuckoo index state.
+ * @return One of the CUCKOO_BATCH_* kinds.
+ */
+int CuckooGetBatchKind(CuckooState *state) {
+  if (state->extractValues || state->nColumns != 1)
+    return CUCKOO_BATCH_NONE;
+
+  switch (state->hashFn[0].fn_oid) {
+  case F_HASHINT2:
+    return CUCKOO_BATCH_INT2;
+  case F_HASHINT4:
+  case F_HASHOID:
+    return CUCKOO_BATCH_INT4;
+  case F_HASHINT8:
+  case F_TIMESTAMP_HASH:
+    return CUCKOO_BATCH_INT8;
+  case F_UUID_HASH:
+    return CUCKOO_BATCH_UUID;
+  default:
+    return CUCKOO_BATCH_NONE;
   }
+}
 
-  /* Extract fingerprint bits, ensuring non-zero */
-  uint32 fingerprint = hash & state->tagMask;
-  if (fingerprint == 0)
-    fingerprint = 1;
+/**
+ * @brief Hash a 32-bit value exactly like hash_bytes_uint32().
+ *
+ * hash_bytes_uint32() is not inlined, so a loop calling it cannot be
+ * vectorized.  This is the same final mix of Jenkins' lookup3.
+ *
+ * @param k Value to hash.
+ * @return Hash of the value.
+ */
+static inline uint32 hashUint32(uint32 k) {
+  uint32 a, b, c;
+
+  a = b = c = 0x9e3779b9 + (uint32)sizeof(uint32) + 3923095;
+  a += k;
+
+  c ^= b;
+  c -= pg_rotate_left32(b, 14);
+  a ^= c;
+  a -= pg_rotate_left32(c, 11);
+  b ^= a;
+  b -= pg_rotate_left32(a, 25);
+  c ^= b;
+  c -= pg_rotate_left32(b, 16);
+  a ^= c;
+  a -= pg_rotate_left32(c, 4);
+  b ^= a;
+  b -= pg_rotate_left32(a, 14);
+  c ^= b;
+  c -= pg_rotate_left32(b, 24);
+
+  return c;
+}
+
+/**
+ * @brief Fingerprint a batch of single-column keys.
+ *
+ * Produces the same fingerprints as computeFingerprint() on each row, but
+ * hashes the keys with the body of the opclass hash function in a loop
+ * the compiler can vectorize, then mixes and masks them in another.
+ *
+ * @param state Cuckoo index state.
+ * @param kind Batch kind returned by CuckooGetBatchKind(), not NONE.
+ * @param keys Key of each row; uuid keys must stay valid until return.
+ * @param isnull Whether each key is NULL.
+ * @param nkeys Number of rows.
+ * @param fingerprints Output: fingerprint of each row.
+ */
+void CuckooBatchFingerprints(CuckooState *state, int kind, const Datum *keys,
+                             const bool *isnull, int nkeys,
+                             uint32 *fingerprints) {
+  uint32 tagMask = state->tagMask;
+
+  /* Column hashes, as hashint2() and the like compute them */
+  switch (kind) {
+  case CUCKOO_BATCH_INT2:
+    for (int i = 0; i < nkeys; i++)
+      fingerprints[i] = hashUint32((uint32)(int32)DatumGetInt16(keys[i]));
+    break;
+  case CUCKOO_BATCH_INT4:
+    for (int i = 0; i < nkeys; i++)
+      fingerprints[i] = hashUint32(DatumGetUInt32(keys[i]));
+    break;
+  case CUCKOO_BATCH_INT8:
+    for (int i = 0; i < nkeys; i++) {
+      int64 val = DatumGetInt64(keys[i]);
+      uint32 lohalf = (uint32)val;
+      uint32 hihalf = (uint32)(val >> 32);
+
+      lohalf ^= (val >= 0) ? hihalf : ~hihalf;
+      fingerprints[i] = hashUint32(lohalf);
+    }
+    break;
+  case CUCKOO_BATCH_UUID:
+    for (int i = 0; i < nkeys; i++)
+      fingerprints[i] =
+          isnull[i] ? 0
+                    : hash_bytes(
+                          (const unsigned char *)DatumGetUUIDP(keys[i])->data,
+                          UUID_LEN);
+    break;
+  default:
+    elog(ERROR, "unrecognized cuckoo batch kind: %d", kind);
+  }
+
+  /* mixColumnHash(), then the sketch wants the row hashes */
+  for (int i = 0; i < nkeys; i++) {
+    uint32 hash = fingerprints[i] * 0x5bd1e995;
+
+    fingerprints[i] = hash ^ (hash >> 15);
+  }
+
+  if (state->sketch != NULL) {
+    for (int i = 0; i < nkeys; i++) {
+      if (!isnull[i])
+        CuckooSketchAdd(state->sketch, fingerprints[i]);
+    }
+  }
+
+  /* hashToFingerprint() without branches */
+  for (int i = 0; i < nkeys; i++) {
+    uint32 fingerprint = fingerprints[i] & tagMask;
+
+    fingerprints[i] = fingerprint + ((fingerprint < 2) << 1);
+  }
+
+  for (int i = 0; i < nkeys; i++) {
+    if (isnull[i])
+      fingerprints[i] = CUCKOO_NULL_FINGERPRINT;
+  }
+}
+
+/**
+ * @brief qsort comparator for fingerprints.
+ */
+static int cmpFingerprint(const void *a, const void *b) {
+  uint32 fa = *(const uint32 *)a;
+  uint32 fb = *(const uint32 *)b;
+
+  if (fa == fb)
+    return 0;
+  return (fa < fb) ? -1 : 1;
+}
+
+/**
+ * @brief Sort fingerprints and remove duplicates in place.
+ *
+ * @param fingerprints Array of fingerprints.
+ * @param nfingerprints Number of entries in the array.
+ * @return Number of distinct fingerprints left at the start of the array.
+ */
+int CuckooUniqueFingerprints(uint32 *fingerprints, int nfingerprints) {
+  if (nfingerprints <= 1)
+    return nfingerprints;
 
-  return fingerprint;
+  qsort(fingerprints, nfingerprints, sizeof(uint32), cmpFingerprint);
+  return (int)qunique(fingerprints, nfingerprints, sizeof(uint32),
+                      cmpFingerprint);
 }
 
 /**
- * @brief Create a cuckoo tuple from values.
+ * @brief Compute all fingerprints to be indexed for a row.
+ *
+ * Whole-value opclasses yield a single fingerprint. Element opclasses
+ * yield one distinct fingerprint per extracted element, or a placeholder
+ * fingerprint when the value has no elements. NULL values of element
+ * opclasses yield CUCKOO_NULL_FINGERPRINT.
  *
  * @param state Cuckoo index state.
- * @param iptr Pointer to the heap tuple.
  * @param values Array of indexed values.
  * @param isnull Array indicating which values are NULL.
- * @return Pointer to newly allocated CuckooTuple.
+ * @param nfingerprints Output: number of fingerprints returned.
+ * @return Palloc'd array of fingerprints (NULL if there are none).
  */
-CuckooTuple *CuckooFormTuple(CuckooState *state, ItemPointer iptr,
-                             Datum *values, bool *isnull) {
-  CuckooTuple *tuple = (CuckooTuple *)palloc0(state->sizeOfCuckooTuple);
+uint32 *computeFingerprints(CuckooState *state, Datum *values, bool *isnull,
+                            int *nfingerprints) {
+  uint32 *fingerprints;
+  uint32 *hashes;
+  int32 nentries = 0;
+
+  if (!state->extractValues) {
+    fingerprints = (uint32 *)palloc(sizeof(uint32));
+    fingerprints[0] = computeFingerprint(state, values, isnull);
+    *nfingerprints = 1;
+    return fingerprints;
+  }
 
-  tuple->heapPtr = *iptr;
-  tuple->fingerprint = computeFingerprint(state, values, isnull);
+  if (isnull[0]) {
+    fingerprints = (uint32 *)palloc(sizeof(uint32));
+    fingerprints[0] = CUCKOO_NULL_FINGERPRINT;
+    *nfingerprints = 1;
+    return fingerprints;
+  }
 
-  return tuple;
+  hashes = (uint32 *)DatumGetPointer(
+      FunctionCall2Coll(&state->extractValueFn, state->collations[0],
+                        values[0], PointerGetDatum(&nentries)));
+
+  if (nentries <= 0) {
+    fingerprints = (uint32 *)palloc(sizeof(uint32));
+    fingerprints[0] = CuckooElementFingerprint(state, CUCKOO_EMPTY_ITEM_HASH);
+    *nfingerprints = 1;
+    return fingerprints;
+  }
+
+  fingerprints = (uint32 *)palloc(sizeof(uint32) * nentries);
+  for (int i = 0; i < nentries; i++)
+    fingerprints[i] = CuckooElementFingerprint(state, hashes[i]);
+
+  *nfingerprints = CuckooUniqueFingerprints(fingerprints, nentries);
+  return fingerprints;
+}
+
+/**
+ * @brief Create the cuckoo tuples for a row.
+ *
+ * @param state Cuckoo index state.
+ * @param iptr Pointer to the heap tuple.
+ * @param values Array of indexed values.
+ * @param isnull Array indicating which values are NULL.
+ * @param ntuples Output: number of tuples created.
+ * @return Palloc'd array of ntuples CuckooTuples.
+ */
+CuckooTuple *CuckooFormTuples(CuckooState *state, ItemPointer iptr,
+                              Datum *values, bool *isnull, int *ntuples) {
+  CuckooTuple *tuples;
+  uint32 *fingerprints;
+  int nfingerprints;
+
+  fingerprints = computeFingerprints(state, values, isnull, &nfingerprints);
+  tuples = (CuckooTuple *)palloc0(state->sizeOfCuckooTuple *
+                                  Max(nfingerprints, 1));
+
+  for (int i = 0; i < nfingerprints; i++) {
+    CuckooTuple *tuple =
+        (CuckooTuple *)((Pointer)tuples + i * state->sizeOfCuckooTuple);
+
+    tuple->heapPtr = *iptr;
+    tuple->fingerprint = fingerprints[i];
+    if (state->opts.exactKeys && !isnull[0])
+      memcpy(CuckooTupleGetKey(tuple), &values[0], sizeof(Datum));
+  }
+
+  *ntuples = nfingerprints;
+  return tuples;
 }
 
 /**
@@ -293,17 +857,50 @@ bool CuckooPageAddItem(CuckooState *state, Page page, CuckooTuple *tuple) {
   return true;
 }
 
+/**
+ * @brief Choose how many pages to extend an index by.
+ *
+ * The batch doubles each time the index runs out of free pages again
+ * soon after the last extension, and halves when extensions are rare.
+ * It never exceeds the current size of the index, so a small index under
+ * a burst of inserts grows at most twofold and keeps few spare pages.
+ *
+ * @param index The index relation.
+ * @return Number of pages to add.
+ */
+static uint32 extendBatchSize(Relation index) {
+  TimestampTz now = GetCurrentTimestamp();
+
+  if (ck_extend.relid != RelationGetRelid(index)) {
+    ck_extend.relid = RelationGetRelid(index);
+    ck_extend.batch = 1;
+  } else if (!TimestampDifferenceExceeds(ck_extend.last, now,
+                                         CUCKOO_EXTEND_INTERVAL_MS)) {
+    ck_extend.batch = Min(ck_extend.batch * 2, CUCKOO_MAX_EXTEND_BATCH);
+  } else {
+    ck_extend.batch = Max(ck_extend.batch / 2, 1);
+  }
+  ck_extend.last = now;
+
+  return Min(ck_extend.batch, Max(RelationGetNumberOfBlocks(index), 1));
+}
+
 /**
  * @brief Allocate a new buffer for the index.
  *
  * First tries to get a page from the free space map, then extends
- * the relation if necessary.
+ * the relation if necessary. Frequent extensions add several pages at
+ * once, taking the extension lock a single time, and the spare pages are
+ * recorded in the free space map for later allocations.
  *
  * @param index The index relation.
  * @return Buffer for the new page (pinned and locked).
  */
 Buffer CuckooNewBuffer(Relation index) {
+  Buffer buffers[CUCKOO_MAX_EXTEND_BATCH];
   Buffer buffer;
+  BlockNumber first;
+  uint32 extended;
 
   /* First try to get a page from FSM */
   for (;;) {
@@ -329,10 +926,22 @@ Buffer CuckooNewBuffer(Relation index) {
     ReleaseBuffer(buffer);
   }
 
-  /* Must extend the file */
-  buffer = ExtendBufferedRel(BMR_REL(index), MAIN_FORKNUM, NULL, EB_LOCK_FIRST);
+  /* Must extend the file; the first new page is returned locked */
+  first = ExtendBufferedRelBy(BMR_REL(index), MAIN_FORKNUM, NULL,
+                              EB_LOCK_FIRST, extendBatchSize(index), buffers,
+                              &extended);
+
+  if (extended > 1) {
+    for (uint32 i = 1; i < extended; i++) {
+      ReleaseBuffer(buffers[i]);
+      RecordFreeIndexPage(index, first + i);
+    }
 
-  return buffer;
+    /* Make the spare pages visible to searches of the map */
+    FreeSpaceMapVacuumRange(index, first + 1, first + extended);
+  }
+
+  return buffers[0];
 }
 
 /**
@@ -349,6 +958,8 @@ void CuckooInitPage(Page page, uint16 flags) {
   opaque = CuckooPageGetOpaque(page);
   opaque->flags = flags;
   opaque->maxoff = 0;
+  opaque->nextBlkno = InvalidBlockNumber;
+  opaque->version = CUCKOO_PAGE_VERSION;
   opaque->cuckoo_page_id = CUCKOO_PAGE_ID;
 }
 
@@ -373,6 +984,8 @@ void CuckooFillMetapage(Relation index, Page metaPage) {
   memset(metadata, 0, sizeof(CuckooMetaPageData));
   metadata->magicNumber = CUCKOO_MAGIC_NUMBER;
   metadata->opts = *opts;
+  metadata->hash.splitBucket = CUCKOO_NO_SPLIT;
+  metadata->hash.splitFrom = CUCKOO_NO_SPLIT;
   ((PageHeader)metaPage)->pd_lower += sizeof(CuckooMetaPageData);
 
   Assert(((PageHeader)metaPage)->pd_lower <= ((PageHeader)metaPage)->pd_upper);
@@ -404,6 +1017,112 @@ void CuckooInitMetapage(Relation index, ForkNumber forknum) {
   UnlockReleaseBuffer(metaBuffer);
 }
 
+/**
+ * @brief Estimate the number of distinct values an index will hold.
+ *
+ * Uses the heap's size estimate, scaled by the column's n_distinct
+ * statistic when the index is on a single plain column that has been
+ * analyzed. Otherwise every row is assumed to hold a distinct value.
+ *
+ * @param heap The heap relation.
+ * @param index The index relation.
+ * @return Estimated number of distinct values, at least 1.
+ */
+static double estimateDistinctValues(Relation heap, Relation index) {
+  BlockNumber pages;
+  double tuples;
+  double allvisfrac;
+  double ndistinct;
+
+  table_relation_estimate_size(heap, NULL, &pages, &tuples, &allvisfrac);
+  ndistinct = tuples;
+
+  if (IndexRelationGetNumberOfKeyAttributes(index) == 1 &&
+      index->rd_index->indkey.values[0] != 0) {
+    HeapTuple statsTuple = SearchSysCache3(
+        STATRELATTINH, ObjectIdGetDatum(RelationGetRelid(heap)),
+        Int16GetDatum(index->rd_index->indkey.values[0]), BoolGetDatum(false));
+
+    if (HeapTupleIsValid(statsTuple)) {
+      float4 stadistinct =
+          ((Form_pg_statistic)GETSTRUCT(statsTuple))->stadistinct;
+
+      /* Negative values are a fraction of the row count */
+      if (stadistinct > 0)
+        ndistinct = Min(ndistinct, (double)stadistinct);
+      else if (stadistinct < 0)
+        ndistinct = -stadistinct * tuples;
+
+      ReleaseSysCache(statsTuple);
+    }
+  }
+
+  return Max(ndistinct, 1.0);
+}
+
+/**
+ * @brief Smallest tag width that meets a false positive rate.
+ *
+ * A lookup of an absent value compares its fingerprint with the
+ * fingerprint of each distinct value in the index, and each comparison
+ * matches by chance with probability 2^-bits. The rate returned is the
+ * chance that any of them does, 1 - (1 - 2^-bits)^ndistinct.
+ *
+ * @param targetFpr Target false positive rate.
+ * @param ndistinct Number of distinct values in the index.
+ * @return Tag width in bits, clamped to the allowed range.
+ */
+int CuckooChooseBitsPerTag(double targetFpr, double ndistinct) {
+  /* Per-comparison rate meeting the target: 1 - (1 - targetFpr)^(1/n) */
+  double perValue = -expm1(log1p(-targetFpr) / ndistinct);
+  int bits;
+
+  if (perValue <= 0.0)
+    return MAX_BITS_PER_TAG;
+
+  bits = (int)ceil(-log2(perValue));
+
+  return Max(MIN_BITS_PER_TAG, Min(bits, MAX_BITS_PER_TAG));
+}
+
+/**
+ * @brief Size fingerprint tags for the target_fpr reloption.
+ *
+ * If target_fpr is set, picks the tag width from the estimated number of
+ * distinct values and records it in the metapage options, replacing
+ * bits_per_tag. Must be called before tuples are added.
+ *
+ * @param heap The heap relation being indexed.
+ * @param index The index relation, with an initialized metapage.
+ */
+void CuckooApplyTargetFpr(Relation heap, Relation index) {
+  CuckooOptions *opts = (CuckooOptions *)index->rd_options;
+  GenericXLogState *state;
+  CuckooMetaPageData *meta;
+  Buffer metaBuffer;
+  int bits;
+
+  if (!opts || opts->targetFpr <= 0.0)
+    return;
+
+  bits = CuckooChooseBitsPerTag(opts->targetFpr,
+                                estimateDistinctValues(heap, index));
+
+  metaBuffer = ReadBuffer(index, CUCKOO_METAPAGE_BLKNO);
+  LockBuffer(metaBuffer, BUFFER_LOCK_EXCLUSIVE);
+  state = GenericXLogStart(index);
+  meta = CuckooPageGetMeta(GenericXLogRegisterBuffer(state, metaBuffer, 0));
+  meta->opts.bitsPerTag = bits;
+  GenericXLogFinish(state);
+  UnlockReleaseBuffer(metaBuffer);
+
+  /* Make sure the new width is picked up */
+  if (index->rd_amcache) {
+    pfree(index->rd_amcache);
+    index->rd_amcache = NULL;
+  }
+}
+
 /**
  * @brief Parse reloptions for cuckoo index.
  *
@@ -418,5 +1137,143 @@ bytea *ckoptions(Datum reloptions, bool validate) {
       reloptions, validate, ck_relopt_kind, sizeof(CuckooOptions),
       ck_relopt_tab, lengthof(ck_relopt_tab));
 
+  if (validate && rdopts && rdopts->summary &&
+      rdopts->layout != CUCKOO_LAYOUT_FLAT)
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("summary pages are only supported with layout \"flat\"")));
+
+  if (validate && rdopts && rdopts->exactKeys &&
+      (rdopts->layout != CUCKOO_LAYOUT_FLAT || rdopts->pagesPerRange > 0))
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("exact_keys is only supported with layout \"flat\" and "
+                    "without pages_per_range")));
+
+  if (validate && rdopts && rdopts->lookupCache && rdopts->pagesPerRange > 0)
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("lookup_cache cannot be combined with pages_per_range")));
+
+  if (validate && rdopts && rdopts->pagesPerRange > 0) {
+    if (rdopts->layout != CUCKOO_LAYOUT_FLAT)
+      ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                      errmsg("pages_per_range is only supported with layout "
+                             "\"flat\"")));
+    if (rdopts->summary)
+      ereport(ERROR,
+              (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+               errmsg("pages_per_range cannot be combined with summary "
+                      "pages")));
+  }
+
   return (bytea *)rdopts;
 }
+
+/**
+ * @brief Open a relation that must be a cuckoo index.
+ *
+ * Used by the SQL-callable functions that take a regclass.
+ *
+ * @param indexOid OID of the relation.
+ * @param lockmode Lock to take on it.
+ * @return The opened index.
+ */
+Relation CuckooOpenIndex(Oid indexOid, LOCKMODE lockmode) {
+  Relation index = relation_open(indexOid, lockmode);
+
+  if (index->rd_rel->relkind != RELKIND_INDEX ||
+      index->rd_indam->ambuild != ckbuild)
+    ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+                    errmsg("\"%s\" is not a cuckoo index",
+                           RelationGetRelationName(index))));
+
+  return index;
+}
+
+/**
+ * @brief Check whether the current user holds SELECT on what an index keys.
+ *
+ * @param index The index relation.
+ * @return true with SELECT on the table, or on every indexed column of an
+ *         index without expressions or a predicate.
+ */
+static bool hasSelectPrivilege(Relation index) {
+  Oid heapOid = index->rd_index->indrelid;
+  Oid userId = GetUserId();
+  bool ok = pg_class_aclcheck(heapOid, userId, ACL_SELECT) == ACLCHECK_OK;
+
+  if (!ok && RelationGetIndexPredicate(index) == NIL) {
+    ok = true;
+    for (int i = 0; i < index->rd_index->indnatts && ok; i++) {
+      AttrNumber attnum = index->rd_index->indkey.values[i];
+
+      ok = attnum > 0 && pg_attribute_aclcheck(heapOid, attnum, userId,
+                                               ACL_SELECT) == ACLCHECK_OK;
+    }
+  }
+
+  return ok;
+}
+
+/**
+ * @brief Check whether the current user may read what an index tells.
+ *
+ * @param index The index relation.
+ * @return true if CuckooCheckReadAccess() would let the user through.
+ */
+bool CuckooHasReadAccess(Relation index) {
+  return hasSelectPrivilege(index) &&
+         check_enable_rls(index->rd_index->indrelid, InvalidOid, true) !=
+             RLS_ENABLED;
+}
+
+/**
+ * @brief Check that the current user may read what an index tells.
+ *
+ * The functions that look values up in an index reveal whether, or how
+ * often, the indexed table holds them. They require SELECT on the table,
+ * or on every indexed column of an index without expressions or a
+ * predicate, and refuse tables whose row security policies apply to the
+ * user, since an index sees the rows the policies hide.
+ *
+ * @param index The index relation.
+ */
+void CuckooCheckReadAccess(Relation index) {
+  Oid heapOid = index->rd_index->indrelid;
+
+  if (!hasSelectPrivilege(index))
+    aclcheck_error(ACLCHECK_NO_PRIV, OBJECT_TABLE, get_rel_name(heapOid));
+
+  if (check_enable_rls(heapOid, InvalidOid, true) == RLS_ENABLED)
+    ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+             errmsg("row-level security is enabled for table \"%s\"",
+                    get_rel_name(heapOid)),
+             errdetail("Cuckoo index lookups would see the rows the "
+                       "policies hide.")));
+}
+
+/**
+ * @brief Give an index new, empty storage.
+ *
+ * The old storage is dropped when the transaction commits. The caller
+ * must hold AccessExclusiveLock on the index and write a new metapage.
+ *
+ * @param index The index relation.
+ */
+void CuckooResetStorage(Relation index) {
+  RelationSetNewRelfilenumber(index, index->rd_rel->relpersistence);
+
+  /* An unlogged index needs its init fork back */
+  if (index->rd_rel->relpersistence == RELPERSISTENCE_UNLOGGED) {
+    smgrcreate(RelationGetSmgr(index), INIT_FORKNUM, false);
+    log_smgrcreate(&index->rd_locator, INIT_FORKNUM);
+    ckbuildempty(index);
+  }
+
+  if (index->rd_amcache) {
+    pfree(index->rd_amcache);
+    index->rd_amcache = NULL;
+  }
+}
@@ -12,21 +12,13 @@
 
 extern "C" {
 #include "access/genam.h"
+#include "access/table.h"
+#include "catalog/index.h"
 #include "commands/vacuum.h"
 #include "storage/bufmgr.h"
 #include "storage/indexfsm.h"
 }
 
-/*
- * Compatibility for vacuum_delay_point() API change.
- * PG18+ requires a bool is_analyze parameter, earlier versions do not.
- */
-#if PG_VERSION_NUM >= 180000
-#define CuckooVacuumDelayPoint() vacuum_delay_point(false)
-#else
-#define CuckooVacuumDelayPoint() vacuum_delay_point()
-#endif
-
 /**
  * @brief Bulk delete index entries pointing to deleted heap tuples.
  *
@@ -53,12 +45,31 @@ IndexBulkDeleteResult *ckbulkdelete(IndexVacuumInfo *info,
   Page page;
   CuckooMetaPageData *metaData;
   GenericXLogState *gxlogState;
+  double removedBefore;
 
   if (stats == NULL)
     stats = (IndexBulkDeleteResult *)palloc0(sizeof(IndexBulkDeleteResult));
+  removedBefore = stats->tuples_removed;
 
   initCuckooState(&state, index);
 
+  /* Hashed indexes are vacuumed bucket by bucket */
+  if (state.opts.layout == CUCKOO_LAYOUT_HASHED) {
+    CuckooHashBulkDelete(info, stats, callback, callback_state);
+    if (stats->tuples_removed > removedBefore &&
+        CuckooLookupCacheUsed(&state))
+      CuckooBumpChangeCount(index);
+    return stats;
+  }
+
+  /*
+   * Range filters hold no TIDs, and a fingerprint cannot be taken out of
+   * a filter it may share with live rows; dead values only cost false
+   * positives until the range is summarized again.
+   */
+  if (state.opts.pagesPerRange > 0)
+    return stats;
+
   /*
    * Iterate over all data pages.
    * We don't worry about pages added concurrently - they can't
@@ -67,6 +78,12 @@ IndexBulkDeleteResult *ckbulkdelete(IndexVacuumInfo *info,
   npages = RelationGetNumberOfBlocks(index);
   for (blkno = CUCKOO_HEAD_BLKNO; blkno < npages; blkno++) {
     CuckooTuple *itup, *itupPtr, *itupEnd;
+    Buffer summaryBuffer;
+    bool frozen;
+
+    /* Summary pages are rewritten along with their data pages */
+    if (CuckooIsSummaryBlock(state.summaryGroup, blkno))
+      continue;
 
     CuckooVacuumDelayPoint();
 
@@ -117,8 +134,11 @@ IndexBulkDeleteResult *ckbulkdelete(IndexVacuumInfo *info,
 
     /*
      * Add page to notFullPage list if it has space and isn't empty.
+     * Pages of a frozen index's frozen region must stay sorted, so they
+     * are never refilled or freed.
      */
-    if (CuckooPageGetMaxOffset(page) != 0 &&
+    frozen = (CuckooPageGetOpaque(page)->flags & CUCKOO_FROZEN) != 0;
+    if (!frozen && CuckooPageGetMaxOffset(page) != 0 &&
         CuckooPageGetFreeSpace(&state, page) >= state.sizeOfCuckooTuple &&
         countPage < (int)CuckooMetaBlockN) {
       notFullPage[countPage++] = blkno;
@@ -127,17 +147,25 @@ IndexBulkDeleteResult *ckbulkdelete(IndexVacuumInfo *info,
     /* Did we delete anything? */
     if (itupPtr != itup) {
       /* Is the page now empty? */
-      if (CuckooPageGetMaxOffset(page) == 0)
+      if (CuckooPageGetMaxOffset(page) == 0 && !frozen)
         CuckooPageSetDeleted(page);
 
       /* Adjust pd_lower */
       ((PageHeader)page)->pd_lower = (Pointer)itupPtr - page;
 
+      summaryBuffer =
+          CuckooSummaryUpdate(index, &state, gxlogState, blkno, page);
       GenericXLogFinish(gxlogState);
+      if (BufferIsValid(summaryBuffer))
+        UnlockReleaseBuffer(summaryBuffer);
     } else {
       GenericXLogAbort(gxlogState);
     }
 
+    TRACE_CUCKOO_VACUUM_PAGE(
+        RelationGetRelid(index), blkno,
+        ((Pointer)itup - (Pointer)itupPtr) / state.sizeOfCuckooTuple,
+        CuckooPageGetMaxOffset(page));
     UnlockReleaseBuffer(buffer);
   }
 
@@ -156,6 +184,13 @@ IndexBulkDeleteResult *ckbulkdelete(IndexVacuumInfo *info,
   metaData->nStart = 0;
   metaData->nEnd = countPage;
 
+  /* Lookups cached before the removal are stale */
+  if (stats->tuples_removed > removedBefore && CuckooLookupCacheUsed(&state) &&
+      (CuckooPageGetOpaque(page)->flags & CUCKOO_CACHED)) {
+    CuckooPageGetOpaque(page)->flags &= ~CUCKOO_CACHED;
+    metaData->changeCount++;
+  }
+
   GenericXLogFinish(gxlogState);
   UnlockReleaseBuffer(buffer);
 
@@ -165,7 +200,9 @@ IndexBulkDeleteResult *ckbulkdelete(IndexVacuumInfo *info,
 /**
  * @brief Post-VACUUM cleanup.
  *
- * Collects statistics and updates the free space map.
+ * Collects statistics and updates the free space map. With
+ * pages_per_range, also summarizes the block ranges that have no usable
+ * filter.
  *
  * @param info Vacuum information.
  * @param stats Stats from bulk delete, or NULL if none performed.
@@ -176,6 +213,9 @@ IndexBulkDeleteResult *ckvacuumcleanup(IndexVacuumInfo *info,
   Relation index = info->index;
   BlockNumber npages;
   BlockNumber blkno;
+  CuckooState state;
+  CuckooSketch sketch;
+  uint32 nsummarized = 0;
 
   if (info->analyze_only)
     return stats;
@@ -183,9 +223,20 @@ IndexBulkDeleteResult *ckvacuumcleanup(IndexVacuumInfo *info,
   if (stats == NULL)
     stats = (IndexBulkDeleteResult *)palloc0(sizeof(IndexBulkDeleteResult));
 
+  initCuckooState(&state, index);
+
+  if (state.opts.pagesPerRange > 0) {
+    Relation heap = table_open(IndexGetRelation(RelationGetRelid(index), false),
+                               AccessShareLock);
+
+    nsummarized = CuckooRangeSummarize(index, heap, &state);
+    table_close(heap, AccessShareLock);
+  }
+
   /*
    * Scan all pages to collect statistics and update FSM.
    */
+
   npages = RelationGetNumberOfBlocks(index);
   stats->num_pages = npages;
   stats->pages_free = 0;
@@ -195,6 +246,10 @@ IndexBulkDeleteResult *ckvacuumcleanup(IndexVacuumInfo *info,
     Buffer buffer;
     Page page;
 
+    /* Summary pages are never free, even before they are initialized */
+    if (CuckooIsSummaryBlock(state.summaryGroup, blkno))
+      continue;
+
     CuckooVacuumDelayPoint();
 
     buffer = ReadBufferExtended(index, MAIN_FORKNUM, blkno, RBM_NORMAL,
@@ -212,6 +267,25 @@ IndexBulkDeleteResult *ckvacuumcleanup(IndexVacuumInfo *info,
     UnlockReleaseBuffer(buffer);
   }
 
+  /* A range index has one entry per summarized range */
+  if (state.opts.pagesPerRange > 0)
+    stats->num_index_tuples = nsummarized;
+
+  /*
+   * The sketch still counts the values of the removed rows. Indexes that
+   * keep no sketch are not worth a heap scan.
+   */
+  if (stats->tuples_removed > 0 &&
+      stats->tuples_removed >=
+          CUCKOO_SKETCH_REBUILD_FRACTION * stats->num_index_tuples &&
+      CuckooSketchRead(index, &sketch)) {
+    Relation heap = table_open(IndexGetRelation(RelationGetRelid(index), false),
+                               AccessShareLock);
+
+    CuckooSketchRebuild(index, heap);
+    table_close(heap, AccessShareLock);
+  }
+
   IndexFreeSpaceMapVacuum(info->index);
 
   return stats;
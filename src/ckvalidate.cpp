@@ -45,6 +45,27 @@ static char *ck_get_opfamily_name(Oid opfamilyoid) {
   return result;
 }
 
+/**
+ * @brief Check whether an opfamily has a hash function for a type.
+ *
+ * @param proclist Support functions of the operator family.
+ * @param typid Type to look for.
+ * @return true if a hash support function for the type is registered.
+ */
+static bool ck_family_has_hash_proc(CatCList *proclist, Oid typid) {
+  for (int i = 0; i < proclist->n_members; i++) {
+    Form_pg_amproc procform =
+        (Form_pg_amproc)GETSTRUCT(&proclist->members[i]->tuple);
+
+    if (procform->amprocnum == CUCKOO_HASH_PROC &&
+        procform->amproclefttype == typid &&
+        procform->amprocrighttype == typid)
+      return true;
+  }
+
+  return false;
+}
+
 /**
  * @brief Validate a cuckoo opclass.
  *
@@ -67,6 +88,7 @@ bool ckvalidate(Oid opclassoid) {
   CatCList *oprlist;
   List *grouplist;
   OpFamilyOpFuncGroup *opclassgroup;
+  bool hasExtract;
   int i;
   ListCell *lc;
 
@@ -120,6 +142,14 @@ bool ckvalidate(Oid opclassoid) {
     case CUCKOO_OPTIONS_PROC:
       ok = check_amoptsproc_signature(procform->amproc);
       break;
+    case CUCKOO_EXTRACTVALUE_PROC:
+      ok = check_amproc_signature(procform->amproc, INTERNALOID, false, 2, 2,
+                                  opckeytype, INTERNALOID);
+      break;
+    case CUCKOO_EXTRACTQUERY_PROC:
+      ok = check_amproc_signature(procform->amproc, INTERNALOID, false, 3, 3,
+                                  opcintype, INTERNALOID, INT2OID);
+      break;
     default:
       ereport(INFO,
               (errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
@@ -177,6 +207,21 @@ bool ckvalidate(Oid opclassoid) {
                             opfamilyname, format_operator(oprform->amopopr))));
       result = false;
     }
+
+    /*
+     * Scans hash the key of a cross-type operator with the family's hash
+     * function for the key type, so one must exist for both input types.
+     */
+    if (oprform->amoplefttype != oprform->amoprighttype &&
+        (!ck_family_has_hash_proc(proclist, oprform->amoplefttype) ||
+         !ck_family_has_hash_proc(proclist, oprform->amoprighttype))) {
+      ereport(INFO, (errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+                     errmsg("cuckoo opfamily %s lacks support function %d "
+                            "for the input types of cross-type operator %s",
+                            opfamilyname, CUCKOO_HASH_PROC,
+                            format_operator(oprform->amopopr))));
+      result = false;
+    }
   }
 
   /* Check for inconsistent groups of operators/functions */
@@ -189,18 +234,40 @@ bool ckvalidate(Oid opclassoid) {
       opclassgroup = thisgroup;
   }
 
+  /*
+   * Element opclasses hash through their extract-value procedure, so they
+   * don't need a whole-value hash function.
+   */
+  hasExtract = opclassgroup &&
+               (opclassgroup->functionset &
+                (((uint64)1) << CUCKOO_EXTRACTVALUE_PROC)) != 0;
+
   /* Check that the opclass has all required support functions */
   for (i = 1; i <= CUCKOO_NPROC; i++) {
     if (opclassgroup && (opclassgroup->functionset & (((uint64)1) << i)) != 0)
       continue;
-    if (i == CUCKOO_OPTIONS_PROC)
+    if (i == CUCKOO_OPTIONS_PROC || i == CUCKOO_EXTRACTVALUE_PROC ||
+        i == CUCKOO_EXTRACTQUERY_PROC)
       continue; /* optional */
+    if (i == CUCKOO_HASH_PROC && hasExtract)
+      continue;
     ereport(INFO, (errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
                    errmsg("cuckoo opclass %s is missing support function %d",
                           opclassname, i)));
     result = false;
   }
 
+  /* An extract-query procedure is useless without extract-value */
+  if (!hasExtract && opclassgroup &&
+      (opclassgroup->functionset &
+       (((uint64)1) << CUCKOO_EXTRACTQUERY_PROC)) != 0) {
+    ereport(INFO,
+            (errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+             errmsg("cuckoo opclass %s is missing support function %d",
+                    opclassname, CUCKOO_EXTRACTVALUE_PROC)));
+    result = false;
+  }
+
   ReleaseCatCacheList(proclist);
   ReleaseCatCacheList(oprlist);
   ReleaseSysCache(classtup);
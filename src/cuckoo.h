@@ -30,18 +30,59 @@ extern "C" {
 #endif
 }
 
+/*
+ * Static tracing probes of the "cuckoo" provider, built with
+ * "make WITH_PROBES=1" where <sys/sdt.h> is available (systemtap-sdt-dev
+ * on Linux). Otherwise the probes and their arguments compile to nothing.
+ * Index arguments are relation OIDs.
+ */
+#ifdef CUCKOO_PROBES
+#include <sys/sdt.h>
+
+#define TRACE_CUCKOO_INSERT_START(index, ntuples)                              \
+  DTRACE_PROBE2(cuckoo, insert__start, index, ntuples)
+#define TRACE_CUCKOO_INSERT_PAGE(index, blkno, newPage, ntuples)               \
+  DTRACE_PROBE4(cuckoo, insert__page, index, blkno, newPage, ntuples)
+#define TRACE_CUCKOO_INSERT_DONE(index, ntuples)                               \
+  DTRACE_PROBE2(cuckoo, insert__done, index, ntuples)
+#define TRACE_CUCKOO_SCAN_START(index, nkeys)                                  \
+  DTRACE_PROBE2(cuckoo, scan__start, index, nkeys)
+#define TRACE_CUCKOO_SCAN_DONE(index, npages, ntids)                           \
+  DTRACE_PROBE3(cuckoo, scan__done, index, npages, ntids)
+#define TRACE_CUCKOO_BUILD_FLUSH(index, blkno, ntuples)                        \
+  DTRACE_PROBE3(cuckoo, build__flush, index, blkno, ntuples)
+#define TRACE_CUCKOO_VACUUM_PAGE(index, blkno, nremoved, nremaining)           \
+  DTRACE_PROBE4(cuckoo, vacuum__page, index, blkno, nremoved, nremaining)
+#else
+#define TRACE_CUCKOO_INSERT_START(index, ntuples) ((void)0)
+#define TRACE_CUCKOO_INSERT_PAGE(index, blkno, newPage, ntuples) ((void)0)
+#define TRACE_CUCKOO_INSERT_DONE(index, ntuples) ((void)0)
+#define TRACE_CUCKOO_SCAN_START(index, nkeys) ((void)0)
+#define TRACE_CUCKOO_SCAN_DONE(index, npages, ntids) ((void)0)
+#define TRACE_CUCKOO_BUILD_FLUSH(index, blkno, ntuples) ((void)0)
+#define TRACE_CUCKOO_VACUUM_PAGE(index, blkno, nremoved, nremaining) ((void)0)
+#endif
+
 /*
  * Support procedure numbers for cuckoo opclass
  */
 #define CUCKOO_HASH_PROC 1
 #define CUCKOO_OPTIONS_PROC 2
-#define CUCKOO_NPROC 2
+#define CUCKOO_EXTRACTVALUE_PROC 3
+#define CUCKOO_EXTRACTQUERY_PROC 4
+#define CUCKOO_NPROC 4
 
 /*
- * Scan strategies - cuckoo only supports equality
+ * Scan strategies.  Whole-value opclasses only support equality; element
+ * opclasses (those with an extract-value procedure) also support
+ * containment, overlap and pattern matching.
  */
 #define CUCKOO_EQUAL_STRATEGY 1
-#define CUCKOO_NSTRATEGIES 1
+#define CUCKOO_CONTAINS_STRATEGY 2
+#define CUCKOO_OVERLAP_STRATEGY 3
+#define CUCKOO_LIKE_STRATEGY 4
+#define CUCKOO_ILIKE_STRATEGY 5
+#define CUCKOO_NSTRATEGIES 5
 
 /*
  * Cuckoo filter configuration defaults
@@ -58,13 +99,26 @@ extern "C" {
 #define MIN_MAX_KICKS 50
 #define MAX_MAX_KICKS 2000
 
+/*
+ * Index layouts.  The flat layout appends tuples to any page with room and
+ * every scan reads the whole index.  The hashed layout keeps each tuple in
+ * the bucket chosen by its fingerprint and grows one bucket at a time, so
+ * a lookup only reads a single bucket.  The frozen layout is written once
+ * by the build as fingerprint-sorted pages behind an XOR filter; later
+ * inserts go to flat pages after it.
+ */
+#define CUCKOO_LAYOUT_FLAT 0
+#define CUCKOO_LAYOUT_HASHED 1
+#define CUCKOO_LAYOUT_FROZEN 2
+
 /**
  * @brief Opaque data at end of each cuckoo index page.
  */
 typedef struct CuckooPageOpaqueData {
+  BlockNumber nextBlkno; /**< Next page of a bucket chain (hashed layout) */
   OffsetNumber maxoff;   /**< Number of index tuples on page */
   uint16 flags;          /**< Page flags (see below) */
-  uint16 unused;         /**< Alignment padding */
+  uint16 version;        /**< Page format version */
   uint16 cuckoo_page_id; /**< Page type identifier */
 } CuckooPageOpaqueData;
 
@@ -75,6 +129,29 @@ typedef CuckooPageOpaqueData *CuckooPageOpaque;
  */
 #define CUCKOO_META (1 << 0)
 #define CUCKOO_DELETED (2 << 0)
+#define CUCKOO_BUCKET (1 << 2)    /* Primary page of a bucket */
+#define CUCKOO_OVERFLOW (1 << 3)  /* Overflow page of a bucket */
+#define CUCKOO_DIRECTORY (1 << 4) /* Bucket directory page */
+#define CUCKOO_SUMMARY (1 << 5)   /* Fingerprint summary page */
+#define CUCKOO_FROZEN (1 << 6)    /* Sorted data page (frozen layout) */
+#define CUCKOO_FENCE (1 << 7)     /* Fence page (frozen layout) */
+#define CUCKOO_FILTER (1 << 8)    /* XOR filter page (frozen layout) */
+#define CUCKOO_RANGE (1 << 9)     /* Block range filter page */
+#define CUCKOO_CACHED (1 << 10)   /* Metapage: lookups cached since a change */
+
+/*
+ * Fingerprint of a row whose indexed columns are all NULL.  No other row
+ * is given it, so IS NULL searches find only NULL rows.
+ */
+#define CUCKOO_NULL_FINGERPRINT 1
+
+/*
+ * Page format version.  Every page records the format it was written in,
+ * so that a later format can be told apart from this one.  Pages written
+ * by cuckoo 1.0 have a smaller special space and no version; they are
+ * rejected, and such indexes need a REINDEX.
+ */
+#define CUCKOO_PAGE_VERSION 1
 
 /*
  * Page ID for identification by pg_filedump and similar utilities
@@ -87,6 +164,7 @@ typedef CuckooPageOpaqueData *CuckooPageOpaque;
 #define CuckooPageGetOpaque(page)                                              \
   ((CuckooPageOpaque)PageGetSpecialPointer(page))
 #define CuckooPageGetMaxOffset(page) (CuckooPageGetOpaque(page)->maxoff)
+#define CuckooPageGetVersion(page) (CuckooPageGetOpaque(page)->version)
 #define CuckooPageIsMeta(page)                                                 \
   ((CuckooPageGetOpaque(page)->flags & CUCKOO_META) != 0)
 #define CuckooPageIsDeleted(page)                                              \
@@ -116,6 +194,15 @@ typedef struct CuckooTuple {
 
 #define CUCKOOTUPLEHDRSZ offsetof(CuckooTuple, fingerprint)
 
+/*
+ * Indexes with exact_keys store the key of a row after its tuple, as an
+ * unaligned Datum, so that index-only scans can return it.
+ */
+#define CuckooTupleGetKey(tuple) ((Pointer)(tuple) + sizeof(CuckooTuple))
+
+/* Callback receiving the tuples of an index one at a time */
+typedef void (*CuckooTupleCallback)(CuckooTuple *itup, void *arg);
+
 /**
  * @brief Options for cuckoo index, stored in metapage.
  */
@@ -124,8 +211,112 @@ typedef struct CuckooOptions {
   int bitsPerTag;    /**< Bits per fingerprint tag */
   int tagsPerBucket; /**< Number of tags per bucket (2, 4, or 8) */
   int maxKicks;      /**< Maximum number of relocations during insert */
+  int layout;        /**< One of the CUCKOO_LAYOUT_* values */
+  double targetFpr;  /**< Chooses bitsPerTag at build time if > 0 */
+  bool summary;      /**< Keep fingerprint summary pages (flat layout) */
+  bool exactKeys;    /**< Store keys for index-only scans (flat layout) */
+  bool lookupCache;  /**< Count changes for backend lookup caches */
+  int pagesPerRange; /**< Heap blocks per range filter, 0 for per-row TIDs */
 } CuckooOptions;
 
+/**
+ * @brief Linear hashing state of a hashed-layout index, kept in the metapage.
+ *
+ * A fingerprint belongs to bucket (hash & highMask), or (hash & lowMask) if
+ * that is beyond maxBucket. Splitting bucket (maxBucket + 1) & lowMask into
+ * a new bucket maxBucket + 1 is recorded in splitBucket and splitFrom until
+ * all its tuples have been copied.
+ */
+typedef struct CuckooHashMetaData {
+  uint32 maxBucket;   /**< Highest bucket number in use */
+  uint32 lowMask;     /**< Mask for buckets past maxBucket */
+  uint32 highMask;    /**< Mask covering all buckets */
+  uint32 nPages;      /**< Primary and overflow pages of all buckets */
+  uint32 splitBucket; /**< Bucket being populated, or CUCKOO_NO_SPLIT */
+  uint32 splitFrom;   /**< Bucket being split, or CUCKOO_NO_SPLIT */
+  uint32 nDirPages;   /**< Directory pages; 0 until the first bucket exists */
+} CuckooHashMetaData;
+
+#define CUCKOO_NO_SPLIT 0xFFFFFFFF
+
+/**
+ * @brief Location of the frozen region of a frozen-layout index.
+ *
+ * The build writes the tuples sorted by fingerprint on nDataPages data
+ * pages from dataStart, the first fingerprint of each data page on fence
+ * pages from fenceStart, and an XOR filter of the distinct fingerprints on
+ * filter pages from filterStart. Blocks from frozenEnd on are flat pages
+ * holding tuples inserted after the build.
+ */
+typedef struct CuckooFrozenMetaData {
+  uint64 seed;             /**< Hash seed of the XOR filter */
+  uint32 nKeys;            /**< Distinct fingerprints in the filter */
+  uint32 segmentLength;    /**< Filter entries per hash segment */
+  BlockNumber dataStart;   /**< First data page */
+  uint32 nDataPages;       /**< Number of data pages */
+  BlockNumber fenceStart;  /**< First fence page */
+  BlockNumber filterStart; /**< First filter page */
+  BlockNumber frozenEnd;   /**< First block after the frozen region */
+} CuckooFrozenMetaData;
+
+/**
+ * @brief Block range state of an index with pages_per_range, kept in the
+ * metapage.
+ *
+ * Range r covers heap blocks [r * pagesPerRange, (r + 1) * pagesPerRange).
+ * Its CuckooRangeEntry is entry r % CUCKOO_RANGE_ENTRIES of directory page
+ * r / CUCKOO_RANGE_ENTRIES. Ranges from nRanges on have no entry yet and
+ * match every query.
+ */
+typedef struct CuckooRangeMetaData {
+  uint32 nRanges;   /**< Ranges with a directory entry */
+  uint32 nDirPages; /**< Directory pages */
+} CuckooRangeMetaData;
+
+/**
+ * @brief Directory entry of one heap block range.
+ *
+ * The range's cuckoo filter is nBuckets buckets of tags_per_bucket
+ * fingerprints, packed at bits_per_tag bits each, on consecutive pages
+ * from filterStart. A range without a filter, or whose filter ran out of
+ * room, matches every query until VACUUM summarizes it again.
+ */
+typedef struct CuckooRangeEntry {
+  BlockNumber filterStart; /**< First filter page, or InvalidBlockNumber */
+  uint32 nBuckets;         /**< Buckets in the filter (a power of two) */
+  uint32 flags;            /**< CUCKOO_RANGE_* flags */
+} CuckooRangeEntry;
+
+#define CUCKOO_RANGE_OVERFLOWED (1 << 0)  /* Filter full; matches everything */
+#define CUCKOO_RANGE_SUMMARIZING (1 << 1) /* VACUUM is rebuilding the filter */
+#define CUCKOO_RANGE_DIRTY (1 << 2)       /* Inserted into while summarizing */
+
+#define CuckooRangeMatchesAll(entry)                                           \
+  ((entry)->filterStart == InvalidBlockNumber ||                               \
+   ((entry)->flags & CUCKOO_RANGE_OVERFLOWED) != 0)
+
+/* Number of range entries on a directory page */
+#define CUCKOO_RANGE_ENTRIES                                                   \
+  ((BLCKSZ - MAXALIGN(SizeOfPageHeaderData) -                                  \
+    MAXALIGN(sizeof(CuckooPageOpaqueData))) /                                  \
+   sizeof(CuckooRangeEntry))
+
+/*
+ * Distinct-value sketch.  A HyperLogLog sketch of the row hashes of a
+ * whole-value index, with 2^CUCKOO_SKETCH_BITS one-byte registers (a
+ * standard error of about 3%).  Builds and inserts raise its registers;
+ * VACUUM rebuilds it from the heap after many deletions.
+ */
+#define CUCKOO_SKETCH_BITS 10
+#define CUCKOO_SKETCH_REGISTERS (1 << CUCKOO_SKETCH_BITS)
+
+/* Fraction of the index VACUUM must remove to rebuild the sketch */
+#define CUCKOO_SKETCH_REBUILD_FRACTION 0.1
+
+typedef struct CuckooSketch {
+  uint8 registers[CUCKOO_SKETCH_REGISTERS]; /**< Maximum rank per register */
+} CuckooSketch;
+
 /**
  * @brief Array of free block numbers for metapage.
  *
@@ -136,38 +327,105 @@ typedef BlockNumber
                                        MAXALIGN(sizeof(CuckooPageOpaqueData)) -
                                        MAXALIGN(sizeof(uint16) * 2 +
                                                 sizeof(uint32) +
-                                                sizeof(CuckooOptions))) /
+                                                sizeof(CuckooOptions) +
+                                                sizeof(CuckooHashMetaData) +
+                                                sizeof(CuckooFrozenMetaData) +
+                                                sizeof(CuckooRangeMetaData) +
+                                                sizeof(CuckooSketch) +
+                                                sizeof(uint64))) /
                          sizeof(BlockNumber)];
 
 /**
  * @brief Metadata stored on metapage (block 0).
+ *
+ * In the hashed layout notFullPage is unused as a free page ring; its first
+ * hash.nDirPages entries hold the block numbers of the directory pages. The
+ * same goes for range.nDirPages with pages_per_range.
  */
 typedef struct CuckooMetaPageData {
   uint32 magicNumber;               /**< Magic number for validation */
   uint16 nStart;                    /**< Start of notFullPage ring buffer */
   uint16 nEnd;                      /**< End of notFullPage ring buffer */
   CuckooOptions opts;               /**< Index options */
+  CuckooHashMetaData hash;          /**< Bucket state (hashed layout) */
+  CuckooFrozenMetaData frozen;      /**< Frozen region (frozen layout) */
+  CuckooRangeMetaData range;        /**< Block ranges (pages_per_range) */
   CuckooFreeBlockArray notFullPage; /**< Pages with free space */
+  CuckooSketch sketch;              /**< Distinct row hashes */
+  uint64 changeCount;               /**< Bumped by changes with lookup_cache */
 } CuckooMetaPageData;
 
 #define CUCKOO_MAGIC_NUMBER 0xC0C000CF
 
+/*
+ * Hash standing in for the elements of a value that has none (such as an
+ * empty array), so that every non-NULL row of an element index owns at
+ * least one tuple and match-all queries can find it.
+ */
+#define CUCKOO_EMPTY_ITEM_HASH 0x8F1BBCDC
+
 #define CuckooMetaBlockN (sizeof(CuckooFreeBlockArray) / sizeof(BlockNumber))
 
 #define CuckooPageGetMeta(page) ((CuckooMetaPageData *)PageGetContents(page))
 
+/* Number of tuples that fit on a data page */
+#define CUCKOO_MAX_TUPLES_PER_PAGE                                             \
+  ((BLCKSZ - MAXALIGN(SizeOfPageHeaderData) -                                  \
+    MAXALIGN(sizeof(CuckooPageOpaqueData))) /                                  \
+   sizeof(CuckooTuple))
+
+/*
+ * Summary pages.  With the summary option, every group of data pages is
+ * preceded by a summary page holding the fingerprints of those pages, so
+ * that a lookup reads the summaries and only the data pages that match.
+ * A summary page sits at every (summaryGroup + 1)th block from
+ * CUCKOO_HEAD_BLKNO; slot i describes the i-th data page after it.
+ */
+#define CuckooIsSummaryBlock(group, blkno)                                     \
+  ((group) > 0 && ((blkno) - CUCKOO_HEAD_BLKNO) % ((group) + 1) == 0)
+#define CuckooSummaryBlock(group, blkno)                                       \
+  ((blkno) - ((blkno) - CUCKOO_HEAD_BLKNO) % ((group) + 1))
+
+/* Fill factor of bucket pages written by an index build, in percent */
+#define CUCKOO_BUILD_FILL_PERCENT 75
+
+/* Number of bucket primary page pointers on a directory page */
+#define CUCKOO_DIR_ENTRIES                                                     \
+  ((BLCKSZ - MAXALIGN(SizeOfPageHeaderData) -                                  \
+    MAXALIGN(sizeof(CuckooPageOpaqueData))) /                                  \
+   sizeof(BlockNumber))
+
+/*
+ * Compatibility for vacuum_delay_point() API change.
+ * PG18+ requires a bool is_analyze parameter, earlier versions do not.
+ */
+#if PG_VERSION_NUM >= 180000
+#define CuckooVacuumDelayPoint() vacuum_delay_point(false)
+#else
+#define CuckooVacuumDelayPoint() vacuum_delay_point()
+#endif
+
 /**
  * @brief Runtime state for cuckoo index operations.
  */
 typedef struct CuckooState {
   FmgrInfo hashFn[INDEX_MAX_KEYS]; /**< Hash functions for each column */
   Oid collations[INDEX_MAX_KEYS];  /**< Collations for each column */
+  bool extractValues;              /**< Element opclass (single column) */
+  FmgrInfo extractValueFn;         /**< Extracts element hashes from a value */
+  FmgrInfo extractQueryFn;         /**< Extracts element hashes from a query */
   CuckooOptions opts;              /**< Copy of index options */
   int32 nColumns;                  /**< Number of indexed columns */
   Size sizeOfCuckooTuple;          /**< Precomputed tuple size */
   uint32 tagMask;                  /**< Mask for extracting tag bits */
   int tagsPerBucket;               /**< Tags per bucket from options */
   int maxKicks;                    /**< Max kicks from options */
+  uint32 summaryGroup;             /**< Data pages per summary page, or 0 */
+  Size summarySlotSize;            /**< Bytes per data page in a summary */
+  CuckooSketch *sketch;            /**< Fed with row hashes, or NULL */
+  bool hasRowHash;                 /**< rowHash is set */
+  uint32 rowHash;                  /**< Row hash of the last non-null row */
+  bool streamed[INDEX_MAX_KEYS];   /**< Columns hashed in blocks */
 } CuckooState;
 
 /*
@@ -185,13 +443,42 @@ typedef struct CuckooState {
    CuckooPageGetMaxOffset(page) * (state)->sizeOfCuckooTuple -                 \
    MAXALIGN(sizeof(CuckooPageOpaqueData)))
 
+/*
+ * Build batches.  The flat build buffers the keys of CUCKOO_BUILD_BATCH
+ * rows and fingerprints them together.  Single-column indexes whose hash
+ * function is one of the fixed-width ones below are hashed in a plain loop
+ * instead of one fmgr call per row.
+ */
+#define CUCKOO_BUILD_BATCH 4096
+#define CUCKOO_BATCH_NONE 0 /* Hashed row by row through fmgr */
+#define CUCKOO_BATCH_INT2 1 /* hashint2 */
+#define CUCKOO_BATCH_INT4 2 /* hashint4, hashoid */
+#define CUCKOO_BATCH_INT8 3 /* hashint8, timestamp_hash */
+#define CUCKOO_BATCH_UUID 4 /* uuid_hash */
+
+/**
+ * @brief Fingerprints extracted from one scan key of an element index.
+ */
+typedef struct CuckooQueryKey {
+  uint32 *fingerprints; /**< Sorted, distinct fingerprints */
+  int nfingerprints;    /**< Number of fingerprints */
+  bool matchAny;        /**< One fingerprint suffices (otherwise all needed) */
+} CuckooQueryKey;
+
 /**
  * @brief Opaque data for cuckoo index scan.
  */
 typedef struct CuckooScanOpaqueData {
-  uint32 fingerprint;    /**< Search fingerprint */
-  bool fingerprintValid; /**< Whether fingerprint has been computed */
-  CuckooState state;     /**< Index state */
+  uint32 fingerprint;        /**< Search fingerprint */
+  bool fingerprintValid;     /**< Whether fingerprint has been computed */
+  bool allRows;              /**< Whether the keys match every row */
+  Pointer matches;           /**< Tuples found for amgettuple */
+  int nMatches;              /**< Number of tuples in matches */
+  int maxMatches;            /**< Allocated size of matches, in tuples */
+  int nextMatch;             /**< Next tuple amgettuple returns */
+  CuckooQueryKey *queryKeys; /**< Per-key fingerprints (element indexes) */
+  int nQueryKeys;            /**< Number of entries in queryKeys */
+  CuckooState state;         /**< Index state */
 } CuckooScanOpaqueData;
 
 typedef CuckooScanOpaqueData *CuckooScanOpaque;
@@ -235,6 +522,7 @@ typedef struct CuckooShared {
   int nparticipantsdone; /**< Count of finished workers */
   double reltuples;      /**< Accumulated heap tuple count */
   double indtuples;      /**< Accumulated index tuple count */
+  CuckooSketch sketch;   /**< Merged sketches of the participants */
 } CuckooShared;
 
 /* Forward declarations for parallel build types */
@@ -266,6 +554,7 @@ typedef struct CuckooParallelBuildState {
   MemoryContext tmpCtx; /**< Temporary memory context */
   PGAlignedBlock data;  /**< Cached page data */
   int count;            /**< Tuples in cached page */
+  CuckooSketch sketch;  /**< Distinct row hashes */
 
   /* Parallel-specific fields */
   CuckooLeader *leader;      /**< Non-NULL only in leader process */
@@ -280,18 +569,154 @@ typedef struct CuckooParallelBuildState {
  */
 extern "C" {
 
+extern CuckooOptions *CuckooGetOptions(Relation index);
 extern void initCuckooState(CuckooState *state, Relation index);
+extern void CuckooSetTagWidth(CuckooState *state, int bits);
+extern Relation CuckooOpenIndex(Oid indexOid, LOCKMODE lockmode);
+extern bool CuckooHasReadAccess(Relation index);
+extern void CuckooCheckReadAccess(Relation index);
+extern void CuckooResetStorage(Relation index);
 extern void CuckooFillMetapage(Relation index, Page metaPage);
 extern void CuckooInitMetapage(Relation index, ForkNumber forknum);
+extern int CuckooChooseBitsPerTag(double targetFpr, double ndistinct);
+extern void CuckooApplyTargetFpr(Relation heap, Relation index);
 extern void CuckooInitPage(Page page, uint16 flags);
 extern Buffer CuckooNewBuffer(Relation index);
 extern uint32 computeFingerprint(CuckooState *state, Datum *values,
                                  bool *isnull);
-extern CuckooTuple *CuckooFormTuple(CuckooState *state, ItemPointer iptr,
-                                    Datum *values, bool *isnull);
+extern uint32 CuckooCombineHashes(CuckooState *state, uint32 *colHashes,
+                                  bool *isnull);
+extern uint32 CuckooElementFingerprint(CuckooState *state, uint32 hash);
+extern uint32 CuckooNarrowFingerprint(CuckooState *state, uint32 fingerprint);
+extern int CuckooGetBatchKind(CuckooState *state);
+extern void CuckooBatchFingerprints(CuckooState *state, int kind,
+                                    const Datum *keys, const bool *isnull,
+                                    int nkeys, uint32 *fingerprints);
+extern int CuckooUniqueFingerprints(uint32 *fingerprints, int nfingerprints);
+extern uint32 *computeFingerprints(CuckooState *state, Datum *values,
+                                   bool *isnull, int *nfingerprints);
+extern CuckooTuple *CuckooFormTuples(CuckooState *state, ItemPointer iptr,
+                                     Datum *values, bool *isnull,
+                                     int *ntuples);
 extern bool CuckooPageAddItem(CuckooState *state, Page page,
                               CuckooTuple *tuple);
 
+/*
+ * Function declarations - ckextract.cpp
+ */
+extern void CuckooCheckTrigramCollation(Relation index);
+
+/*
+ * Function declarations - ckstream.cpp
+ */
+extern bool CuckooCanStreamHash(Oid hashProc, Oid collation);
+extern uint32 CuckooHashColumn(CuckooState *state, int attno,
+                               FmgrInfo *hashFn, Datum value);
+
+/*
+ * Function declarations - cksummary.cpp
+ */
+extern void CuckooSummaryGeometry(const CuckooOptions *opts, uint32 *group,
+                                  Size *slotSize);
+extern Buffer CuckooNewDataBuffer(Relation index, CuckooState *state);
+extern Buffer CuckooSummaryUpdate(Relation index, CuckooState *state,
+                                  GenericXLogState *xlogState,
+                                  BlockNumber blkno, Page page);
+extern int64 CuckooSummaryForEachMatch(Relation index, CuckooState *state,
+                                       uint32 fingerprint,
+                                       CuckooTupleCallback callback,
+                                       void *arg);
+extern bool CuckooSummaryMayContain(Relation index, CuckooState *state,
+                                    uint32 fingerprint);
+
+/*
+ * Function declarations - ckhash.cpp
+ */
+extern uint32 CuckooHashBucket(CuckooHashMetaData *hash, uint32 fingerprint);
+extern double CuckooHashBuild(Relation heap, Relation index,
+                              struct IndexInfo *indexInfo,
+                              CuckooState *ckstate, int64 *indtuples);
+extern void CuckooHashInsert(Relation index, CuckooState *ckstate,
+                             CuckooTuple *tuples, int ntuples);
+extern ItemPointerData *CuckooHashLookup(Relation index, CuckooState *ckstate,
+                                         uint32 fingerprint, int *ntids);
+extern ItemPointerData *CuckooHashLookupAll(Relation index,
+                                            CuckooState *ckstate, int *ntids);
+extern void CuckooHashForEachTuple(Relation index, CuckooState *ckstate,
+                                   CuckooTupleCallback callback, void *arg);
+extern int64 CuckooHashSortKey(uint32 fingerprint);
+extern void CuckooHashWriteBuckets(Relation index, CuckooState *ckstate,
+                                   struct Tuplesortstate *sortstate,
+                                   TupleDesc tupdesc, int64 ntuples);
+extern void CuckooHashBulkDelete(IndexVacuumInfo *info,
+                                 IndexBulkDeleteResult *stats,
+                                 IndexBulkDeleteCallback callback,
+                                 void *callback_state);
+
+/*
+ * Function declarations - ckfrozen.cpp
+ */
+extern double CuckooFrozenBuild(Relation heap, Relation index,
+                                struct IndexInfo *indexInfo,
+                                CuckooState *ckstate, int64 *indtuples);
+extern void CuckooFrozenWrite(Relation index, CuckooState *ckstate,
+                              struct Tuplesortstate *sortstate,
+                              TupleDesc tupdesc, int64 ntuples);
+extern int64 CuckooFrozenForEachMatch(Relation index, CuckooState *ckstate,
+                                      uint32 fingerprint,
+                                      CuckooTupleCallback callback, void *arg,
+                                      BlockNumber *frozenEnd);
+extern bool CuckooFrozenMayContain(Relation index, CuckooState *ckstate,
+                                   uint32 fingerprint);
+
+/*
+ * Function declarations - ckrange.cpp
+ */
+extern double CuckooRangeBuild(Relation heap, Relation index,
+                               struct IndexInfo *indexInfo,
+                               CuckooState *ckstate, int64 *indtuples);
+extern void CuckooRangeInsert(Relation index, CuckooState *ckstate,
+                              CuckooTuple *tuples, int ntuples);
+extern int64 CuckooRangeGetBitmap(Relation index, CuckooState *ckstate,
+                                  CuckooQueryKey *keys, int nkeys,
+                                  TIDBitmap *tbm);
+extern uint32 CuckooRangeSummarize(Relation index, Relation heap,
+                                   CuckooState *ckstate);
+extern bool CuckooRangeMayContain(Relation index, CuckooState *ckstate,
+                                  uint32 fingerprint);
+
+/*
+ * Function declarations - cksketch.cpp
+ */
+extern void CuckooSketchAdd(CuckooSketch *sketch, uint32 hash);
+extern void CuckooSketchMerge(CuckooSketch *dst, const CuckooSketch *src);
+extern double CuckooSketchEstimate(const CuckooSketch *sketch);
+extern void CuckooSketchWrite(Relation index, const CuckooSketch *sketch);
+extern void CuckooSketchInsert(Relation index, uint32 hash);
+extern bool CuckooSketchRead(Relation index, CuckooSketch *sketch);
+extern void CuckooSketchRebuild(Relation index, Relation heap);
+extern void CuckooInitStatsHooks(void);
+
+/*
+ * Function declarations - ckcache.cpp
+ */
+extern bool CuckooLookupCacheUsed(CuckooState *state);
+extern uint64 CuckooWatchChangeCount(Relation index);
+extern void CuckooBumpChangeCount(Relation index);
+extern bool CuckooLookupCacheGet(Relation index, uint32 fingerprint,
+                                 uint64 changeCount, TIDBitmap *tbm,
+                                 int64 *ntids);
+extern void CuckooLookupCachePut(Relation index, uint32 fingerprint,
+                                 uint64 changeCount,
+                                 const ItemPointerData *tids, int ntids);
+extern void CuckooLookupCacheReset(void);
+extern void CuckooInitLookupCache(void);
+
+/*
+ * Function declarations - ckprune.cpp
+ */
+extern void CuckooInitPruning(void);
+
 /*
  * Function declarations - ckvalidate.cpp
  */
@@ -313,6 +738,12 @@ extern void ckbuildempty(Relation index);
 /* ckscan.cpp */
 extern IndexScanDesc ckbeginscan(Relation r, int nkeys, int norderbys);
 extern int64 ckgetbitmap(IndexScanDesc scan, TIDBitmap *tbm);
+extern bool ckgettuple(IndexScanDesc scan, ScanDirection dir);
+extern bool ckcanreturn(Relation index, int attno);
+extern void CuckooInitScanHooks(void);
+extern Oid CuckooKeySubtype(Relation index, int attno, Oid valueType);
+extern bool CuckooKeysFingerprint(Relation index, CuckooState *state,
+                                  ScanKey keys, int nkeys, uint32 *fingerprint);
 extern void ckrescan(IndexScanDesc scan, ScanKey scankey, int nscankeys,
                      ScanKey orderbys, int norderbys);
 extern void ckendscan(IndexScanDesc scan);